@@ -99,6 +99,17 @@ struct
   unsigned long max_cache_ttl;     /* Default. */
   unsigned long max_cache_ttl_ssh; /* for SSH. */
 
+  /* The TTL of unprotected keys in the key cache; 0 disables it.  */
+  unsigned long key_cache_ttl;
+
+  /* The time in milliseconds the S2K count is calibrated for; 0
+     selects the default.  */
+  unsigned long s2k_calibration;
+
+  /* If set, keys with an S2K count much larger than the calibrated
+     one are protected again with the calibrated count on use.  */
+  int s2k_reprotect;
+
   /* Flag disallowing bypassing of the warning.  */
   int enforce_passphrase_constraints;
 
@@ -278,6 +289,8 @@ typedef int (*lookup_ttl_t)(const char *hexgrip);
 void agent_exit (int rc) JNLIB_GCC_A_NR; /* Also implemented in other tools */
 const char *get_agent_socket_name (void);
 const char *get_agent_ssh_socket_name (void);
+void get_agent_connection_stats (unsigned int *r_active,
+                                 unsigned int *r_queued);
 #ifdef HAVE_W32_SYSTEM
 void *get_agent_scd_notify_event (void);
 #endif
@@ -351,6 +364,14 @@ void agent_flush_cache (void);
 int agent_put_cache (const char *key, cache_mode_t cache_mode,
                      const char *data, int ttl);
 char *agent_get_cache (const char *key, cache_mode_t cache_mode);
+void agent_cache_stats (unsigned int *r_items, unsigned long *r_hits,
+                        unsigned long *r_misses, unsigned long *r_expired);
+void agent_put_key_cache (const char *key, const unsigned char *canonkey,
+                          time_t mtime, unsigned long inode,
+                          unsigned long size);
+gcry_sexp_t agent_get_key_cache (const char *key, time_t mtime,
+                                 unsigned long inode, unsigned long size);
+void agent_forget_key_cache (const char *key);
 
 
 /*-- pksign.c --*/
@@ -361,6 +382,13 @@ int agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 int agent_pksign (ctrl_t ctrl, const char *cache_nonce,
                   const char *desc_text,
                   membuf_t *outbuf, cache_mode_t cache_mode);
+int agent_pksign_batch (ctrl_t ctrl, const char *cache_nonce,
+                        const char *desc_text, int algo,
+                        const unsigned char *hashes, size_t hashlen,
+                        unsigned int nhashes, cache_mode_t cache_mode,
+                        gpg_error_t (*putsig)(void *opaque,
+                                              const void *sig, size_t siglen),
+                        void *opaque);
 
 /*-- pkdecrypt.c --*/
 int agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
@@ -386,6 +414,8 @@ int agent_protect (const unsigned char *plainkey, const char *passphrase,
 int agent_unprotect (const unsigned char *protectedkey, const char *passphrase,
                      gnupg_isotime_t protected_at,
                      unsigned char **result, size_t *resultlen);
+gpg_error_t agent_get_s2k_count (const unsigned char *protectedkey,
+                                 unsigned long *r_count);
 int agent_private_key_type (const unsigned char *privatekey);
 unsigned char *make_shadow_info (const char *serialno, const char *idstring);
 int agent_shadow_key (const unsigned char *pubkey,
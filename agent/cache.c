@@ -51,19 +51,58 @@ struct secret_data_s {
   char data[1];  /* A string.  */
 };
 
+/* The size of the hash table used to look up items.  Must be a power
+   of 2.  */
+#define CACHE_TABLE_SIZE 256
+
+/* The number of slots of the timer wheel.  Each slot covers one
+   second; items expiring later are put into the slot of their
+   expiration time modulo this number.  */
+#define CACHE_WHEEL_SIZE 256
+
+/* A cache item.  An item for a keygrip may also hold the
+   unprotected private key (see agent_put_key_cache); the key is
+   dropped with the item and after --key-cache-ttl seconds.  */
 typedef struct cache_item_s *ITEM;
 struct cache_item_s {
-  ITEM next;
+  ITEM next;     /* Next item in the same hash bucket.  */
+  ITEM wnext;    /* Next item in the same slot of the timer wheel.  */
+  ITEM wprev;    /* Previous item in that slot or NULL.  */
   time_t created;
   time_t accessed;
+  time_t expires; /* The item expires at this time.  */
+  time_t wtime;   /* Time of the wheel slot; the earlier of EXPIRES and
+                     the expiration of the cached key.  */
   int ttl;  /* max. lifetime given in seconds, -1 one means infinite */
   struct secret_data_s *pw;
   cache_mode_t cache_mode;
+  struct {
+    struct secret_data_s *data;  /* The canonical encoded key or NULL.  */
+    time_t created;
+    time_t mtime;                /* Modification time, inode and size */
+    unsigned long inode;         /* of the key file.                  */
+    unsigned long size;
+  } skey;
   char key[1];
 };
 
-/* The cache himself.  */
-static ITEM thecache;
+/* The cache himself.  This is a hash table indexed by the key.  */
+static ITEM cache_table[CACHE_TABLE_SIZE];
+
+/* The timer wheel with all items of CACHE_TABLE.  */
+static ITEM cache_wheel[CACHE_WHEEL_SIZE];
+
+/* All items expiring before this time have been removed from the
+   wheel.  */
+static time_t wheel_time;
+
+/* Statistics shown by GETINFO cache_stats.  */
+static struct {
+  unsigned int items;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long expired;
+} cache_stats;
 
 
 /* This function must be called once to initialize this module. It
@@ -145,12 +184,12 @@ release_data (struct secret_data_s *data)
    xfree (data);
 }
 
+/* Encrypt LENGTH bytes of DATA into a new secret data object.  */
 static gpg_error_t
-new_data (const char *string, struct secret_data_s **r_data)
+new_data (const void *data, size_t length, struct secret_data_s **r_data)
 {
   gpg_error_t err;
   struct secret_data_s *d, *d_enc;
-  size_t length;
   int total;
   int res;
 
@@ -160,8 +199,6 @@ new_data (const char *string, struct secret_data_s **r_data)
   if (err)
     return err;
 
-  length = strlen (string) + 1;
-
   /* We pad the data to 32 bytes so that it get more complicated
      finding something out by watching allocation patterns.  This is
      usally not possible but we better assume nothing about our secure
@@ -172,7 +209,7 @@ new_data (const char *string, struct secret_data_s **r_data)
   d = xtrymalloc_secure (sizeof *d + total - 1);
   if (!d)
     return gpg_error_from_syserror ();
-  memcpy (d->data, string, length);
+  memcpy (d->data, data, length);
 
   d_enc = xtrymalloc (sizeof *d_enc + total - 1);
   if (!d_enc)
@@ -204,73 +241,192 @@ new_data (const char *string, struct secret_data_s **r_data)
 }
 
 
-
-/* Check whether there are items to expire.  */
-static void
-housekeeping (void)
+/* Decrypt DATA into a new buffer in secure memory which is stored at
+   R_VALUE.  */
+static gpg_error_t
+get_data (struct secret_data_s *data, char **r_value)
 {
-  ITEM r, rprev;
-  time_t current = gnupg_get_time ();
+  gpg_error_t err;
+  char *value;
+  int res;
 
-  /* First expire the actual data */
-  for (r=thecache; r; r = r->next)
+  *r_value = NULL;
+  if (data->totallen < 32)
+    return gpg_error (GPG_ERR_INV_LENGTH);
+  err = init_encryption ();
+  if (err)
+    return err;
+  value = xtrymalloc_secure (data->totallen - 8);
+  if (!value)
+    return gpg_error_from_syserror ();
+
+  res = npth_mutex_lock (&encryption_lock);
+  if (res)
+    log_fatal ("failed to acquire cache encryption mutex: %s\n",
+               strerror (res));
+  err = gcry_cipher_decrypt (encryption_handle,
+                             value, data->totallen - 8,
+                             data->data, data->totallen);
+  res = npth_mutex_unlock (&encryption_lock);
+  if (res)
+    log_fatal ("failed to release cache encryption mutex: %s\n",
+               strerror (res));
+  if (err)
     {
-      if (r->pw && r->ttl >= 0 && r->accessed + r->ttl < current)
-        {
-          if (DBG_CACHE)
-            log_debug ("  expired '%s' (%ds after last access)\n",
-                       r->key, r->ttl);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = current;
-        }
+      xfree (value);
+      return err;
     }
+  *r_value = value;
+  return 0;
+}
+
+
+
+/* Return the hash table bucket for KEY.  */
+static ITEM *
+bucket_for_key (const char *key)
+{
+  unsigned int h = 0;
+
+  for (; *key; key++)
+    h = (h << 5) + h + *(const unsigned char *)key;
+  return &cache_table[h & (CACHE_TABLE_SIZE - 1)];
+}
+
+
+/* Compute the expiration time of R from its TTL and the maximum TTL
+   for its cache mode.  */
+static time_t
+item_expiration (ITEM r)
+{
+  unsigned long maxttl;
+  time_t expires;
 
-  /* Second, make sure that we also remove them based on the created stamp so
-     that the user has to enter it from time to time. */
-  for (r=thecache; r; r = r->next)
+  switch (r->cache_mode)
     {
-      unsigned long maxttl;
+    case CACHE_MODE_SSH: maxttl = opt.max_cache_ttl_ssh; break;
+    default: maxttl = opt.max_cache_ttl; break;
+    }
+  expires = r->created + maxttl + 1;
+  if (r->ttl >= 0 && r->accessed + r->ttl + 1 < expires)
+    expires = r->accessed + r->ttl + 1;
+  return expires;
+}
 
-      switch (r->cache_mode)
-        {
-        case CACHE_MODE_SSH: maxttl = opt.max_cache_ttl_ssh; break;
-        default: maxttl = opt.max_cache_ttl; break;
-        }
-      if (r->pw && r->created + maxttl < current)
-        {
-          if (DBG_CACHE)
-            log_debug ("  expired '%s' (%lus after creation)\n",
-                       r->key, opt.max_cache_ttl);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = current;
-        }
+
+static void
+wheel_unlink (ITEM r)
+{
+  if (r->wprev)
+    r->wprev->wnext = r->wnext;
+  else
+    cache_wheel[(unsigned long)r->wtime % CACHE_WHEEL_SIZE] = r->wnext;
+  if (r->wnext)
+    r->wnext->wprev = r->wprev;
+  r->wnext = r->wprev = NULL;
+}
+
+
+/* Compute the expiration time of R and put it into the right slot of
+   the wheel.  R must not be in the wheel.  */
+static void
+wheel_link (ITEM r)
+{
+  ITEM *slot;
+
+  r->expires = item_expiration (r);
+  r->wtime = r->expires;
+  if (r->skey.data
+      && r->skey.created + (time_t)opt.key_cache_ttl < r->wtime)
+    r->wtime = r->skey.created + (time_t)opt.key_cache_ttl;
+  slot = &cache_wheel[(unsigned long)r->wtime % CACHE_WHEEL_SIZE];
+  r->wprev = NULL;
+  r->wnext = *slot;
+  if (*slot)
+    (*slot)->wprev = r;
+  *slot = r;
+}
+
+
+/* Drop the private key cached with R.  */
+static void
+drop_key (ITEM r)
+{
+  if (!r->skey.data)
+    return;
+  if (DBG_CACHE)
+    log_debug ("  dropped key '%s'\n", r->key);
+  release_data (r->skey.data);
+  r->skey.data = NULL;
+}
+
+
+/* Remove R from the cache and release it.  */
+static void
+remove_item (ITEM r)
+{
+  ITEM *bucket, *rp;
+
+  bucket = bucket_for_key (r->key);
+  for (rp = bucket; *rp; rp = &(*rp)->next)
+    if (*rp == r)
+      {
+        *rp = r->next;
+        break;
+      }
+  wheel_unlink (r);
+  drop_key (r);
+  release_data (r->pw);
+  xfree (r);
+  cache_stats.items--;
+}
+
+
+/* Handle R if the time of its wheel slot has been reached at
+   CURRENT: Either the item has expired and is removed or only its
+   cached key is dropped.  Returns true if R has been removed.  */
+static int
+expire_item (ITEM r, time_t current)
+{
+  if (r->expires <= current)
+    {
+      if (DBG_CACHE)
+        log_debug ("  expired '%s' (mode %d)\n", r->key, r->cache_mode);
+      cache_stats.expired++;
+      remove_item (r);
+      return 1;
     }
+  wheel_unlink (r);
+  drop_key (r);
+  wheel_link (r);
+  return 0;
+}
+
+
+/* Remove all items which have expired.  Only the slots of the wheel
+   for the time since the last call are visited.  */
+static void
+housekeeping (void)
+{
+  ITEM r, r2;
+  time_t current = gnupg_get_time ();
+  unsigned int n;
+
+  if (!wheel_time)
+    wheel_time = current;
 
-  /* Third, make sure that we don't have too many items in the list.
-     Expire old and unused entries after 30 minutes */
-  for (rprev=NULL, r=thecache; r; )
+  for (n=0; wheel_time <= current && n < CACHE_WHEEL_SIZE; wheel_time++, n++)
     {
-      if (!r->pw && r->ttl >= 0 && r->accessed + 60*30 < current)
+      for (r = cache_wheel[(unsigned long)wheel_time % CACHE_WHEEL_SIZE];
+           r; r = r2)
         {
-          ITEM r2 = r->next;
-          if (DBG_CACHE)
-            log_debug ("  removed '%s' (mode %d) (slot not used for 30m)\n",
-                       r->key, r->cache_mode);
-          xfree (r);
-          if (!rprev)
-            thecache = r2;
-          else
-            rprev->next = r2;
-          r = r2;
-        }
-      else
-        {
-          rprev = r;
-          r = r->next;
+          r2 = r->wnext;
+          if (r->wtime <= current)
+            expire_item (r, current);
         }
     }
+  if (wheel_time <= current)
+    wheel_time = current + 1;
 }
 
 
@@ -278,25 +434,38 @@ void
 agent_flush_cache (void)
 {
   ITEM r;
+  int i;
 
   if (DBG_CACHE)
     log_debug ("agent_flush_cache\n");
 
-  for (r=thecache; r; r = r->next)
-    {
-      if (r->pw)
-        {
-          if (DBG_CACHE)
-            log_debug ("  flushing '%s'\n", r->key);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = 0;
-        }
-    }
+  for (i=0; i < CACHE_TABLE_SIZE; i++)
+    while ((r = cache_table[i]))
+      {
+        if (DBG_CACHE)
+          log_debug ("  flushing '%s'\n", r->key);
+        remove_item (r);
+      }
 }
 
 
 
+/* Return the item for KEY matching CACHE_MODE or NULL.  */
+static ITEM
+find_item (const char *key, cache_mode_t cache_mode)
+{
+  ITEM r;
+
+  for (r = *bucket_for_key (key); r; r = r->next)
+    if (((cache_mode != CACHE_MODE_USER
+          && cache_mode != CACHE_MODE_NONCE)
+         || r->cache_mode == cache_mode)
+        && !strcmp (r->key, key))
+      return r;
+  return NULL;
+}
+
+
 /* Store the string DATA in the cache under KEY and mark it with a
    maximum lifetime of TTL seconds.  If there is already data under
    this key, it will be replaced.  Using a DATA of NULL deletes the
@@ -326,30 +495,30 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
   if ((!ttl && data) || cache_mode == CACHE_MODE_IGNORE)
     return 0;
 
-  for (r=thecache; r; r = r->next)
-    {
-      if (((cache_mode != CACHE_MODE_USER
-            && cache_mode != CACHE_MODE_NONCE)
-           || r->cache_mode == cache_mode)
-          && !strcmp (r->key, key))
-        break;
-    }
+  r = find_item (key, cache_mode);
   if (r) /* Replace.  */
     {
-      if (r->pw)
-        {
-          release_data (r->pw);
-          r->pw = NULL;
-        }
       if (data)
         {
-          r->created = r->accessed = gnupg_get_time ();
-          r->ttl = ttl;
-          r->cache_mode = cache_mode;
-          err = new_data (data, &r->pw);
+          struct secret_data_s *pw;
+
+          err = new_data (data, strlen (data) + 1, &pw);
           if (err)
             log_error ("error replacing cache item: %s\n", gpg_strerror (err));
+          else
+            {
+              release_data (r->pw);
+              r->pw = pw;
+              wheel_unlink (r);
+              drop_key (r);
+              r->created = r->accessed = gnupg_get_time ();
+              r->ttl = ttl;
+              r->cache_mode = cache_mode;
+              wheel_link (r);
+              return 0;
+            }
         }
+      remove_item (r);
     }
   else if (data) /* Insert.  */
     {
@@ -362,13 +531,17 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
           r->created = r->accessed = gnupg_get_time ();
           r->ttl = ttl;
           r->cache_mode = cache_mode;
-          err = new_data (data, &r->pw);
+          err = new_data (data, strlen (data) + 1, &r->pw);
           if (err)
             xfree (r);
           else
             {
-              r->next = thecache;
-              thecache = r;
+              ITEM *bucket = bucket_for_key (key);
+
+              r->next = *bucket;
+              *bucket = r;
+              wheel_link (r);
+              cache_stats.items++;
             }
         }
       if (err)
@@ -387,7 +560,7 @@ agent_get_cache (const char *key, cache_mode_t cache_mode)
   gpg_error_t err;
   ITEM r;
   char *value = NULL;
-  int res;
+  time_t current;
 
   if (cache_mode == CACHE_MODE_IGNORE)
     return NULL;
@@ -396,49 +569,181 @@ agent_get_cache (const char *key, cache_mode_t cache_mode)
     log_debug ("agent_get_cache '%s' (mode %d) ...\n", key, cache_mode);
   housekeeping ();
 
-  for (r=thecache; r; r = r->next)
+  current = gnupg_get_time ();
+  r = find_item (key, cache_mode);
+  if (r && r->wtime <= current && expire_item (r, current))
+    r = NULL; /* The wheel had not yet reached this item.  */
+  if (!r)
     {
-      if (r->pw
-          && ((cache_mode != CACHE_MODE_USER
-               && cache_mode != CACHE_MODE_NONCE)
-              || r->cache_mode == cache_mode)
-          && !strcmp (r->key, key))
-        {
-          r->accessed = gnupg_get_time ();
-          if (DBG_CACHE)
-            log_debug ("... hit\n");
-          if (r->pw->totallen < 32)
-            err = gpg_error (GPG_ERR_INV_LENGTH);
-          else if ((err = init_encryption ()))
-            ;
-          else if (!(value = xtrymalloc_secure (r->pw->totallen - 8)))
-            err = gpg_error_from_syserror ();
-          else
-            {
-              res = npth_mutex_lock (&encryption_lock);
-              if (res)
-                log_fatal ("failed to acquire cache encryption mutex: %s\n",
-			   strerror (res));
-              err = gcry_cipher_decrypt (encryption_handle,
-                                         value, r->pw->totallen - 8,
-                                         r->pw->data, r->pw->totallen);
-              res = npth_mutex_unlock (&encryption_lock);
-              if (res)
-                log_fatal ("failed to release cache encryption mutex: %s\n",
-			   strerror (res));
-            }
-          if (err)
-            {
-              xfree (value);
-              value = NULL;
-              log_error ("retrieving cache entry '%s' failed: %s\n",
-                         key, gpg_strerror (err));
-            }
-          return value;
-        }
+      if (DBG_CACHE)
+        log_debug ("... miss\n");
+      cache_stats.misses++;
+      return NULL;
     }
+
+  wheel_unlink (r);
+  r->accessed = current;
+  wheel_link (r);
   if (DBG_CACHE)
-    log_debug ("... miss\n");
+    log_debug ("... hit\n");
+  cache_stats.hits++;
+  err = get_data (r->pw, &value);
+  if (err)
+    log_error ("retrieving cache entry '%s' failed: %s\n",
+               key, gpg_strerror (err));
+  return value;
+}
 
-  return NULL;
+
+/* Return the cache statistics for GETINFO.  */
+void
+agent_cache_stats (unsigned int *r_items, unsigned long *r_hits,
+                   unsigned long *r_misses, unsigned long *r_expired)
+{
+  housekeeping ();
+  *r_items = cache_stats.items;
+  *r_hits = cache_stats.hits;
+  *r_misses = cache_stats.misses;
+  *r_expired = cache_stats.expired;
+}
+
+
+/* Return the item holding the passphrase for the private key with
+   the hexified keygrip KEY or NULL.  Expired items are removed.  */
+static ITEM
+find_key_item (const char *key)
+{
+  ITEM r;
+  time_t current = gnupg_get_time ();
+
+  for (r = *bucket_for_key (key); r; r = r->next)
+    if (r->cache_mode != CACHE_MODE_USER
+        && r->cache_mode != CACHE_MODE_NONCE
+        && !strcmp (r->key, key))
+      break;
+  if (r && r->wtime <= current && expire_item (r, current))
+    r = NULL;
+  return r;
+}
+
+
+/* Store the unprotected private key CANONKEY in the key cache under
+   KEY, which is the hexified keygrip.  MTIME, INODE and SIZE describe
+   the key file the key has been read from; the key is only returned
+   as long as the file has not been changed.  The key is stored with
+   the cached passphrase for KEY and thus nothing is cached if the
+   passphrase is not cached.  The key is dropped with the passphrase
+   or after --key-cache-ttl seconds, whatever comes first.  */
+void
+agent_put_key_cache (const char *key, const unsigned char *canonkey,
+                     time_t mtime, unsigned long inode, unsigned long size)
+{
+  gpg_error_t err;
+  ITEM r;
+  size_t len;
+
+  if (!opt.key_cache_ttl)
+    return;
+  if (DBG_CACHE)
+    log_debug ("agent_put_key_cache '%s'\n", key);
+  housekeeping ();
+
+  r = find_key_item (key);
+  if (!r)
+    {
+      if (DBG_CACHE)
+        log_debug ("... passphrase not cached\n");
+      return;
+    }
+  len = gcry_sexp_canon_len (canonkey, 0, NULL, NULL);
+  if (!len)
+    return;
+
+  wheel_unlink (r);
+  drop_key (r);
+  err = new_data (canonkey, len, &r->skey.data);
+  if (err)
+    {
+      r->skey.data = NULL;
+      log_error ("error inserting key cache item: %s\n", gpg_strerror (err));
+    }
+  else
+    {
+      r->skey.created = gnupg_get_time ();
+      r->skey.mtime = mtime;
+      r->skey.inode = inode;
+      r->skey.size = size;
+    }
+  wheel_link (r);
+}
+
+
+/* Return the unprotected private key cached under KEY or NULL if it
+   is not cached.  MTIME, INODE and SIZE describe the current key
+   file; if they do not match the values stored with the key, the
+   key is dropped.  */
+gcry_sexp_t
+agent_get_key_cache (const char *key, time_t mtime,
+                     unsigned long inode, unsigned long size)
+{
+  gpg_error_t err;
+  ITEM r;
+  char *value;
+  gcry_sexp_t s_key;
+
+  if (DBG_CACHE)
+    log_debug ("agent_get_key_cache '%s' ...\n", key);
+  housekeeping ();
+
+  r = find_key_item (key);
+  if (!r || !r->skey.data)
+    {
+      if (DBG_CACHE)
+        log_debug ("... miss\n");
+      return NULL;
+    }
+  if (r->skey.mtime != mtime || r->skey.inode != inode
+      || r->skey.size != size)
+    {
+      if (DBG_CACHE)
+        log_debug ("... key file has changed\n");
+      agent_forget_key_cache (key);
+      return NULL;
+    }
+
+  if (DBG_CACHE)
+    log_debug ("... hit\n");
+  err = get_data (r->skey.data, &value);
+  if (!err)
+    {
+      err = gcry_sexp_new (&s_key, value,
+                           gcry_sexp_canon_len ((unsigned char*)value,
+                                                r->skey.data->totallen - 8,
+                                                NULL, NULL), 1);
+      wipememory (value, r->skey.data->totallen - 8);
+      xfree (value);
+    }
+  if (err)
+    {
+      log_error ("retrieving key cache entry '%s' failed: %s\n",
+                 key, gpg_strerror (err));
+      return NULL;
+    }
+  return s_key;
+}
+
+
+/* Remove the key stored under KEY from the key cache.  */
+void
+agent_forget_key_cache (const char *key)
+{
+  ITEM r;
+
+  for (r = *bucket_for_key (key); r; r = r->next)
+    if (r->skey.data && !strcmp (r->key, key))
+      {
+        wheel_unlink (r);
+        drop_key (r);
+        wheel_link (r);
+      }
 }
@@ -48,6 +48,8 @@
 #define MAXLEN_KEYPARAM 1024
 /* Maximum allowed size of key data as used in inquiries (bytes). */
 #define MAXLEN_KEYDATA 4096
+/* Maximum allowed size of the inquired hashes for PKSIGN_BATCH.  */
+#define MAXLEN_HASHES (256*1024)
 /* The size of the import/export KEK key (in bytes).  */
 #define KEYWRAP_KEYSIZE (128/8)
 
@@ -725,19 +727,13 @@ cmd_setkeydesc (assuan_context_t ctx, char *line)
 }
 
 
-static const char hlp_sethash[] =
-  "SETHASH (--hash=<name>)|(<algonumber>) <hexstring>\n"
-  "\n"
-  "The client can use this command to tell the server about the data\n"
-  "(which usually is a hash) to be signed.";
+/* Parse the hash algorithm given either by the option --hash=<name>
+   or as an algorithm number at *LINE.  Store the algorithm at R_ALGO
+   and update *LINE to point to the next argument.  */
 static gpg_error_t
-cmd_sethash (assuan_context_t ctx, char *line)
+parse_hash_algo (assuan_context_t ctx, char **r_line, int *r_algo)
 {
-  int rc;
-  size_t n;
-  char *p;
-  ctrl_t ctrl = assuan_get_pointer (ctx);
-  unsigned char *buf;
+  char *line = *r_line;
   char *endp;
   int algo;
 
@@ -778,6 +774,30 @@ cmd_sethash (assuan_context_t ctx, char *line)
       if (!algo || gcry_md_test_algo (algo))
         return set_error (GPG_ERR_UNSUPPORTED_ALGORITHM, NULL);
     }
+  *r_algo = algo;
+  *r_line = line;
+  return 0;
+}
+
+
+static const char hlp_sethash[] =
+  "SETHASH (--hash=<name>)|(<algonumber>) <hexstring>\n"
+  "\n"
+  "The client can use this command to tell the server about the data\n"
+  "(which usually is a hash) to be signed.";
+static gpg_error_t
+cmd_sethash (assuan_context_t ctx, char *line)
+{
+  int rc;
+  size_t n;
+  char *p;
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  unsigned char *buf;
+  int algo;
+
+  rc = parse_hash_algo (ctx, &line, &algo);
+  if (rc)
+    return rc;
   ctrl->digest.algo = algo;
   ctrl->digest.raw_value = 0;
 
@@ -851,6 +871,99 @@ cmd_pksign (assuan_context_t ctx, char *line)
 }
 
 
+/* Helper for cmd_pksign_batch to send back one signature.  */
+static gpg_error_t
+send_batch_signature (void *opaque, const void *sig, size_t siglen)
+{
+  assuan_context_t ctx = opaque;
+  gpg_error_t err;
+
+  err = assuan_send_data (ctx, sig, siglen);
+  if (!err)
+    err = assuan_send_data (ctx, NULL, 0);  /* Flush.  */
+  return err;
+}
+
+
+static const char hlp_pksign_batch[] =
+  "PKSIGN_BATCH (--hash=<name>)|(<algonumber>) [<cache_nonce>]\n"
+  "\n"
+  "Sign many hashes with the key set by SIGKEY.  The hashes are\n"
+  "inquired using\n"
+  "\n"
+  "  S: INQUIRE HASHES\n"
+  "\n"
+  "and are expected as the concatenated binary hash values.  The key\n"
+  "is read and unprotected only once.  The signatures are returned in\n"
+  "the order of the hashes as canonical encoded S-expressions; each\n"
+  "one is sent as soon as it has been created.  On error the already\n"
+  "sent signatures are valid.  This command is not available if the\n"
+  "passphrase cache may not be used for signing.";
+static gpg_error_t
+cmd_pksign_batch (assuan_context_t ctx, char *line)
+{
+  int rc;
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  char *cache_nonce = NULL;
+  unsigned char *value = NULL;
+  size_t valuelen, hashlen;
+  char *p;
+  int algo;
+
+  rc = parse_hash_algo (ctx, &line, &algo);
+  if (rc)
+    return rc;
+  if (algo == MD_USER_TLS_MD5SHA1)
+    hashlen = 36;
+  else
+    hashlen = gcry_md_get_algo_dlen (algo);
+  if (!hashlen || hashlen > MAX_DIGEST_LEN)
+    return set_error (GPG_ERR_ASS_PARAMETER, "unsupported length of hash");
+
+  for (p=line; *p && *p != ' ' && *p != '\t'; p++)
+    ;
+  *p = '\0';
+  if (*line)
+    {
+      cache_nonce = xtrystrdup (line);
+      if (!cache_nonce)
+        return gpg_error_from_syserror ();
+    }
+
+  /* The user wants to be asked for each signature; a batch would
+     give away all of them for one passphrase.  */
+  if (opt.ignore_cache_for_signing
+      || !ctrl->server_local->use_cache_for_signing)
+    {
+      rc = set_error (GPG_ERR_NOT_SUPPORTED,
+                      "not allowed without the cache for signing");
+      goto leave;
+    }
+
+  rc = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u", MAXLEN_HASHES);
+  if (!rc)
+    rc = assuan_inquire (ctx, "HASHES", &value, &valuelen, MAXLEN_HASHES);
+  if (rc)
+    goto leave;
+  if (!valuelen || (valuelen % hashlen))
+    {
+      rc = set_error (GPG_ERR_ASS_PARAMETER, "invalid length of hashes");
+      goto leave;
+    }
+
+  rc = agent_pksign_batch (ctrl, cache_nonce, ctrl->server_local->keydesc,
+                           algo, value, hashlen, valuelen / hashlen,
+                           CACHE_MODE_NORMAL, send_batch_signature, ctx);
+
+ leave:
+  xfree (value);
+  xfree (cache_nonce);
+  xfree (ctrl->server_local->keydesc);
+  ctrl->server_local->keydesc = NULL;
+  return leave_cmd (ctx, rc);
+}
+
+
 static const char hlp_pkdecrypt[] =
   "PKDECRYPT [<options>]\n"
   "\n"
@@ -2361,6 +2474,10 @@ static const char hlp_getinfo[] =
   "  ssh_socket_name - Return the name of the ssh socket.\n"
   "  scd_running - Return OK if the SCdaemon is already running.\n"
   "  s2k_count   - Return the calibrated S2K count.\n"
+  "  cache_stats - Return the number of items in the passphrase cache\n"
+  "                and the number of hits, misses and expired items.\n"
+  "  connections - Return the number of connections being served and\n"
+  "                the number of queued connections.\n"
   "  std_session_env - List the standard session environment.\n"
   "  std_startup_env - List the standard startup environment.\n"
   "  cmd_has_option\n"
@@ -2412,6 +2529,26 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       snprintf (numbuf, sizeof numbuf, "%lu", get_standard_s2k_count ());
       rc = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strcmp (line, "cache_stats"))
+    {
+      char numbuf[100];
+      unsigned int items;
+      unsigned long hits, misses, expired;
+
+      agent_cache_stats (&items, &hits, &misses, &expired);
+      snprintf (numbuf, sizeof numbuf, "%u %lu %lu %lu",
+                items, hits, misses, expired);
+      rc = assuan_send_data (ctx, numbuf, strlen (numbuf));
+    }
+  else if (!strcmp (line, "connections"))
+    {
+      char numbuf[50];
+      unsigned int active, queued;
+
+      get_agent_connection_stats (&active, &queued);
+      snprintf (numbuf, sizeof numbuf, "%u %u", active, queued);
+      rc = assuan_send_data (ctx, numbuf, strlen (numbuf));
+    }
   else if (!strcmp (line, "std_session_env")
            || !strcmp (line, "std_startup_env"))
     {
@@ -2659,6 +2796,7 @@ register_commands (assuan_context_t ctx)
     { "SETKEYDESC",     cmd_setkeydesc,hlp_setkeydesc },
     { "SETHASH",        cmd_sethash,   hlp_sethash },
     { "PKSIGN",         cmd_pksign,    hlp_pksign },
+    { "PKSIGN_BATCH",   cmd_pksign_batch, hlp_pksign_batch },
     { "PKDECRYPT",      cmd_pkdecrypt, hlp_pkdecrypt },
     { "GENKEY",         cmd_genkey,    hlp_genkey },
     { "READKEY",        cmd_readkey,   hlp_readkey },
@@ -52,14 +52,17 @@ struct try_unprotect_arg_s
 
 /* Write an S-expression formatted key to our key storage.  With FORCE
    passed as true an existing key with the given GRIP will get
-   overwritten.  */
+   overwritten.  In this case the key is written to a temporary file
+   which then replaces the existing file; on error the existing file
+   is kept.  */
 int
 agent_write_private_key (const unsigned char *grip,
                          const void *buffer, size_t length, int force)
 {
-  char *fname;
+  char *fname, *tmpfname;
   estream_t fp;
   char hexgrip[40+4+1];
+  gpg_error_t err = 0;
 
   bin2hex (grip, 20, hexgrip);
   strcpy (hexgrip+40, ".key");
@@ -73,35 +76,65 @@ agent_write_private_key (const unsigned char *grip,
       return gpg_error (GPG_ERR_EEXIST);
     }
 
-  fp = es_fopen (fname, force? "wb,mode=-rw" : "wbx,mode=-rw");
+  if (force)
+    {
+      tmpfname = xtryasprintf ("%s.tmp", fname);
+      if (!tmpfname)
+        {
+          err = gpg_error_from_syserror ();
+          xfree (fname);
+          return err;
+        }
+    }
+  else
+    tmpfname = fname;
+
+  fp = es_fopen (tmpfname, force? "wb,mode=-rw" : "wbx,mode=-rw");
   if (!fp)
     {
-      gpg_error_t tmperr = gpg_error_from_syserror ();
-      log_error ("can't create '%s': %s\n", fname, gpg_strerror (tmperr));
-      xfree (fname);
-      return tmperr;
+      err = gpg_error_from_syserror ();
+      log_error ("can't create '%s': %s\n", tmpfname, gpg_strerror (err));
+      goto leave;
     }
 
   if (es_fwrite (buffer, length, 1, fp) != 1)
     {
-      gpg_error_t tmperr = gpg_error_from_syserror ();
-      log_error ("error writing '%s': %s\n", fname, gpg_strerror (tmperr));
+      err = gpg_error_from_syserror ();
+      log_error ("error writing '%s': %s\n", tmpfname, gpg_strerror (err));
       es_fclose (fp);
-      gnupg_remove (fname);
-      xfree (fname);
-      return tmperr;
+      gnupg_remove (tmpfname);
+      goto leave;
     }
   if (es_fclose (fp))
     {
-      gpg_error_t tmperr = gpg_error_from_syserror ();
-      log_error ("error closing '%s': %s\n", fname, gpg_strerror (tmperr));
+      err = gpg_error_from_syserror ();
+      log_error ("error closing '%s': %s\n", tmpfname, gpg_strerror (err));
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  if (force)
+    {
+#ifdef HAVE_DOSISH_SYSTEM
       gnupg_remove (fname);
-      xfree (fname);
-      return tmperr;
+#endif
+      if (rename (tmpfname, fname))
+        {
+          err = gpg_error_from_syserror ();
+          log_error ("renaming '%s' to '%s' failed: %s\n",
+                     tmpfname, fname, gpg_strerror (err));
+          gnupg_remove (tmpfname);
+          goto leave;
+        }
     }
+  hexgrip[40] = 0;
+  agent_forget_key_cache (hexgrip);
   bump_key_eventcounter ();
+
+ leave:
+  if (tmpfname != fname)
+    xfree (tmpfname);
   xfree (fname);
-  return 0;
+  return err;
 }
 
 
@@ -452,11 +485,44 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
 }
 
 
+/* Protect the unprotected key KEYBUF again with PASSPHRASE and the
+   standard S2K count and store it under GRIP.  This is used with
+   --s2k-reprotect.  Errors are only logged.  Returns true if the key
+   file has been replaced.  */
+static int
+reprotect_key (const unsigned char *grip, const unsigned char *keybuf,
+               const char *passphrase)
+{
+  gpg_error_t err;
+  unsigned char *p;
+  size_t len;
+
+  err = agent_protect (keybuf, passphrase, &p, &len, 0);
+  if (!err)
+    {
+      err = agent_write_private_key (grip, p, len, 1);
+      xfree (p);
+    }
+  if (err)
+    {
+      log_error ("failed to protect the key again: %s\n",
+                 gpg_strerror (err));
+      return 0;
+    }
+  if (opt.verbose)
+    log_info ("key protected again with S2K count %lu\n",
+              get_standard_s2k_count ());
+  return 1;
+}
+
+
 /* Read the key identified by GRIP from the private key directory and
-   return it as an gcrypt S-expression object in RESULT.  On failure
-   returns an error code and stores NULL at RESULT. */
+   return it as an gcrypt S-expression object in RESULT.  If R_ST is
+   not NULL the stat information of the file is stored there.  On
+   failure returns an error code and stores NULL at RESULT. */
 static gpg_error_t
-read_key_file (const unsigned char *grip, gcry_sexp_t *result)
+read_key_file (const unsigned char *grip, gcry_sexp_t *result,
+               struct stat *r_st)
 {
   int rc;
   char *fname;
@@ -529,10 +595,31 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result)
       return rc;
     }
   *result = s_skey;
+  if (r_st)
+    *r_st = st;
   return 0;
 }
 
 
+/* Store the stat information of the key file for GRIP at ST.  */
+static gpg_error_t
+stat_key_file (const unsigned char *grip, struct stat *st)
+{
+  gpg_error_t err = 0;
+  char *fname;
+  char hexgrip[40+4+1];
+
+  bin2hex (grip, 20, hexgrip);
+  strcpy (hexgrip+40, ".key");
+
+  fname = make_filename (opt.homedir, GNUPG_PRIVATE_KEYS_DIR, hexgrip, NULL);
+  if (stat (fname, st))
+    err = gpg_error_from_syserror ();
+  xfree (fname);
+  return err;
+}
+
+
 /* Return the secret key as an S-Exp in RESULT after locating it using
    the GRIP.  Stores NULL at RESULT if the operation shall be diverted
    to a token; in this case an allocated S-expression with the
@@ -547,7 +634,10 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result)
    R_PASSPHRASE is not NULL, the function succeeded and the key was
    protected the used passphrase (entered or from the cache) is stored
    there; if not NULL will be stored.  The caller needs to free the
-   returned passphrase.   */
+   returned passphrase.  If --key-cache-ttl is used, the unprotected
+   key is cached and returned without reading the key file as long as
+   the file has not been changed; this is not done if CACHE_MODE is
+   CACHE_MODE_IGNORE or the passphrase has been requested.  */
 gpg_error_t
 agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
                      const char *desc_text,
@@ -560,6 +650,9 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   size_t len, buflen, erroff;
   gcry_sexp_t s_skey;
   int got_shadow_info = 0;
+  int use_key_cache;
+  struct stat st;
+  char hexgrip[40+1];
 
   *result = NULL;
   if (shadow_info)
@@ -567,7 +660,18 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   if (r_passphrase)
     *r_passphrase = NULL;
 
-  rc = read_key_file (grip, &s_skey);
+  bin2hex (grip, 20, hexgrip);
+  use_key_cache = (opt.key_cache_ttl && cache_mode != CACHE_MODE_IGNORE
+                   && !r_passphrase);
+  if (use_key_cache && !stat_key_file (grip, &st))
+    {
+      *result = agent_get_key_cache (hexgrip, st.st_mtime,
+                                     st.st_ino, st.st_size);
+      if (*result)
+        return 0;
+    }
+
+  rc = read_key_file (grip, &s_skey, &st);
   if (rc)
     return rc;
 
@@ -586,6 +690,8 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
       {
 	char *desc_text_final;
 	char *comment = NULL;
+        char *passphrase = NULL;
+        unsigned long s2k_count = 0;
 
         /* Note, that we will take the comment as a C string for
            display purposes; i.e. all stuff beyond a Nul character is
@@ -605,15 +711,36 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
                                    &desc_text_final);
         gcry_free (comment);
 
+        /* With --s2k-reprotect we need to know whether the S2K count
+           is too large and the passphrase to protect the key again.  */
+        if (opt.s2k_reprotect && agent_get_s2k_count (buf, &s2k_count))
+          s2k_count = 0;
+
 	if (!rc)
 	  {
 	    rc = unprotect (ctrl, cache_nonce, desc_text_final, &buf, grip,
-                            cache_mode, lookup_ttl, r_passphrase);
+                            cache_mode, lookup_ttl,
+                            (r_passphrase || s2k_count)? &passphrase : NULL);
 	    if (rc)
 	      log_error ("failed to unprotect the secret key: %s\n",
 			 gpg_strerror (rc));
 	  }
 
+        if (!rc && passphrase && *passphrase
+            && s2k_count > 2 * get_standard_s2k_count ())
+          {
+            if (opt.verbose)
+              log_info ("S2K count %lu of key is too large\n", s2k_count);
+            /* The cached key must be tied to the new file.  */
+            if (reprotect_key (grip, buf, passphrase)
+                && use_key_cache && stat_key_file (grip, &st))
+              use_key_cache = 0;
+          }
+        if (r_passphrase)
+          *r_passphrase = passphrase;
+        else
+          xfree (passphrase);
+
 	xfree (desc_text_final);
       }
       break;
@@ -664,6 +791,8 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
 
   buflen = gcry_sexp_canon_len (buf, 0, NULL, NULL);
   rc = gcry_sexp_sscan (&s_skey, &erroff, (char*)buf, buflen);
+  if (!rc && use_key_cache)
+    agent_put_key_cache (hexgrip, buf, st.st_mtime, st.st_ino, st.st_size);
   wipememory (buf, buflen);
   xfree (buf);
   if (rc)
@@ -808,7 +937,7 @@ agent_raw_key_from_file (ctrl_t ctrl, const unsigned char *grip,
 
   *result = NULL;
 
-  err = read_key_file (grip, &s_skey);
+  err = read_key_file (grip, &s_skey, NULL);
   if (!err)
     *result = s_skey;
   return err;
@@ -844,7 +973,7 @@ agent_public_key_from_file (ctrl_t ctrl,
 
   *result = NULL;
 
-  err = read_key_file (grip, &s_skey);
+  err = read_key_file (grip, &s_skey, NULL);
   if (err)
     return err;
 
@@ -1021,7 +1150,7 @@ agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
   {
     gcry_sexp_t sexp;
 
-    err = read_key_file (grip, &sexp);
+    err = read_key_file (grip, &sexp, NULL);
     if (err)
       {
         if (gpg_err_code (err) == GPG_ERR_ENOENT)
@@ -53,6 +53,7 @@
 #include "asshelp.h"
 #include "../include/cipher.h"	/* for PUBKEY_ALGO_ECDSA, PUBKEY_ALGO_ECDH */
 #include "../common/init.h"
+#include "../common/connpool.h"
 
 
 enum cmd_and_opt_values
@@ -94,6 +95,9 @@ enum cmd_and_opt_values
   oDefCacheTTLSSH,
   oMaxCacheTTL,
   oMaxCacheTTLSSH,
+  oKeyCacheTTL,
+  oS2KCalibration,
+  oS2KReprotect,
   oEnforcePassphraseConstraints,
   oMinPassphraseLen,
   oMinPassphraseNonalpha,
@@ -112,7 +116,9 @@ enum cmd_and_opt_values
   oKeepDISPLAY,
   oSSHSupport,
   oDisableScdaemon,
-  oWriteEnvFile
+  oWriteEnvFile,
+  oListenBacklog,
+  oMaxConnections
 };
 
 
@@ -168,6 +174,9 @@ static ARGPARSE_OPTS opts[] = {
   { oDefCacheTTLSSH, "default-cache-ttl-ssh", 4, "@" },
   { oMaxCacheTTL, "max-cache-ttl", 4, "@" },
   { oMaxCacheTTLSSH, "max-cache-ttl-ssh", 4, "@" },
+  { oKeyCacheTTL, "key-cache-ttl", 4, "@" },
+  { oS2KCalibration, "s2k-calibration", 4, "@" },
+  { oS2KReprotect, "s2k-reprotect", 0, "@" },
 
   { oEnforcePassphraseConstraints, "enforce-passphrase-constraints", 0, "@"},
   { oMinPassphraseLen, "min-passphrase-len", 4, "@" },
@@ -187,6 +196,8 @@ static ARGPARSE_OPTS opts[] = {
   { oSSHSupport, "enable-ssh-support", 0, N_("enable ssh-agent emulation") },
   { oWriteEnvFile, "write-env-file", 2|8,
             N_("|FILE|write environment settings also to FILE")},
+  { oListenBacklog, "listen-backlog", 1, "@" },
+  { oMaxConnections, "max-connections", 1, "@" },
   {0}
 };
 
@@ -270,8 +281,15 @@ static char *current_logfile;
    watched. */
 static pid_t parent_pid = (pid_t)(-1);
 
-/* Number of active connections.  */
-static int active_connections;
+/* The backlog of the listening sockets; also the maximum number of
+   accepted connections waiting for a free connection thread.  */
+static int listen_backlog = 64;
+
+/* The maximum number of connection threads or 0 for no limit.  */
+static unsigned int max_connections;
+
+/* The pool of connection threads.  */
+static conn_pool_t connection_pool;
 
 
 /*
@@ -482,6 +500,9 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
       opt.def_cache_ttl_ssh = DEFAULT_CACHE_TTL_SSH;
       opt.max_cache_ttl = MAX_CACHE_TTL;
       opt.max_cache_ttl_ssh = MAX_CACHE_TTL_SSH;
+      opt.key_cache_ttl = 0;
+      opt.s2k_calibration = 0;
+      opt.s2k_reprotect = 0;
       opt.enforce_passphrase_constraints = 0;
       opt.min_passphrase_len = MIN_PASSPHRASE_LEN;
       opt.min_passphrase_nonalpha = MIN_PASSPHRASE_NONALPHA;
@@ -526,6 +547,9 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
     case oDefCacheTTLSSH: opt.def_cache_ttl_ssh = pargs->r.ret_ulong; break;
     case oMaxCacheTTL: opt.max_cache_ttl = pargs->r.ret_ulong; break;
     case oMaxCacheTTLSSH: opt.max_cache_ttl_ssh = pargs->r.ret_ulong; break;
+    case oKeyCacheTTL: opt.key_cache_ttl = pargs->r.ret_ulong; break;
+    case oS2KCalibration: opt.s2k_calibration = pargs->r.ret_ulong; break;
+    case oS2KReprotect: opt.s2k_reprotect = 1; break;
 
     case oEnforcePassphraseConstraints:
       opt.enforce_passphrase_constraints=1;
@@ -815,6 +839,13 @@ main (int argc, char **argv )
             env_file_name = make_filename ("~/.gpg-agent-info", NULL);
           break;
 
+        case oListenBacklog:
+          listen_backlog = pargs.r.ret_int;
+          break;
+        case oMaxConnections:
+          max_connections = pargs.r.ret_int > 0? pargs.r.ret_int : 0;
+          break;
+
         default : pargs.err = configfp? 1:2; break;
 	}
     }
@@ -947,6 +978,8 @@ main (int argc, char **argv )
               GC_OPT_FLAG_DEFAULT|GC_OPT_FLAG_RUNTIME, MAX_CACHE_TTL );
       es_printf ("max-cache-ttl-ssh:%lu:%d:\n",
               GC_OPT_FLAG_DEFAULT|GC_OPT_FLAG_RUNTIME, MAX_CACHE_TTL_SSH );
+      es_printf ("key-cache-ttl:%lu:%d:\n",
+              GC_OPT_FLAG_DEFAULT|GC_OPT_FLAG_RUNTIME, 0 );
       es_printf ("enforce-passphrase-constraints:%lu:\n",
               GC_OPT_FLAG_NONE|GC_OPT_FLAG_RUNTIME);
       es_printf ("min-passphrase-len:%lu:%d:\n",
@@ -1396,6 +1429,20 @@ get_agent_ssh_socket_name (void)
 }
 
 
+/* Store the number of connections being served and the number of
+   connections waiting for a connection thread.  */
+void
+get_agent_connection_stats (unsigned int *r_active, unsigned int *r_queued)
+{
+  unsigned int threads;
+
+  if (connection_pool)
+    conn_pool_stats (connection_pool, r_active, r_queued, &threads);
+  else
+    *r_active = *r_queued = 0;
+}
+
+
 /* Under W32, this function returns the handle of the scdaemon
    notification event.  Calling it the first time creates that
    event.  */
@@ -1572,7 +1619,7 @@ create_server_socket (char *name, int is_ssh, assuan_sock_nonce_t *nonce)
       agent_exit (2);
     }
 
-  if (listen (FD2INT(fd), 5 ) == -1)
+  if (listen (FD2INT(fd), listen_backlog ) == -1)
     {
       log_error (_("listen() failed: %s\n"), strerror (errno));
       assuan_sock_close (fd);
@@ -1759,8 +1806,8 @@ handle_signal (int signo)
       if (!shutdown_pending)
         log_info ("SIGTERM received - shutting down ...\n");
       else
-        log_info ("SIGTERM received - still %i open connections\n",
-		  active_connections);
+        log_info ("SIGTERM received - still %u open connections\n",
+		  conn_pool_count (connection_pool));
       shutdown_pending++;
       if (shutdown_pending > 2)
         {
@@ -1856,12 +1903,12 @@ start_connection_thread_ssh (void *arg)
 }
 
 
-/* Connection handler loop.  Wait for connection requests and spawn a
-   thread after accepting a connection.  */
+/* Connection handler loop.  Wait for connection requests and pass
+   them to the connection pool after accepting a connection.  */
 static void
 handle_connections (gnupg_fd_t listen_fd, gnupg_fd_t listen_fd_ssh)
 {
-  npth_attr_t tattr;
+  gpg_error_t err;
   struct sockaddr_un paddr;
   socklen_t plen;
   fd_set fdset, read_fdset;
@@ -1877,11 +1924,11 @@ handle_connections (gnupg_fd_t listen_fd, gnupg_fd_t listen_fd_ssh)
   int events_set;
 #endif
 
-  ret = npth_attr_init(&tattr);
-  if (ret)
-    log_fatal ("error allocating thread attributes: %s\n",
-	       strerror (ret));
-  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  err = conn_pool_new (&connection_pool, max_connections,
+                       listen_backlog > 0? listen_backlog : 0);
+  if (err)
+    log_fatal ("error allocating the connection pool: %s\n",
+	       gpg_strerror (err));
 
 #ifndef HAVE_W32_SYSTEM
   npth_sigev_init ();
@@ -1924,7 +1971,7 @@ handle_connections (gnupg_fd_t listen_fd, gnupg_fd_t listen_fd_ssh)
       /* Shutdown test.  */
       if (shutdown_pending)
         {
-          if (active_connections == 0)
+          if (!conn_pool_count (connection_pool))
             break; /* ready */
 
           /* Do not accept new connections but keep on running the
@@ -2005,19 +2052,17 @@ handle_connections (gnupg_fd_t listen_fd, gnupg_fd_t listen_fd_ssh)
             }
           else
             {
-	      npth_t thread;
-
               ctrl->thread_startup.fd = fd;
-	      ret = npth_create (&thread, &tattr,
-                                 start_connection_thread, ctrl);
-              if (ret)
+              err = conn_pool_submit (connection_pool,
+                                      start_connection_thread, ctrl);
+              if (err)
                 {
-                  log_error ("error spawning connection handler: %s\n",
-			     strerror (ret));
+                  log_error ("error queuing connection: %s\n",
+			     gpg_strerror (err));
+                  session_env_release (ctrl->session_env);
                   assuan_sock_close (fd);
                   xfree (ctrl);
                 }
-
             }
           fd = GNUPG_INVALID_FD;
 	}
@@ -2049,16 +2094,15 @@ handle_connections (gnupg_fd_t listen_fd, gnupg_fd_t listen_fd_ssh)
             }
           else
             {
-	      npth_t thread;
-
               agent_init_default_ctrl (ctrl);
               ctrl->thread_startup.fd = fd;
-              ret = npth_create (&thread, &tattr,
-                                 start_connection_thread_ssh, ctrl);
-	      if (ret)
+              err = conn_pool_submit (connection_pool,
+                                      start_connection_thread_ssh, ctrl);
+	      if (err)
                 {
-                  log_error ("error spawning ssh connection handler: %s\n",
-			     strerror (ret));
+                  log_error ("error queuing ssh connection: %s\n",
+			     gpg_strerror (err));
+                  agent_deinit_default_ctrl (ctrl);
                   assuan_sock_close (fd);
                   xfree (ctrl);
                 }
@@ -2069,7 +2113,6 @@ handle_connections (gnupg_fd_t listen_fd, gnupg_fd_t listen_fd_ssh)
 
   cleanup ();
   log_info (_("%s %s stopped\n"), strusage(11), strusage(13));
-  npth_attr_destroy (&tattr);
 }
 
 
@@ -248,32 +248,17 @@ do_encode_raw_pkcs1 (const byte *md, size_t mdlen, unsigned int nbits,
 
 
 
-/* SIGN whatever information we have accumulated in CTRL and return
-   the signature S-expression.  LOOKUP is an optional function to
-   provide a way for lower layers to ask for the caching TTL.  If a
-   CACHE_NONCE is given that cache item is first tried to get a
-   passphrase.  */
-int
-agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
-                 const char *desc_text,
-		 gcry_sexp_t *signature_sexp,
-                 cache_mode_t cache_mode, lookup_ttl_t lookup_ttl)
+/* Sign the digest in CTRL with the secret key S_SKEY or, if S_SKEY
+   is NULL, with the smartcard described by SHADOW_INFO.  Store the
+   signature S-expression at R_SIG.  */
+static gpg_error_t
+sign_digest (ctrl_t ctrl, gcry_sexp_t s_skey,
+             const unsigned char *shadow_info, gcry_sexp_t *r_sig)
 {
-  gcry_sexp_t s_skey = NULL, s_sig = NULL;
-  unsigned char *shadow_info = NULL;
+  gcry_sexp_t s_sig = NULL;
   unsigned int rc = 0;		/* FIXME: gpg-error? */
 
-  if (! ctrl->have_keygrip)
-    return gpg_error (GPG_ERR_NO_SECKEY);
-
-  rc = agent_key_from_file (ctrl, cache_nonce, desc_text, ctrl->keygrip,
-                            &shadow_info, cache_mode, lookup_ttl,
-                            &s_skey, NULL);
-  if (rc)
-    {
-      log_error ("failed to read the secret key\n");
-      goto leave;
-    }
+  *r_sig = NULL;
 
   if (!s_skey)
     {
@@ -290,7 +275,7 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
       if (rc)
         {
           log_error ("smartcard signing failed: %s\n", gpg_strerror (rc));
-          goto leave;
+          return rc;
         }
       len = gcry_sexp_canon_len (buf, 0, NULL, NULL);
       assert (len);
@@ -301,7 +286,7 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 	{
 	  log_error ("failed to convert sigbuf returned by divert_pksign "
 		     "into S-Exp: %s", gpg_strerror (rc));
-	  goto leave;
+	  return rc;
 	}
     }
   else
@@ -328,7 +313,7 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
                            &s_hash,
                            ctrl->digest.raw_value);
       if (rc)
-        goto leave;
+        return rc;
 
       if (DBG_CRYPTO)
         {
@@ -344,7 +329,7 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
       if (rc)
         {
           log_error ("signing failed: %s\n", gpg_strerror (rc));
-          goto leave;
+          return rc;
         }
 
       if (DBG_CRYPTO)
@@ -354,6 +339,40 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
         }
     }
 
+  *r_sig = s_sig;
+  return 0;
+}
+
+
+/* SIGN whatever information we have accumulated in CTRL and return
+   the signature S-expression.  LOOKUP is an optional function to
+   provide a way for lower layers to ask for the caching TTL.  If a
+   CACHE_NONCE is given that cache item is first tried to get a
+   passphrase.  */
+int
+agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
+                 const char *desc_text,
+		 gcry_sexp_t *signature_sexp,
+                 cache_mode_t cache_mode, lookup_ttl_t lookup_ttl)
+{
+  gcry_sexp_t s_skey = NULL, s_sig = NULL;
+  unsigned char *shadow_info = NULL;
+  unsigned int rc = 0;		/* FIXME: gpg-error? */
+
+  if (! ctrl->have_keygrip)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+
+  rc = agent_key_from_file (ctrl, cache_nonce, desc_text, ctrl->keygrip,
+                            &shadow_info, cache_mode, lookup_ttl,
+                            &s_skey, NULL);
+  if (rc)
+    {
+      log_error ("failed to read the secret key\n");
+      goto leave;
+    }
+
+  rc = sign_digest (ctrl, s_skey, shadow_info, &s_sig);
+
  leave:
 
   *signature_sexp = s_sig;
@@ -364,6 +383,81 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
   return rc;
 }
 
+
+/* Sign NHASHES digests of algorithm ALGO, each HASHLEN bytes long and
+   stored one after the other in HASHES, with the key set in CTRL.
+   The key is read and unprotected only once.  PUTSIG is called with
+   OPAQUE and the canonical encoded signature of each digest in turn;
+   the first error returned by PUTSIG or by the signing stops the
+   operation.  The digest set in CTRL is not changed.  */
+int
+agent_pksign_batch (ctrl_t ctrl, const char *cache_nonce,
+                    const char *desc_text, int algo,
+                    const unsigned char *hashes, size_t hashlen,
+                    unsigned int nhashes, cache_mode_t cache_mode,
+                    gpg_error_t (*putsig)(void *opaque,
+                                          const void *sig, size_t siglen),
+                    void *opaque)
+{
+  gcry_sexp_t s_skey = NULL, s_sig;
+  unsigned char *shadow_info = NULL;
+  unsigned char *buf = NULL;
+  size_t len, buflen = 0;
+  unsigned int idx;
+  unsigned char saved_digest[sizeof ctrl->digest];
+  int rc;
+
+  if (! ctrl->have_keygrip)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+  if (hashlen > MAX_DIGEST_LEN)
+    return gpg_error (GPG_ERR_INV_LENGTH);
+
+  rc = agent_key_from_file (ctrl, cache_nonce, desc_text, ctrl->keygrip,
+                            &shadow_info, cache_mode, NULL, &s_skey, NULL);
+  if (rc)
+    {
+      log_error ("failed to read the secret key\n");
+      return rc;
+    }
+
+  memcpy (saved_digest, &ctrl->digest, sizeof saved_digest);
+  ctrl->digest.algo = algo;
+  ctrl->digest.raw_value = 0;
+  ctrl->digest.valuelen = hashlen;
+  for (idx=0; idx < nhashes && !rc; idx++)
+    {
+      memcpy (ctrl->digest.value, hashes + idx * hashlen, hashlen);
+      rc = sign_digest (ctrl, s_skey, shadow_info, &s_sig);
+      if (rc)
+        break;
+
+      len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, NULL, 0);
+      assert (len);
+      if (len > buflen)
+        {
+          xfree (buf);
+          buflen = len;
+          buf = xtrymalloc (buflen);
+          if (!buf)
+            rc = gpg_error_from_syserror ();
+        }
+      if (!rc)
+        {
+          len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, buf, len);
+          assert (len);
+          rc = putsig (opaque, buf, len);
+        }
+      gcry_sexp_release (s_sig);
+    }
+  memcpy (&ctrl->digest, saved_digest, sizeof saved_digest);
+  wipememory (saved_digest, sizeof saved_digest);
+
+  xfree (buf);
+  gcry_sexp_release (s_skey);
+  xfree (shadow_info);
+  return rc;
+}
+
 /* SIGN whatever information we have accumulated in CTRL and write it
    back to OUTFP.  If a CACHE_NONCE is given that cache item is first
    tried to get a passphrase.  */
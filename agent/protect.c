@@ -31,6 +31,7 @@
 # include <windows.h>
 #else
 # include <sys/times.h>
+# include <sys/utsname.h>
 #endif
 
 #include "agent.h"
@@ -44,6 +45,15 @@
 /* Decode an rfc4880 encoded S2K count.  */
 #define S2K_DECODE_COUNT(_val) ((16ul + ((_val) & 15)) << (((_val) >> 4) + 6))
 
+/* The default time in milliseconds the S2K count is calibrated for.  */
+#define DEFAULT_S2K_CALIBRATION 100
+
+/* The file in the home directory with the calibrated S2K counts.  */
+#define S2K_CALIBRATION_FILE "s2k-calibration"
+
+/* The time in seconds after which the calibration is repeated.  */
+#define S2K_CALIBRATION_MAXAGE (30*86400)
+
 
 /* A table containing the information needed to create a protected
    private key.  */
@@ -148,9 +158,9 @@ calibrate_s2k_count_one (unsigned long count)
 
 
 /* Measure the time we need to do the hash operations and deduce an
-   S2K count which requires about 100ms of time.  */
+   S2K count which requires about MSEC milliseconds of time.  */
 static unsigned long
-calibrate_s2k_count (void)
+calibrate_s2k_count (unsigned long msec)
 {
   unsigned long count;
   unsigned long ms;
@@ -160,11 +170,11 @@ calibrate_s2k_count (void)
       ms = calibrate_s2k_count_one (count);
       if (opt.verbose > 1)
         log_info ("S2K calibration: %lu -> %lums\n", count, ms);
-      if (ms > 100)
+      if (ms > msec)
         break;
     }
 
-  count = (unsigned long)(((double)count / ms) * 100);
+  count = (unsigned long)(((double)count / ms) * msec);
   count /= 1024;
   count *= 1024;
   if (count < 65536)
@@ -181,14 +191,165 @@ calibrate_s2k_count (void)
 
 
 
-/* Return the standard S2K count.  */
+/* Store the name of this host in the buffer NAME of size
+   NAMESIZE.  */
+static void
+get_nodename (char *name, size_t namesize)
+{
+#ifdef HAVE_W32_SYSTEM
+  DWORD n = namesize;
+
+  if (!GetComputerNameA (name, &n))
+    n = 0;
+  name[n] = 0;
+#else
+  struct utsname utsbuf;
+
+  if (uname (&utsbuf))
+    *name = 0;
+  else
+    {
+      strncpy (name, utsbuf.nodename, namesize-1);
+      name[namesize-1] = 0;
+    }
+#endif
+  if (!*name || strchr (name, ' '))
+    strcpy (name, "unknown");
+}
+
+
+/* Return the S2K count calibrated for MSEC milliseconds on host
+   NODENAME from the calibration file FNAME or 0 if not available.
+   The file has one line for each host with the fields NODENAME, MSEC,
+   COUNT and the time of the calibration delimited by spaces.  A count
+   older than S2K_CALIBRATION_MAXAGE is not returned, so that the
+   count follows changes of the machine.  The time of the calibration
+   is stored at R_TIME.  */
+static unsigned long
+read_s2k_calibration (const char *fname, const char *nodename,
+                      unsigned long msec, time_t *r_time)
+{
+  estream_t fp;
+  char line[256], name[256];
+  unsigned long m, c, t;
+  unsigned long count = 0;
+  unsigned long now = gnupg_get_time ();
+
+  fp = es_fopen (fname, "r");
+  if (!fp)
+    return 0;
+  while (es_fgets (line, sizeof line, fp))
+    {
+      if (*line == '#')
+        continue;
+      if (sscanf (line, "%255s %lu %lu %lu", name, &m, &c, &t) == 4
+          && !strcmp (name, nodename) && m == msec && c >= 65536
+          && t <= now && now - t < S2K_CALIBRATION_MAXAGE)
+        {
+          count = c;
+          *r_time = t;
+          break;
+        }
+    }
+  es_fclose (fp);
+  return count;
+}
+
+
+/* Store COUNT as the S2K count calibrated for MSEC milliseconds on
+   host NODENAME in the calibration file FNAME.  The lines for other
+   hosts are kept.  */
+static void
+write_s2k_calibration (const char *fname, const char *nodename,
+                       unsigned long msec, unsigned long count)
+{
+  estream_t fp, newfp;
+  char line[256], name[256];
+  char *tmpfname;
+
+  tmpfname = xtryasprintf ("%s.tmp", fname);
+  if (!tmpfname)
+    return;
+  newfp = es_fopen (tmpfname, "w");
+  if (!newfp)
+    {
+      log_error ("can't create '%s': %s\n", tmpfname, strerror (errno));
+      xfree (tmpfname);
+      return;
+    }
+  es_fputs ("# Calibrated S2K counts - maintained by gpg-agent\n"
+            "# <host> <milliseconds> <count> <time>\n", newfp);
+  fp = es_fopen (fname, "r");
+  if (fp)
+    {
+      while (es_fgets (line, sizeof line, fp))
+        if (*line != '#' && strchr (line, '\n')
+            && sscanf (line, "%255s", name) == 1 && strcmp (name, nodename))
+          es_fputs (line, newfp);
+      es_fclose (fp);
+    }
+  es_fprintf (newfp, "%s %lu %lu %lu\n", nodename, msec, count,
+              (unsigned long)gnupg_get_time ());
+  if (es_fclose (newfp))
+    {
+      log_error ("error writing '%s': %s\n", tmpfname, strerror (errno));
+      gnupg_remove (tmpfname);
+    }
+  else
+    {
+#ifdef HAVE_DOSISH_SYSTEM
+      gnupg_remove (fname);
+#endif
+      if (rename (tmpfname, fname))
+        {
+          log_error ("renaming '%s' to '%s' failed: %s\n",
+                     tmpfname, fname, strerror (errno));
+          gnupg_remove (tmpfname);
+        }
+    }
+  xfree (tmpfname);
+}
+
+
+/* Return the standard S2K count.  The count is calibrated for the
+   time given by --s2k-calibration.  To avoid the calibration at each
+   start, the result is stored per host in a file in the home
+   directory.  The calibration is repeated after
+   S2K_CALIBRATION_MAXAGE.  */
 unsigned long
 get_standard_s2k_count (void)
 {
   static unsigned long count;
-
-  if (!count)
-    count = calibrate_s2k_count ();
+  static unsigned long count_msec;
+  static time_t count_time;
+  unsigned long msec;
+  time_t now = gnupg_get_time ();
+  char nodename[256];
+  char *fname = NULL;
+
+  msec = opt.s2k_calibration? opt.s2k_calibration : DEFAULT_S2K_CALIBRATION;
+  if (!count || count_msec != msec
+      || now < count_time || now - count_time >= S2K_CALIBRATION_MAXAGE)
+    {
+      count = 0;
+      if (opt.homedir)
+        {
+          get_nodename (nodename, sizeof nodename);
+          fname = make_filename (opt.homedir, S2K_CALIBRATION_FILE, NULL);
+          count = read_s2k_calibration (fname, nodename, msec, &count_time);
+          if (count && opt.verbose)
+            log_info ("S2K calibration: using %lu from '%s'\n", count, fname);
+        }
+      if (!count)
+        {
+          count = calibrate_s2k_count (msec);
+          count_time = now;
+          if (fname)
+            write_s2k_calibration (fname, nodename, msec, count);
+        }
+      xfree (fname);
+      count_msec = msec;
+    }
 
   /* Enforce a lower limit.  */
   return count < 65536 ? 65536 : count;
@@ -812,28 +973,29 @@ merge_lists (const unsigned char *protectedkey,
 
 
 
-/* Unprotect the key encoded in canonical format.  We assume a valid
-   S-Exp here.  If a protected-at item is available, its value will
-   be stored at protocted_at unless this is NULL.  */
-int
-agent_unprotect (const unsigned char *protectedkey, const char *passphrase,
-                 gnupg_isotime_t protected_at,
-                 unsigned char **result, size_t *resultlen)
+/* Parse the protected key PROTECTEDKEY encoded in canonical format.
+   On success the start of the "protected" list, the S2K salt and
+   count, the IV and the encrypted data are stored at the provided
+   addresses.  If a protected-at item is available, its value will be
+   stored at PROTECTED_AT unless this is NULL.  */
+static gpg_error_t
+parse_protected_key (const unsigned char *protectedkey,
+                     gnupg_isotime_t protected_at,
+                     const unsigned char **r_prot_begin,
+                     const unsigned char **r_s2ksalt,
+                     unsigned long *r_s2kcount,
+                     const unsigned char **r_iv,
+                     const unsigned char **r_data, size_t *r_datalen)
 {
   int rc;
   const unsigned char *s;
   const unsigned char *protect_list;
   size_t n;
   int infidx, i;
-  unsigned char sha1hash[20], sha1hash2[20];
   const unsigned char *s2ksalt;
   unsigned long s2kcount;
   const unsigned char *iv;
   const unsigned char *prot_begin;
-  unsigned char *cleartext;
-  unsigned char *final;
-  size_t finallen;
-  size_t cutoff, cutlen;
 
   if (protected_at)
     *protected_at = 0;
@@ -974,6 +1136,55 @@ agent_unprotect (const unsigned char *protectedkey, const char *passphrase,
   if (!n)
     return gpg_error (GPG_ERR_INV_SEXP);
 
+  *r_prot_begin = prot_begin;
+  *r_s2ksalt = s2ksalt;
+  *r_s2kcount = s2kcount;
+  *r_iv = iv;
+  *r_data = s;
+  *r_datalen = n;
+  return 0;
+}
+
+
+/* Store the S2K count of the protected key PROTECTEDKEY at R_COUNT.  */
+gpg_error_t
+agent_get_s2k_count (const unsigned char *protectedkey,
+                     unsigned long *r_count)
+{
+  const unsigned char *prot_begin, *s2ksalt, *iv, *data;
+  size_t datalen;
+
+  return parse_protected_key (protectedkey, NULL, &prot_begin, &s2ksalt,
+                              r_count, &iv, &data, &datalen);
+}
+
+
+/* Unprotect the key encoded in canonical format.  We assume a valid
+   S-Exp here.  If a protected-at item is available, its value will
+   be stored at protocted_at unless this is NULL.  */
+int
+agent_unprotect (const unsigned char *protectedkey, const char *passphrase,
+                 gnupg_isotime_t protected_at,
+                 unsigned char **result, size_t *resultlen)
+{
+  int rc;
+  const unsigned char *s;
+  size_t n;
+  unsigned char sha1hash[20], sha1hash2[20];
+  const unsigned char *s2ksalt;
+  unsigned long s2kcount;
+  const unsigned char *iv;
+  const unsigned char *prot_begin;
+  unsigned char *cleartext;
+  unsigned char *final;
+  size_t finallen;
+  size_t cutoff, cutlen;
+
+  rc = parse_protected_key (protectedkey, protected_at, &prot_begin,
+                            &s2ksalt, &s2kcount, &iv, &s, &n);
+  if (rc)
+    return rc;
+
   cleartext = NULL; /* Avoid cc warning. */
   rc = do_decryption (s, n,
                       passphrase, s2ksalt, s2kcount,
@@ -0,0 +1,355 @@
+/* t-cache.c - Module tests for cache.c
+ * Copyright (C) 2012 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <npth.h>
+
+#include "agent.h"
+
+
+#define pass()  do { ; } while(0)
+#define fail()  do { fprintf (stderr, "%s:%d: test failed\n",\
+                              __FILE__,__LINE__);            \
+                     exit (1);                               \
+                   } while(0)
+
+
+/* The faked current time.  */
+static time_t now;
+
+
+/* Advance the faked time by SECS seconds.  */
+static void
+advance (int secs)
+{
+  now += secs;
+  gnupg_set_time (now, 1);
+}
+
+
+/* Return true if the passphrase VALUE is cached under KEY.  */
+static int
+cached_p (const char *key, cache_mode_t mode, const char *value)
+{
+  char *pw;
+  int okay;
+
+  pw = agent_get_cache (key, mode);
+  okay = pw && !strcmp (pw, value);
+  xfree (pw);
+  return okay;
+}
+
+
+/* Return true if the counters of the cache have been changed by the
+   given values since the last call.  */
+static int
+stats_p (int items, int hits, int misses, int expired)
+{
+  static unsigned int last_items;
+  static unsigned long last_hits, last_misses, last_expired;
+  unsigned int n_items;
+  unsigned long n_hits, n_misses, n_expired;
+  int okay;
+
+  agent_cache_stats (&n_items, &n_hits, &n_misses, &n_expired);
+  okay = (n_items - last_items == items
+          && n_hits - last_hits == hits
+          && n_misses - last_misses == misses
+          && n_expired - last_expired == expired);
+  last_items = n_items;
+  last_hits = n_hits;
+  last_misses = n_misses;
+  last_expired = n_expired;
+  return okay;
+}
+
+
+static void
+test_ttl (void)
+{
+  agent_flush_cache ();
+  opt.def_cache_ttl = 600;
+  opt.max_cache_ttl = 7200;
+
+  /* The default TTL is counted from the last access.  */
+  agent_put_cache ("A", CACHE_MODE_NORMAL, "pwA", 0);
+  advance (600);
+  if (!cached_p ("A", CACHE_MODE_NORMAL, "pwA"))
+    fail ();
+  advance (600);
+  if (!cached_p ("A", CACHE_MODE_NORMAL, "pwA"))
+    fail ();
+  advance (601);
+  if (cached_p ("A", CACHE_MODE_NORMAL, "pwA"))
+    fail ();
+
+  /* An explicit TTL.  */
+  agent_put_cache ("B", CACHE_MODE_NORMAL, "pwB", 10);
+  advance (10);
+  if (!cached_p ("B", CACHE_MODE_NORMAL, "pwB"))
+    fail ();
+  advance (11);
+  if (cached_p ("B", CACHE_MODE_NORMAL, "pwB"))
+    fail ();
+
+  /* Replacing an item restarts its TTL.  */
+  agent_put_cache ("C", CACHE_MODE_NORMAL, "pwC", 10);
+  advance (8);
+  agent_put_cache ("C", CACHE_MODE_NORMAL, "pwC2", 10);
+  advance (8);
+  if (!cached_p ("C", CACHE_MODE_NORMAL, "pwC2"))
+    fail ();
+
+  /* Deleting an item.  */
+  agent_put_cache ("C", CACHE_MODE_NORMAL, NULL, 0);
+  if (cached_p ("C", CACHE_MODE_NORMAL, "pwC2"))
+    fail ();
+}
+
+
+static void
+test_max_ttl (void)
+{
+  int i;
+
+  agent_flush_cache ();
+  opt.max_cache_ttl = 1500;
+  opt.max_cache_ttl_ssh = 300;
+
+  /* Accessing an item does not extend its lifetime beyond
+     --max-cache-ttl.  */
+  agent_put_cache ("A", CACHE_MODE_NORMAL, "pwA", 600);
+  for (i=0; i < 3; i++)
+    {
+      advance (500);
+      if (!cached_p ("A", CACHE_MODE_NORMAL, "pwA"))
+        fail ();
+    }
+  advance (1);
+  if (cached_p ("A", CACHE_MODE_NORMAL, "pwA"))
+    fail ();
+
+  /* An infinite TTL is also limited.  */
+  agent_put_cache ("B", CACHE_MODE_NORMAL, "pwB", -1);
+  advance (1500);
+  if (!cached_p ("B", CACHE_MODE_NORMAL, "pwB"))
+    fail ();
+  advance (1);
+  if (cached_p ("B", CACHE_MODE_NORMAL, "pwB"))
+    fail ();
+
+  /* SSH items use --max-cache-ttl-ssh.  */
+  agent_put_cache ("C", CACHE_MODE_SSH, "pwC", -1);
+  advance (300);
+  if (!cached_p ("C", CACHE_MODE_SSH, "pwC"))
+    fail ();
+  advance (1);
+  if (cached_p ("C", CACHE_MODE_SSH, "pwC"))
+    fail ();
+
+  opt.max_cache_ttl = 7200;
+}
+
+
+static void
+test_wheel_wrap (void)
+{
+  char key[50], value[50];
+  int i;
+
+  agent_flush_cache ();
+  stats_p (0, 0, 0, 0);
+
+  /* The TTLs cover more than one turn of the wheel.  */
+  for (i=0; i < 1000; i++)
+    {
+      snprintf (key, sizeof key, "%040d", i);
+      snprintf (value, sizeof value, "pw%d", i);
+      agent_put_cache (key, CACHE_MODE_NORMAL, value, 10 + i % 500);
+    }
+  agent_put_cache ("long", CACHE_MODE_NORMAL, "pwlong", 3000);
+  if (!stats_p (1001, 0, 0, 0))
+    fail ();
+
+  /* Items with a TTL below 300 have expired.  */
+  advance (300);
+  if (!stats_p (-580, 0, 0, 580))
+    fail ();
+
+  /* After being idle for more than a turn of the wheel all items but
+     one have expired.  */
+  advance (1000);
+  if (!stats_p (-420, 0, 0, 420))
+    fail ();
+  if (!cached_p ("long", CACHE_MODE_NORMAL, "pwlong"))
+    fail ();
+  for (i=0; i < 1000; i += 7)
+    {
+      snprintf (key, sizeof key, "%040d", i);
+      snprintf (value, sizeof value, "pw%d", i);
+      if (cached_p (key, CACHE_MODE_NORMAL, value))
+        fail ();
+    }
+  if (!stats_p (0, 1, 143, 0))
+    fail ();
+
+  /* The remaining item expires after another long idle time.  */
+  advance (3001);
+  if (!stats_p (-1, 0, 0, 1))
+    fail ();
+}
+
+
+static void
+test_stats (void)
+{
+  agent_flush_cache ();
+  stats_p (0, 0, 0, 0);
+
+  agent_put_cache ("A", CACHE_MODE_NORMAL, "pwA", 10);
+  agent_put_cache ("N", CACHE_MODE_NONCE, "pwN", 10);
+  if (!stats_p (2, 0, 0, 0))
+    fail ();
+
+  if (!cached_p ("A", CACHE_MODE_NORMAL, "pwA"))
+    fail ();
+  if (!cached_p ("N", CACHE_MODE_NONCE, "pwN"))
+    fail ();
+  if (cached_p ("A", CACHE_MODE_USER, "pwA"))
+    fail ();
+  if (cached_p ("X", CACHE_MODE_NORMAL, "pwX"))
+    fail ();
+  if (cached_p ("A", CACHE_MODE_IGNORE, "pwA"))
+    fail ();
+  if (!stats_p (0, 2, 2, 0))
+    fail ();
+
+  advance (11);
+  if (cached_p ("A", CACHE_MODE_NORMAL, "pwA"))
+    fail ();
+  if (!stats_p (-2, 0, 1, 2))
+    fail ();
+
+  agent_put_cache ("B", CACHE_MODE_NORMAL, "pwB", 10);
+  agent_flush_cache ();
+  if (!stats_p (0, 0, 0, 0))
+    fail ();
+}
+
+
+static void
+test_key_cache (void)
+{
+  gcry_sexp_t s_key;
+  unsigned char *key;
+  size_t keylen;
+  const char *grip = "0123456789ABCDEF0123456789ABCDEF01234567";
+
+  if (gcry_sexp_new (&s_key, "(private-key(rsa(n #00e0ce#)(e #010001#)))",
+                     0, 1))
+    fail ();
+  if (make_canon_sexp (s_key, &key, &keylen))
+    fail ();
+  gcry_sexp_release (s_key);
+
+  agent_flush_cache ();
+  opt.def_cache_ttl = 600;
+  opt.max_cache_ttl = 1000;
+  opt.key_cache_ttl = 300;
+
+  /* Without a cached passphrase the key is not cached.  */
+  agent_put_key_cache (grip, key, 1, 2, 3);
+  if ((s_key = agent_get_key_cache (grip, 1, 2, 3)))
+    fail ();
+
+  agent_put_cache (grip, CACHE_MODE_NORMAL, "pw", 0);
+  agent_put_key_cache (grip, key, 1, 2, 3);
+  if (!(s_key = agent_get_key_cache (grip, 1, 2, 3)))
+    fail ();
+  gcry_sexp_release (s_key);
+
+  /* A changed key file drops the key.  */
+  if ((s_key = agent_get_key_cache (grip, 4, 2, 3)))
+    fail ();
+  if ((s_key = agent_get_key_cache (grip, 1, 2, 3)))
+    fail ();
+
+  /* The key expires after --key-cache-ttl.  */
+  agent_put_key_cache (grip, key, 1, 2, 3);
+  advance (299);
+  if (!(s_key = agent_get_key_cache (grip, 1, 2, 3)))
+    fail ();
+  gcry_sexp_release (s_key);
+  advance (1);
+  if ((s_key = agent_get_key_cache (grip, 1, 2, 3)))
+    fail ();
+  if (!cached_p (grip, CACHE_MODE_NORMAL, "pw"))
+    fail ();
+
+  /* The key is dropped with the passphrase.  */
+  agent_put_key_cache (grip, key, 1, 2, 3);
+  agent_put_cache (grip, CACHE_MODE_NORMAL, NULL, 0);
+  if ((s_key = agent_get_key_cache (grip, 1, 2, 3)))
+    fail ();
+
+  /* The key does not outlive the passphrase.  */
+  opt.key_cache_ttl = 5000;
+  agent_put_cache (grip, CACHE_MODE_NORMAL, "pw", 0);
+  agent_put_key_cache (grip, key, 1, 2, 3);
+  advance (601);
+  if ((s_key = agent_get_key_cache (grip, 1, 2, 3)))
+    fail ();
+
+  agent_put_cache (grip, CACHE_MODE_NORMAL, "pw", -1);
+  agent_put_key_cache (grip, key, 1, 2, 3);
+  advance (1001);
+  if ((s_key = agent_get_key_cache (grip, 1, 2, 3)))
+    fail ();
+
+  opt.key_cache_ttl = 0;
+  xfree (key);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  npth_init ();
+  initialize_module_cache ();
+
+  now = 1000000000;
+  gnupg_set_time (now, 1);
+
+  test_ttl ();
+  test_max_ttl ();
+  test_wheel_wrap ();
+  test_stats ();
+  test_key_cache ();
+
+  agent_flush_cache ();
+  return 0;
+}
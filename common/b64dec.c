@@ -38,27 +38,6 @@
 #include "util.h"
 
 
-/* The reverse base-64 list used for base-64 decoding. */
-static unsigned char const asctobin[128] =
-  {
-    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-    0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
-    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b,
-    0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
-    0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
-    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
-    0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
-    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20,
-    0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
-    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
-    0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff
-  };
-
 enum decoder_states
   {
     s_init, s_idle, s_lfseen, s_begin,
@@ -123,6 +102,21 @@ b64dec_proc (struct b64state *state, void *buffer, size_t length,
 
   for (s=d=buffer; length && !state->stop_seen; length--, s++)
     {
+      if (ds == s_b64_0 && length >= 4)
+        {
+          /* Convert a run of complete groups at once.  */
+          size_t n = radix64_decode_groups (d, s, length);
+
+          if (n)
+            {
+              d += n / 4 * 3;
+              s += n;
+              length -= n;
+              if (!length)
+                break;
+            }
+        }
+
       switch (ds)
         {
         case s_idle:
@@ -169,7 +163,7 @@ b64dec_proc (struct b64state *state, void *buffer, size_t length,
             else if (*s == '\n' || *s == ' ' || *s == '\r' || *s == '\t')
               ; /* Skip white spaces. */
             else if ( (*s & 0x80)
-                      || (c = asctobin[*(unsigned char *)s]) == 255)
+                      || (c = radix64_asctobin[*(unsigned char *)s]) == 255)
               {
                 /* Skip invalid encodings.  */
                 state->invalid_encoding = 1;
@@ -0,0 +1,258 @@
+/* connpool.c - A pool of threads to serve connections
+ * Copyright (C) 2012 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The servers accept a connection in their main loop and then run a
+   handler for it.  Instead of creating a new thread for each
+   connection, the handlers are run by worker threads which wait for
+   the next connection when done.  The number of workers may be
+   limited; further connections are then queued until a worker is
+   available.  A worker which has been idle for CONN_POOL_IDLE_TIMEOUT
+   seconds terminates.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <npth.h>
+
+#include "util.h"
+#include "connpool.h"
+
+/* Seconds after which an idle worker terminates.  */
+#define CONN_POOL_IDLE_TIMEOUT 60
+
+
+/* A connection waiting for a worker.  */
+struct conn_job_s
+{
+  struct conn_job_s *next;
+  conn_pool_handler_t handler;
+  void *arg;
+};
+
+
+struct conn_pool_s
+{
+  npth_mutex_t lock;
+  npth_cond_t cond;          /* Signaled for a new job.  */
+  unsigned int max_threads;  /* Maximum number of workers or 0.  */
+  unsigned int max_queued;   /* Maximum number of queued jobs or 0.  */
+  unsigned int threads;      /* Number of workers.  */
+  unsigned int active;       /* Number of jobs being run.  */
+  unsigned int queued;       /* Number of jobs in the queue.  */
+  struct conn_job_s *head;   /* The queue.  */
+  struct conn_job_s **tail;
+};
+
+
+/* Take the next job from the queue of POOL.  POOL->LOCK must be
+   held.  */
+static struct conn_job_s *
+take_job (conn_pool_t pool)
+{
+  struct conn_job_s *job = pool->head;
+
+  if (job)
+    {
+      pool->head = job->next;
+      if (!pool->head)
+        pool->tail = &pool->head;
+      pool->queued--;
+    }
+  return job;
+}
+
+
+/* The worker thread.  */
+static void *
+worker_thread (void *arg)
+{
+  conn_pool_t pool = arg;
+  struct conn_job_s *job;
+  struct timespec abstime;
+  int err;
+
+  npth_mutex_lock (&pool->lock);
+  for (;;)
+    {
+      while (!(job = take_job (pool)))
+        {
+          npth_clock_gettime (&abstime);
+          abstime.tv_sec += CONN_POOL_IDLE_TIMEOUT;
+          err = npth_cond_timedwait (&pool->cond, &pool->lock, &abstime);
+          if (err == ETIMEDOUT && !pool->head)
+            {
+              pool->threads--;
+              npth_mutex_unlock (&pool->lock);
+              return NULL;
+            }
+        }
+      pool->active++;
+      npth_mutex_unlock (&pool->lock);
+
+      job->handler (job->arg);
+      xfree (job);
+
+      npth_mutex_lock (&pool->lock);
+      pool->active--;
+    }
+}
+
+
+/* Create a new pool with at most MAX_THREADS workers and return it at
+   R_POOL.  If all workers are busy, up to MAX_QUEUED connections are
+   queued.  A value of 0 does not limit the number.  */
+gpg_error_t
+conn_pool_new (conn_pool_t *r_pool,
+               unsigned int max_threads, unsigned int max_queued)
+{
+  conn_pool_t pool;
+  int err;
+
+  *r_pool = NULL;
+  pool = xtrycalloc (1, sizeof *pool);
+  if (!pool)
+    return gpg_error_from_syserror ();
+  err = npth_mutex_init (&pool->lock, NULL);
+  if (!err)
+    {
+      err = npth_cond_init (&pool->cond, NULL);
+      if (err)
+        npth_mutex_destroy (&pool->lock);
+    }
+  if (err)
+    {
+      xfree (pool);
+      return gpg_error_from_errno (err);
+    }
+  pool->max_threads = max_threads;
+  pool->max_queued = max_queued;
+  pool->tail = &pool->head;
+  *r_pool = pool;
+  return 0;
+}
+
+
+/* Run HANDLER with ARG by a worker of POOL.  Returns
+   GPG_ERR_EAGAIN if the connection can't be queued.  On error the
+   caller needs to close the connection.  */
+gpg_error_t
+conn_pool_submit (conn_pool_t pool, conn_pool_handler_t handler, void *arg)
+{
+  struct conn_job_s *job;
+  gpg_error_t err = 0;
+  npth_attr_t tattr;
+  npth_t thread;
+  unsigned int idle;
+  int ret;
+
+  job = xtrycalloc (1, sizeof *job);
+  if (!job)
+    return gpg_error_from_syserror ();
+  job->handler = handler;
+  job->arg = arg;
+
+  npth_mutex_lock (&pool->lock);
+  /* Workers which are not running a job will take a queued job.  */
+  idle = pool->threads - pool->active;
+  if (pool->max_threads && pool->threads >= pool->max_threads
+      && pool->max_queued && pool->queued >= idle + pool->max_queued)
+    {
+      npth_mutex_unlock (&pool->lock);
+      xfree (job);
+      return gpg_error (GPG_ERR_EAGAIN);
+    }
+
+  *pool->tail = job;
+  pool->tail = &job->next;
+  pool->queued++;
+
+  if (pool->queued > idle
+      && (!pool->max_threads || pool->threads < pool->max_threads))
+    {
+      npth_attr_init (&tattr);
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+      ret = npth_create (&thread, &tattr, worker_thread, pool);
+      npth_attr_destroy (&tattr);
+      if (ret)
+        {
+          err = gpg_error_from_errno (ret);
+          log_error ("error spawning connection worker: %s\n",
+                     strerror (ret));
+        }
+      else
+        pool->threads++;
+    }
+
+  if (err && !pool->threads)
+    {
+      /* Nobody will ever take the job.  Remove it again.  */
+      struct conn_job_s **jp;
+
+      for (jp = &pool->head; *jp != job; jp = &(*jp)->next)
+        ;
+      *jp = NULL;
+      pool->tail = jp;
+      pool->queued--;
+      xfree (job);
+    }
+  else
+    {
+      err = 0;
+      npth_cond_signal (&pool->cond);
+    }
+  npth_mutex_unlock (&pool->lock);
+  return err;
+}
+
+
+/* Store the number of connections being served, the number of queued
+   connections and the number of workers of POOL.  */
+void
+conn_pool_stats (conn_pool_t pool, unsigned int *r_active,
+                 unsigned int *r_queued, unsigned int *r_threads)
+{
+  npth_mutex_lock (&pool->lock);
+  *r_active = pool->active;
+  *r_queued = pool->queued;
+  *r_threads = pool->threads;
+  npth_mutex_unlock (&pool->lock);
+}
+
+
+/* Return the number of connections which are served or queued.  */
+unsigned int
+conn_pool_count (conn_pool_t pool)
+{
+  unsigned int n;
+
+  npth_mutex_lock (&pool->lock);
+  n = pool->active + pool->queued;
+  npth_mutex_unlock (&pool->lock);
+  return n;
+}
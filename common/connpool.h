@@ -0,0 +1,50 @@
+/* connpool.h - Definitions for the connection thread pool
+ * Copyright (C) 2012 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GNUPG_COMMON_CONNPOOL_H
+#define GNUPG_COMMON_CONNPOOL_H
+
+struct conn_pool_s;
+typedef struct conn_pool_s *conn_pool_t;
+
+/* The function run for a connection.  This has the same signature
+   as a thread function so that existing connection threads can be
+   used unchanged.  The return value is ignored.  */
+typedef void *(*conn_pool_handler_t) (void *arg);
+
+gpg_error_t conn_pool_new (conn_pool_t *r_pool,
+                           unsigned int max_threads, unsigned int max_queued);
+gpg_error_t conn_pool_submit (conn_pool_t pool,
+                              conn_pool_handler_t handler, void *arg);
+void conn_pool_stats (conn_pool_t pool, unsigned int *r_active,
+                      unsigned int *r_queued, unsigned int *r_threads);
+unsigned int conn_pool_count (conn_pool_t pool);
+
+
+#endif /*GNUPG_COMMON_CONNPOOL_H*/
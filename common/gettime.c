@@ -106,7 +106,7 @@ gnupg_set_time (time_t newtime, int freeze)
 {
   time_t current = time (NULL);
 
-  if ( newtime == (time_t)-1 || current == newtime)
+  if ( newtime == (time_t)-1 || (!freeze && current == newtime))
     {
       timemode = NORMAL;
       timewarp = 0;
@@ -114,7 +114,7 @@ gnupg_set_time (time_t newtime, int freeze)
   else if (freeze)
     {
       timemode = FROZEN;
-      timewarp = current;
+      timewarp = newtime;
     }
   else if (newtime > current)
     {
@@ -42,6 +42,12 @@
 #ifdef HAVE_W32_SYSTEM
 # include <windows.h>
 #endif
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+# include <signal.h>
+# include <setjmp.h>
+# define USE_IOBUF_MMAP 1
+#endif
 #ifdef __riscos__
 # include <kernel.h>
 # include <swis.h>
@@ -55,11 +61,27 @@
 
 /*-- Begin configurable part.  --*/
 
-/* The size of the internal buffers.
+/* The default size of the internal buffers.  It may be changed at
+   runtime using iobuf_set_buffer_size; temporary iobufs always
+   start with this size.
    NOTE: If you change this value you MUST also adjust the regression
    test "armored_key_8192" in armor.test! */
 #define IOBUF_BUFFER_SIZE  8192
 
+/* The limits for iobuf_set_buffer_size in kilobytes.  */
+#define IOBUF_MIN_BUFFER_KB  4
+#define IOBUF_MAX_BUFFER_KB  (16*1024)
+
+/* Regular files opened for reading with at least this size are read
+   using mmap.  */
+#define IOBUF_MMAP_MIN_SIZE  (64*1024)
+
+/* The maximum size of the mapped window of a file.  We use a smaller
+   window if the address space is small so that files larger than
+   the address space can be read.  */
+#define IOBUF_MMAP_WINDOW    (sizeof (void*) > 4? (1024*1024*1024) \
+                                                : (64*1024*1024))
+
 /*-- End configurable part.  --*/
 
 
@@ -85,6 +107,12 @@ typedef struct
   int no_cache;
   int eof_seen;
   int print_only_name; /* Flags indicating that fname is not a real file.  */
+  int use_map;         /* The file is read using mmap.  */
+  byte *map;           /* The currently mapped window or NULL.  */
+  off_t map_off;       /* File offset of the window.  */
+  size_t map_len;      /* Length of the window.  */
+  off_t map_pos;       /* File offset of the next byte to read.  */
+  off_t map_end;       /* Size of the file when it was opened.  */
   char fname[1];       /* Name of the file.  */
 } file_filter_ctx_t;
 
@@ -130,6 +158,8 @@ typedef struct
  * for all chunks (but the last one) */
 #define OP_MIN_PARTIAL_CHUNK	  512
 #define OP_MIN_PARTIAL_CHUNK_2POW 9
+/* The largest partial length is 2^30; 0xff is the 5 octet length.  */
+#define OP_MAX_PARTIAL_CHUNK_2POW 30
 
 /* The context we use for the block filter (used to handle OpenPGP
    length information header).  */
@@ -152,6 +182,14 @@ block_filter_ctx_t;
    belong into the iobuf subsystem. */
 static int special_names_enabled;
 
+/* The size of the buffers allocated for new iobufs.  */
+static size_t iobuf_buffer_size = IOBUF_BUFFER_SIZE;
+
+/* Functions called before and after a read or write system call
+   which may block.  See iobuf_set_syscall_clamp.  */
+static void (*syscall_clamp_pre) (void);
+static void (*syscall_clamp_post) (void);
+
 /* Local prototypes.  */
 static int underflow (iobuf_t a);
 static int translate_file_handle (int fd, int for_write);
@@ -418,6 +456,160 @@ fd_cache_open (const char *fname, const char *mode)
 }
 
 
+#ifdef USE_IOBUF_MMAP
+/* If another process truncates a mapped file, accessing the pages
+   beyond the new end raises SIGBUS.  The handler jumps back to the
+   copy in file_filter_map_copy; the copies are done with the nPth
+   lock held and thus a single jump buffer is sufficient.  */
+static sigjmp_buf map_jmpbuf;
+static volatile sig_atomic_t map_jmpbuf_valid;
+static struct sigaction old_sigbus_action;
+
+static void
+map_sigbus_handler (int signo)
+{
+  (void)signo;
+
+  if (map_jmpbuf_valid)
+    siglongjmp (map_jmpbuf, 1);
+
+  /* Not our fault; restore the old action so that it is taken when
+     the faulting access is repeated.  */
+  sigaction (SIGBUS, &old_sigbus_action, NULL);
+}
+
+
+/* Install the SIGBUS handler.  Returns true on success.  */
+static int
+install_sigbus_handler (void)
+{
+  static int installed;
+  struct sigaction sa;
+
+  if (!installed)
+    {
+      memset (&sa, 0, sizeof sa);
+      sa.sa_handler = map_sigbus_handler;
+      sigemptyset (&sa.sa_mask);
+      sa.sa_flags = SA_NODEFER;
+      if (!sigaction (SIGBUS, &sa, &old_sigbus_action))
+        installed = 1;
+    }
+  return installed;
+}
+#endif /*USE_IOBUF_MMAP*/
+
+
+/* Setup FCX to read the file using mmap if it is a regular file of
+   sufficient size.  Reading starts at the current file position.  */
+static void
+file_filter_setup_map (file_filter_ctx_t *fcx)
+{
+#ifdef USE_IOBUF_MMAP
+  struct stat st;
+  off_t pos;
+
+  if (fstat (fcx->fp, &st) || !S_ISREG (st.st_mode)
+      || st.st_size < IOBUF_MMAP_MIN_SIZE)
+    return;
+  if (!install_sigbus_handler ())
+    return;
+  pos = lseek (fcx->fp, 0, SEEK_CUR);
+  if (pos == (off_t)(-1) || pos >= st.st_size)
+    return;
+
+  fcx->map_pos = pos;
+  fcx->map_end = st.st_size;
+  fcx->use_map = 1;
+#else
+  (void)fcx;
+#endif
+}
+
+
+/* Release the mapping of FCX and set the file position to the next
+   byte to read so that reading continues with read(2).  */
+static void
+file_filter_unmap (file_filter_ctx_t *fcx)
+{
+#ifdef USE_IOBUF_MMAP
+  if (!fcx->use_map)
+    return;
+  if (fcx->map)
+    munmap (fcx->map, fcx->map_len);
+  fcx->map = NULL;
+  fcx->use_map = 0;
+  if (lseek (fcx->fp, fcx->map_pos, SEEK_SET) == (off_t)(-1))
+    log_error ("%s: lseek failed: %s\n", fcx->fname, strerror (errno));
+#else
+  (void)fcx;
+#endif
+}
+
+
+#ifdef USE_IOBUF_MMAP
+/* Make sure that the window of FCX covers the next byte to read and
+   return the number of bytes available there.  Returns 0 at the end
+   of the mapped range or if the file could not be mapped.  */
+static size_t
+file_filter_map_window (file_filter_ctx_t *fcx)
+{
+  static long pagesize;
+  off_t off;
+  size_t len;
+  void *p;
+
+  if (fcx->map_pos >= fcx->map_end)
+    return 0;
+  if (fcx->map && fcx->map_pos >= fcx->map_off
+      && fcx->map_pos < fcx->map_off + (off_t)fcx->map_len)
+    return fcx->map_off + fcx->map_len - fcx->map_pos;
+
+  if (!pagesize)
+    pagesize = sysconf (_SC_PAGESIZE);
+  if (fcx->map)
+    munmap (fcx->map, fcx->map_len);
+  fcx->map = NULL;
+
+  off = fcx->map_pos - (fcx->map_pos % pagesize);
+  len = IOBUF_MMAP_WINDOW;
+  if (fcx->map_end - off < (off_t)len)
+    len = fcx->map_end - off;
+  p = mmap (NULL, len, PROT_READ, MAP_PRIVATE, fcx->fp, off);
+  if (p == MAP_FAILED)
+    {
+      if (DBG_IOBUF)
+        log_debug ("%s: mmap failed: %s\n", fcx->fname, strerror (errno));
+      return 0;
+    }
+#ifdef MADV_SEQUENTIAL
+  madvise (p, len, MADV_SEQUENTIAL);
+#endif
+  fcx->map = p;
+  fcx->map_off = off;
+  fcx->map_len = len;
+  return fcx->map_off + fcx->map_len - fcx->map_pos;
+}
+
+
+/* Copy N bytes at the read position of FCX to BUF.  Returns false if
+   the file has been truncated below the read position.  */
+static int
+file_filter_map_copy (file_filter_ctx_t *fcx, byte *buf, size_t n)
+{
+  if (sigsetjmp (map_jmpbuf, 0))
+    {
+      map_jmpbuf_valid = 0;
+      return 0;
+    }
+  map_jmpbuf_valid = 1;
+  memcpy (buf, fcx->map + (fcx->map_pos - fcx->map_off), n);
+  map_jmpbuf_valid = 0;
+  return 1;
+}
+#endif /*USE_IOBUF_MMAP*/
+
+
 /****************
  * Read data from a file into buf which has an allocated length of *LEN.
  * return the number of read bytes in *LEN. OPAQUE is the FILE * of
@@ -437,7 +629,9 @@ fd_cache_open (const char *fname, const char *mode)
  *		    GPG_ERR_xxxxx for other errors.
  *
  * IOBUFCTRL_FLUSH: called by iobuf_flush() to write out the collected stuff.
- *		    *RET_LAN is the number of bytes in BUF.
+ *		    *RET_LAN is the number of bytes in BUF.  The filter
+ *		    must not modify BUF because it may be the buffer
+ *		    of the caller of iobuf_write.
  *
  * IOBUFCTRL_CANCEL: send to all filters on behalf of iobuf_cancel.  The
  *		    filter may take appropriate action on this message.
@@ -492,11 +686,37 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
 	  int n;
 
 	  nbytes = 0;
+#ifdef USE_IOBUF_MMAP
+	  if (a->use_map)
+	    {
+	      size_t avail = file_filter_map_window (a);
+
+	      if (avail)
+		{
+		  nbytes = avail < size? avail : size;
+		  if (file_filter_map_copy (a, buf, nbytes))
+		    {
+		      a->map_pos += nbytes;
+		      *ret_len = nbytes;
+		      return 0;
+		    }
+		  log_info ("%s: file shrunk while reading\n", a->fname);
+		  nbytes = 0;
+		}
+	      /* Continue with read(2) so that data appended to the
+		 file after it has been opened is not lost.  */
+	      file_filter_unmap (a);
+	    }
+#endif /*USE_IOBUF_MMAP*/
+	  if (syscall_clamp_pre)
+	    syscall_clamp_pre ();
 	  do
 	    {
 	      n = read (f, buf, size);
 	    }
 	  while (n == -1 && errno == EINTR);
+	  if (syscall_clamp_post)
+	    syscall_clamp_post ();
 	  if (n == -1)
 	    {			/* error */
 	      if (errno != EPIPE)
@@ -547,6 +767,8 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
 	  int n;
 
 	  nbytes = size;
+	  if (syscall_clamp_pre)
+	    syscall_clamp_pre ();
 	  do
 	    {
 	      do
@@ -561,6 +783,8 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
 		}
 	    }
 	  while (n != -1 && nbytes);
+	  if (syscall_clamp_post)
+	    syscall_clamp_post ();
 	  if (n == -1)
 	    {
 	      rc = gpg_error_from_syserror ();
@@ -576,6 +800,8 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
       a->eof_seen = 0;
       a->keep_open = 0;
       a->no_cache = 0;
+      a->use_map = 0;
+      a->map = NULL;
     }
   else if (control == IOBUFCTRL_DESC)
     {
@@ -583,6 +809,7 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
     }
   else if (control == IOBUFCTRL_FREE)
     {
+      file_filter_unmap (a);
       if (f != FD_FOR_STDIN && f != FD_FOR_STDOUT)
 	{
 	  if (DBG_IOBUF)
@@ -921,7 +1148,7 @@ block_filter (void *opaque, int control, iobuf_t chain, byte * buffer,
 	{			/* the complicated openpgp scheme */
 	  size_t blen, n, nbytes = size + a->buflen;
 
-	  assert (a->buflen <= OP_MIN_PARTIAL_CHUNK);
+	  assert (a->buflen < OP_MIN_PARTIAL_CHUNK);
 	  if (nbytes < OP_MIN_PARTIAL_CHUNK)
 	    {
 	      /* not enough to write a partial block out; so we store it */
@@ -939,29 +1166,30 @@ block_filter (void *opaque, int control, iobuf_t chain, byte * buffer,
 		  /* find the best matching block length - this is limited
 		   * by the size of the internal buffering */
 		  for (blen = OP_MIN_PARTIAL_CHUNK * 2,
-		       c = OP_MIN_PARTIAL_CHUNK_2POW + 1; blen <= nbytes;
+		       c = OP_MIN_PARTIAL_CHUNK_2POW + 1;
+		       blen <= nbytes && c <= OP_MAX_PARTIAL_CHUNK_2POW;
 		       blen *= 2, c++)
 		    ;
 		  blen /= 2;
 		  c--;
 		  /* write the partial length header */
-		  assert (c <= 0x1f);	/*;-) */
+		  assert (c <= OP_MAX_PARTIAL_CHUNK_2POW);
 		  c |= 0xe0;
 		  iobuf_put (chain, c);
 		  if ((n = a->buflen))
 		    {		/* write stuff from the buffer */
-		      assert (n == OP_MIN_PARTIAL_CHUNK);
 		      if (iobuf_write (chain, a->buffer, n))
 			rc = gpg_error_from_syserror ();
 		      a->buflen = 0;
-		      nbytes -= n;
 		    }
-		  if ((n = nbytes) > blen)
-		    n = blen;
-		  if (n && iobuf_write (chain, p, n))
+		  /* and fill up the block with the new data; BUF may
+		   * have any size because iobuf_write passes large
+		   * buffers of the caller directly to us */
+		  n = blen - n;
+		  if (iobuf_write (chain, p, n))
 		    rc = gpg_error_from_syserror ();
 		  p += n;
-		  nbytes -= n;
+		  nbytes -= blen;
 		}
 	      while (!rc && nbytes >= OP_MIN_PARTIAL_CHUNK);
 	      /* store the rest in the buffer */
@@ -1109,6 +1337,43 @@ iobuf_alloc (int use, size_t bufsize)
   return a;
 }
 
+
+/* Set the size of the buffers used for new iobufs to KILOBYTE
+   kilobytes.  The value is clamped to a sensible range.  Temporary
+   iobufs are not affected.  */
+void
+iobuf_set_buffer_size (unsigned int kilobyte)
+{
+  if (kilobyte < IOBUF_MIN_BUFFER_KB)
+    kilobyte = IOBUF_MIN_BUFFER_KB;
+  else if (kilobyte > IOBUF_MAX_BUFFER_KB)
+    kilobyte = IOBUF_MAX_BUFFER_KB;
+  iobuf_buffer_size = kilobyte * 1024;
+}
+
+
+/* Return the size in bytes of the buffers used for new iobufs.
+   Filters use this to size their own buffers accordingly.  */
+unsigned int
+iobuf_get_buffer_size (void)
+{
+  return iobuf_buffer_size;
+}
+
+
+/* Register PRE and POST to be called before and after the read and
+   write system calls on file descriptors.  A threaded application
+   uses this to let other threads run while the I/O blocks; the
+   functions are called with only the file descriptor being accessed,
+   thus the file filter may not log or touch any other shared state
+   between them.  Passing NULL for both disables this.  */
+void
+iobuf_set_syscall_clamp (void (*pre)(void), void (*post)(void))
+{
+  syscall_clamp_pre = pre;
+  syscall_clamp_post = post;
+}
+
 int
 iobuf_close (iobuf_t a)
 {
@@ -1210,6 +1475,8 @@ iobuf_temp ()
 {
   iobuf_t a;
 
+  /* Temporary iobufs are often used for small objects and grow as
+     needed, thus they always start with the default size.  */
   a = iobuf_alloc (3, IOBUF_BUFFER_SIZE);
 
   return a;
@@ -1306,7 +1573,7 @@ iobuf_open (const char *fname)
     return iobuf_fdopen (translate_file_handle (fd, 0), "rb");
   else if ((fp = fd_cache_open (fname, "rb")) == GNUPG_INVALID_FD)
     return NULL;
-  a = iobuf_alloc (1, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (1, iobuf_buffer_size);
   fcx = xmalloc (sizeof *fcx + strlen (fname));
   fcx->fp = fp;
   fcx->print_only_name = print_only;
@@ -1317,6 +1584,7 @@ iobuf_open (const char *fname)
   a->filter_ov = fcx;
   file_filter (fcx, IOBUFCTRL_DESC, NULL, (byte *) & a->desc, &len);
   file_filter (fcx, IOBUFCTRL_INIT, NULL, NULL, &len);
+  file_filter_setup_map (fcx);
   if (DBG_IOBUF)
     log_debug ("iobuf-%d.%d: open '%s' fd=%d\n",
 	       a->no, a->subno, fname, FD2INT (fcx->fp));
@@ -1335,7 +1603,7 @@ do_iobuf_fdopen (int fd, const char *mode, int keep_open)
 
   fp = INT2FD (fd);
 
-  a = iobuf_alloc (strchr (mode, 'w') ? 2 : 1, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (strchr (mode, 'w') ? 2 : 1, iobuf_buffer_size);
   fcx = xmalloc (sizeof *fcx + 20);
   fcx->fp = fp;
   fcx->print_only_name = 1;
@@ -1345,6 +1613,8 @@ do_iobuf_fdopen (int fd, const char *mode, int keep_open)
   a->filter_ov = fcx;
   file_filter (fcx, IOBUFCTRL_DESC, NULL, (byte *) & a->desc, &len);
   file_filter (fcx, IOBUFCTRL_INIT, NULL, NULL, &len);
+  if (a->use == 1)
+    file_filter_setup_map (fcx);
   if (DBG_IOBUF)
     log_debug ("iobuf-%d.%d: fdopen%s '%s'\n",
                a->no, a->subno, keep_open? "_nc":"", fcx->fname);
@@ -1375,7 +1645,7 @@ iobuf_esopen (estream_t estream, const char *mode, int keep_open)
   file_es_filter_ctx_t *fcx;
   size_t len;
 
-  a = iobuf_alloc (strchr (mode, 'w') ? 2 : 1, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (strchr (mode, 'w') ? 2 : 1, iobuf_buffer_size);
   fcx = xtrymalloc (sizeof *fcx + 30);
   fcx->fp = estream;
   fcx->print_only_name = 1;
@@ -1400,7 +1670,7 @@ iobuf_sockopen (int fd, const char *mode)
   sock_filter_ctx_t *scx;
   size_t len;
 
-  a = iobuf_alloc (strchr (mode, 'w') ? 2 : 1, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (strchr (mode, 'w') ? 2 : 1, iobuf_buffer_size);
   scx = xmalloc (sizeof *scx + 25);
   scx->sock = fd;
   scx->print_only_name = 1;
@@ -1441,7 +1711,7 @@ iobuf_create (const char *fname)
     return iobuf_fdopen (translate_file_handle (fd, 1), "wb");
   else if ((fp = direct_open (fname, "wb")) == GNUPG_INVALID_FD)
     return NULL;
-  a = iobuf_alloc (2, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (2, iobuf_buffer_size);
   fcx = xmalloc (sizeof *fcx + strlen (fname));
   fcx->fp = fp;
   fcx->print_only_name = print_only;
@@ -1472,7 +1742,7 @@ iobuf_openrw (const char *fname)
     return NULL;
   else if ((fp = direct_open (fname, "r+b")) == GNUPG_INVALID_FD)
     return NULL;
-  a = iobuf_alloc (2, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (2, iobuf_buffer_size);
   fcx = xmalloc (sizeof *fcx + strlen (fname));
   fcx->fp = fp;
   strcpy (fcx->fname, fname);
@@ -1621,7 +1891,9 @@ iobuf_push_filter2 (iobuf_t a,
   if (a->use == 2)
     {				/* allocate a fresh buffer for the
                                    original stream */
-      b->d.buf = xmalloc (a->d.size);
+      if (b->use == 3)
+        b->d.size = IOBUF_BUFFER_SIZE; /* A temp stream grows as needed. */
+      b->d.buf = xmalloc (b->d.size);
       b->d.len = 0;
       b->d.start = 0;
     }
@@ -1745,6 +2017,66 @@ pop_filter (iobuf_t a, int (*f) (void *opaque, int control,
 }
 
 
+/* Ask the filter of the input iobuf A for up to *R_LEN bytes which
+   are stored at BUF and set *R_LEN to the number of bytes actually
+   read.  BUF is either the buffer of A or, for large reads, the
+   buffer of the caller.  On EOF the filter is released; if it did
+   not return any data the iobuf is popped so that the caller sees
+   one(!) EOF.  A returned length of 0 indicates EOF or an error.  */
+static void
+filter_underflow (iobuf_t a, byte *buf, size_t *r_len)
+{
+  size_t len = *r_len;
+  int rc;
+
+  if (DBG_IOBUF)
+    log_debug ("iobuf-%d.%d: underflow: req=%lu\n",
+               a->no, a->subno, (ulong) len);
+  rc = a->filter (a->filter_ov, IOBUFCTRL_UNDERFLOW, a->chain, buf, &len);
+  if (DBG_IOBUF)
+    {
+      log_debug ("iobuf-%d.%d: underflow: got=%lu rc=%d\n",
+                 a->no, a->subno, (ulong) len, rc);
+/*  	    if( a->no == 1 ) */
+/*                   log_hexdump ("     data:", buf, len); */
+    }
+  if (a->use == 1 && rc == -1)
+    {			/* EOF: we can remove the filter */
+      size_t dummy_len = 0;
+
+      /* and tell the filter to free itself */
+      if ((rc = a->filter (a->filter_ov, IOBUFCTRL_FREE, a->chain,
+                           NULL, &dummy_len)))
+        log_error ("IOBUFCTRL_FREE failed: %s\n", gpg_strerror (rc));
+      if (a->filter_ov && a->filter_ov_owner)
+        {
+          xfree (a->filter_ov);
+          a->filter_ov = NULL;
+        }
+      a->filter = NULL;
+      a->desc = NULL;
+      a->filter_ov = NULL;
+      a->filter_eof = 1;
+      if (!len && a->chain)
+        {
+          iobuf_t b = a->chain;
+          if (DBG_IOBUF)
+            log_debug ("iobuf-%d.%d: pop in underflow (!len)\n",
+                       a->no, a->subno);
+          xfree (a->d.buf);
+          xfree (a->real_fname);
+          memcpy (a, b, sizeof *a);
+          xfree (b);
+          print_chain (a);
+        }
+    }
+  else if (rc)
+    a->error = rc;
+
+  *r_len = len;
+}
+
+
 /****************
  * read underflow: read more bytes into the buffer and return
  * the first byte or -1 on EOF.
@@ -1753,7 +2085,6 @@ static int
 underflow (iobuf_t a)
 {
   size_t len;
-  int rc;
 
   assert (a->d.start == a->d.len);
   if (a->use == 3)
@@ -1806,51 +2137,7 @@ underflow (iobuf_t a)
   if (a->filter)
     {
       len = a->d.size;
-      if (DBG_IOBUF)
-	log_debug ("iobuf-%d.%d: underflow: req=%lu\n",
-		   a->no, a->subno, (ulong) len);
-      rc = a->filter (a->filter_ov, IOBUFCTRL_UNDERFLOW, a->chain,
-		      a->d.buf, &len);
-      if (DBG_IOBUF)
-	{
-	  log_debug ("iobuf-%d.%d: underflow: got=%lu rc=%d\n",
-		     a->no, a->subno, (ulong) len, rc);
-/*  	    if( a->no == 1 ) */
-/*                   log_hexdump ("     data:", a->d.buf, len); */
-	}
-      if (a->use == 1 && rc == -1)
-	{			/* EOF: we can remove the filter */
-	  size_t dummy_len = 0;
-
-	  /* and tell the filter to free itself */
-	  if ((rc = a->filter (a->filter_ov, IOBUFCTRL_FREE, a->chain,
-			       NULL, &dummy_len)))
-	    log_error ("IOBUFCTRL_FREE failed: %s\n", gpg_strerror (rc));
-	  if (a->filter_ov && a->filter_ov_owner)
-	    {
-	      xfree (a->filter_ov);
-	      a->filter_ov = NULL;
-	    }
-	  a->filter = NULL;
-	  a->desc = NULL;
-	  a->filter_ov = NULL;
-	  a->filter_eof = 1;
-	  if (!len && a->chain)
-	    {
-	      iobuf_t b = a->chain;
-	      if (DBG_IOBUF)
-		log_debug ("iobuf-%d.%d: pop in underflow (!len)\n",
-			   a->no, a->subno);
-	      xfree (a->d.buf);
-	      xfree (a->real_fname);
-	      memcpy (a, b, sizeof *a);
-	      xfree (b);
-	      print_chain (a);
-	    }
-	}
-      else if (rc)
-	a->error = rc;
-
+      filter_underflow (a, a->d.buf, &len);
       if (!len)
 	{
 	  if (DBG_IOBUF)
@@ -1977,7 +2264,25 @@ iobuf_read (iobuf_t a, void *buffer, unsigned int buflen)
 	  if (buf)
 	    buf += size;
 	}
-      if (n < buflen)
+      if (n < buflen && buf && buflen - n >= a->d.size
+          && a->use == 1 && a->filter && !a->filter_eof && !a->error
+          && !a->directfp)
+	{
+          /* The buffer is empty and the caller wants at least a
+             buffer full: Let the filter store the data directly in
+             the caller's buffer.  */
+          size_t len = buflen - n;
+
+          filter_underflow (a, buf, &len);
+          if (!len)
+            {
+	      a->nbytes += n;
+	      return n ? n : -1 /*EOF*/;
+            }
+          n += len;
+          buf += len;
+	}
+      else if (n < buflen)
 	{
 	  if ((c = underflow (a)) == -1)
 	    {
@@ -1996,6 +2301,48 @@ iobuf_read (iobuf_t a, void *buffer, unsigned int buflen)
 
 
 
+/* Return a pointer to the next up to MAXLEN bytes of A and consume
+   them.  The number of bytes is stored at R_LEN; NULL is returned on
+   EOF.  The pointer points into the buffer of A and thus saves the
+   copy done by iobuf_read.  It never points into a memory mapped file,
+   because only file_filter_map_copy is guarded against a truncation
+   of the file.  The data is only valid until the next operation on
+   A.  */
+const void *
+iobuf_get_span (iobuf_t a, size_t maxlen, size_t *r_len)
+{
+  const byte *p;
+  size_t len;
+
+  *r_len = 0;
+  if (a->nlimit)
+    {
+      if (a->nbytes >= a->nlimit)
+        return NULL;  /* Forced EOF.  */
+      if (maxlen > a->nlimit - a->nbytes)
+        maxlen = a->nlimit - a->nbytes;
+    }
+  if (!maxlen)
+    return NULL;
+
+  if (a->d.start == a->d.len)
+    {
+      if (underflow (a) == -1)
+        return NULL;
+      /* Unget the byte returned by underflow.  */
+      a->d.start--;
+    }
+  len = a->d.len - a->d.start;
+  if (len > maxlen)
+    len = maxlen;
+  p = a->d.buf + a->d.start;
+  a->d.start += len;
+  a->nbytes += len;
+  *r_len = len;
+  return p;
+}
+
+
 /****************
  * Have a look at the iobuf.
  * NOTE: This only works in special cases.
@@ -2054,7 +2401,27 @@ iobuf_write (iobuf_t a, const void *buffer, unsigned int buflen)
 
   do
     {
-      if (buflen && a->d.len < a->d.size)
+      if (buflen >= a->d.size && !a->d.len && a->use == 2 && a->filter)
+	{
+          /* Nothing is buffered and the caller has at least a buffer
+             full: Pass the caller's buffer directly to the filter.  */
+	  size_t len = buflen;
+
+	  rc = a->filter (a->filter_ov, IOBUFCTRL_FLUSH, a->chain,
+                          (byte *)buf, &len);
+	  if (!rc && len != buflen)
+	    {
+	      log_info ("iobuf_write did not write all!\n");
+	      rc = GPG_ERR_INTERNAL;
+	    }
+	  else if (rc)
+	    a->error = rc;
+	  if (rc)
+	    return rc;
+	  buf += buflen;
+	  buflen = 0;
+	}
+      else if (buflen && a->d.len < a->d.size)
 	{
 	  unsigned size = a->d.size - a->d.len;
 	  if (size > buflen)
@@ -2336,6 +2703,8 @@ iobuf_seek (iobuf_t a, off_t newpos)
 	  log_error ("can't lseek: %s\n", strerror (errno));
 	  return -1;
 	}
+      if (b->use_map)
+        b->map_pos = newpos;
 #endif
     }
   a->d.len = 0;			/* discard buffer */
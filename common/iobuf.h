@@ -106,6 +106,9 @@ EXTERN_UNLESS_MAIN_MODULE int iobuf_debug_mode;
 void iobuf_enable_special_filenames (int yes);
 int  iobuf_is_pipe_filename (const char *fname);
 iobuf_t iobuf_alloc (int use, size_t bufsize);
+void iobuf_set_buffer_size (unsigned int kilobyte);
+unsigned int iobuf_get_buffer_size (void);
+void iobuf_set_syscall_clamp (void (*pre)(void), void (*post)(void));
 iobuf_t iobuf_temp (void);
 iobuf_t iobuf_temp_with_content (const char *buffer, size_t length);
 iobuf_t iobuf_open_fd_or_name (gnupg_fd_t fd, const char *fname,
@@ -141,6 +144,7 @@ int iobuf_seek (iobuf_t a, off_t newpos);
 
 int iobuf_readbyte (iobuf_t a);
 int iobuf_read (iobuf_t a, void *buf, unsigned buflen);
+const void *iobuf_get_span (iobuf_t a, size_t maxlen, size_t *r_len);
 void iobuf_unread (iobuf_t a, const unsigned char *buf, unsigned int buflen);
 unsigned iobuf_read_line (iobuf_t a, byte ** addr_of_buffer,
 			  unsigned *length_of_buffer, unsigned *max_length);
@@ -0,0 +1,396 @@
+/* radix64.c - Base64 and CRC24 primitives
+ * Copyright (C) 1998, 1999, 2000, 2001, 2002, 2003, 2004, 2005, 2006,
+ *               2007, 2008, 2010, 2011 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This module provides the inner loops used by all the base64 coders
+   in GnuPG: the OpenPGP armor filter, the b64enc/b64dec functions
+   and the gpgsm reader and writer callbacks.  The callers keep their
+   own state machines for headers, white space, padding and error
+   reporting; they hand clean runs of complete groups to the functions
+   below which convert them without any per-character branching.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+
+/* The base-64 character list.  */
+const char radix64_bintoasc[65] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                  "abcdefghijklmnopqrstuvwxyz"
+                                  "0123456789+/";
+
+/* The reverse base-64 list; 0xff marks characters which are not part
+   of the alphabet.  */
+const unsigned char radix64_asctobin[256] =
+  {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b,
+    0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
+    0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20,
+    0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+    0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+  };
+
+
+/* Tables to compute the OpenPGP CRC (RFC-4880, 6.1) four bytes at a
+   time.  The CRC is kept in the high 24 bits of each entry.  They
+   have been created using this code:
+
+   #include <stdio.h>
+   #include <stdint.h>
+
+   #define CRCPOLY 0x864CFB
+
+   int
+   main (void)
+   {
+     int i, j, k;
+     uint32_t c;
+     uint32_t crc_table[4][256];
+
+     for (i=0; i < 256; i++)
+       {
+         c = i << 16;
+         for (j=0; j < 8; j++)
+           c = (c & 0x800000)? ((c << 1) ^ CRCPOLY) : (c << 1);
+         crc_table[0][i] = (c & 0xffffff) << 8;
+       }
+     for (k=1; k < 4; k++)
+       for (i=0; i < 256; i++)
+         {
+           c = crc_table[k-1][i];
+           crc_table[k][i] = (c << 8) ^ crc_table[0][c >> 24];
+         }
+
+     puts ("static const u32 crc_table[4][256] = {");
+     for (k=0; k < 4; k++)
+       {
+         puts ("  {");
+         for (i=j=0; i < 256; i++)
+           {
+             printf ("%s 0x%08lx", j? "":"   ",
+                     (unsigned long)crc_table[k][i]);
+             if (i != 255)
+               {
+                 putchar (',');
+                 if ( ++j > 5)
+                   {
+                     j = 0;
+                     putchar ('\n');
+                   }
+               }
+           }
+         printf ("\n  }%s\n", k < 3? ",":"");
+       }
+     puts ("};");
+     return 0;
+   }
+*/
+static const u32 crc_table[4][256] = {
+  {
+    0x00000000, 0x864cfb00, 0x8ad50d00, 0x0c99f600, 0x93e6e100, 0x15aa1a00,
+    0x1933ec00, 0x9f7f1700, 0xa1813900, 0x27cdc200, 0x2b543400, 0xad18cf00,
+    0x3267d800, 0xb42b2300, 0xb8b2d500, 0x3efe2e00, 0xc54e8900, 0x43027200,
+    0x4f9b8400, 0xc9d77f00, 0x56a86800, 0xd0e49300, 0xdc7d6500, 0x5a319e00,
+    0x64cfb000, 0xe2834b00, 0xee1abd00, 0x68564600, 0xf7295100, 0x7165aa00,
+    0x7dfc5c00, 0xfbb0a700, 0x0cd1e900, 0x8a9d1200, 0x8604e400, 0x00481f00,
+    0x9f370800, 0x197bf300, 0x15e20500, 0x93aefe00, 0xad50d000, 0x2b1c2b00,
+    0x2785dd00, 0xa1c92600, 0x3eb63100, 0xb8faca00, 0xb4633c00, 0x322fc700,
+    0xc99f6000, 0x4fd39b00, 0x434a6d00, 0xc5069600, 0x5a798100, 0xdc357a00,
+    0xd0ac8c00, 0x56e07700, 0x681e5900, 0xee52a200, 0xe2cb5400, 0x6487af00,
+    0xfbf8b800, 0x7db44300, 0x712db500, 0xf7614e00, 0x19a3d200, 0x9fef2900,
+    0x9376df00, 0x153a2400, 0x8a453300, 0x0c09c800, 0x00903e00, 0x86dcc500,
+    0xb822eb00, 0x3e6e1000, 0x32f7e600, 0xb4bb1d00, 0x2bc40a00, 0xad88f100,
+    0xa1110700, 0x275dfc00, 0xdced5b00, 0x5aa1a000, 0x56385600, 0xd074ad00,
+    0x4f0bba00, 0xc9474100, 0xc5deb700, 0x43924c00, 0x7d6c6200, 0xfb209900,
+    0xf7b96f00, 0x71f59400, 0xee8a8300, 0x68c67800, 0x645f8e00, 0xe2137500,
+    0x15723b00, 0x933ec000, 0x9fa73600, 0x19ebcd00, 0x8694da00, 0x00d82100,
+    0x0c41d700, 0x8a0d2c00, 0xb4f30200, 0x32bff900, 0x3e260f00, 0xb86af400,
+    0x2715e300, 0xa1591800, 0xadc0ee00, 0x2b8c1500, 0xd03cb200, 0x56704900,
+    0x5ae9bf00, 0xdca54400, 0x43da5300, 0xc596a800, 0xc90f5e00, 0x4f43a500,
+    0x71bd8b00, 0xf7f17000, 0xfb688600, 0x7d247d00, 0xe25b6a00, 0x64179100,
+    0x688e6700, 0xeec29c00, 0x3347a400, 0xb50b5f00, 0xb992a900, 0x3fde5200,
+    0xa0a14500, 0x26edbe00, 0x2a744800, 0xac38b300, 0x92c69d00, 0x148a6600,
+    0x18139000, 0x9e5f6b00, 0x01207c00, 0x876c8700, 0x8bf57100, 0x0db98a00,
+    0xf6092d00, 0x7045d600, 0x7cdc2000, 0xfa90db00, 0x65efcc00, 0xe3a33700,
+    0xef3ac100, 0x69763a00, 0x57881400, 0xd1c4ef00, 0xdd5d1900, 0x5b11e200,
+    0xc46ef500, 0x42220e00, 0x4ebbf800, 0xc8f70300, 0x3f964d00, 0xb9dab600,
+    0xb5434000, 0x330fbb00, 0xac70ac00, 0x2a3c5700, 0x26a5a100, 0xa0e95a00,
+    0x9e177400, 0x185b8f00, 0x14c27900, 0x928e8200, 0x0df19500, 0x8bbd6e00,
+    0x87249800, 0x01686300, 0xfad8c400, 0x7c943f00, 0x700dc900, 0xf6413200,
+    0x693e2500, 0xef72de00, 0xe3eb2800, 0x65a7d300, 0x5b59fd00, 0xdd150600,
+    0xd18cf000, 0x57c00b00, 0xc8bf1c00, 0x4ef3e700, 0x426a1100, 0xc426ea00,
+    0x2ae47600, 0xaca88d00, 0xa0317b00, 0x267d8000, 0xb9029700, 0x3f4e6c00,
+    0x33d79a00, 0xb59b6100, 0x8b654f00, 0x0d29b400, 0x01b04200, 0x87fcb900,
+    0x1883ae00, 0x9ecf5500, 0x9256a300, 0x141a5800, 0xefaaff00, 0x69e60400,
+    0x657ff200, 0xe3330900, 0x7c4c1e00, 0xfa00e500, 0xf6991300, 0x70d5e800,
+    0x4e2bc600, 0xc8673d00, 0xc4fecb00, 0x42b23000, 0xddcd2700, 0x5b81dc00,
+    0x57182a00, 0xd154d100, 0x26359f00, 0xa0796400, 0xace09200, 0x2aac6900,
+    0xb5d37e00, 0x339f8500, 0x3f067300, 0xb94a8800, 0x87b4a600, 0x01f85d00,
+    0x0d61ab00, 0x8b2d5000, 0x14524700, 0x921ebc00, 0x9e874a00, 0x18cbb100,
+    0xe37b1600, 0x6537ed00, 0x69ae1b00, 0xefe2e000, 0x709df700, 0xf6d10c00,
+    0xfa48fa00, 0x7c040100, 0x42fa2f00, 0xc4b6d400, 0xc82f2200, 0x4e63d900,
+    0xd11cce00, 0x57503500, 0x5bc9c300, 0xdd853800
+  },
+  {
+    0x00000000, 0x668f4800, 0xcd1e9000, 0xab91d800, 0x1c71db00, 0x7afe9300,
+    0xd16f4b00, 0xb7e00300, 0x38e3b600, 0x5e6cfe00, 0xf5fd2600, 0x93726e00,
+    0x24926d00, 0x421d2500, 0xe98cfd00, 0x8f03b500, 0x71c76c00, 0x17482400,
+    0xbcd9fc00, 0xda56b400, 0x6db6b700, 0x0b39ff00, 0xa0a82700, 0xc6276f00,
+    0x4924da00, 0x2fab9200, 0x843a4a00, 0xe2b50200, 0x55550100, 0x33da4900,
+    0x984b9100, 0xfec4d900, 0xe38ed800, 0x85019000, 0x2e904800, 0x481f0000,
+    0xffff0300, 0x99704b00, 0x32e19300, 0x546edb00, 0xdb6d6e00, 0xbde22600,
+    0x1673fe00, 0x70fcb600, 0xc71cb500, 0xa193fd00, 0x0a022500, 0x6c8d6d00,
+    0x9249b400, 0xf4c6fc00, 0x5f572400, 0x39d86c00, 0x8e386f00, 0xe8b72700,
+    0x4326ff00, 0x25a9b700, 0xaaaa0200, 0xcc254a00, 0x67b49200, 0x013bda00,
+    0xb6dbd900, 0xd0549100, 0x7bc54900, 0x1d4a0100, 0x41514b00, 0x27de0300,
+    0x8c4fdb00, 0xeac09300, 0x5d209000, 0x3bafd800, 0x903e0000, 0xf6b14800,
+    0x79b2fd00, 0x1f3db500, 0xb4ac6d00, 0xd2232500, 0x65c32600, 0x034c6e00,
+    0xa8ddb600, 0xce52fe00, 0x30962700, 0x56196f00, 0xfd88b700, 0x9b07ff00,
+    0x2ce7fc00, 0x4a68b400, 0xe1f96c00, 0x87762400, 0x08759100, 0x6efad900,
+    0xc56b0100, 0xa3e44900, 0x14044a00, 0x728b0200, 0xd91ada00, 0xbf959200,
+    0xa2df9300, 0xc450db00, 0x6fc10300, 0x094e4b00, 0xbeae4800, 0xd8210000,
+    0x73b0d800, 0x153f9000, 0x9a3c2500, 0xfcb36d00, 0x5722b500, 0x31adfd00,
+    0x864dfe00, 0xe0c2b600, 0x4b536e00, 0x2ddc2600, 0xd318ff00, 0xb597b700,
+    0x1e066f00, 0x78892700, 0xcf692400, 0xa9e66c00, 0x0277b400, 0x64f8fc00,
+    0xebfb4900, 0x8d740100, 0x26e5d900, 0x406a9100, 0xf78a9200, 0x9105da00,
+    0x3a940200, 0x5c1b4a00, 0x82a29600, 0xe42dde00, 0x4fbc0600, 0x29334e00,
+    0x9ed34d00, 0xf85c0500, 0x53cddd00, 0x35429500, 0xba412000, 0xdcce6800,
+    0x775fb000, 0x11d0f800, 0xa630fb00, 0xc0bfb300, 0x6b2e6b00, 0x0da12300,
+    0xf365fa00, 0x95eab200, 0x3e7b6a00, 0x58f42200, 0xef142100, 0x899b6900,
+    0x220ab100, 0x4485f900, 0xcb864c00, 0xad090400, 0x0698dc00, 0x60179400,
+    0xd7f79700, 0xb178df00, 0x1ae90700, 0x7c664f00, 0x612c4e00, 0x07a30600,
+    0xac32de00, 0xcabd9600, 0x7d5d9500, 0x1bd2dd00, 0xb0430500, 0xd6cc4d00,
+    0x59cff800, 0x3f40b000, 0x94d16800, 0xf25e2000, 0x45be2300, 0x23316b00,
+    0x88a0b300, 0xee2ffb00, 0x10eb2200, 0x76646a00, 0xddf5b200, 0xbb7afa00,
+    0x0c9af900, 0x6a15b100, 0xc1846900, 0xa70b2100, 0x28089400, 0x4e87dc00,
+    0xe5160400, 0x83994c00, 0x34794f00, 0x52f60700, 0xf967df00, 0x9fe89700,
+    0xc3f3dd00, 0xa57c9500, 0x0eed4d00, 0x68620500, 0xdf820600, 0xb90d4e00,
+    0x129c9600, 0x7413de00, 0xfb106b00, 0x9d9f2300, 0x360efb00, 0x5081b300,
+    0xe761b000, 0x81eef800, 0x2a7f2000, 0x4cf06800, 0xb234b100, 0xd4bbf900,
+    0x7f2a2100, 0x19a56900, 0xae456a00, 0xc8ca2200, 0x635bfa00, 0x05d4b200,
+    0x8ad70700, 0xec584f00, 0x47c99700, 0x2146df00, 0x96a6dc00, 0xf0299400,
+    0x5bb84c00, 0x3d370400, 0x207d0500, 0x46f24d00, 0xed639500, 0x8becdd00,
+    0x3c0cde00, 0x5a839600, 0xf1124e00, 0x979d0600, 0x189eb300, 0x7e11fb00,
+    0xd5802300, 0xb30f6b00, 0x04ef6800, 0x62602000, 0xc9f1f800, 0xaf7eb000,
+    0x51ba6900, 0x37352100, 0x9ca4f900, 0xfa2bb100, 0x4dcbb200, 0x2b44fa00,
+    0x80d52200, 0xe65a6a00, 0x6959df00, 0x0fd69700, 0xa4474f00, 0xc2c80700,
+    0x75280400, 0x13a74c00, 0xb8369400, 0xdeb9dc00
+  },
+  {
+    0x00000000, 0x8309d700, 0x805f5500, 0x03568200, 0x86f25100, 0x05fb8600,
+    0x06ad0400, 0x85a4d300, 0x8ba85900, 0x08a18e00, 0x0bf70c00, 0x88fedb00,
+    0x0d5a0800, 0x8e53df00, 0x8d055d00, 0x0e0c8a00, 0x911c4900, 0x12159e00,
+    0x11431c00, 0x924acb00, 0x17ee1800, 0x94e7cf00, 0x97b14d00, 0x14b89a00,
+    0x1ab41000, 0x99bdc700, 0x9aeb4500, 0x19e29200, 0x9c464100, 0x1f4f9600,
+    0x1c191400, 0x9f10c300, 0xa4746900, 0x277dbe00, 0x242b3c00, 0xa722eb00,
+    0x22863800, 0xa18fef00, 0xa2d96d00, 0x21d0ba00, 0x2fdc3000, 0xacd5e700,
+    0xaf836500, 0x2c8ab200, 0xa92e6100, 0x2a27b600, 0x29713400, 0xaa78e300,
+    0x35682000, 0xb661f700, 0xb5377500, 0x363ea200, 0xb39a7100, 0x3093a600,
+    0x33c52400, 0xb0ccf300, 0xbec07900, 0x3dc9ae00, 0x3e9f2c00, 0xbd96fb00,
+    0x38322800, 0xbb3bff00, 0xb86d7d00, 0x3b64aa00, 0xcea42900, 0x4dadfe00,
+    0x4efb7c00, 0xcdf2ab00, 0x48567800, 0xcb5faf00, 0xc8092d00, 0x4b00fa00,
+    0x450c7000, 0xc605a700, 0xc5532500, 0x465af200, 0xc3fe2100, 0x40f7f600,
+    0x43a17400, 0xc0a8a300, 0x5fb86000, 0xdcb1b700, 0xdfe73500, 0x5ceee200,
+    0xd94a3100, 0x5a43e600, 0x59156400, 0xda1cb300, 0xd4103900, 0x5719ee00,
+    0x544f6c00, 0xd746bb00, 0x52e26800, 0xd1ebbf00, 0xd2bd3d00, 0x51b4ea00,
+    0x6ad04000, 0xe9d99700, 0xea8f1500, 0x6986c200, 0xec221100, 0x6f2bc600,
+    0x6c7d4400, 0xef749300, 0xe1781900, 0x6271ce00, 0x61274c00, 0xe22e9b00,
+    0x678a4800, 0xe4839f00, 0xe7d51d00, 0x64dcca00, 0xfbcc0900, 0x78c5de00,
+    0x7b935c00, 0xf89a8b00, 0x7d3e5800, 0xfe378f00, 0xfd610d00, 0x7e68da00,
+    0x70645000, 0xf36d8700, 0xf03b0500, 0x7332d200, 0xf6960100, 0x759fd600,
+    0x76c95400, 0xf5c08300, 0x1b04a900, 0x980d7e00, 0x9b5bfc00, 0x18522b00,
+    0x9df6f800, 0x1eff2f00, 0x1da9ad00, 0x9ea07a00, 0x90acf000, 0x13a52700,
+    0x10f3a500, 0x93fa7200, 0x165ea100, 0x95577600, 0x9601f400, 0x15082300,
+    0x8a18e000, 0x09113700, 0x0a47b500, 0x894e6200, 0x0ceab100, 0x8fe36600,
+    0x8cb5e400, 0x0fbc3300, 0x01b0b900, 0x82b96e00, 0x81efec00, 0x02e63b00,
+    0x8742e800, 0x044b3f00, 0x071dbd00, 0x84146a00, 0xbf70c000, 0x3c791700,
+    0x3f2f9500, 0xbc264200, 0x39829100, 0xba8b4600, 0xb9ddc400, 0x3ad41300,
+    0x34d89900, 0xb7d14e00, 0xb487cc00, 0x378e1b00, 0xb22ac800, 0x31231f00,
+    0x32759d00, 0xb17c4a00, 0x2e6c8900, 0xad655e00, 0xae33dc00, 0x2d3a0b00,
+    0xa89ed800, 0x2b970f00, 0x28c18d00, 0xabc85a00, 0xa5c4d000, 0x26cd0700,
+    0x259b8500, 0xa6925200, 0x23368100, 0xa03f5600, 0xa369d400, 0x20600300,
+    0xd5a08000, 0x56a95700, 0x55ffd500, 0xd6f60200, 0x5352d100, 0xd05b0600,
+    0xd30d8400, 0x50045300, 0x5e08d900, 0xdd010e00, 0xde578c00, 0x5d5e5b00,
+    0xd8fa8800, 0x5bf35f00, 0x58a5dd00, 0xdbac0a00, 0x44bcc900, 0xc7b51e00,
+    0xc4e39c00, 0x47ea4b00, 0xc24e9800, 0x41474f00, 0x4211cd00, 0xc1181a00,
+    0xcf149000, 0x4c1d4700, 0x4f4bc500, 0xcc421200, 0x49e6c100, 0xcaef1600,
+    0xc9b99400, 0x4ab04300, 0x71d4e900, 0xf2dd3e00, 0xf18bbc00, 0x72826b00,
+    0xf726b800, 0x742f6f00, 0x7779ed00, 0xf4703a00, 0xfa7cb000, 0x79756700,
+    0x7a23e500, 0xf92a3200, 0x7c8ee100, 0xff873600, 0xfcd1b400, 0x7fd86300,
+    0xe0c8a000, 0x63c17700, 0x6097f500, 0xe39e2200, 0x663af100, 0xe5332600,
+    0xe665a400, 0x656c7300, 0x6b60f900, 0xe8692e00, 0xeb3fac00, 0x68367b00,
+    0xed92a800, 0x6e9b7f00, 0x6dcdfd00, 0xeec42a00
+  },
+  {
+    0x00000000, 0x36095200, 0x6c12a400, 0x5a1bf600, 0xd8254800, 0xee2c1a00,
+    0xb437ec00, 0x823ebe00, 0x36066b00, 0x000f3900, 0x5a14cf00, 0x6c1d9d00,
+    0xee232300, 0xd82a7100, 0x82318700, 0xb438d500, 0x6c0cd600, 0x5a058400,
+    0x001e7200, 0x36172000, 0xb4299e00, 0x8220cc00, 0xd83b3a00, 0xee326800,
+    0x5a0abd00, 0x6c03ef00, 0x36181900, 0x00114b00, 0x822ff500, 0xb426a700,
+    0xee3d5100, 0xd8340300, 0xd819ac00, 0xee10fe00, 0xb40b0800, 0x82025a00,
+    0x003ce400, 0x3635b600, 0x6c2e4000, 0x5a271200, 0xee1fc700, 0xd8169500,
+    0x820d6300, 0xb4043100, 0x363a8f00, 0x0033dd00, 0x5a282b00, 0x6c217900,
+    0xb4157a00, 0x821c2800, 0xd807de00, 0xee0e8c00, 0x6c303200, 0x5a396000,
+    0x00229600, 0x362bc400, 0x82131100, 0xb41a4300, 0xee01b500, 0xd808e700,
+    0x5a365900, 0x6c3f0b00, 0x3624fd00, 0x002daf00, 0x367fa300, 0x0076f100,
+    0x5a6d0700, 0x6c645500, 0xee5aeb00, 0xd853b900, 0x82484f00, 0xb4411d00,
+    0x0079c800, 0x36709a00, 0x6c6b6c00, 0x5a623e00, 0xd85c8000, 0xee55d200,
+    0xb44e2400, 0x82477600, 0x5a737500, 0x6c7a2700, 0x3661d100, 0x00688300,
+    0x82563d00, 0xb45f6f00, 0xee449900, 0xd84dcb00, 0x6c751e00, 0x5a7c4c00,
+    0x0067ba00, 0x366ee800, 0xb4505600, 0x82590400, 0xd842f200, 0xee4ba000,
+    0xee660f00, 0xd86f5d00, 0x8274ab00, 0xb47df900, 0x36434700, 0x004a1500,
+    0x5a51e300, 0x6c58b100, 0xd8606400, 0xee693600, 0xb472c000, 0x827b9200,
+    0x00452c00, 0x364c7e00, 0x6c578800, 0x5a5eda00, 0x826ad900, 0xb4638b00,
+    0xee787d00, 0xd8712f00, 0x5a4f9100, 0x6c46c300, 0x365d3500, 0x00546700,
+    0xb46cb200, 0x8265e000, 0xd87e1600, 0xee774400, 0x6c49fa00, 0x5a40a800,
+    0x005b5e00, 0x36520c00, 0x6cff4600, 0x5af61400, 0x00ede200, 0x36e4b000,
+    0xb4da0e00, 0x82d35c00, 0xd8c8aa00, 0xeec1f800, 0x5af92d00, 0x6cf07f00,
+    0x36eb8900, 0x00e2db00, 0x82dc6500, 0xb4d53700, 0xeecec100, 0xd8c79300,
+    0x00f39000, 0x36fac200, 0x6ce13400, 0x5ae86600, 0xd8d6d800, 0xeedf8a00,
+    0xb4c47c00, 0x82cd2e00, 0x36f5fb00, 0x00fca900, 0x5ae75f00, 0x6cee0d00,
+    0xeed0b300, 0xd8d9e100, 0x82c21700, 0xb4cb4500, 0xb4e6ea00, 0x82efb800,
+    0xd8f44e00, 0xeefd1c00, 0x6cc3a200, 0x5acaf000, 0x00d10600, 0x36d85400,
+    0x82e08100, 0xb4e9d300, 0xeef22500, 0xd8fb7700, 0x5ac5c900, 0x6ccc9b00,
+    0x36d76d00, 0x00de3f00, 0xd8ea3c00, 0xeee36e00, 0xb4f89800, 0x82f1ca00,
+    0x00cf7400, 0x36c62600, 0x6cddd000, 0x5ad48200, 0xeeec5700, 0xd8e50500,
+    0x82fef300, 0xb4f7a100, 0x36c91f00, 0x00c04d00, 0x5adbbb00, 0x6cd2e900,
+    0x5a80e500, 0x6c89b700, 0x36924100, 0x009b1300, 0x82a5ad00, 0xb4acff00,
+    0xeeb70900, 0xd8be5b00, 0x6c868e00, 0x5a8fdc00, 0x00942a00, 0x369d7800,
+    0xb4a3c600, 0x82aa9400, 0xd8b16200, 0xeeb83000, 0x368c3300, 0x00856100,
+    0x5a9e9700, 0x6c97c500, 0xeea97b00, 0xd8a02900, 0x82bbdf00, 0xb4b28d00,
+    0x008a5800, 0x36830a00, 0x6c98fc00, 0x5a91ae00, 0xd8af1000, 0xeea64200,
+    0xb4bdb400, 0x82b4e600, 0x82994900, 0xb4901b00, 0xee8bed00, 0xd882bf00,
+    0x5abc0100, 0x6cb55300, 0x36aea500, 0x00a7f700, 0xb49f2200, 0x82967000,
+    0xd88d8600, 0xee84d400, 0x6cba6a00, 0x5ab33800, 0x00a8ce00, 0x36a19c00,
+    0xee959f00, 0xd89ccd00, 0x82873b00, 0xb48e6900, 0x36b0d700, 0x00b98500,
+    0x5aa27300, 0x6cab2100, 0xd893f400, 0xee9aa600, 0xb4815000, 0x82880200,
+    0x00b6bc00, 0x36bfee00, 0x6ca41800, 0x5aad4a00
+  }
+};
+
+
+/* Update the OpenPGP CRC value CRC with LENGTH bytes from BUFFER and
+   return the new value.  Start with RADIX64_CRCINIT.  */
+u32
+radix64_crc24 (u32 crc, const void *buffer, size_t length)
+{
+  const unsigned char *p = buffer;
+  u32 c = crc << 8;
+
+  for (; length >= 4; p += 4, length -= 4)
+    {
+      c ^= ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | p[3];
+      c = (crc_table[3][c >> 24]
+           ^ crc_table[2][(c >> 16) & 0xff]
+           ^ crc_table[1][(c >> 8) & 0xff]
+           ^ crc_table[0][c & 0xff]);
+    }
+  for (; length; p++, length--)
+    c = (c << 8) ^ crc_table[0][(c >> 24) ^ *p];
+
+  return c >> 8;
+}
+
+
+/* Encode NGROUPS groups of 3 bytes from SRC into 4 * NGROUPS base64
+   characters at DST.  No padding or line breaks are written.  */
+void
+radix64_encode_groups (char *dst, const void *src, size_t ngroups)
+{
+  const unsigned char *s = src;
+
+  for (; ngroups; ngroups--, s += 3, dst += 4)
+    {
+      dst[0] = radix64_bintoasc[s[0] >> 2];
+      dst[1] = radix64_bintoasc[((s[0] << 4) & 060) | (s[1] >> 4)];
+      dst[2] = radix64_bintoasc[((s[1] << 2) & 074) | (s[2] >> 6)];
+      dst[3] = radix64_bintoasc[s[2] & 077];
+    }
+}
+
+
+/* Decode complete groups of 4 base64 characters from SRC, which has
+   LENGTH bytes, and store the resulting bytes at DST.  Decoding stops
+   at the first group which contains a character not in the alphabet
+   (this includes white space and the pad character) so that the
+   caller can handle the rest of the input.  DST may be the same as
+   SRC.  Returns the number of characters consumed; 3/4 of that is
+   the number of bytes stored.  */
+size_t
+radix64_decode_groups (void *dst, const void *src, size_t length)
+{
+  const unsigned char *s = src;
+  unsigned char *d = dst;
+  unsigned int c0, c1, c2, c3;
+
+  for (; length >= 4; length -= 4, s += 4, d += 3)
+    {
+      c0 = radix64_asctobin[s[0]];
+      c1 = radix64_asctobin[s[1]];
+      c2 = radix64_asctobin[s[2]];
+      c3 = radix64_asctobin[s[3]];
+      if (((c0 | c1 | c2 | c3) & 0x80))
+        break;
+      d[0] = (c0 << 2) | (c1 >> 4);
+      d[1] = (c1 << 4) | (c2 >> 2);
+      d[2] = (c2 << 6) | c3;
+    }
+
+  return s - (const unsigned char *)src;
+}
@@ -126,7 +126,9 @@ enum
     STATUS_MOUNTPOINT,
 
     STATUS_ERROR,
-    STATUS_SUCCESS
+    STATUS_SUCCESS,
+
+    STATUS_COMPRESSION
 };
 
 
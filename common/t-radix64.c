@@ -0,0 +1,215 @@
+/* t-radix64.c - Module test for radix64.c
+ * Copyright (C) 2012 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+   Running this program with the option --timing prints the
+   throughput of the coders and of the CRC instead of running the
+   tests.  An optional second argument gives the size of the test
+   buffer in megabytes.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a)  do { fprintf (stderr, "%s:%d: test %d failed\n",\
+                               __FILE__,__LINE__, (a));          \
+                     exit (1);                                   \
+                   } while(0)
+
+
+/* The bitwise CRC24 from RFC-4880, section 6.1.  */
+static u32
+crc24_reference (const unsigned char *octets, size_t len)
+{
+  u32 crc = RADIX64_CRCINIT;
+  int i;
+
+  while (len--)
+    {
+      crc ^= (*octets++) << 16;
+      for (i = 0; i < 8; i++)
+        {
+          crc <<= 1;
+          if (crc & 0x1000000)
+            crc ^= 0x1864CFB;
+        }
+    }
+  return crc & 0xFFFFFF;
+}
+
+
+static void
+test_crc24 (void)
+{
+  static struct {
+    const char *string;
+    u32 expect;
+  } tbl[] = {
+    { "",          0xB704CE },
+    { "a",         0xF25713 },
+    { "123456789", 0x21CF02 }
+  };
+  unsigned char buffer[1000];
+  int i;
+  size_t n, off;
+  u32 crc;
+
+  for (i=0; i < DIM (tbl); i++)
+    {
+      crc = radix64_crc24 (RADIX64_CRCINIT, tbl[i].string,
+                           strlen (tbl[i].string));
+      if (crc != tbl[i].expect)
+        fail (i);
+    }
+
+  /* Compare with the bitwise implementation for all lengths and
+     alignments and for the computation in pieces.  */
+  for (n=0; n < sizeof buffer; n++)
+    buffer[n] = n * 7 + (n >> 3);
+  for (off=0; off < 4; off++)
+    for (n=0; n < 100; n++)
+      {
+        if (radix64_crc24 (RADIX64_CRCINIT, buffer + off, n)
+            != crc24_reference (buffer + off, n))
+          fail (100 + (int)n);
+      }
+  crc = radix64_crc24 (RADIX64_CRCINIT, buffer, 333);
+  crc = radix64_crc24 (crc, buffer + 333, sizeof buffer - 333);
+  if (crc != crc24_reference (buffer, sizeof buffer))
+    fail (200);
+}
+
+
+static void
+test_encode_decode (void)
+{
+  static struct {
+    const char *string;
+    const char *expect;
+  } tbl[] = {
+    { "",       "" },
+    { "foo",    "Zm9v" },
+    { "foobar", "Zm9vYmFy" },
+    { "\xfb\xff\xbf\x00\x10\x83", "+/+/ABCD" }
+  };
+  unsigned char data[768];
+  char encoded[1024];
+  unsigned char decoded[768];
+  int i;
+  size_t n, len;
+
+  for (i=0; i < DIM (tbl); i++)
+    {
+      len = strlen (tbl[i].string);
+      radix64_encode_groups (encoded, tbl[i].string, len / 3);
+      if (memcmp (encoded, tbl[i].expect, len / 3 * 4))
+        fail (i);
+      n = radix64_decode_groups (decoded, tbl[i].expect,
+                                 strlen (tbl[i].expect));
+      if (n != strlen (tbl[i].expect) || memcmp (decoded, tbl[i].string, len))
+        fail (i);
+    }
+
+  /* Decoding stops at the first group with a character not in the
+     alphabet.  */
+  if (radix64_decode_groups (decoded, "Zm9vYm=y", 8) != 4)
+    fail (10);
+  if (radix64_decode_groups (decoded, "Zm9v\nYmFy", 9) != 4)
+    fail (11);
+  if (radix64_decode_groups (decoded, "Zm9vYmF", 7) != 4)
+    fail (12);
+
+  /* Round trip of all byte values, also in place.  */
+  for (n=0; n < sizeof data; n++)
+    data[n] = n;
+  radix64_encode_groups (encoded, data, sizeof data / 3);
+  n = radix64_decode_groups (decoded, encoded, sizeof data / 3 * 4);
+  if (n != sizeof data / 3 * 4 || memcmp (decoded, data, sizeof data))
+    fail (20);
+  n = radix64_decode_groups (encoded, encoded, sizeof data / 3 * 4);
+  if (n != sizeof data / 3 * 4 || memcmp (encoded, data, sizeof data))
+    fail (21);
+}
+
+
+static double
+elapsed (clock_t start)
+{
+  double secs = (double)(clock () - start) / CLOCKS_PER_SEC;
+
+  return secs > 0? secs : 1.0 / CLOCKS_PER_SEC;
+}
+
+
+/* Print the throughput for a buffer of MEGABYTES.  */
+static void
+run_timing (size_t megabytes)
+{
+  size_t ngroups = megabytes * 1024 * 1024 / 3;
+  unsigned char *data;
+  char *encoded;
+  clock_t start;
+  size_t n;
+  u32 crc;
+
+  data = xmalloc (ngroups * 3);
+  encoded = xmalloc (ngroups * 4);
+  for (n=0; n < ngroups * 3; n++)
+    data[n] = n * 13 + (n >> 5);
+
+  start = clock ();
+  crc = radix64_crc24 (RADIX64_CRCINIT, data, ngroups * 3);
+  printf ("crc24:  %8.1f MiB/s (crc=%06lX)\n",
+          megabytes / elapsed (start), (unsigned long)crc);
+
+  start = clock ();
+  radix64_encode_groups (encoded, data, ngroups);
+  printf ("encode: %8.1f MiB/s\n", megabytes / elapsed (start));
+
+  start = clock ();
+  n = radix64_decode_groups (data, encoded, ngroups * 4);
+  printf ("decode: %8.1f MiB/s\n", megabytes / elapsed (start));
+  if (n != ngroups * 4)
+    fail (1);
+
+  xfree (encoded);
+  xfree (data);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  if (argc > 1 && !strcmp (argv[1], "--timing"))
+    {
+      run_timing (argc > 2? strtoul (argv[2], NULL, 10) : 64);
+      return 0;
+    }
+
+  test_crc24 ();
+  test_encode_decode ();
+
+  return 0;
+}
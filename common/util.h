@@ -173,6 +173,14 @@ gpg_error_t b64dec_proc (struct b64state *state, void *buffer, size_t length,
                          size_t *r_nbytes);
 gpg_error_t b64dec_finish (struct b64state *state);
 
+/*-- radix64.c --*/
+#define RADIX64_CRCINIT 0xB704CE
+extern const char radix64_bintoasc[65];
+extern const unsigned char radix64_asctobin[256];
+u32 radix64_crc24 (u32 crc, const void *buffer, size_t length);
+void radix64_encode_groups (char *dst, const void *src, size_t ngroups);
+size_t radix64_decode_groups (void *dst, const void *src, size_t length);
+
 
 
 
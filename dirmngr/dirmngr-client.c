@@ -109,13 +109,6 @@ struct inq_cert_parm_s
 };
 
 
-/* Base64 conversion tables. */
-static unsigned char bintoasc[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-                                  "abcdefghijklmnopqrstuvwxyz"
-			          "0123456789+/";
-static unsigned char asctobin[256]; /* runtime initialized */
-
-
 /* Prototypes.  */
 static assuan_context_t start_dirmngr (int only_daemon);
 static gpg_error_t read_certificate (const char *fname,
@@ -234,19 +227,6 @@ main (int argc, char **argv )
   if (log_get_errorcount (0))
     exit (2);
 
-  /* Build the helptable for radix64 to bin conversion. */
-  if (opt.pem)
-    {
-      int i;
-      unsigned char *s;
-
-      for (i=0; i < 256; i++ )
-        asctobin[i] = 255; /* Used to detect invalid characters. */
-      for (s=bintoasc, i=0; *s; s++, i++)
-        asctobin[*s] = i;
-    }
-
-
   if (cmd_ping)
     err = 0;
   else if (cmd_lookup || cmd_loadcrl)
@@ -645,7 +625,7 @@ read_pem_certificate (const char *fname, unsigned char **rbuf, size_t *rbuflen)
 
             if (c == '-')
               state = s_waitend;
-            else if ((c = asctobin[c & 0xff]) == 255 )
+            else if ((c = radix64_asctobin[c & 0xff]) == 255 )
               ; /* Just skip invalid base64 characters. */
             else if (state == s_b64_0)
               {
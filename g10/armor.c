@@ -39,20 +39,6 @@
 
 #define MAX_LINELEN 20000
 
-#define CRCINIT 0xB704CE
-#define CRCPOLY 0X864CFB
-#define CRCUPDATE(a,c) do {						    \
-			a = ((a) << 8) ^ crc_table[((a)&0xff >> 16) ^ (c)]; \
-			a &= 0x00ffffff;				    \
-		    } while(0)
-static u32 crc_table[256];
-static byte bintoasc[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-			 "abcdefghijklmnopqrstuvwxyz"
-			 "0123456789+/";
-static byte asctobin[256]; /* runtime initialized */
-static int is_initialized;
-
-
 typedef enum {
     fhdrHASArmor = 0,
     fhdrNOArmor,
@@ -160,37 +146,6 @@ push_armor_filter (armor_filter_context_t *afx, iobuf_t iobuf)
 
 
 
-static void
-initialize(void)
-{
-    int i, j;
-    u32 t;
-    byte *s;
-
-    /* init the crc lookup table */
-    crc_table[0] = 0;
-    for(i=j=0; j < 128; j++ ) {
-	t = crc_table[j];
-	if( t & 0x00800000 ) {
-	    t <<= 1;
-	    crc_table[i++] = t ^ CRCPOLY;
-	    crc_table[i++] = t;
-	}
-	else {
-	    t <<= 1;
-	    crc_table[i++] = t;
-	    crc_table[i++] = t ^ CRCPOLY;
-	}
-    }
-    /* build the helptable for radix64 to bin conversion */
-    for(i=0; i < 256; i++ )
-	asctobin[i] = 255; /* used to detect invalid characters */
-    for(s=bintoasc,i=0; *s; s++,i++ )
-	asctobin[*s] = i;
-
-    is_initialized=1;
-}
-
 /****************
  * Check whether this is an armored file or not See also
  * parse-packet.c for details on this code For unknown historic
@@ -548,7 +503,7 @@ check_input( armor_filter_context_t *afx, IOBUF a )
 	afx->faked = 1;
     else {
 	afx->inp_checked = 1;
-	afx->crc = CRCINIT;
+	afx->crc = RADIX64_CRCINIT;
 	afx->idx = 0;
 	afx->radbuf[0] = 0;
     }
@@ -725,7 +680,7 @@ fake_packet( armor_filter_context_t *afx, IOBUF a,
 	    }
 	}
 	afx->inp_checked = 1;
-	afx->crc = CRCINIT;
+	afx->crc = RADIX64_CRCINIT;
 	afx->idx = 0;
 	afx->radbuf[0] = 0;
     }
@@ -754,7 +709,7 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
     int checkcrc=0;
     int rc = 0;
     size_t n = 0;
-    int  idx, i, onlypad=0;
+    int  idx, onlypad=0;
     u32 crc;
 
     crc = afx->crc;
@@ -762,6 +717,20 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
     val = afx->radbuf[0];
     for( n=0; n < size; ) {
 
+	if( !idx && afx->buffer_pos < afx->buffer_len ) {
+	    /* fast path for the clean part of the line */
+	    size_t nn = afx->buffer_len - afx->buffer_pos;
+	    if( nn > (size - n) / 3 * 4 )
+		nn = (size - n) / 3 * 4;
+	    nn = radix64_decode_groups( buf + n,
+					afx->buffer + afx->buffer_pos, nn );
+	    if( nn ) {
+		afx->buffer_pos += nn;
+		n += nn / 4 * 3;
+		continue;
+	    }
+	}
+
 	if( afx->buffer_pos < afx->buffer_len )
 	    c = afx->buffer[afx->buffer_pos++];
 	else { /* read the next line */
@@ -807,7 +776,7 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
 	    checkcrc++;
 	    break;
 	}
-	else if( (c = asctobin[(c2=c)]) == 255 ) {
+	else if( (c = radix64_asctobin[(c2=c)]) == 255 ) {
 	    log_error(_("invalid radix64 character %02X skipped\n"), c2);
 	    continue;
 	}
@@ -820,9 +789,7 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
 	idx = (idx+1) % 4;
     }
 
-    for(i=0; i < n; i++ )
-	crc = (crc << 8) ^ crc_table[((crc >> 16)&0xff) ^ buf[i]];
-    crc &= 0x00ffffff;
+    crc = radix64_crc24( crc, buf, n );
     afx->crc = crc;
     afx->idx = idx;
     afx->radbuf[0] = val;
@@ -856,7 +823,7 @@ radix64_read( armor_filter_context_t *afx, IOBUF a, size_t *retn,
 	    u32 mycrc = 0;
 	    idx = 0;
 	    do {
-		if( (c = asctobin[c]) == 255 )
+		if( (c = radix64_asctobin[c]) == 255 )
 		    break;
 		switch(idx) {
 		  case 0: val =  c << 2; break;
@@ -1117,7 +1084,7 @@ armor_filter( void *opaque, int control,
 	    afx->status++;
 	    afx->idx = 0;
 	    afx->idx2 = 0;
-	    afx->crc = CRCINIT;
+	    afx->crc = RADIX64_CRCINIT;
 
 	}
 	crc = afx->crc;
@@ -1126,21 +1093,22 @@ armor_filter( void *opaque, int control,
 	for(i=0; i < idx; i++ )
 	    radbuf[i] = afx->radbuf[i];
 
-	for(i=0; i < size; i++ )
-	    crc = (crc << 8) ^ crc_table[((crc >> 16)&0xff) ^ buf[i]];
-	crc &= 0x00ffffff;
+	crc = radix64_crc24( crc, buf, size );
 
-	for( ; size; buf++, size-- ) {
+	/* complete a group left over from the last call */
+	for( ; size && idx; buf++, size-- ) {
 	    radbuf[idx++] = *buf;
 	    if( idx > 2 ) {
 		idx = 0;
-		c = bintoasc[(*radbuf >> 2) & 077];
+		c = radix64_bintoasc[(*radbuf >> 2) & 077];
 		iobuf_put(a, c);
-		c = bintoasc[(((*radbuf<<4)&060)|((radbuf[1] >> 4)&017))&077];
+		c = radix64_bintoasc[(((*radbuf<<4)&060)
+				       |((radbuf[1] >> 4)&017))&077];
 		iobuf_put(a, c);
-		c = bintoasc[(((radbuf[1]<<2)&074)|((radbuf[2]>>6)&03))&077];
+		c = radix64_bintoasc[(((radbuf[1]<<2)&074)
+				       |((radbuf[2]>>6)&03))&077];
 		iobuf_put(a, c);
-		c = bintoasc[radbuf[2]&077];
+		c = radix64_bintoasc[radbuf[2]&077];
 		iobuf_put(a, c);
 		if( ++idx2 >= (64/4) )
 		  { /* pgp doesn't like 72 here */
@@ -1149,6 +1117,29 @@ armor_filter( void *opaque, int control,
 		  }
 	    }
 	}
+	/* encode all complete groups a line at a time */
+	while( size >= 3 ) {
+	    char line[64+sizeof afx->eol];
+	    size_t n, ngroups;
+
+	    ngroups = (64/4) - idx2;
+	    if( ngroups > size / 3 )
+		ngroups = size / 3;
+	    radix64_encode_groups( line, buf, ngroups );
+	    n = 4 * ngroups;
+	    buf += 3 * ngroups;
+	    size -= 3 * ngroups;
+	    idx2 += ngroups;
+	    if( idx2 >= (64/4) ) {
+		for(i=0; i < sizeof afx->eol && afx->eol[i]; i++ )
+		    line[n++] = afx->eol[i];
+		idx2 = 0;
+	    }
+	    iobuf_write( a, line, n );
+	}
+	/* and keep the remaining bytes for the next call */
+	for( ; size; buf++, size-- )
+	    radbuf[idx++] = *buf;
 	for(i=0; i < idx; i++ )
 	    afx->radbuf[i] = radbuf[i];
 	afx->idx = idx;
@@ -1157,9 +1148,6 @@ armor_filter( void *opaque, int control,
     }
     else if( control == IOBUFCTRL_INIT )
       {
-	if( !is_initialized )
-	  initialize();
-
 	/* Figure out what we're using for line endings if the caller
 	   didn't specify. */
 	if(afx->eol[0]==0)
@@ -1183,19 +1171,19 @@ armor_filter( void *opaque, int control,
 	    idx = afx->idx;
 	    idx2 = afx->idx2;
 	    if( idx ) {
-		c = bintoasc[(afx->radbuf[0]>>2)&077];
+		c = radix64_bintoasc[(afx->radbuf[0]>>2)&077];
 		iobuf_put(a, c);
 		if( idx == 1 ) {
-		    c = bintoasc[((afx->radbuf[0] << 4) & 060) & 077];
+		    c = radix64_bintoasc[((afx->radbuf[0] << 4) & 060) & 077];
 		    iobuf_put(a, c);
 		    iobuf_put(a, '=');
 		    iobuf_put(a, '=');
 		}
 		else { /* 2 */
-		    c = bintoasc[(((afx->radbuf[0]<<4)&060)
-                                  |((afx->radbuf[1]>>4)&017))&077];
+		    c = radix64_bintoasc[(((afx->radbuf[0]<<4)&060)
+					   |((afx->radbuf[1]>>4)&017))&077];
 		    iobuf_put(a, c);
-		    c = bintoasc[((afx->radbuf[1] << 2) & 074) & 077];
+		    c = radix64_bintoasc[((afx->radbuf[1] << 2) & 074) & 077];
 		    iobuf_put(a, c);
 		    iobuf_put(a, '=');
 		}
@@ -1213,13 +1201,15 @@ armor_filter( void *opaque, int control,
 	    radbuf[0] = crc >>16;
 	    radbuf[1] = crc >> 8;
 	    radbuf[2] = crc;
-	    c = bintoasc[(*radbuf >> 2) & 077];
+	    c = radix64_bintoasc[(*radbuf >> 2) & 077];
 	    iobuf_put(a, c);
-	    c = bintoasc[(((*radbuf<<4)&060)|((radbuf[1] >> 4)&017))&077];
+	    c = radix64_bintoasc[(((*radbuf<<4)&060)
+				   |((radbuf[1] >> 4)&017))&077];
 	    iobuf_put(a, c);
-	    c = bintoasc[(((radbuf[1]<<2)&074)|((radbuf[2]>>6)&03))&077];
+	    c = radix64_bintoasc[(((radbuf[1]<<2)&074)
+				   |((radbuf[2]>>6)&03))&077];
 	    iobuf_put(a, c);
-	    c = bintoasc[radbuf[2]&077];
+	    c = radix64_bintoasc[radbuf[2]&077];
 	    iobuf_put(a, c);
 	    iobuf_writestr(a,afx->eol);
 	    /* and the the trailer */
@@ -1262,19 +1252,21 @@ make_radix64_string( const byte *data, size_t len )
 
     buffer = p = xmalloc( (len+2)/3*4 + 1 );
     for( ; len >= 3 ; len -= 3, data += 3 ) {
-	*p++ = bintoasc[(data[0] >> 2) & 077];
-	*p++ = bintoasc[(((data[0] <<4)&060)|((data[1] >> 4)&017))&077];
-	*p++ = bintoasc[(((data[1]<<2)&074)|((data[2]>>6)&03))&077];
-	*p++ = bintoasc[data[2]&077];
+	*p++ = radix64_bintoasc[(data[0] >> 2) & 077];
+	*p++ = radix64_bintoasc[(((data[0] <<4)&060)
+				  |((data[1] >> 4)&017))&077];
+	*p++ = radix64_bintoasc[(((data[1]<<2)&074)|((data[2]>>6)&03))&077];
+	*p++ = radix64_bintoasc[data[2]&077];
     }
     if( len == 2 ) {
-	*p++ = bintoasc[(data[0] >> 2) & 077];
-	*p++ = bintoasc[(((data[0] <<4)&060)|((data[1] >> 4)&017))&077];
-	*p++ = bintoasc[((data[1]<<2)&074)];
+	*p++ = radix64_bintoasc[(data[0] >> 2) & 077];
+	*p++ = radix64_bintoasc[(((data[0] <<4)&060)
+				  |((data[1] >> 4)&017))&077];
+	*p++ = radix64_bintoasc[((data[1]<<2)&074)];
     }
     else if( len == 1 ) {
-	*p++ = bintoasc[(data[0] >> 2) & 077];
-	*p++ = bintoasc[(data[0] <<4)&060];
+	*p++ = radix64_bintoasc[(data[0] >> 2) & 077];
+	*p++ = radix64_bintoasc[(data[0] <<4)&060];
     }
     *p = 0;
     return buffer;
@@ -1318,8 +1310,6 @@ unarmor_pump_new (void)
 {
     UnarmorPump x;
 
-    if( !is_initialized )
-        initialize();
     x = xmalloc_clear (sizeof *x);
     return x;
 }
@@ -1389,7 +1379,7 @@ unarmor_pump (UnarmorPump x, int c)
         /* i.e. wait for one empty line */
         if ( c == '\n' ) {
             x->state = STA_read_data;
-            x->crc = CRCINIT;
+            x->crc = RADIX64_CRCINIT;
             x->val = 0;
             x->pos = 0;
         }
@@ -1416,7 +1406,7 @@ unarmor_pump (UnarmorPump x, int c)
 
         {
             int c2;
-            if( (c = asctobin[(c2=c)]) == 255 ) {
+            if( (c = radix64_asctobin[(c2=c)]) == 255 ) {
                 log_error(_("invalid radix64 character %02X skipped\n"), c2);
                 break;
             }
@@ -1451,7 +1441,7 @@ unarmor_pump (UnarmorPump x, int c)
         x->pos = 0;
         x->mycrc = 0;
       case STA_read_crc:
-        if( (c = asctobin[c]) == 255 ) {
+        if( (c = radix64_asctobin[c]) == 255 ) {
             rval = -1; /* ready */
             if( x->crc != x->mycrc ) {
                 log_info (_("CRC error; %06lX - %06lX\n"),
@@ -1490,8 +1480,8 @@ unarmor_pump (UnarmorPump x, int c)
     }
 
     if ( !(rval & ~255) ) { /* compute the CRC */
-        x->crc = (x->crc << 8) ^ crc_table[((x->crc >> 16)&0xff) ^ rval];
-        x->crc &= 0x00ffffff;
+        byte b = rval;
+        x->crc = radix64_crc24 (x->crc, &b, 1);
     }
 
     return rval;
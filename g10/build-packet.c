@@ -503,8 +503,8 @@ do_plaintext( IOBUF out, int ctb, PKT_plaintext *pt )
 {
     int i, rc = 0;
     u32 n;
-    byte buf[1000]; /* this buffer has the plaintext! */
-    int nbytes;
+    const void *p;
+    size_t maxlen, nbytes;
 
     write_header(out, ctb, calc_plaintext( pt ) );
     iobuf_put(out, pt->mode );
@@ -515,14 +515,17 @@ do_plaintext( IOBUF out, int ctb, PKT_plaintext *pt )
     if (rc)
       return rc;
 
+    /* Pass the data directly from the input buffer to the output
+       filters.  Chunks of the iobuf size allow the filters to process
+       them without copying.  */
+    maxlen = iobuf_get_buffer_size ();
     n = 0;
-    while( (nbytes=iobuf_read(pt->buf, buf, 1000)) != -1 ) {
-      rc = iobuf_write (out, buf, nbytes);
+    while( (p = iobuf_get_span (pt->buf, maxlen, &nbytes)) ) {
+      rc = iobuf_write (out, p, nbytes);
       if (rc)
         break;
       n += nbytes;
     }
-    wipememory(buf,1000); /* burn the buffer */
     if( (ctb&0x40) && !pt->len )
       iobuf_set_partial_block_mode(out, 0 ); /* turn off partial */
     if( pt->len && n != pt->len )
@@ -782,6 +785,13 @@ build_sig_subpkt (PKT_signature *sig, sigsubpkttype_t type,
         newarea = oldarea;
         /*log_debug ("updating area for type %d\n", type );*/
     }
+    else if (oldarea && pkt_arena_owns (oldarea)) {
+        /* Areas of parsed signatures can't be reallocated.  */
+        newarea = xmalloc (sizeof (*newarea) + n - 1);
+        memcpy (newarea->data, oldarea->data, n0);
+        pkt_arena_free (oldarea);
+        newarea->size = n;
+    }
     else if (oldarea) {
         newarea = xrealloc (oldarea, sizeof (*newarea) + n - 1);
         newarea->size = n;
@@ -129,8 +129,15 @@ cipher_filter( void *opaque, int control,
 	}
 	if (cfx->mdc_hash)
 	    gcry_md_write (cfx->mdc_hash, buf, size);
-	gcry_cipher_encrypt (cfx->cipher_hd, buf, size, NULL, 0);
-	rc = iobuf_write( a, buf, size );
+	/* BUF may belong to the caller of iobuf_write; thus we may not
+	 * encrypt in place.  */
+	if (cfx->buffer_size < size) {
+	    xfree (cfx->buffer);
+	    cfx->buffer = xmalloc (size);
+	    cfx->buffer_size = size;
+	}
+	gcry_cipher_encrypt (cfx->cipher_hd, cfx->buffer, size, buf, size);
+	rc = iobuf_write( a, cfx->buffer, size );
     }
     else if( control == IOBUFCTRL_FREE ) {
 	if( cfx->mdc_hash ) {
@@ -155,6 +162,9 @@ cipher_filter( void *opaque, int control,
 		log_error("writing MDC packet failed\n" );
 	}
 	gcry_cipher_close (cfx->cipher_hd);
+	xfree (cfx->buffer);
+	cfx->buffer = NULL;
+	cfx->buffer_size = 0;
     }
     else if( control == IOBUFCTRL_DESC ) {
 	*(char**)buf = "cipher_filter";
@@ -54,7 +54,7 @@ init_compress( compress_filter_context_t *zfx, bz_stream *bzs )
   if((rc=BZ2_bzCompressInit(bzs,level,0,0))!=BZ_OK)
     log_fatal("bz2lib problem: %d\n",rc);
 
-  zfx->outbufsize = 8192;
+  zfx->outbufsize = iobuf_get_buffer_size ();
   zfx->outbuf = xmalloc( zfx->outbufsize );
 }
 
@@ -65,6 +65,11 @@ do_compress(compress_filter_context_t *zfx, bz_stream *bzs, int flush, IOBUF a)
   int zrc;
   unsigned n;
 
+  /* iobuf_write may have passed all data directly to us, so that we
+     get an empty flush on close; bzCompress would fail on that.  */
+  if( !bzs->avail_in && flush != BZ_FINISH )
+    return 0;
+
   do
     {
       bzs->next_out = zfx->outbuf;
@@ -104,7 +109,7 @@ init_uncompress( compress_filter_context_t *zfx, bz_stream *bzs )
   if((rc=BZ2_bzDecompressInit(bzs,0,opt.bz2_decompress_lowmem))!=BZ_OK)
     log_fatal("bz2lib problem: %d\n",rc);
 
-  zfx->inbufsize = 2048;
+  zfx->inbufsize = iobuf_get_buffer_size ();
   zfx->inbuf = xmalloc( zfx->inbufsize );
   bzs->avail_in = 0;
 }
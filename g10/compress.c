@@ -33,6 +33,7 @@
 #include <errno.h>
 #ifdef HAVE_ZIP
 # include <zlib.h>
+# include <npth.h>
 # if defined(__riscos__) && defined(USE_ZLIBRISCOS)
 #  include "zlib-riscos.h"
 # endif
@@ -44,6 +45,8 @@
 #include "filter.h"
 #include "main.h"
 #include "options.h"
+#include "status.h"
+#include "i18n.h"
 
 
 #ifdef __riscos__
@@ -58,6 +61,19 @@ int compress_filter_bz2( void *opaque, int control,
 			 IOBUF a, byte *buf, size_t *ret_len);
 
 #ifdef HAVE_ZIP
+static int
+get_compress_level (void)
+{
+    if( opt.compress_level >= 1 && opt.compress_level <= 9 )
+	return opt.compress_level;
+    else if( opt.compress_level == -1 )
+	return Z_DEFAULT_COMPRESSION;
+    else {
+	log_error("invalid compression level; using default level\n");
+	return Z_DEFAULT_COMPRESSION;
+    }
+}
+
 static void
 init_compress( compress_filter_context_t *zfx, z_stream *zs )
 {
@@ -71,14 +87,7 @@ init_compress( compress_filter_context_t *zfx, z_stream *zs )
         zlib_initialized = riscos_load_module("ZLib", zlib_path, 1);
 #endif
 
-    if( opt.compress_level >= 1 && opt.compress_level <= 9 )
-	level = opt.compress_level;
-    else if( opt.compress_level == -1 )
-	level = Z_DEFAULT_COMPRESSION;
-    else {
-	log_error("invalid compression level; using default level\n");
-	level = Z_DEFAULT_COMPRESSION;
-    }
+    level = get_compress_level ();
 
     if( (rc = zfx->algo == 1? deflateInit2( zs, level, Z_DEFLATED,
 					    -13, 8, Z_DEFAULT_STRATEGY)
@@ -90,7 +99,7 @@ init_compress( compress_filter_context_t *zfx, z_stream *zs )
 						       "unknown error" );
     }
 
-    zfx->outbufsize = 8192;
+    zfx->outbufsize = iobuf_get_buffer_size ();
     zfx->outbuf = xmalloc( zfx->outbufsize );
 }
 
@@ -101,6 +110,11 @@ do_compress( compress_filter_context_t *zfx, z_stream *zs, int flush, IOBUF a )
     int zrc;
     unsigned n;
 
+    /* iobuf_write may have passed all data directly to us, so that
+       we get an empty flush on close; deflate would fail on that.  */
+    if( !zs->avail_in && flush != Z_FINISH )
+	return 0;
+
     do {
 	zs->next_out = BYTEF_CAST (zfx->outbuf);
 	zs->avail_out = zfx->outbufsize;
@@ -131,6 +145,517 @@ do_compress( compress_filter_context_t *zfx, z_stream *zs, int flush, IOBUF a )
     return 0;
 }
 
+
+
+/* Parallel compression as enabled by --compress-threads.  Following
+   the approach of pigz the input is split into blocks of
+   PZ_BLOCK_SIZE bytes which are deflated independently by a pool of
+   threads.  Each block is primed with the tail of the preceding block
+   as dictionary so that little compression is lost.  All but the last
+   block are terminated with a sync flush, so the concatenation of the
+   blocks is a single valid deflate stream.  For ZLIB we write the
+   header and the Adler-32 trailer ourselves.
+
+   The filter itself runs in the main thread which fills the blocks,
+   queues them and writes the results in order.  While waiting for a
+   result it takes part in the compression.  Only zlib code runs
+   without the nPth lock.  */
+
+#define PZ_BLOCK_SIZE (128*1024)
+
+struct pz_job_s
+{
+  struct pz_job_s *next;      /* Next job in output order.  */
+  struct pz_job_s *next_todo; /* Next job waiting for a thread.  */
+  byte *in;
+  size_t inlen;
+  byte *dict;                 /* Tail of the preceding block.  */
+  size_t dictlen;
+  int last;                   /* This is the final block.  */
+  int done;                   /* The job has been processed.  */
+  int zrc;                    /* Z_OK or the zlib error code.  */
+  byte *out;
+  size_t outlen;
+  uLong check;                /* Adler-32 of IN (ZLIB only).  */
+};
+typedef struct pz_job_s *pz_job_t;
+
+struct pz_context_s
+{
+  int algo;
+  int level;
+  int windowbits;         /* Negative value for raw deflate.  */
+  npth_mutex_t lock;      /* Protects the TODO queue and DONE flags.  */
+  npth_cond_t todo_cond;  /* Signalled when a job has been queued.  */
+  npth_cond_t done_cond;  /* Signalled when a job has been done.  */
+  int stop;               /* Tell the threads to terminate.  */
+  int nthreads;
+  npth_t *threads;
+  int maxjobs;            /* Maximum number of jobs in flight.  */
+  pz_job_t todo;          /* Queue of jobs for the threads.  */
+  pz_job_t *todo_tail;
+  pz_job_t head;          /* Queued jobs in output order.  */
+  pz_job_t *tail;
+  int njobs;              /* Length of that list.  */
+  pz_job_t current;       /* The block being filled.  */
+  uLong check;            /* Running Adler-32 for ZLIB.  */
+};
+typedef struct pz_context_s *pz_context_t;
+
+
+static pz_job_t
+pz_new_job (void)
+{
+  pz_job_t job;
+
+  job = xmalloc_clear (sizeof *job);
+  job->in = xmalloc (PZ_BLOCK_SIZE);
+  job->zrc = Z_OK;
+  return job;
+}
+
+
+static void
+pz_release_job (pz_job_t job)
+{
+  if (!job)
+    return;
+  xfree (job->in);
+  xfree (job->dict);
+  xfree (job->out);
+  xfree (job);
+}
+
+
+/* Deflate the block described by JOB.  */
+static void
+pz_deflate_block (pz_context_t pz, pz_job_t job)
+{
+  z_stream zs;
+  size_t outsize;
+  int zrc;
+
+  memset (&zs, 0, sizeof zs);
+  zrc = deflateInit2 (&zs, pz->level, Z_DEFLATED, pz->windowbits,
+                      8, Z_DEFAULT_STRATEGY);
+  if (zrc != Z_OK)
+    {
+      job->zrc = zrc;
+      return;
+    }
+  if (job->dictlen)
+    {
+      zrc = deflateSetDictionary (&zs, job->dict, job->dictlen);
+      if (zrc != Z_OK)
+        {
+          job->zrc = zrc;
+          deflateEnd (&zs);
+          return;
+        }
+    }
+
+  /* The bound covers a Z_FINISH; add room for the sync marker.  */
+  outsize = deflateBound (&zs, job->inlen) + 16;
+  job->out = xmalloc (outsize);
+  zs.next_in = BYTEF_CAST (job->in);
+  zs.avail_in = job->inlen;
+  zs.next_out = BYTEF_CAST (job->out);
+  zs.avail_out = outsize;
+
+  gpg_npth_unprotect ();
+  if (pz->algo == COMPRESS_ALGO_ZLIB)
+    job->check = adler32 (adler32 (0, NULL, 0), job->in, job->inlen);
+  zrc = deflate (&zs, job->last? Z_FINISH : Z_SYNC_FLUSH);
+  gpg_npth_protect ();
+
+  if (job->last && zrc != Z_STREAM_END)
+    job->zrc = zrc == Z_OK? Z_BUF_ERROR : zrc;
+  else if (!job->last && (zrc != Z_OK || zs.avail_in || !zs.avail_out))
+    job->zrc = zrc == Z_OK? Z_BUF_ERROR : zrc;
+  job->outlen = outsize - zs.avail_out;
+  deflateEnd (&zs);
+}
+
+
+/* Take the next job from the queue and process it.  Must be called
+   with PZ->LOCK held; the lock is released while the job runs.  */
+static void
+pz_run_next (pz_context_t pz)
+{
+  pz_job_t job = pz->todo;
+
+  pz->todo = job->next_todo;
+  if (!pz->todo)
+    pz->todo_tail = &pz->todo;
+  npth_mutex_unlock (&pz->lock);
+
+  pz_deflate_block (pz, job);
+
+  npth_mutex_lock (&pz->lock);
+  job->done = 1;
+  npth_cond_broadcast (&pz->done_cond);
+}
+
+
+/* Thread function of the compression threads.  */
+static void *
+pz_worker (void *arg)
+{
+  pz_context_t pz = arg;
+
+  npth_mutex_lock (&pz->lock);
+  for (;;)
+    {
+      if (pz->todo)
+        pz_run_next (pz);
+      else if (pz->stop)
+        break;
+      else
+        npth_cond_wait (&pz->todo_cond, &pz->lock);
+    }
+  npth_mutex_unlock (&pz->lock);
+  return NULL;
+}
+
+
+/* Queue the current block.  LAST indicates the end of the input.  */
+static void
+pz_submit (pz_context_t pz, int last)
+{
+  pz_job_t job = pz->current;
+  pz_job_t next = NULL;
+
+  job->last = last;
+  if (!last)
+    {
+      next = pz_new_job ();
+      next->dictlen = (size_t)1 << -pz->windowbits;
+      if (next->dictlen > job->inlen)
+        next->dictlen = job->inlen;
+      next->dict = xmalloc (next->dictlen);
+      memcpy (next->dict, job->in + job->inlen - next->dictlen,
+              next->dictlen);
+    }
+  pz->current = next;
+
+  *pz->tail = job;
+  pz->tail = &job->next;
+  pz->njobs++;
+
+  npth_mutex_lock (&pz->lock);
+  *pz->todo_tail = job;
+  pz->todo_tail = &job->next_todo;
+  npth_cond_signal (&pz->todo_cond);
+  npth_mutex_unlock (&pz->lock);
+}
+
+
+/* Wait for the oldest queued job, write its output to A and release
+   it.  */
+static int
+pz_write_oldest (pz_context_t pz, IOBUF a)
+{
+  pz_job_t job = pz->head;
+  int rc;
+
+  npth_mutex_lock (&pz->lock);
+  while (!job->done)
+    {
+      if (pz->todo)
+        pz_run_next (pz);
+      else
+        npth_cond_wait (&pz->done_cond, &pz->lock);
+    }
+  npth_mutex_unlock (&pz->lock);
+
+  if (job->zrc != Z_OK)
+    log_fatal ("zlib deflate problem: rc=%d\n", job->zrc);
+  if (DBG_FILTER)
+    log_debug ("pz: block of %u bytes deflated to %u bytes\n",
+               (unsigned int)job->inlen, (unsigned int)job->outlen);
+  if (pz->algo == COMPRESS_ALGO_ZLIB)
+    pz->check = adler32_combine (pz->check, job->check, job->inlen);
+  rc = iobuf_write (a, job->out, job->outlen);
+  if (rc)
+    log_debug ("deflate: iobuf_write failed\n");
+
+  pz->head = job->next;
+  if (!pz->head)
+    pz->tail = &pz->head;
+  pz->njobs--;
+  pz_release_job (job);
+  return rc;
+}
+
+
+static pz_context_t
+pz_start (compress_filter_context_t *zfx, IOBUF a)
+{
+  pz_context_t pz;
+  npth_attr_t tattr;
+  int err, n;
+
+  pz = xmalloc_clear (sizeof *pz);
+  pz->algo = zfx->algo;
+  pz->level = get_compress_level ();
+  pz->windowbits = zfx->algo == COMPRESS_ALGO_ZIP? -13 : -15;
+  pz->todo_tail = &pz->todo;
+  pz->tail = &pz->head;
+  pz->maxjobs = 2 * opt.compress_threads;
+  pz->check = adler32 (0, NULL, 0);
+  pz->current = pz_new_job ();
+
+  gpg_init_npth ();
+  if ((err = npth_mutex_init (&pz->lock, NULL))
+      || (err = npth_cond_init (&pz->todo_cond, NULL))
+      || (err = npth_cond_init (&pz->done_cond, NULL)))
+    log_fatal ("error initializing the compression threads: %s\n",
+               strerror (err));
+
+  if (pz->algo == COMPRESS_ALGO_ZLIB)
+    {
+      /* Same header as written by deflateInit.  */
+      unsigned int head, flevel;
+
+      if (pz->level == Z_DEFAULT_COMPRESSION || pz->level == 6)
+        flevel = 2;
+      else if (pz->level < 2)
+        flevel = 0;
+      else if (pz->level < 6)
+        flevel = 1;
+      else
+        flevel = 3;
+      head = (Z_DEFLATED + ((15 - 8) << 4)) << 8;
+      head |= flevel << 6;
+      head += 31 - (head % 31);
+      iobuf_put (a, head >> 8);
+      iobuf_put (a, head);
+    }
+
+  /* The main thread takes part in the work.  */
+  pz->threads = xcalloc (opt.compress_threads, sizeof *pz->threads);
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (n=1; n < opt.compress_threads; n++)
+    if ((err = npth_create (&pz->threads[n], &tattr, pz_worker, pz)))
+      {
+        log_error ("error spawning compression thread: %s\n",
+                   strerror (err));
+        break;
+      }
+  pz->nthreads = n;
+  npth_attr_destroy (&tattr);
+
+  return pz;
+}
+
+
+/* Write all remaining blocks and release PZ.  */
+static int
+pz_finish (pz_context_t pz, IOBUF a)
+{
+  int rc = 0;
+  int n;
+
+  pz_submit (pz, 1);
+  while (pz->head)
+    {
+      n = pz_write_oldest (pz, a);
+      if (!rc)
+        rc = n;
+    }
+  if (!rc && pz->algo == COMPRESS_ALGO_ZLIB)
+    {
+      iobuf_put (a, pz->check >> 24);
+      iobuf_put (a, pz->check >> 16);
+      iobuf_put (a, pz->check >> 8);
+      rc = iobuf_put (a, pz->check);
+    }
+
+  npth_mutex_lock (&pz->lock);
+  pz->stop = 1;
+  npth_cond_broadcast (&pz->todo_cond);
+  npth_mutex_unlock (&pz->lock);
+  for (n=1; n < pz->nthreads; n++)
+    npth_join (pz->threads[n], NULL);
+  xfree (pz->threads);
+  npth_cond_destroy (&pz->done_cond);
+  npth_cond_destroy (&pz->todo_cond);
+  npth_mutex_destroy (&pz->lock);
+  xfree (pz);
+  return rc;
+}
+
+
+/* Add SIZE bytes from BUF to the parallel compressor.  */
+static int
+pz_write (pz_context_t pz, IOBUF a, const byte *buf, size_t size)
+{
+  pz_job_t job;
+  size_t n;
+  int rc;
+
+  while (size)
+    {
+      job = pz->current;
+      n = PZ_BLOCK_SIZE - job->inlen;
+      if (n > size)
+        n = size;
+      memcpy (job->in + job->inlen, buf, n);
+      job->inlen += n;
+      buf += n;
+      size -= n;
+      if (job->inlen == PZ_BLOCK_SIZE)
+        {
+          pz_submit (pz, 0);
+          while (pz->njobs > pz->maxjobs)
+            if ((rc = pz_write_oldest (pz, a)))
+              return rc;
+        }
+    }
+  return 0;
+}
+
+
+
+
+/* Write the compressed packet header and set up the compressor.  */
+static void
+start_compress (compress_filter_context_t *zfx, IOBUF a)
+{
+  PACKET pkt;
+  PKT_compressed cd;
+  z_stream *zs;
+
+  if (zfx->algo != COMPRESS_ALGO_ZIP && zfx->algo != COMPRESS_ALGO_ZLIB)
+    BUG ();
+  memset (&cd, 0, sizeof cd);
+  cd.len = 0;
+  cd.algorithm = zfx->algo;
+  /* Fixme: We should force a new CTB here:
+     cd.new_ctb = zfx->new_ctb;
+  */
+  init_packet (&pkt);
+  pkt.pkttype = PKT_COMPRESSED;
+  pkt.pkt.compressed = &cd;
+  if (build_packet (a, &pkt))
+    log_bug ("build_packet(PKT_COMPRESSED) failed\n");
+  if (opt.compress_threads > 1)
+    {
+      zfx->opaque = pz_start (zfx, a);
+      zfx->status = 3;
+    }
+  else
+    {
+      zs = zfx->opaque = xmalloc_clear (sizeof *zs);
+      init_compress (zfx, zs);
+      zfx->status = 2;
+    }
+}
+
+
+/* Feed SIZE bytes from BUF to the compressor.  */
+static int
+write_compressed (compress_filter_context_t *zfx, IOBUF a,
+                  byte *buf, size_t size)
+{
+  z_stream *zs = zfx->opaque;
+
+  if (zfx->status == 3)
+    return pz_write (zfx->opaque, a, buf, size);
+
+  zs->next_in = BYTEF_CAST (buf);
+  zs->avail_in = size;
+  return do_compress (zfx, zs, Z_NO_FLUSH, a);
+}
+
+
+/* Probing as enabled by --compress-probe.  The first PROBE_SIZE bytes
+   are collected and compressed at the fastest level.  If that does
+   not save at least PROBE_MIN_SAVING percent, the data is most likely
+   already compressed or encrypted and we write it without a
+   compressed packet.  */
+
+#define PROBE_SIZE (256*1024)
+#define PROBE_MIN_SAVING 3
+
+/* Return the size of BUF after a fast compression in percent of its
+   length LEN.  */
+static int
+probe_ratio (byte *buf, size_t len)
+{
+  z_stream zs;
+  byte *tmp;
+  unsigned long total;
+  int zrc;
+
+  if (!len)
+    return 0;
+
+  memset (&zs, 0, sizeof zs);
+  if (deflateInit2 (&zs, Z_BEST_SPEED, Z_DEFLATED, -15,
+                    8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return 0;
+  tmp = xmalloc (8192);
+  zs.next_in = BYTEF_CAST (buf);
+  zs.avail_in = len;
+  do
+    {
+      zs.next_out = BYTEF_CAST (tmp);
+      zs.avail_out = 8192;
+      zrc = deflate (&zs, Z_FINISH);
+    }
+  while (zrc == Z_OK);
+  total = zs.total_out;
+  deflateEnd (&zs);
+  xfree (tmp);
+
+  if (zrc != Z_STREAM_END)
+    return 0;
+  return (int)(total * 100 / len);
+}
+
+
+/* Decide whether the data collected while probing is worth to be
+   compressed and write it out.  */
+static int
+probe_finish (compress_filter_context_t *zfx, IOBUF a)
+{
+  char status[50];
+  int ratio, rc;
+
+  ratio = probe_ratio (zfx->probebuf, zfx->probelen);
+  if (zfx->probelen && ratio > 100 - PROBE_MIN_SAVING)
+    {
+      if (opt.verbose)
+        log_info (_("data does not compress well (%d%%)"
+                    " - compression skipped\n"), ratio);
+      snprintf (status, sizeof status, "0 %d", ratio);
+      write_status_text (STATUS_COMPRESSION, status);
+      zfx->status = 5;
+      rc = iobuf_write (a, zfx->probebuf, zfx->probelen);
+    }
+  else
+    {
+      if (zfx->probelen)
+        {
+          if (opt.verbose)
+            log_info (_("using %s compression (sample compressed to %d%%)\n"),
+                      compress_algo_to_string (zfx->algo), ratio);
+          snprintf (status, sizeof status, "%d %d", zfx->algo, ratio);
+          write_status_text (STATUS_COMPRESSION, status);
+        }
+      start_compress (zfx, a);
+      rc = write_compressed (zfx, a, zfx->probebuf, zfx->probelen);
+    }
+
+  xfree (zfx->probebuf);
+  zfx->probebuf = NULL;
+  zfx->probelen = 0;
+  return rc;
+}
+
+
 static void
 init_uncompress( compress_filter_context_t *zfx, z_stream *zs )
 {
@@ -154,7 +679,7 @@ init_uncompress( compress_filter_context_t *zfx, z_stream *zs )
 						       "unknown error" );
     }
 
-    zfx->inbufsize = 2048;
+    zfx->inbufsize = iobuf_get_buffer_size ();
     zfx->inbuf = xmalloc( zfx->inbufsize );
     zs->avail_in = 0;
 }
@@ -196,7 +721,9 @@ do_uncompress( compress_filter_context_t *zfx, z_stream *zs,
 	if( DBG_FILTER )
 	    log_debug("enter inflate: avail_in=%u, avail_out=%u\n",
 		    (unsigned)zs->avail_in, (unsigned)zs->avail_out);
+	gpg_npth_unprotect ();
 	zrc = inflate ( zs, Z_SYNC_FLUSH );
+	gpg_npth_protect ();
 	if( DBG_FILTER )
 	    log_debug("leave inflate: avail_in=%u, avail_out=%u, zrc=%d\n",
 		   (unsigned)zs->avail_in, (unsigned)zs->avail_out, zrc);
@@ -240,32 +767,40 @@ compress_filter( void *opaque, int control,
     }
     else if( control == IOBUFCTRL_FLUSH ) {
 	if( !zfx->status ) {
-	    PACKET pkt;
-	    PKT_compressed cd;
-	    if(zfx->algo != COMPRESS_ALGO_ZIP
-	       && zfx->algo != COMPRESS_ALGO_ZLIB)
-	      BUG();
-	    memset( &cd, 0, sizeof cd );
-	    cd.len = 0;
-	    cd.algorithm = zfx->algo;
-            /* Fixme: We should force a new CTB here:
-               cd.new_ctb = zfx->new_ctb;
-            */
-	    init_packet( &pkt );
-	    pkt.pkttype = PKT_COMPRESSED;
-	    pkt.pkt.compressed = &cd;
-	    if( build_packet( a, &pkt ))
-		log_bug("build_packet(PKT_COMPRESSED) failed\n");
-	    zs = zfx->opaque = xmalloc_clear( sizeof *zs );
-	    init_compress( zfx, zs );
-	    zfx->status = 2;
+	    if( opt.compress_probe ) {
+		zfx->probebuf = xmalloc( PROBE_SIZE );
+		zfx->probelen = 0;
+		zfx->status = 4;
+	    }
+	    else
+		start_compress( zfx, a );
+	}
+
+	if( zfx->status == 4 ) {
+	    size_t n = PROBE_SIZE - zfx->probelen;
+
+	    if( n > size )
+		n = size;
+	    memcpy( zfx->probebuf + zfx->probelen, buf, n );
+	    zfx->probelen += n;
+	    buf += n;
+	    size -= n;
+	    if( zfx->probelen == PROBE_SIZE )
+		rc = probe_finish( zfx, a );
 	}
 
-	zs->next_in = BYTEF_CAST (buf);
-	zs->avail_in = size;
-	rc = do_compress( zfx, zs, Z_NO_FLUSH, a );
+	if( rc || !size )
+	    ;
+	else if( zfx->status == 5 )
+	    rc = iobuf_write( a, buf, size );
+	else
+	    rc = write_compressed( zfx, a, buf, size );
     }
     else if( control == IOBUFCTRL_FREE ) {
+	if( zfx->status == 4 ) {
+	    rc = probe_finish( zfx, a );
+	    zs = zfx->opaque;
+	}
 	if( zfx->status == 1 ) {
 	    inflateEnd(zs);
 	    xfree(zs);
@@ -281,6 +816,10 @@ compress_filter( void *opaque, int control,
 	    zfx->opaque = NULL;
 	    xfree(zfx->outbuf); zfx->outbuf = NULL;
 	}
+	else if( zfx->status == 3 ) {
+	    rc = pz_finish( zfx->opaque, a );
+	    zfx->opaque = NULL;
+	}
         if (zfx->release)
           zfx->release (zfx);
     }
@@ -304,6 +843,7 @@ handle_compressed (ctrl_t ctrl, void *procctx, PKT_compressed *cd,
 		   int (*callback)(IOBUF, void *), void *passthru )
 {
     compress_filter_context_t *cfx;
+    pipeline_filter_context_t pfx;
     int rc;
 
     if(check_compress_algo(cd->algorithm))
@@ -312,11 +852,13 @@ handle_compressed (ctrl_t ctrl, void *procctx, PKT_compressed *cd,
     cfx->release = release_context;
     cfx->algo = cd->algorithm;
     push_compress_filter(cd->buf,cfx,cd->algorithm);
+    pfx = push_pipeline_filter (cd->buf);
     if( callback )
 	rc = callback(cd->buf, passthru );
     else
       rc = proc_packets (ctrl,procctx, cd->buf);
     cd->buf = NULL;
+    release_pipeline_context (pfx);
     return rc;
 }
 
@@ -44,6 +44,10 @@
    this is NULL.  */
 static estream_t statusfp;
 
+/* If set, this function returns the stream for the status output of
+   the current thread.  If it returns NULL, STATUSFP is used.  */
+static estream_t (*status_stream_hook) (void);
+
 
 static void
 progress_cb (void *ctx, const char *what, int printchar,
@@ -125,10 +129,33 @@ set_status_fd (int fd)
 }
 
 
+/* Set a function returning the stream for the status output of the
+   current thread.  This is used by the server to send the status
+   lines of a command to its client.  */
+void
+set_status_stream_hook (estream_t (*fnc) (void))
+{
+  status_stream_hook = fnc;
+}
+
+
+/* Return the stream for status output or NULL if output is
+   disabled.  */
+static estream_t
+status_stream (void)
+{
+  estream_t fp;
+
+  if (status_stream_hook && (fp = status_stream_hook ()))
+    return fp;
+  return statusfp;
+}
+
+
 int
 is_status_enabled ()
 {
-  return !!statusfp;
+  return !!status_stream ();
 }
 
 
@@ -142,26 +169,28 @@ write_status ( int no )
 void
 write_status_text (int no, const char *text)
 {
-  if (!statusfp || !status_currently_allowed (no) )
+  estream_t fp = status_stream ();
+
+  if (!fp || !status_currently_allowed (no) )
     return;  /* Not enabled or allowed. */
 
-  es_fputs ("[GNUPG:] ", statusfp);
-  es_fputs (get_status_string (no), statusfp);
+  es_fputs ("[GNUPG:] ", fp);
+  es_fputs (get_status_string (no), fp);
   if ( text )
     {
-      es_putc ( ' ', statusfp);
+      es_putc ( ' ', fp);
       for (; *text; text++)
         {
           if (*text == '\n')
-            es_fputs ("\\n", statusfp);
+            es_fputs ("\\n", fp);
           else if (*text == '\r')
-            es_fputs ("\\r", statusfp);
+            es_fputs ("\\r", fp);
           else
-            es_fputc ( *(const byte *)text, statusfp);
+            es_fputc ( *(const byte *)text, fp);
         }
     }
-  es_putc ('\n', statusfp);
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
+  es_putc ('\n', fp);
+  if (es_fflush (fp) && opt.exit_on_status_write_error)
     g10_exit (0);
 }
 
@@ -170,12 +199,14 @@ write_status_text (int no, const char *text)
 void
 write_status_error (const char *where, gpg_error_t err)
 {
-  if (!statusfp || !status_currently_allowed (STATUS_ERROR))
+  estream_t fp = status_stream ();
+
+  if (!fp || !status_currently_allowed (STATUS_ERROR))
     return;  /* Not enabled or allowed. */
 
-  es_fprintf (statusfp, "[GNUPG:] %s %s %u\n",
+  es_fprintf (fp, "[GNUPG:] %s %s %u\n",
               get_status_string (STATUS_ERROR), where, err);
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
+  if (es_fflush (fp) && opt.exit_on_status_write_error)
     g10_exit (0);
 }
 
@@ -184,12 +215,14 @@ write_status_error (const char *where, gpg_error_t err)
 void
 write_status_errcode (const char *where, int errcode)
 {
-  if (!statusfp || !status_currently_allowed (STATUS_ERROR))
+  estream_t fp = status_stream ();
+
+  if (!fp || !status_currently_allowed (STATUS_ERROR))
     return;  /* Not enabled or allowed. */
 
-  es_fprintf (statusfp, "[GNUPG:] %s %s %u\n",
+  es_fprintf (fp, "[GNUPG:] %s %s %u\n",
               get_status_string (STATUS_ERROR), where, gpg_err_code (errcode));
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
+  if (es_fflush (fp) && opt.exit_on_status_write_error)
     g10_exit (0);
 }
 
@@ -204,12 +237,13 @@ void
 write_status_text_and_buffer (int no, const char *string,
                               const char *buffer, size_t len, int wrap)
 {
+  estream_t fp = status_stream ();
   const char *s, *text;
   int esc, first;
   int lower_limit = ' ';
   size_t n, count, dowrap;
 
-  if (!statusfp || !status_currently_allowed (no))
+  if (!fp || !status_currently_allowed (no))
     return;  /* Not enabled or allowed. */
 
   if (wrap == -1)
@@ -224,16 +258,16 @@ write_status_text_and_buffer (int no, const char *string,
     {
       if (dowrap)
         {
-          es_fprintf (statusfp, "[GNUPG:] %s ", text);
+          es_fprintf (fp, "[GNUPG:] %s ", text);
           count = dowrap = 0;
           if (first && string)
             {
-              es_fputs (string, statusfp);
+              es_fputs (string, fp);
               count += strlen (string);
               /* Make sure that there is a space after the string.  */
               if (*string && string[strlen (string)-1] != ' ')
                 {
-                  es_putc (' ', statusfp);
+                  es_putc (' ', fp);
                   count++;
                 }
             }
@@ -255,21 +289,21 @@ write_status_text_and_buffer (int no, const char *string,
           s--; n++;
         }
       if (s != buffer)
-        es_fwrite (buffer, s-buffer, 1, statusfp);
+        es_fwrite (buffer, s-buffer, 1, fp);
       if ( esc )
         {
-          es_fprintf (statusfp, "%%%02X", *(const byte*)s );
+          es_fprintf (fp, "%%%02X", *(const byte*)s );
           s++; n--;
         }
       buffer = s;
       len = n;
       if (dowrap && len)
-        es_putc ('\n', statusfp);
+        es_putc ('\n', fp);
     }
   while (len);
 
-  es_putc ('\n',statusfp);
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
+  es_putc ('\n',fp);
+  if (es_fflush (fp) && opt.exit_on_status_write_error)
     g10_exit (0);
 }
 
@@ -359,7 +393,7 @@ do_get_from_fd ( const char *keyword, int hidden, int getbool )
   int i, len;
   char *string;
 
-  if (statusfp != es_stdout)
+  if (status_stream () != es_stdout)
     es_fflush (es_stdout);
 
   write_status_text (getbool? STATUS_GET_BOOL :
@@ -28,9 +28,11 @@
 #include "util.h"
 #include "packet.h"
 #include "cipher.h"
+#include "filter.h"
 #include "options.h"
 #include "i18n.h"
 #include "status.h"
+#include "main.h"
 
 
 static int mdc_decode_filter ( void *opaque, int control, IOBUF a,
@@ -78,6 +80,7 @@ int
 decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek)
 {
   decode_filter_ctx_t dfx;
+  pipeline_filter_context_t pfx;
   byte *p;
   int rc=0, c, i;
   byte temp[32];
@@ -199,9 +202,12 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek)
     iobuf_push_filter ( ed->buf, mdc_decode_filter, dfx );
   else
     iobuf_push_filter ( ed->buf, decode_filter, dfx );
+  pfx = push_pipeline_filter (ed->buf);
 
   proc_packets (ctrl, procctx, ed->buf );
   ed->buf = NULL;
+  /* The pipeline thread must not touch DFX while we check it.  */
+  release_pipeline_context (pfx);
   if (dfx->eof_seen > 1 )
     rc = gpg_error (GPG_ERR_INV_PACKET);
   else if ( ed->mdc_method )
@@ -359,10 +365,12 @@ mdc_decode_filter (void *opaque, int control, IOBUF a,
 
       if ( n )
         {
+          gpg_npth_unprotect ();
           if ( dfx->cipher_hd )
             gcry_cipher_decrypt (dfx->cipher_hd, buf, n, NULL, 0);
           if ( dfx->mdc_hash )
             gcry_md_write (dfx->mdc_hash, buf, n);
+          gpg_npth_protect ();
 	}
       else
         {
@@ -431,8 +439,10 @@ decode_filter( void *opaque, int control, IOBUF a, byte *buf, size_t *ret_len)
         }
       if (n)
         {
+          gpg_npth_unprotect ();
           if (fc->cipher_hd)
             gcry_cipher_decrypt (fc->cipher_hd, buf, n, NULL, 0);
+          gpg_npth_protect ();
         }
       else
         {
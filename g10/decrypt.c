@@ -98,9 +98,10 @@ decrypt_message (ctrl_t ctrl, const char *filename)
 
 
 /* Same as decrypt_message but takes a file descriptor for input and
-   output.  */
+   writes the plaintext to the stream OUTPUT.  OUTPUT is not closed
+   by this function.  */
 gpg_error_t
-decrypt_message_fd (ctrl_t ctrl, int input_fd, int output_fd)
+decrypt_message_fd (ctrl_t ctrl, int input_fd, estream_t output)
 {
   gpg_error_t err;
   IOBUF fp;
@@ -131,23 +132,7 @@ decrypt_message_fd (ctrl_t ctrl, int input_fd, int output_fd)
       return err;
     }
 
-#ifdef HAVE_W32CE_SYSTEM
-#warning Need to fix this if we want to use g13
-  opt.outfp = NULL;
-#else
-  opt.outfp = es_fdopen_nc (output_fd, "wb");
-#endif
-  if (!opt.outfp)
-    {
-      char xname[64];
-
-      err = gpg_error_from_syserror ();
-      snprintf (xname, sizeof xname, "[fd %d]", output_fd);
-      log_error (_("can't open '%s': %s\n"), xname, gpg_strerror (err));
-      iobuf_close (fp);
-      release_progress_context (pfx);
-      return err;
-    }
+  opt.outfp = output;
 
   if (!opt.no_armor)
     {
@@ -161,7 +146,6 @@ decrypt_message_fd (ctrl_t ctrl, int input_fd, int output_fd)
   err = proc_encryption_packets (ctrl, NULL, fp );
 
   iobuf_close (fp);
-  es_fclose (opt.outfp);
   opt.outfp = NULL;
   release_armor_context (afx);
   release_progress_context (pfx);
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "options.h"
@@ -370,15 +371,17 @@ encrypt_simple (const char *filename, int mode, int use_seskey)
     {
       /* User requested not to create a literal packet, so we copy the
          plain data.  */
-    byte copy_buffer[4096];
+    unsigned int copy_size = iobuf_get_buffer_size ();
+    byte *copy_buffer = xmalloc (copy_size);
     int  bytes_copied;
-    while ((bytes_copied = iobuf_read(inp, copy_buffer, 4096)) != -1)
+    while ((bytes_copied = iobuf_read(inp, copy_buffer, copy_size)) != -1)
       if ( (rc=iobuf_write(out, copy_buffer, bytes_copied)) ) {
         log_error ("copying input to output failed: %s\n",
                    gpg_strerror (rc) );
         break;
       }
-    wipememory (copy_buffer, 4096); /* burn buffer */
+    wipememory (copy_buffer, copy_size); /* burn buffer */
+    xfree (copy_buffer);
     }
 
   /* Finish the stuff.  */
@@ -730,9 +733,10 @@ encrypt_crypt (ctrl_t ctrl, int filefd, const char *filename,
     {
       /* User requested not to create a literal packet, so we copy the
          plain data. */
-      byte copy_buffer[4096];
+      unsigned int copy_size = iobuf_get_buffer_size ();
+      byte *copy_buffer = xmalloc (copy_size);
       int  bytes_copied;
-      while ((bytes_copied = iobuf_read (inp, copy_buffer, 4096)) != -1)
+      while ((bytes_copied = iobuf_read (inp, copy_buffer, copy_size)) != -1)
         {
           rc = iobuf_write (out, copy_buffer, bytes_copied);
           if (rc)
@@ -742,7 +746,8 @@ encrypt_crypt (ctrl_t ctrl, int filefd, const char *filename,
               break;
             }
         }
-      wipememory (copy_buffer, 4096); /* Burn the buffer. */
+      wipememory (copy_buffer, copy_size); /* Burn the buffer. */
+      xfree (copy_buffer);
     }
 
   /* Finish the stuff. */
@@ -862,6 +867,84 @@ encrypt_filter (void *opaque, int control,
 }
 
 
+/* The work queue of write_pubkey_enc_from_list.  */
+struct pubkey_enc_queue
+{
+  struct pubkey_enc_job
+  {
+    PKT_public_key *pk;
+    PKT_pubkey_enc *enc;
+    gcry_mpi_t frame;
+    int rc;
+  } *jobs;
+  int njobs;
+  int next;  /* Index of the next job to take.  */
+};
+
+
+/* Thread function for write_pubkey_enc_from_list.  The worker holds
+   the global nPth lock, which also protects NEXT; pk_encrypt releases
+   it for the public key operation itself.  */
+static void *
+pubkey_enc_worker (void *arg)
+{
+  struct pubkey_enc_queue *queue = arg;
+  struct pubkey_enc_job *job;
+
+  while (queue->next < queue->njobs)
+    {
+      job = queue->jobs + queue->next++;
+      job->rc = pk_encrypt (job->pk->pubkey_algo, job->enc->data,
+                            job->frame, job->pk, job->pk->pkey);
+    }
+  return NULL;
+}
+
+
+/* Run the jobs of QUEUE using up to opt.recipient_jobs threads.  */
+static void
+run_pubkey_enc_jobs (struct pubkey_enc_queue *queue)
+{
+  struct pubkey_enc_job *job;
+  npth_t *threads;
+  npth_attr_t tattr;
+  int nthreads, n, err;
+
+  nthreads = opt.recipient_jobs;
+  if (nthreads > queue->njobs)
+    nthreads = queue->njobs;
+  if (nthreads < 2)
+    {
+      for (n=0; n < queue->njobs; n++)
+        {
+          job = queue->jobs + n;
+          job->rc = pk_encrypt (job->pk->pubkey_algo, job->enc->data,
+                                job->frame, job->pk, job->pk->pkey);
+        }
+      return;
+    }
+
+  gpg_init_npth ();
+
+  threads = xcalloc (nthreads, sizeof *threads);
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  /* The main thread takes part in the work.  */
+  for (n=1; n < nthreads; n++)
+    if ((err = npth_create (&threads[n], &tattr, pubkey_enc_worker, queue)))
+      {
+        log_error ("error spawning encryption thread: %s\n", strerror (err));
+        break;
+      }
+  nthreads = n;
+  npth_attr_destroy (&tattr);
+  pubkey_enc_worker (queue);
+  for (n=1; n < nthreads; n++)
+    npth_join (threads[n], NULL);
+  xfree (threads);
+}
+
+
 /*
  * Write pubkey-enc packets from the list of PKs to OUT.
  */
@@ -871,19 +954,26 @@ write_pubkey_enc_from_list (PK_LIST pk_list, DEK *dek, iobuf_t out)
   PACKET pkt;
   PKT_public_key *pk;
   PKT_pubkey_enc  *enc;
-  int rc;
+  struct pubkey_enc_queue queue;
+  struct pubkey_enc_job *job;
+  PK_LIST r;
+  int rc = 0;
+  int i;
 
-  for ( ; pk_list; pk_list = pk_list->next )
-    {
-      gcry_mpi_t frame;
+  memset (&queue, 0, sizeof queue);
+  for (r = pk_list; r; r = r->next)
+    queue.njobs++;
+  queue.jobs = xcalloc (queue.njobs? queue.njobs : 1, sizeof *queue.jobs);
 
-      pk = pk_list->pk;
+  for (i=0, r = pk_list; r; r = r->next, i++)
+    {
+      pk = r->pk;
 
       print_pubkey_algo_note ( pk->pubkey_algo );
       enc = xmalloc_clear ( sizeof *enc );
       enc->pubkey_algo = pk->pubkey_algo;
       keyid_from_pk( pk, enc->keyid );
-      enc->throw_keyid = (opt.throw_keyid || (pk_list->flags&1));
+      enc->throw_keyid = (opt.throw_keyid || (r->flags&1));
 
       if (opt.throw_keyid && (PGP2 || PGP6 || PGP7 || PGP8))
         {
@@ -903,38 +993,54 @@ write_pubkey_enc_from_list (PK_LIST pk_list, DEK *dek, iobuf_t out)
        * array has a size which depends on the used algorithm (e.g. 2
        * for Elgamal).  We don't need frame anymore because we have
        * everything now in enc->data which is the passed to
-       * build_packet().  */
-      frame = encode_session_key (pk->pubkey_algo, dek,
-                                  pubkey_nbits (pk->pubkey_algo, pk->pkey));
-      rc = pk_encrypt (pk->pubkey_algo, enc->data, frame, pk, pk->pkey);
-      gcry_mpi_release (frame);
-      if (rc)
-        log_error ("pubkey_encrypt failed: %s\n", gpg_strerror (rc) );
-      else
+       * build_packet().  The encryption for all recipients is done
+       * by run_pubkey_enc_jobs, possibly in parallel.  */
+      job = queue.jobs + i;
+      job->pk = pk;
+      job->enc = enc;
+      job->frame = encode_session_key (pk->pubkey_algo, dek,
+                                       pubkey_nbits (pk->pubkey_algo,
+                                                     pk->pkey));
+    }
+
+  run_pubkey_enc_jobs (&queue);
+
+  /* Write the packets in the order of PK_LIST.  */
+  for (i=0; i < queue.njobs; i++)
+    {
+      job = queue.jobs + i;
+      enc = job->enc;
+      gcry_mpi_release (job->frame);
+      if (!rc)
         {
-          if ( opt.verbose )
-            {
-              char *ustr = get_user_id_string_native (enc->keyid);
-              log_info (_("%s/%s encrypted for: \"%s\"\n"),
-                        openpgp_pk_algo_name (enc->pubkey_algo),
-                        openpgp_cipher_algo_name (dek->algo),
-                        ustr );
-              xfree (ustr);
-	    }
-          /* And write it. */
-          init_packet (&pkt);
-          pkt.pkttype = PKT_PUBKEY_ENC;
-          pkt.pkt.pubkey_enc = enc;
-          rc = build_packet (out, &pkt);
+          rc = job->rc;
           if (rc)
-            log_error ("build_packet(pubkey_enc) failed: %s\n",
-                       g10_errstr (rc));
-	}
-      free_pubkey_enc(enc);
-      if (rc)
-        return rc;
+            log_error ("pubkey_encrypt failed: %s\n", gpg_strerror (rc) );
+          else
+            {
+              if ( opt.verbose )
+                {
+                  char *ustr = get_user_id_string_native (enc->keyid);
+                  log_info (_("%s/%s encrypted for: \"%s\"\n"),
+                            openpgp_pk_algo_name (enc->pubkey_algo),
+                            openpgp_cipher_algo_name (dek->algo),
+                            ustr );
+                  xfree (ustr);
+                }
+              /* And write it. */
+              init_packet (&pkt);
+              pkt.pkttype = PKT_PUBKEY_ENC;
+              pkt.pkt.pubkey_enc = enc;
+              rc = build_packet (out, &pkt);
+              if (rc)
+                log_error ("build_packet(pubkey_enc) failed: %s\n",
+                           g10_errstr (rc));
+            }
+        }
+      free_pubkey_enc (enc);
     }
-  return 0;
+  xfree (queue.jobs);
+  return rc;
 }
 
 
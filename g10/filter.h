@@ -84,6 +84,8 @@ struct compress_filter_context_s {
     int algo;	 /* compress algo */
     int algo1hack;
     int new_ctb;
+    byte *probebuf;  /* Start of the data while probing.  */
+    size_t probelen;
     void (*release)(struct compress_filter_context_s*);
 };
 typedef struct compress_filter_context_s compress_filter_context_t;
@@ -97,6 +99,8 @@ typedef struct {
     gcry_md_hd_t mdc_hash;
     byte enchash[20];
     int create_mdc; /* flag will be set by the cipher filter */
+    byte *buffer;   /* Buffer for the ciphertext.  */
+    size_t buffer_size;
 } cipher_filter_context_t;
 
 
@@ -124,6 +128,8 @@ typedef struct {
     int  refcount;
 } progress_filter_context_t;
 
+typedef struct pipeline_filter_context_s *pipeline_filter_context_t;
+
 /* encrypt_filter_context_t defined in main.h */
 
 /*-- mdfilter.c --*/
@@ -154,6 +160,10 @@ int text_filter( void *opaque, int control,
 int copy_clearsig_text (iobuf_t out, iobuf_t inp, gcry_md_hd_t md,
                         int escape_dash, int escape_from, int pgp2mode);
 
+/*-- pipeline.c --*/
+pipeline_filter_context_t push_pipeline_filter (iobuf_t a);
+void release_pipeline_context (pipeline_filter_context_t pfx);
+
 /*-- progress.c --*/
 progress_filter_context_t *new_progress_context (void);
 void release_progress_context (progress_filter_context_t *pfx);
@@ -62,8 +62,8 @@ free_seckey_enc( PKT_signature *sig )
     mpi_release( sig->data[i] );
 
   xfree(sig->revkey);
-  xfree(sig->hashed);
-  xfree(sig->unhashed);
+  pkt_arena_free (sig->hashed);
+  pkt_arena_free (sig->unhashed);
 
   if (sig->pka_info)
     {
@@ -71,7 +71,7 @@ free_seckey_enc( PKT_signature *sig )
       xfree (sig->pka_info);
     }
 
-  xfree(sig);
+  pkt_arena_free (sig);
 }
 
 
@@ -296,7 +296,7 @@ free_user_id (PKT_user_id *uid)
     free_attributes(uid);
     xfree (uid->prefs);
     xfree (uid->namehash);
-    xfree (uid);
+    pkt_arena_free (uid);
 }
 
 void
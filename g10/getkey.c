@@ -30,6 +30,7 @@
 #include "packet.h"
 #include "iobuf.h"
 #include "keydb.h"
+#include "keyring.h"
 #include "options.h"
 #include "main.h"
 #include "trustdb.h"
@@ -74,42 +75,76 @@ static struct
 typedef struct keyid_list
 {
   struct keyid_list *next;
+  struct keyid_list *hnext;    /* Next in the hash bucket.  */
+  struct user_id_db *owner;    /* The user ID cache entry.  */
   u32 keyid[2];
 } *keyid_list_t;
 
 
 #if MAX_PK_CACHE_ENTRIES
+/* The public key cache is a hash table indexed by the low 32 bit of
+   the key ID.  All entries are also linked into a list ordered by
+   their last use, so that the least recently used entry can be
+   evicted if the cache is full.  */
+#define PK_CACHE_BUCKETS 1024  /* Must be a power of 2.  */
 typedef struct pk_cache_entry
 {
-  struct pk_cache_entry *next;
+  struct pk_cache_entry *next;       /* Next in the hash bucket.  */
+  struct pk_cache_entry *lru_prev;   /* More recently used entry.  */
+  struct pk_cache_entry *lru_next;   /* Less recently used entry.  */
   u32 keyid[2];
   PKT_public_key *pk;
 } *pk_cache_entry_t;
-static pk_cache_entry_t pk_cache;
+static pk_cache_entry_t pk_cache[PK_CACHE_BUCKETS];
+static pk_cache_entry_t pk_cache_lru_head;  /* Most recently used.  */
+static pk_cache_entry_t pk_cache_lru_tail;  /* Least recently used.  */
 static int pk_cache_entries;	/* Number of entries in pk cache.  */
 static int pk_cache_disabled;
+static struct
+{
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+} pk_cache_stats;
 #endif
 
 #if MAX_UID_CACHE_ENTRIES < 5
 #error we really need the userid cache
 #endif
+/* The user ID cache maps the key IDs of all keys of a keyblock to
+   the primary user ID.  The key IDs are indexed by a hash table and
+   the entries are kept in a list ordered by their last use, so that
+   the least recently used entry can be evicted if the cache is
+   full.  */
+#define UID_CACHE_BUCKETS 1024  /* Must be a power of 2.  */
 typedef struct user_id_db
 {
-  struct user_id_db *next;
+  struct user_id_db *lru_prev;  /* More recently used entry.  */
+  struct user_id_db *lru_next;  /* Less recently used entry.  */
   keyid_list_t keyids;
   int len;
   char name[1];
 } *user_id_db_t;
-static user_id_db_t user_id_db;
+static keyid_list_t uid_cache[UID_CACHE_BUCKETS];
+static user_id_db_t uid_cache_lru_head;  /* Most recently used.  */
+static user_id_db_t uid_cache_lru_tail;  /* Least recently used.  */
 static int uid_cache_entries;	/* Number of entries in uid cache. */
+static struct
+{
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+} uid_cache_stats;
 
 static void merge_selfsigs (kbnode_t keyblock);
 static int lookup (getkey_ctx_t ctx, kbnode_t *ret_keyblock, int want_secret);
+static int finish_lookup (getkey_ctx_t ctx);
 
-#if 0
-static void
-print_stats ()
+/* Print statistics about the key lookups and the caches.  */
+void
+getkey_print_stats (void)
 {
+#if 0
   int i;
   for (i = 0; i < DIM (lkup_stats); i++)
     {
@@ -120,15 +155,111 @@ print_stats ()
 		 lkup_stats[i].okay_count,
 		 lkup_stats[i].nokey_count, lkup_stats[i].error_count);
     }
-}
 #endif
+#if MAX_PK_CACHE_ENTRIES
+  log_info ("pk cache: entries=%d/%d hits=%lu misses=%lu evictions=%lu%s\n",
+            pk_cache_entries, MAX_PK_CACHE_ENTRIES,
+            pk_cache_stats.hits, pk_cache_stats.misses,
+            pk_cache_stats.evictions,
+            pk_cache_disabled? " (disabled)":"");
+#endif
+  log_info ("uid cache: entries=%d/%d hits=%lu misses=%lu evictions=%lu\n",
+            uid_cache_entries, MAX_UID_CACHE_ENTRIES,
+            uid_cache_stats.hits, uid_cache_stats.misses,
+            uid_cache_stats.evictions);
+}
+
+
+#if MAX_PK_CACHE_ENTRIES
+static inline pk_cache_entry_t *
+pk_cache_bucket (u32 *keyid)
+{
+  return &pk_cache[keyid[1] & (PK_CACHE_BUCKETS - 1)];
+}
+
+
+/* Unlink entry CE from the LRU list.  */
+static void
+pk_cache_lru_unlink (pk_cache_entry_t ce)
+{
+  if (ce->lru_prev)
+    ce->lru_prev->lru_next = ce->lru_next;
+  else
+    pk_cache_lru_head = ce->lru_next;
+  if (ce->lru_next)
+    ce->lru_next->lru_prev = ce->lru_prev;
+  else
+    pk_cache_lru_tail = ce->lru_prev;
+  ce->lru_prev = ce->lru_next = NULL;
+}
+
+
+/* Put entry CE at the head of the LRU list.  */
+static void
+pk_cache_lru_push (pk_cache_entry_t ce)
+{
+  ce->lru_prev = NULL;
+  ce->lru_next = pk_cache_lru_head;
+  if (pk_cache_lru_head)
+    pk_cache_lru_head->lru_prev = ce;
+  else
+    pk_cache_lru_tail = ce;
+  pk_cache_lru_head = ce;
+}
+
+
+/* Return the cache entry for KEYID or NULL if it is not cached.  A
+   found entry is marked as the most recently used one.  */
+static pk_cache_entry_t
+pk_cache_lookup (u32 *keyid)
+{
+  pk_cache_entry_t ce;
+
+  for (ce = *pk_cache_bucket (keyid); ce; ce = ce->next)
+    if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
+      {
+        if (ce != pk_cache_lru_head)
+          {
+            pk_cache_lru_unlink (ce);
+            pk_cache_lru_push (ce);
+          }
+        pk_cache_stats.hits++;
+        return ce;
+      }
+  pk_cache_stats.misses++;
+  return NULL;
+}
+
+
+/* Remove the least recently used entry from the cache.  */
+static void
+pk_cache_evict (void)
+{
+  pk_cache_entry_t ce, *cep;
+
+  ce = pk_cache_lru_tail;
+  if (!ce)
+    return;
+  pk_cache_lru_unlink (ce);
+  for (cep = pk_cache_bucket (ce->keyid); *cep; cep = &(*cep)->next)
+    if (*cep == ce)
+      {
+        *cep = ce->next;
+        break;
+      }
+  free_public_key (ce->pk);
+  xfree (ce);
+  pk_cache_entries--;
+  pk_cache_stats.evictions++;
+}
+#endif /*MAX_PK_CACHE_ENTRIES*/
 
 
 void
 cache_public_key (PKT_public_key * pk)
 {
 #if MAX_PK_CACHE_ENTRIES
-  pk_cache_entry_t ce;
+  pk_cache_entry_t ce, *bucket;
   u32 keyid[2];
 
   if (pk_cache_disabled)
@@ -148,7 +279,8 @@ cache_public_key (PKT_public_key * pk)
   else
     return; /* Don't know how to get the keyid.  */
 
-  for (ce = pk_cache; ce; ce = ce->next)
+  bucket = pk_cache_bucket (keyid);
+  for (ce = *bucket; ce; ce = ce->next)
     if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
       {
 	if (DBG_CACHE)
@@ -157,17 +289,13 @@ cache_public_key (PKT_public_key * pk)
       }
 
   if (pk_cache_entries >= MAX_PK_CACHE_ENTRIES)
-    {
-      /* fixme: Use another algorithm to free some cache slots.  */
-      pk_cache_disabled = 1;
-      if (opt.verbose > 1)
-	log_info (_("too many entries in pk cache - disabled\n"));
-      return;
-    }
+    pk_cache_evict ();
+
   pk_cache_entries++;
   ce = xmalloc (sizeof *ce);
-  ce->next = pk_cache;
-  pk_cache = ce;
+  ce->next = *bucket;
+  *bucket = ce;
+  pk_cache_lru_push (ce);
   ce->pk = copy_public_key (NULL, pk);
   ce->keyid[0] = keyid[0];
   ce->keyid[1] = keyid[1];
@@ -227,6 +355,83 @@ release_keyid_list (keyid_list_t k)
     }
 }
 
+
+static inline keyid_list_t *
+uid_cache_bucket (u32 *keyid)
+{
+  return &uid_cache[keyid[1] & (UID_CACHE_BUCKETS - 1)];
+}
+
+
+/* Return the user ID cache entry for KEYID or NULL if it is not
+   cached.  Unless NOSTATS is set, a found entry is marked as the
+   most recently used one and the statistics are updated.  */
+static user_id_db_t
+uid_cache_lookup (u32 *keyid, int nostats)
+{
+  keyid_list_t a;
+  user_id_db_t r;
+
+  for (a = *uid_cache_bucket (keyid); a; a = a->hnext)
+    if (a->keyid[0] == keyid[0] && a->keyid[1] == keyid[1])
+      break;
+  if (nostats)
+    return a? a->owner : NULL;
+  if (!a)
+    {
+      uid_cache_stats.misses++;
+      return NULL;
+    }
+
+  uid_cache_stats.hits++;
+  r = a->owner;
+  if (r != uid_cache_lru_head)
+    {
+      /* Move to the head of the LRU list.  */
+      r->lru_prev->lru_next = r->lru_next;
+      if (r->lru_next)
+        r->lru_next->lru_prev = r->lru_prev;
+      else
+        uid_cache_lru_tail = r->lru_prev;
+      r->lru_prev = NULL;
+      r->lru_next = uid_cache_lru_head;
+      uid_cache_lru_head->lru_prev = r;
+      uid_cache_lru_head = r;
+    }
+  return r;
+}
+
+
+/* Remove the least recently used entry from the user ID cache.  */
+static void
+uid_cache_evict (void)
+{
+  user_id_db_t r;
+  keyid_list_t a, *ap;
+
+  r = uid_cache_lru_tail;
+  if (!r)
+    return;
+  uid_cache_lru_tail = r->lru_prev;
+  if (uid_cache_lru_tail)
+    uid_cache_lru_tail->lru_next = NULL;
+  else
+    uid_cache_lru_head = NULL;
+
+  for (a = r->keyids; a; a = a->next)
+    for (ap = uid_cache_bucket (a->keyid); *ap; ap = &(*ap)->hnext)
+      if (*ap == a)
+        {
+          *ap = a->hnext;
+          break;
+        }
+  release_keyid_list (r->keyids);
+  xfree (r);
+  uid_cache_entries--;
+  uid_cache_stats.evictions++;
+}
+
+
 /****************
  * Store the association of keyid and userid
  * Feed only public keys to this function.
@@ -238,6 +443,7 @@ cache_user_id (KBNODE keyblock)
   const char *uid;
   size_t uidlen;
   keyid_list_t keyids = NULL;
+  keyid_list_t a, *bucket;
   KBNODE k;
 
   for (k = keyblock; k; k = k->next)
@@ -245,27 +451,19 @@ cache_user_id (KBNODE keyblock)
       if (k->pkt->pkttype == PKT_PUBLIC_KEY
 	  || k->pkt->pkttype == PKT_PUBLIC_SUBKEY)
 	{
-	  keyid_list_t a = xmalloc_clear (sizeof *a);
+	  a = xmalloc_clear (sizeof *a);
 	  /* Hmmm: For a long list of keyids it might be an advantage
 	   * to append the keys.  */
 	  keyid_from_pk (k->pkt->pkt.public_key, a->keyid);
 	  /* First check for duplicates.  */
-	  for (r = user_id_db; r; r = r->next)
-	    {
-	      keyid_list_t b = r->keyids;
-	      for (b = r->keyids; b; b = b->next)
-		{
-		  if (b->keyid[0] == a->keyid[0]
-		      && b->keyid[1] == a->keyid[1])
-		    {
-		      if (DBG_CACHE)
-			log_debug ("cache_user_id: already in cache\n");
-		      release_keyid_list (keyids);
-		      xfree (a);
-		      return;
-		    }
-		}
-	    }
+          if (uid_cache_lookup (a->keyid, 1))
+            {
+              if (DBG_CACHE)
+                log_debug ("cache_user_id: already in cache\n");
+              release_keyid_list (keyids);
+              xfree (a);
+              return;
+            }
 	  /* Now put it into the cache.  */
 	  a->next = keyids;
 	  keyids = a;
@@ -278,20 +476,26 @@ cache_user_id (KBNODE keyblock)
   uid = get_primary_uid (keyblock, &uidlen);
 
   if (uid_cache_entries >= MAX_UID_CACHE_ENTRIES)
-    {
-      /* fixme: use another algorithm to free some cache slots */
-      r = user_id_db;
-      user_id_db = r->next;
-      release_keyid_list (r->keyids);
-      xfree (r);
-      uid_cache_entries--;
-    }
+    uid_cache_evict ();
+
   r = xmalloc (sizeof *r + uidlen - 1);
   r->keyids = keyids;
   r->len = uidlen;
   memcpy (r->name, uid, r->len);
-  r->next = user_id_db;
-  user_id_db = r;
+  for (a = keyids; a; a = a->next)
+    {
+      a->owner = r;
+      bucket = uid_cache_bucket (a->keyid);
+      a->hnext = *bucket;
+      *bucket = a;
+    }
+  r->lru_prev = NULL;
+  r->lru_next = uid_cache_lru_head;
+  if (uid_cache_lru_head)
+    uid_cache_lru_head->lru_prev = r;
+  else
+    uid_cache_lru_tail = r;
+  uid_cache_lru_head = r;
   uid_cache_entries++;
 }
 
@@ -300,19 +504,9 @@ void
 getkey_disable_caches ()
 {
 #if MAX_PK_CACHE_ENTRIES
-  {
-    pk_cache_entry_t ce, ce2;
-
-    for (ce = pk_cache; ce; ce = ce2)
-      {
-	ce2 = ce->next;
-	free_public_key (ce->pk);
-	xfree (ce);
-      }
-    pk_cache_disabled = 1;
-    pk_cache_entries = 0;
-    pk_cache = NULL;
-  }
+  while (pk_cache_lru_tail)
+    pk_cache_evict ();
+  pk_cache_disabled = 1;
 #endif
   /* fixme: disable user id cache ? */
 }
@@ -344,15 +538,12 @@ get_pubkey (PKT_public_key * pk, u32 * keyid)
       /* Try to get it from the cache.  We don't do this when pk is
          NULL as it does not guarantee that the user IDs are
          cached. */
-      pk_cache_entry_t ce;
-      for (ce = pk_cache; ce; ce = ce->next)
-	{
-	  if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-	    {
-	      copy_public_key (pk, ce->pk);
-	      return 0;
-	    }
-	}
+      pk_cache_entry_t ce = pk_cache_lookup (keyid);
+      if (ce)
+        {
+          copy_public_key (pk, ce->pk);
+          return 0;
+        }
     }
 #endif
   /* More init stuff.  */
@@ -415,16 +606,13 @@ get_pubkey_fast (PKT_public_key * pk, u32 * keyid)
 #if MAX_PK_CACHE_ENTRIES
   {
     /* Try to get it from the cache */
-    pk_cache_entry_t ce;
+    pk_cache_entry_t ce = pk_cache_lookup (keyid);
 
-    for (ce = pk_cache; ce; ce = ce->next)
+    if (ce)
       {
-	if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-	  {
-	    if (pk)
-	      copy_public_key (pk, ce->pk);
-	    return 0;
-	  }
+        if (pk)
+          copy_public_key (pk, ce->pk);
+        return 0;
       }
   }
 #endif
@@ -908,6 +1096,192 @@ get_pubkey_bynames (GETKEY_CTX * retctx, PKT_public_key * pk,
   return key_byname (retctx, names, pk, 0, 1, ret_keyblock, NULL);
 }
 
+/* Return true if KEYBLOCK contains a key or a usable user ID
+   matching DESC.  The matching node is flagged the same way as done
+   by keydb_get_keyblock.  */
+static int
+keyblock_matches_desc (kbnode_t keyblock, KEYDB_SEARCH_DESC *desc)
+{
+  kbnode_t node;
+  PKT_public_key *pk;
+  PKT_user_id *uid;
+  u32 kid[2];
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+
+  for (node = keyblock; node; node = node->next)
+    node->flag &= ~3;
+
+  for (node = keyblock; node; node = node->next)
+    {
+      if (node->pkt->pkttype == PKT_PUBLIC_KEY
+          || node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        {
+          pk = node->pkt->pkt.public_key;
+          switch (desc->mode)
+            {
+            case KEYDB_SEARCH_MODE_SHORT_KID:
+            case KEYDB_SEARCH_MODE_LONG_KID:
+              keyid_from_pk (pk, kid);
+              if (desc->u.kid[1] == kid[1]
+                  && (desc->mode == KEYDB_SEARCH_MODE_SHORT_KID
+                      || desc->u.kid[0] == kid[0]))
+                goto found_key;
+              break;
+            case KEYDB_SEARCH_MODE_FPR16:
+            case KEYDB_SEARCH_MODE_FPR20:
+            case KEYDB_SEARCH_MODE_FPR:
+              fingerprint_from_pk (pk, fpr, &fprlen);
+              while (fprlen < 20)
+                fpr[fprlen++] = 0;
+              if (!memcmp (desc->u.fpr, fpr,
+                           desc->mode == KEYDB_SEARCH_MODE_FPR16? 16:20))
+                goto found_key;
+              break;
+            default:
+              break;
+            }
+        }
+      else if (node->pkt->pkttype == PKT_USER_ID)
+        {
+          uid = node->pkt->pkt.user_id;
+          switch (desc->mode)
+            {
+            case KEYDB_SEARCH_MODE_EXACT:
+            case KEYDB_SEARCH_MODE_SUBSTR:
+            case KEYDB_SEARCH_MODE_MAIL:
+            case KEYDB_SEARCH_MODE_MAILSUB:
+            case KEYDB_SEARCH_MODE_MAILEND:
+            case KEYDB_SEARCH_MODE_WORDS:
+              /* Same as skip_unusable but on the merged keyblock.  */
+              if (!keyring_compare_name (desc->mode, desc->u.name,
+                                         uid->name, uid->len)
+                  && !uid->is_revoked && !uid->is_expired
+                  && !pk_is_disabled (keyblock->pkt->pkt.public_key))
+                {
+                  node->flag |= 2;
+                  return 1;
+                }
+              break;
+            default:
+              break;
+            }
+        }
+    }
+  return 0;
+
+ found_key:
+  node->flag |= 1;
+  return 1;
+}
+
+
+/* Look up the keys for the NNAMES user IDs in NAMES with a single
+ * pass over the key database.  For each name for which a usable key
+ * for REQ_USAGE has been found, a new public key is stored at the
+ * same index in R_PKS; all other items are set to NULL.  Names which
+ * need the auto key retrieval, an exact key or a word search are not
+ * looked up.  For all names which were not found, the caller should
+ * use get_pubkey_byname, which also takes care of the diagnostics.
+ * The key found for a name is the same as get_pubkey_byname would
+ * return from the local key database.  */
+void
+get_pubkeys_byname (char **names, int nnames, unsigned int req_usage,
+                    PKT_public_key **r_pks)
+{
+  struct getkey_ctx_s ctx;
+  KEYDB_SEARCH_DESC *desc;
+  int *map;  /* Index into NAMES for each item of DESC.  */
+  int ndesc, i, j;
+  int nodefault = 0;
+  struct akl *akl;
+  kbnode_t keyblock;
+  int rc;
+
+  for (i=0; i < nnames; i++)
+    r_pks[i] = NULL;
+
+  for (akl = opt.auto_key_locate; akl; akl = akl->next)
+    if (akl->type == AKL_NODEFAULT || akl->type == AKL_LOCAL)
+      {
+        nodefault = 1;
+        break;
+      }
+
+  desc = xcalloc (nnames, sizeof *desc);
+  map = xcalloc (nnames, sizeof *map);
+  for (ndesc=i=0; i < nnames; i++)
+    {
+      if (nodefault && is_valid_mailbox (names[i]))
+        continue;
+      if (classify_user_id (names[i], desc + ndesc, 1) || desc[ndesc].exact)
+        continue;
+      switch (desc[ndesc].mode)
+        {
+        case KEYDB_SEARCH_MODE_EXACT:
+        case KEYDB_SEARCH_MODE_SUBSTR:
+        case KEYDB_SEARCH_MODE_MAIL:
+        case KEYDB_SEARCH_MODE_MAILSUB:
+        case KEYDB_SEARCH_MODE_MAILEND:
+        case KEYDB_SEARCH_MODE_SHORT_KID:
+        case KEYDB_SEARCH_MODE_LONG_KID:
+        case KEYDB_SEARCH_MODE_FPR16:
+        case KEYDB_SEARCH_MODE_FPR20:
+        case KEYDB_SEARCH_MODE_FPR:
+          map[ndesc++] = i;
+          break;
+        default:
+          break;
+        }
+    }
+
+  memset (&ctx, 0, sizeof ctx);
+  ctx.not_allocated = 1;
+  ctx.req_usage = req_usage;
+  ctx.kr_handle = keydb_new ();
+
+  /* The search returns each keyblock matching any of the names.
+     Because it reports only the first matching item, we check the
+     keyblock against all of them.  The unusable user IDs are skipped
+     by keyblock_matches_desc and not by a skip function, which would
+     be called for each item.  */
+  while (ndesc && !(rc = keydb_search (ctx.kr_handle, desc, ndesc)))
+    {
+      rc = keydb_get_keyblock (ctx.kr_handle, &keyblock);
+      if (rc)
+        {
+          log_error ("keydb_get_keyblock failed: %s\n", g10_errstr (rc));
+          continue;
+        }
+      merge_selfsigs (keyblock);
+      ctx.keyblock = keyblock;
+      for (j=0; j < ndesc; )
+        {
+          if (!keyblock_matches_desc (keyblock, desc + j)
+              || !finish_lookup (&ctx))
+            {
+              j++;
+              continue;
+            }
+          r_pks[map[j]] = xmalloc_clear (sizeof **r_pks);
+          pk_from_block (&ctx, r_pks[map[j]], keyblock);
+          /* Done with this name.  */
+          ndesc--;
+          desc[j] = desc[ndesc];
+          map[j] = map[ndesc];
+        }
+      ctx.keyblock = NULL;
+      release_kbnode (keyblock);
+    }
+  if (ndesc && rc && gpg_err_code (rc) != GPG_ERR_NOT_FOUND)
+    log_error ("keydb_search failed: %s\n", g10_errstr (rc));
+
+  get_pubkey_end (&ctx);
+  xfree (map);
+  xfree (desc);
+}
+
+
 int
 get_pubkey_next (GETKEY_CTX ctx, PKT_public_key * pk, KBNODE * ret_keyblock)
 {
@@ -1913,7 +2287,8 @@ buf_to_sig (const byte * buf, size_t len)
 
   if (parse_signature (iobuf, PKT_SIGNATURE, len, sig) != 0)
     {
-      xfree (sig);
+      /* The subpacket areas may have been taken from the arena.  */
+      free_seckey_enc (sig);
       sig = NULL;
     }
 
@@ -2642,19 +3017,13 @@ get_user_id_string (u32 * keyid)
   /* Try it two times; second pass reads from key resources.  */
   do
     {
-      for (r = user_id_db; r; r = r->next)
-	{
-	  keyid_list_t a;
-	  for (a = r->keyids; a; a = a->next)
-	    {
-	      if (a->keyid[0] == keyid[0] && a->keyid[1] == keyid[1])
-		{
-		  p = xmalloc (keystrlen () + 1 + r->len + 1);
-		  sprintf (p, "%s %.*s", keystr (keyid), r->len, r->name);
-		  return p;
-		}
-	    }
-	}
+      r = uid_cache_lookup (keyid, 0);
+      if (r)
+        {
+          p = xmalloc (keystrlen () + 1 + r->len + 1);
+          sprintf (p, "%s %.*s", keystr (keyid), r->len, r->name);
+          return p;
+        }
     }
   while (++pass < 2 && !get_pubkey (NULL, keyid));
   p = xmalloc (keystrlen () + 5);
@@ -2682,21 +3051,15 @@ get_long_user_id_string (u32 * keyid)
   /* Try it two times; second pass reads from key resources.  */
   do
     {
-      for (r = user_id_db; r; r = r->next)
-	{
-	  keyid_list_t a;
-	  for (a = r->keyids; a; a = a->next)
-	    {
-	      if (a->keyid[0] == keyid[0] && a->keyid[1] == keyid[1])
-		{
-		  p = xmalloc (r->len + 20);
-		  sprintf (p, "%08lX%08lX %.*s",
-			   (ulong) keyid[0], (ulong) keyid[1],
-			   r->len, r->name);
-		  return p;
-		}
-	    }
-	}
+      r = uid_cache_lookup (keyid, 0);
+      if (r)
+        {
+          p = xmalloc (r->len + 20);
+          sprintf (p, "%08lX%08lX %.*s",
+                   (ulong) keyid[0], (ulong) keyid[1],
+                   r->len, r->name);
+          return p;
+        }
     }
   while (++pass < 2 && !get_pubkey (NULL, keyid));
   p = xmalloc (25);
@@ -2714,20 +3077,14 @@ get_user_id (u32 * keyid, size_t * rn)
   /* Try it two times; second pass reads from key resources.  */
   do
     {
-      for (r = user_id_db; r; r = r->next)
-	{
-	  keyid_list_t a;
-	  for (a = r->keyids; a; a = a->next)
-	    {
-	      if (a->keyid[0] == keyid[0] && a->keyid[1] == keyid[1])
-		{
-		  p = xmalloc (r->len);
-		  memcpy (p, r->name, r->len);
-		  *rn = r->len;
-		  return p;
-		}
-	    }
-	}
+      r = uid_cache_lookup (keyid, 0);
+      if (r)
+        {
+          p = xmalloc (r->len);
+          memcpy (p, r->name, r->len);
+          *rn = r->len;
+          return p;
+        }
     }
   while (++pass < 2 && !get_pubkey (NULL, keyid));
   p = xstrdup (user_id_not_found_utf8 ());
@@ -33,6 +33,7 @@
 #ifdef HAVE_W32_SYSTEM
 #include <windows.h>
 #endif
+#include <npth.h>
 
 #define INCLUDED_BY_MAIN_MODULE 1
 #include "gpg.h"
@@ -55,6 +56,7 @@
 #include "gc-opt-flags.h"
 #include "asshelp.h"
 #include "call-dirmngr.h"
+#include "../kbx/keybox.h"
 #include "../common/init.h"
 
 #if defined(HAVE_DOSISH_SYSTEM) || defined(__CYGWIN__)
@@ -92,6 +94,7 @@ enum cmd_and_opt_values
     aListSecretKeys = 'K',
     oBatch	  = 500,
     oMaxOutput,
+    oIOBufSize,
     oSigNotation,
     oCertNotation,
     oShowNotation,
@@ -151,6 +154,7 @@ enum cmd_and_opt_values
     aChangePIN,
     aPasswd,
     aServer,
+    aDaemon,
 
     oTextmode,
     oNoTextmode,
@@ -194,6 +198,8 @@ enum cmd_and_opt_values
     oCompletesNeeded,
     oMarginalsNeeded,
     oMaxCertDepth,
+    oTrustDBJobs,
+    oRecipientJobs,
     oLoadExtension,
     oGnuPG,
     oRFC1991,
@@ -213,6 +219,11 @@ enum cmd_and_opt_values
     oCompressLevel,
     oBZ2CompressLevel,
     oBZ2DecompressLowmem,
+    oCompressThreads,
+    oCompressProbe,
+    oNoCompressProbe,
+    oPipelinedDecryption,
+    oNoPipelinedDecryption,
     oPassphrase,
     oPassphraseFD,
     oPassphraseFile,
@@ -222,6 +233,7 @@ enum cmd_and_opt_values
     oQuickRandom,
     oNoVerbose,
     oTrustDBName,
+    oTrustDBMmap,
     oNoSecmemWarn,
     oRequireSecmem,
     oNoRequireSecmem,
@@ -333,6 +345,8 @@ enum cmd_and_opt_values
     oNoSigCreateCheck,
     oAutoCheckTrustDB,
     oNoAutoCheckTrustDB,
+    oIncrementalTrustDB,
+    oNoIncrementalTrustDB,
     oPreservePermissions,
     oDefaultPreferenceList,
     oDefaultKeyserverURL,
@@ -442,6 +456,7 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_c (aPrimegen, "gen-prime", "@" ),
   ARGPARSE_c (aGenRandom,"gen-random", "@" ),
   ARGPARSE_c (aServer,   "server",  N_("run in server mode")),
+  ARGPARSE_c (aDaemon,   "daemon",  "@"),
 
   ARGPARSE_group (301, N_("@\nOptions:\n ")),
 
@@ -470,6 +485,11 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_i (oCompressLevel, "compress-level", "@"),
   ARGPARSE_s_i (oBZ2CompressLevel, "bzip2-compress-level", "@"),
   ARGPARSE_s_n (oBZ2DecompressLowmem, "bzip2-decompress-lowmem", "@"),
+  ARGPARSE_s_i (oCompressThreads, "compress-threads", "@"),
+  ARGPARSE_s_n (oCompressProbe, "compress-probe", "@"),
+  ARGPARSE_s_n (oNoCompressProbe, "no-compress-probe", "@"),
+  ARGPARSE_s_n (oPipelinedDecryption, "pipelined-decryption", "@"),
+  ARGPARSE_s_n (oNoPipelinedDecryption, "no-pipelined-decryption", "@"),
 
   ARGPARSE_s_n (oTextmodeShort, NULL, "@"),
   ARGPARSE_s_n (oTextmode,      "textmode", N_("use canonical text mode")),
@@ -491,6 +511,7 @@ static ARGPARSE_OPTS opts[] = {
 
   ARGPARSE_s_s (oOutput, "output", N_("|FILE|write output to FILE")),
   ARGPARSE_p_u (oMaxOutput, "max-output", "@"),
+  ARGPARSE_s_u (oIOBufSize, "iobuf-size", "@"),
 
   ARGPARSE_s_n (oVerbose, "verbose", N_("verbose")),
   ARGPARSE_s_n (oQuiet,	  "quiet",   "@"),
@@ -546,6 +567,8 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_i (oCompletesNeeded, "completes-needed", "@"),
   ARGPARSE_s_i (oMarginalsNeeded, "marginals-needed", "@"),
   ARGPARSE_s_i (oMaxCertDepth,	"max-cert-depth", "@" ),
+  ARGPARSE_s_i (oTrustDBJobs,	"trustdb-jobs", "@" ),
+  ARGPARSE_s_i (oRecipientJobs, "recipient-jobs", "@" ),
   ARGPARSE_s_s (oTrustedKey, "trusted-key", "@"),
 
   ARGPARSE_s_s (oLoadExtension, "load-extension", "@"),  /* Dummy.  */
@@ -616,6 +639,7 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_n (oQuickRandom, "debug-quick-random", "@"),
   ARGPARSE_s_n (oNoVerbose, "no-verbose", "@"),
   ARGPARSE_s_s (oTrustDBName, "trustdb-name", "@"),
+  ARGPARSE_s_n (oTrustDBMmap, "trustdb-mmap", "@"),
   ARGPARSE_s_n (oNoSecmemWarn, "no-secmem-warning", "@"),
   ARGPARSE_s_n (oRequireSecmem, "require-secmem", "@"),
   ARGPARSE_s_n (oNoRequireSecmem, "no-require-secmem", "@"),
@@ -701,6 +725,8 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_n (oNoSigCreateCheck,   "no-sig-create-check", "@"),
   ARGPARSE_s_n (oAutoCheckTrustDB, "auto-check-trustdb", "@"),
   ARGPARSE_s_n (oNoAutoCheckTrustDB, "no-auto-check-trustdb", "@"),
+  ARGPARSE_s_n (oIncrementalTrustDB, "incremental-trustdb", "@"),
+  ARGPARSE_s_n (oNoIncrementalTrustDB, "no-incremental-trustdb", "@"),
   ARGPARSE_s_n (oMergeOnly,	  "merge-only", "@" ),
   ARGPARSE_s_n (oAllowSecretKeyImport, "allow-secret-key-import", "@"),
   ARGPARSE_s_n (oTryAllSecrets,  "try-all-secrets", "@"),
@@ -1812,7 +1838,7 @@ parse_trust_model(const char *model)
 /* This fucntion called to initialized a new control object.  It is
    assumed that this object has been zeroed out before calling this
    function. */
-static void
+void
 gpg_init_default_ctrl (ctrl_t ctrl)
 {
   (void)ctrl;
@@ -1821,13 +1847,63 @@ gpg_init_default_ctrl (ctrl_t ctrl)
 
 /* This function is called to deinitialize a control object.  It is
    not deallocated. */
-static void
+void
 gpg_deinit_default_ctrl (ctrl_t ctrl)
 {
   gpg_dirmngr_deinit_session_data (ctrl);
 }
 
 
+/* Set if nPth has been initialized.  */
+static int npth_initialized;
+
+/* Set if other threads may call Libgcrypt while this thread runs
+   Libgcrypt code.  This requires Libgcrypt 1.6.  */
+static int npth_may_unprotect;
+
+/* Initialize nPth.  This is done on demand by the first part of gpg
+   which requires threads; it is safe to call this several times.  */
+void
+gpg_init_npth (void)
+{
+  if (!npth_initialized)
+    {
+      npth_init ();
+      npth_initialized = 1;
+      npth_may_unprotect = !!gcry_check_version ("1.6.0");
+    }
+}
+
+
+/* Release the nPth lock so that other threads may run while this
+   thread does a lengthy computation or blocking I/O.  Between
+   gpg_npth_unprotect and gpg_npth_protect only functions of Libgcrypt
+   and zlib and system calls on file descriptors owned by the thread
+   may be called; in particular nothing which logs, writes status
+   lines or otherwise uses estream, and nothing which allocates
+   packets.  gpg_npth_protect does not change ERRNO.  These functions
+   do nothing if nPth is not in use or if Libgcrypt is older than 1.6;
+   in the latter case the lock serializes all calls to Libgcrypt.  */
+void
+gpg_npth_unprotect (void)
+{
+  if (npth_may_unprotect)
+    npth_unprotect ();
+}
+
+void
+gpg_npth_protect (void)
+{
+  if (npth_may_unprotect)
+    {
+      int saved_errno = errno;
+
+      npth_protect ();
+      gpg_err_set_errno (saved_errno);
+    }
+}
+
+
 char *
 get_default_configname (void)
 {
@@ -1991,6 +2067,11 @@ main (int argc, char **argv)
     opt.completes_needed = 1;
     opt.marginals_needed = 3;
     opt.max_cert_depth = 5;
+    opt.trustdb_jobs = 1;
+    opt.recipient_jobs = 1;
+    opt.compress_threads = 1;
+    opt.incremental_trustdb = 1;
+    opt.persistent_sig_cache = 1;
     opt.pgp2_workarounds = 1;
     opt.escape_from = 1;
     opt.flags.require_cross_cert = 1;
@@ -2082,6 +2163,7 @@ main (int argc, char **argv)
     malloc_hooks.realloc = gcry_realloc;
     malloc_hooks.free = gcry_free;
     assuan_set_malloc_hooks (&malloc_hooks);
+    keybox_set_malloc_hooks (gcry_malloc, gcry_realloc, gcry_free);
     assuan_set_gpg_err_source (GPG_ERR_SOURCE_DEFAULT);
     setup_libassuan_logging (&opt.debug);
 
@@ -2213,6 +2295,7 @@ main (int argc, char **argv)
 	  case aVerify: set_cmd( &cmd, aVerify); break;
 
           case aServer:
+          case aDaemon:
             set_cmd (&cmd, pargs.r_opt);
             opt.batch = 1;
             break;
@@ -2220,6 +2303,7 @@ main (int argc, char **argv)
 	  case oArmor: opt.armor = 1; opt.no_armor=0; break;
 	  case oOutput: opt.outfile = pargs.r.ret_str; break;
 	  case oMaxOutput: opt.max_output = pargs.r.ret_ulong; break;
+	  case oIOBufSize: iobuf_set_buffer_size (pargs.r.ret_ulong); break;
 	  case oQuiet: opt.quiet = 1; break;
 	  case oNoTTY: tty_no_terminal(1); break;
 	  case oDryRun: opt.dry_run = 1; break;
@@ -2322,7 +2406,10 @@ main (int argc, char **argv)
 	  case oCompletesNeeded: opt.completes_needed = pargs.r.ret_int; break;
 	  case oMarginalsNeeded: opt.marginals_needed = pargs.r.ret_int; break;
 	  case oMaxCertDepth: opt.max_cert_depth = pargs.r.ret_int; break;
+	  case oTrustDBJobs: opt.trustdb_jobs = pargs.r.ret_int; break;
+	  case oRecipientJobs: opt.recipient_jobs = pargs.r.ret_int; break;
 	  case oTrustDBName: trustdb_name = pargs.r.ret_str; break;
+	  case oTrustDBMmap: opt.trustdb_mmap = 1; break;
 	  case oDefaultKey: opt.def_secret_key = pargs.r.ret_str; break;
 	  case oDefRecipient:
             if( *pargs.r.ret_str )
@@ -2584,6 +2671,11 @@ main (int argc, char **argv)
 	  case oCompressLevel: opt.compress_level = pargs.r.ret_int; break;
 	  case oBZ2CompressLevel: opt.bz2_compress_level = pargs.r.ret_int; break;
 	  case oBZ2DecompressLowmem: opt.bz2_decompress_lowmem=1; break;
+	  case oCompressThreads: opt.compress_threads = pargs.r.ret_int; break;
+	  case oCompressProbe: opt.compress_probe = 1; break;
+	  case oNoCompressProbe: opt.compress_probe = 0; break;
+	  case oPipelinedDecryption: opt.pipelined_decryption = 1; break;
+	  case oNoPipelinedDecryption: opt.pipelined_decryption = 0; break;
 	  case oPassphrase:
 	    set_passphrase_from_string(pargs.r.ret_str);
 	    break;
@@ -2852,6 +2944,8 @@ main (int argc, char **argv)
           case oNoExpensiveTrustChecks: opt.no_expensive_trust_checks=1; break;
           case oAutoCheckTrustDB: opt.no_auto_check_trustdb=0; break;
           case oNoAutoCheckTrustDB: opt.no_auto_check_trustdb=1; break;
+          case oIncrementalTrustDB: opt.incremental_trustdb=1; break;
+          case oNoIncrementalTrustDB: opt.incremental_trustdb=0; break;
           case oPreservePermissions: opt.preserve_permissions=1; break;
           case oDefaultPreferenceList:
 	    opt.def_preference_list = pargs.r.ret_str;
@@ -3052,6 +3146,20 @@ main (int argc, char **argv)
         opt.flags.dsa2 = 0;
       }
 
+    /* The options using threads rely on the thread-safety of
+       Libgcrypt 1.6.  */
+    if ((opt.trustdb_jobs > 1 || opt.recipient_jobs > 1
+         || opt.compress_threads > 1 || opt.pipelined_decryption)
+        && !gcry_check_version ("1.6.0"))
+      {
+        log_info ("WARNING: "
+                  "threads are only used with Libgcrypt 1.6 and later\n");
+        opt.trustdb_jobs = 1;
+        opt.recipient_jobs = 1;
+        opt.compress_threads = 1;
+        opt.pipelined_decryption = 0;
+      }
+
     if (opt.verbose > 2)
         log_info ("using character set '%s'\n", get_native_charset ());
 
@@ -3247,6 +3355,12 @@ main (int argc, char **argv)
       log_error(_("marginals-needed must be greater than 1\n"));
     if( opt.max_cert_depth < 1 || opt.max_cert_depth > 255 )
       log_error(_("max-cert-depth must be in the range from 1 to 255\n"));
+    if( opt.trustdb_jobs < 1 || opt.trustdb_jobs > 256 )
+      log_error(_("trustdb-jobs must be in the range from 1 to 256\n"));
+    if( opt.recipient_jobs < 1 || opt.recipient_jobs > 256 )
+      log_error(_("recipient-jobs must be in the range from 1 to 256\n"));
+    if( opt.compress_threads < 1 || opt.compress_threads > 256 )
+      log_error(_("compress-threads must be in the range from 1 to 256\n"));
     if(opt.def_cert_level<0 || opt.def_cert_level>3)
       log_error(_("invalid default-cert-level; must be 0, 1, 2, or 3\n"));
     if( opt.min_cert_level < 1 || opt.min_cert_level > 3 )
@@ -3469,6 +3583,10 @@ main (int argc, char **argv)
         gpg_server (ctrl);
         break;
 
+      case aDaemon:
+        gpg_daemon ();
+        break;
+
       case aStore: /* only store the file */
 	if( argc > 1 )
 	    wrong_args(_("--store [filename]"));
@@ -4100,8 +4218,15 @@ void
 g10_exit( int rc )
 {
   gcry_control (GCRYCTL_UPDATE_RANDOM_SEED_FILE);
+  sigcache_sync ();
+  if (DBG_CACHE)
+    {
+      getkey_print_stats ();
+      sigcache_print_stats ();
+    }
   if ( (opt.debug & DBG_MEMSTAT_VALUE) )
     {
+      pkt_arena_print_stats ();
       gcry_control (GCRYCTL_DUMP_MEMORY_STATS);
       gcry_control (GCRYCTL_DUMP_RANDOM_STATS);
     }
@@ -32,6 +32,7 @@
         map_assuan_err_with_source (GPG_ERR_SOURCE_DEFAULT, (a))
 #include <gpg-error.h>
 #include <gcrypt.h>
+#include "../common/sysutils.h" /* (gnupg_fd_t) */
 
 
 /* Number of bits we accept when reading or writing MPIs. */
@@ -67,6 +68,12 @@ struct server_control_s
 
   /* Local data for call-dirmngr.c  */
   dirmngr_local_t dirmngr_local;
+
+  /* Private data used to fire up the connection thread in daemon
+     mode.  We use this structure to avoid an extra allocation.  */
+  struct {
+    gnupg_fd_t fd;
+  } thread_startup;
 };
 
 
@@ -49,6 +49,7 @@
 #include "sysutils.h"
 #include "status.h"
 #include "call-agent.h"
+#include "../kbx/keybox.h"
 #include "../common/init.h"
 
 
@@ -151,6 +152,7 @@ main( int argc, char **argv )
   /* Make sure that our subsystems are ready.  */
   i18n_init();
   init_common_subsystems (&argc, &argv);
+  keybox_set_malloc_hooks (gcry_malloc, gcry_realloc, gcry_free);
 
   gnupg_init_signals (0, NULL);
 
@@ -395,6 +397,28 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek)
 }
 
 
+/* Stub:
+ * We never compress, but compress.c links to this
+ */
+void
+gpg_init_npth (void)
+{
+}
+
+/* Stubs:
+ * gpgv does not use threads
+ */
+void
+gpg_npth_unprotect (void)
+{
+}
+
+void
+gpg_npth_protect (void)
+{
+}
+
+
 /* Stub:
  * No interactive commands, so we don't need the helptexts
  */
@@ -405,7 +405,7 @@ read_block( IOBUF a, PACKET **pending_pkt, KBNODE *ret_root )
     }
     else
 	in_cert = 0;
-    pkt = xmalloc( sizeof *pkt );
+    pkt = pkt_arena_alloc( sizeof *pkt );
     init_packet(pkt);
     while( (rc=parse_packet(a, pkt)) != -1 ) {
 	if( rc ) {  /* ignore errors */
@@ -466,7 +466,7 @@ read_block( IOBUF a, PACKET **pending_pkt, KBNODE *ret_root )
 		    root = new_kbnode( pkt );
 		else
 		    add_kbnode( root, new_kbnode( pkt ) );
-		pkt = xmalloc( sizeof *pkt );
+		pkt = pkt_arena_alloc( sizeof *pkt );
 	    }
 	    init_packet(pkt);
 	    break;
@@ -481,7 +481,7 @@ read_block( IOBUF a, PACKET **pending_pkt, KBNODE *ret_root )
     else
 	*ret_root = root;
     free_packet( pkt );
-    xfree( pkt );
+    pkt_arena_free( pkt );
     return rc;
 }
 
@@ -895,7 +895,7 @@ import_one (ctrl_t ctrl,
 
 	    clear_ownertrusts (pk);
 	    if(non_self)
-	      revalidation_mark ();
+	      revalidation_mark_key (pk);
 	  }
         keydb_release (hd);
 
@@ -987,7 +987,7 @@ import_one (ctrl_t ctrl,
 		log_error (_("error writing keyring '%s': %s\n"),
 			     keydb_get_resource_name (hd), g10_errstr(rc) );
 	    else if(non_self)
-	      revalidation_mark ();
+	      revalidation_mark_key (pk);
 
 	    /* we are ready */
 	    if( !opt.quiet )
@@ -1745,7 +1745,7 @@ import_revoke_cert( const char *fname, KBNODE node, struct stats_s *stats )
     if(get_ownertrust(pk)==TRUST_ULTIMATE)
       clear_ownertrusts(pk);
 
-    revalidation_mark ();
+    revalidation_mark_key (pk);
 
   leave:
     keydb_release (hd);
@@ -29,20 +29,205 @@
 #include "packet.h"
 #include "keydb.h"
 
-#define USE_UNUSED_NODES 1
+/* Keyblocks are parsed and released as a whole, so the nodes, the
+   packet structures, the signatures, the user IDs and the subpacket
+   areas are taken from an arena of large chunks instead of being
+   allocated one by one.  Each chunk counts its live objects and is
+   released as soon as the last of them has been freed; thus releasing
+   a keyblock gives back its chunks in one go while packets moved to
+   another keyblock keep their chunk alive.  Objects larger than
+   ARENA_MAX_OBJECT are taken from the heap, and pkt_arena_free may be
+   used for all of these objects regardless of where they have been
+   allocated.  The arena is not locked: threads may only use it while
+   holding the nPth lock, that is not between gpg_npth_unprotect and
+   gpg_npth_protect.  */
+#define ARENA_CHUNK_SIZE  (64*1024)
+#define ARENA_MAX_OBJECT  1024
+#define ARENA_ALIGN       16
+
+struct arena_chunk_s
+{
+  char *data;          /* Start of the usable area.  */
+  unsigned int used;   /* Number of bytes handed out.  */
+  unsigned int live;   /* Number of objects not yet freed.  */
+};
+typedef struct arena_chunk_s *arena_chunk_t;
+
+static arena_chunk_t cur_chunk;    /* The chunk we allocate from.  */
+static arena_chunk_t spare_chunk;  /* A released chunk kept for reuse.  */
+static arena_chunk_t *chunk_table; /* All live chunks sorted by address.  */
+static unsigned int chunk_count, chunk_table_size;
+
+static struct
+{
+  unsigned long allocs;       /* Objects taken from the arena.  */
+  unsigned long heap_allocs;  /* Large objects taken from the heap.  */
+  unsigned long chunks;       /* Number of chunks allocated.  */
+  unsigned long max_chunks;   /* Highest number of live chunks.  */
+} arena_stats;
+
+
+static arena_chunk_t
+new_chunk (void)
+{
+  arena_chunk_t chunk;
+  unsigned int i;
+
+  if (spare_chunk)
+    {
+      chunk = spare_chunk;
+      spare_chunk = NULL;
+    }
+  else
+    {
+      size_t hdrlen = ((sizeof *chunk + ARENA_ALIGN - 1)
+                       / ARENA_ALIGN * ARENA_ALIGN);
+
+      chunk = xmalloc (hdrlen + ARENA_CHUNK_SIZE);
+      chunk->data = (char*)chunk + hdrlen;
+      arena_stats.chunks++;
+    }
+  chunk->used = 0;
+  chunk->live = 0;
+
+  if (chunk_count == chunk_table_size)
+    {
+      chunk_table_size = chunk_table_size? 2*chunk_table_size : 16;
+      chunk_table = xrealloc (chunk_table,
+                              chunk_table_size * sizeof *chunk_table);
+    }
+  for (i = chunk_count; i && chunk_table[i-1]->data > chunk->data; i--)
+    chunk_table[i] = chunk_table[i-1];
+  chunk_table[i] = chunk;
+  chunk_count++;
+  if (chunk_count > arena_stats.max_chunks)
+    arena_stats.max_chunks = chunk_count;
+  return chunk;
+}
+
+
+/* Return the index of the chunk holding P or -1 if P has not been
+   allocated from the arena.  */
+static int
+find_chunk (const void *p)
+{
+  const char *cp = p;
+  int lo = 0, hi = (int)chunk_count - 1, mid;
+
+  while (lo <= hi)
+    {
+      mid = (lo + hi) / 2;
+      if (cp < chunk_table[mid]->data)
+        hi = mid - 1;
+      else if (cp >= chunk_table[mid]->data + ARENA_CHUNK_SIZE)
+        lo = mid + 1;
+      else
+        return mid;
+    }
+  return -1;
+}
+
+
+void *
+pkt_arena_alloc (size_t n)
+{
+  void *p;
+
+  if (n > ARENA_MAX_OBJECT)
+    {
+      arena_stats.heap_allocs++;
+      return xmalloc (n);
+    }
+
+  n = (n + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+  if (!cur_chunk || cur_chunk->used + n > ARENA_CHUNK_SIZE)
+    {
+      /* The old chunk stays alive until its last object has been
+         freed.  */
+      if (cur_chunk && !cur_chunk->live)
+        cur_chunk->used = 0;
+      else
+        cur_chunk = new_chunk ();
+    }
+  p = cur_chunk->data + cur_chunk->used;
+  cur_chunk->used += n;
+  cur_chunk->live++;
+  arena_stats.allocs++;
+  return p;
+}
+
+
+void *
+pkt_arena_alloc_clear (size_t n)
+{
+  void *p = pkt_arena_alloc (n);
+
+  memset (p, 0, n);
+  return p;
+}
+
+
+/* Return true if P has been allocated from the arena.  Such objects
+   may not be passed to xrealloc or xfree.  */
+int
+pkt_arena_owns (const void *p)
+{
+  return p && find_chunk (p) != -1;
+}
+
+
+void
+pkt_arena_free (void *p)
+{
+  arena_chunk_t chunk;
+  int idx;
+
+  if (!p)
+    return;
+
+  idx = find_chunk (p);
+  if (idx == -1)
+    {
+      xfree (p);
+      return;
+    }
+
+  chunk = chunk_table[idx];
+  assert (chunk->live);
+  if (--chunk->live)
+    return;
+
+  if (chunk == cur_chunk)
+    chunk->used = 0;
+  else
+    {
+      chunk_count--;
+      memmove (chunk_table + idx, chunk_table + idx + 1,
+               (chunk_count - idx) * sizeof *chunk_table);
+      if (spare_chunk)
+        xfree (chunk);
+      else
+        spare_chunk = chunk;
+    }
+}
+
+
+void
+pkt_arena_print_stats (void)
+{
+  log_info ("packet arena: %lu allocs, %lu large, %lu chunks,"
+            " %u live (max %lu)\n",
+            arena_stats.allocs, arena_stats.heap_allocs, arena_stats.chunks,
+            chunk_count, arena_stats.max_chunks);
+}
 
-static KBNODE unused_nodes;
 
 static KBNODE
 alloc_node(void)
 {
     KBNODE n;
 
-    n = unused_nodes;
-    if( n )
-	unused_nodes = n->next;
-    else
-	n = xmalloc( sizeof *n );
+    n = pkt_arena_alloc( sizeof *n );
     n->next = NULL;
     n->pkt = NULL;
     n->flag = 0;
@@ -54,14 +239,7 @@ alloc_node(void)
 static void
 free_node( KBNODE n )
 {
-    if( n ) {
-#if USE_UNUSED_NODES
-	n->next = unused_nodes;
-	unused_nodes = n;
-#else
-	xfree( n );
-#endif
-    }
+    pkt_arena_free( n );
 }
 
 
@@ -95,7 +273,7 @@ release_kbnode( KBNODE n )
 	n2 = n->next;
 	if( !is_cloned_kbnode(n) ) {
 	    free_packet( n->pkt );
-	    xfree( n->pkt );
+	    pkt_arena_free( n->pkt );
 	}
 	free_node( n );
 	n = n2;
@@ -266,7 +444,7 @@ commit_kbnode( KBNODE *root )
 		nl->next = n->next;
 	    if( !is_cloned_kbnode(n) ) {
 		free_packet( n->pkt );
-		xfree( n->pkt );
+		pkt_arena_free( n->pkt );
 	    }
 	    free_node( n );
 	    changed = 1;
@@ -290,7 +468,7 @@ remove_kbnode( KBNODE *root, KBNODE node )
 		nl->next = n->next;
 	    if( !is_cloned_kbnode(n) ) {
 		free_packet( n->pkt );
-		xfree( n->pkt );
+		pkt_arena_free( n->pkt );
 	    }
 	    free_node( n );
 	}
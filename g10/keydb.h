@@ -202,6 +202,7 @@ char *gpg_format_keydesc (PKT_public_key *pk, int mode, int escaped);
 /*-- getkey.c --*/
 void cache_public_key( PKT_public_key *pk );
 void getkey_disable_caches(void);
+void getkey_print_stats (void);
 int get_pubkey( PKT_public_key *pk, u32 *keyid );
 int get_pubkey_fast ( PKT_public_key *pk, u32 *keyid );
 KBNODE get_pubkeyblock( u32 *keyid );
@@ -209,6 +210,8 @@ int get_pubkey_byname (ctrl_t ctrl,
                        GETKEY_CTX *rx, PKT_public_key *pk,  const char *name,
                        KBNODE *ret_keyblock, KEYDB_HANDLE *ret_kdbhd,
 		       int include_unusable, int no_akl );
+void get_pubkeys_byname (char **names, int nnames, unsigned int req_usage,
+                         PKT_public_key **r_pks);
 int get_pubkey_bynames( GETKEY_CTX *rx, PKT_public_key *pk,
 			strlist_t names, KBNODE *ret_keyblock );
 int get_pubkey_next( GETKEY_CTX ctx, PKT_public_key *pk, KBNODE *ret_keyblock );
@@ -2211,7 +2211,7 @@ keyedit_menu (ctrl_t ctrl, const char *username, strlist_t locusr,
 
 	  if (update_trust)
 	    {
-	      revalidation_mark ();
+	      revalidation_mark_key (keyblock->pkt->pkt.public_key);
 	      update_trust = 0;
 	    }
 	  goto leave;
@@ -3548,7 +3548,7 @@ menu_expire (KBNODE pub_keyblock)
 	      newpkt->pkttype = PKT_SIGNATURE;
 	      newpkt->pkt.signature = newsig;
 	      free_packet (node->pkt);
-	      xfree (node->pkt);
+	      pkt_arena_free (node->pkt);
 	      node->pkt = newpkt;
 	      sub_pk = NULL;
 	    }
@@ -3647,7 +3647,7 @@ menu_backsign (KBNODE pub_keyblock)
 	      newpkt->pkttype = PKT_SIGNATURE;
 	      newpkt->pkt.signature = newsig;
 	      free_packet (sig_pk->pkt);
-	      xfree (sig_pk->pkt);
+	      pkt_arena_free (sig_pk->pkt);
 	      sig_pk->pkt = newpkt;
 
 	      modified = 1;
@@ -3805,7 +3805,7 @@ menu_set_primary_uid (KBNODE pub_keyblock)
 		      newpkt->pkttype = PKT_SIGNATURE;
 		      newpkt->pkt.signature = newsig;
 		      free_packet (node->pkt);
-		      xfree (node->pkt);
+		      pkt_arena_free (node->pkt);
 		      node->pkt = newpkt;
 		      modified = 1;
 		    }
@@ -3894,7 +3894,7 @@ menu_set_preferences (KBNODE pub_keyblock)
 		  newpkt->pkttype = PKT_SIGNATURE;
 		  newpkt->pkt.signature = newsig;
 		  free_packet (node->pkt);
-		  xfree (node->pkt);
+		  pkt_arena_free (node->pkt);
 		  node->pkt = newpkt;
 		  modified = 1;
 		}
@@ -4030,7 +4030,7 @@ menu_set_keyserver_url (const char *url, KBNODE pub_keyblock)
 		  newpkt->pkttype = PKT_SIGNATURE;
 		  newpkt->pkt.signature = newsig;
 		  free_packet (node->pkt);
-		  xfree (node->pkt);
+		  pkt_arena_free (node->pkt);
 		  node->pkt = newpkt;
 		  modified = 1;
 		}
@@ -4231,7 +4231,7 @@ menu_set_notation (const char *string, KBNODE pub_keyblock)
 		  newpkt->pkttype = PKT_SIGNATURE;
 		  newpkt->pkt.signature = newsig;
 		  free_packet (node->pkt);
-		  xfree (node->pkt);
+		  pkt_arena_free (node->pkt);
 		  node->pkt = newpkt;
 		  modified = 1;
 
@@ -57,6 +57,23 @@ struct sig_stats
 /* The stream used to write attribute packets to.  */
 static estream_t attrib_fp;
 
+/* The stream used for the key listing; NULL is es_stdout.  The
+   server uses this to send the listing to its client.  */
+static estream_t listing_fp;
+#define LISTFP (listing_fp? listing_fp : es_stdout)
+
+
+/* Write the output of the listing functions to FP instead of stdout.
+   Passing NULL reverts to stdout.  Returns the former stream.  */
+estream_t
+keylist_set_output (estream_t fp)
+{
+  estream_t old = listing_fp;
+
+  listing_fp = fp;
+  return old;
+}
+
 
 /* List the keys.  If list is NULL, all available keys are listed.
    With LOCATE_MODE set the locate algorithm is used to find a
@@ -72,34 +89,34 @@ public_key_list (ctrl_t ctrl, strlist_t list, int locate_mode)
       read_trust_options (&trust_model, &created, &nextcheck,
 			  &marginals, &completes, &cert_depth, &min_cert_level);
 
-      es_fprintf (es_stdout, "tru:");
+      es_fprintf (LISTFP, "tru:");
 
       if (nextcheck && nextcheck <= make_timestamp ())
-	es_fprintf (es_stdout, "o");
+	es_fprintf (LISTFP, "o");
       if (trust_model != opt.trust_model)
-	es_fprintf (es_stdout, "t");
+	es_fprintf (LISTFP, "t");
       if (opt.trust_model == TM_PGP || opt.trust_model == TM_CLASSIC)
 	{
 	  if (marginals != opt.marginals_needed)
-	    es_fprintf (es_stdout, "m");
+	    es_fprintf (LISTFP, "m");
 	  if (completes != opt.completes_needed)
-	    es_fprintf (es_stdout, "c");
+	    es_fprintf (LISTFP, "c");
 	  if (cert_depth != opt.max_cert_depth)
-	    es_fprintf (es_stdout, "d");
+	    es_fprintf (LISTFP, "d");
 	  if (min_cert_level != opt.min_cert_level)
-	    es_fprintf (es_stdout, "l");
+	    es_fprintf (LISTFP, "l");
 	}
 
-      es_fprintf (es_stdout, ":%d:%lu:%lu", trust_model, created, nextcheck);
+      es_fprintf (LISTFP, ":%d:%lu:%lu", trust_model, created, nextcheck);
 
       /* Only show marginals, completes, and cert_depth in the classic
          or PGP trust models since they are not meaningful
          otherwise. */
 
       if (trust_model == TM_PGP || trust_model == TM_CLASSIC)
-	es_fprintf (es_stdout, ":%d:%d:%d", marginals, completes, cert_depth);
+	es_fprintf (LISTFP, ":%d:%d:%d", marginals, completes, cert_depth);
 
-      es_fprintf (es_stdout, "\n");
+      es_fprintf (LISTFP, "\n");
     }
 
   /* We need to do the stale check right here because it might need to
@@ -267,7 +284,7 @@ show_policy_url (PKT_signature * sig, int indent, int mode)
   const byte *p;
   size_t len;
   int seq = 0, crit;
-  estream_t fp = mode ? log_get_stream () : es_stdout;
+  estream_t fp = mode ? log_get_stream () : LISTFP;
 
   while ((p =
 	  enum_sig_subpkt (sig->hashed, SIGSUBPKT_POLICY, &len, &seq, &crit)))
@@ -310,7 +327,7 @@ show_keyserver_url (PKT_signature * sig, int indent, int mode)
   const byte *p;
   size_t len;
   int seq = 0, crit;
-  estream_t fp = mode ? log_get_stream () : es_stdout;
+  estream_t fp = mode ? log_get_stream () : LISTFP;
 
   while ((p =
 	  enum_sig_subpkt (sig->hashed, SIGSUBPKT_PREF_KS, &len, &seq,
@@ -322,7 +339,7 @@ show_keyserver_url (PKT_signature * sig, int indent, int mode)
 	  const char *str;
 
 	  for (i = 0; i < indent; i++)
-	    es_putc (' ', es_stdout);
+	    es_putc (' ', LISTFP);
 
 	  if (crit)
 	    str = _("Critical preferred keyserver: ");
@@ -331,7 +348,7 @@ show_keyserver_url (PKT_signature * sig, int indent, int mode)
 	  if (mode)
 	    log_info ("%s", str);
 	  else
-	    es_fprintf (es_stdout, "%s", str);
+	    es_fprintf (LISTFP, "%s", str);
 	  print_utf8_buffer (fp, p, len);
 	  es_fprintf (fp, "\n");
 	}
@@ -354,7 +371,7 @@ show_keyserver_url (PKT_signature * sig, int indent, int mode)
 void
 show_notation (PKT_signature * sig, int indent, int mode, int which)
 {
-  estream_t fp = mode ? log_get_stream () : es_stdout;
+  estream_t fp = mode ? log_get_stream () : LISTFP;
   struct notation *nd, *notations;
 
   if (which == 0)
@@ -375,7 +392,7 @@ show_notation (PKT_signature * sig, int indent, int mode, int which)
 	      const char *str;
 
 	      for (i = 0; i < indent; i++)
-		es_putc (' ', es_stdout);
+		es_putc (' ', LISTFP);
 
 	      if (nd->flags.critical)
 		str = _("Critical signature notation: ");
@@ -384,7 +401,7 @@ show_notation (PKT_signature * sig, int indent, int mode, int which)
 	      if (mode)
 		log_info ("%s", str);
 	      else
-		es_fprintf (es_stdout, "%s", str);
+		es_fprintf (LISTFP, "%s", str);
 	      /* This is all UTF8 */
 	      print_utf8_buffer (fp, nd->name, strlen (nd->name));
 	      es_fprintf (fp, "=");
@@ -466,10 +483,10 @@ list_all (int secret)
                 {
                   int i;
 
-                  es_fprintf (es_stdout, "%s\n", resname);
+                  es_fprintf (LISTFP, "%s\n", resname);
                   for (i = strlen (resname); i; i--)
-                    es_putc ('-', es_stdout);
-                  es_putc ('\n', es_stdout);
+                    es_putc ('-', LISTFP);
+                  es_putc ('\n', LISTFP);
                   lastresname = resname;
                 }
             }
@@ -528,10 +545,10 @@ list_one (strlist_t names, int secret)
       if ((opt.list_options & LIST_SHOW_KEYRING) && !opt.with_colons)
         {
           resname = keydb_get_resource_name (get_ctx_handle (ctx));
-          es_fprintf (es_stdout, "%s: %s\n", keyring_str, resname);
+          es_fprintf (LISTFP, "%s: %s\n", keyring_str, resname);
           for (i = strlen (resname) + strlen (keyring_str) + 2; i; i--)
-            es_putc ('-', es_stdout);
-          es_putc ('\n', es_stdout);
+            es_putc ('-', LISTFP);
+          es_putc ('\n', LISTFP);
         }
       list_keyblock (keyblock, secret, opt.fingerprint,
                      (!secret && opt.check_sigs)? &stats : NULL);
@@ -591,10 +608,10 @@ print_key_data (PKT_public_key * pk)
 
   for (i = 0; i < n; i++)
     {
-      es_fprintf (es_stdout, "pkd:%d:%u:", i, mpi_get_nbits (pk->pkey[i]));
-      mpi_print (es_stdout, pk->pkey[i], 1);
-      es_putc (':', es_stdout);
-      es_putc ('\n', es_stdout);
+      es_fprintf (LISTFP, "pkd:%d:%u:", i, mpi_get_nbits (pk->pkey[i]));
+      mpi_print (LISTFP, pk->pkey[i], 1);
+      es_putc (':', LISTFP);
+      es_putc ('\n', LISTFP);
     }
 }
 
@@ -605,14 +622,14 @@ print_capabilities (PKT_public_key *pk, KBNODE keyblock)
   int c_printed = 0;
 
   if (use & PUBKEY_USAGE_ENC)
-    es_putc ('e', es_stdout);
+    es_putc ('e', LISTFP);
 
   if (use & PUBKEY_USAGE_SIG)
     {
-      es_putc ('s', es_stdout);
+      es_putc ('s', LISTFP);
       if (pk->flags.primary)
         {
-          es_putc ('c', es_stdout);
+          es_putc ('c', LISTFP);
           /* The PUBKEY_USAGE_CERT flag was introduced later and we
              used to always print 'c' for a primary key.  To avoid any
              regression here we better track whether we printed 'c'
@@ -622,10 +639,10 @@ print_capabilities (PKT_public_key *pk, KBNODE keyblock)
     }
 
   if ((use & PUBKEY_USAGE_CERT) && !c_printed)
-    es_putc ('c', es_stdout);
+    es_putc ('c', LISTFP);
 
   if ((use & PUBKEY_USAGE_AUTH))
-    es_putc ('a', es_stdout);
+    es_putc ('a', LISTFP);
 
   if (keyblock)
     {
@@ -661,18 +678,18 @@ print_capabilities (PKT_public_key *pk, KBNODE keyblock)
 	    }
 	}
       if (enc)
-	es_putc ('E', es_stdout);
+	es_putc ('E', LISTFP);
       if (sign)
-	es_putc ('S', es_stdout);
+	es_putc ('S', LISTFP);
       if (cert)
-	es_putc ('C', es_stdout);
+	es_putc ('C', LISTFP);
       if (auth)
-	es_putc ('A', es_stdout);
+	es_putc ('A', LISTFP);
       if (disabled)
-	es_putc ('D', es_stdout);
+	es_putc ('D', LISTFP);
     }
 
-  es_putc (':', es_stdout);
+  es_putc (':', LISTFP);
 }
 
 
@@ -684,18 +701,18 @@ print_one_subpacket (sigsubpkttype_t type, size_t len, int flags,
 {
   size_t i;
 
-  es_fprintf (es_stdout, "spk:%d:%u:%u:", type, flags, (unsigned int) len);
+  es_fprintf (LISTFP, "spk:%d:%u:%u:", type, flags, (unsigned int) len);
 
   for (i = 0; i < len; i++)
     {
       /* printable ascii other than : and % */
       if (buf[i] >= 32 && buf[i] <= 126 && buf[i] != ':' && buf[i] != '%')
-	es_fprintf (es_stdout, "%c", buf[i]);
+	es_fprintf (LISTFP, "%c", buf[i]);
       else
-	es_fprintf (es_stdout, "%%%02X", buf[i]);
+	es_fprintf (LISTFP, "%%%02X", buf[i]);
     }
 
-  es_fprintf (es_stdout, "\n");
+  es_fprintf (LISTFP, "\n");
 }
 
 
@@ -808,7 +825,7 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr, void *opaque)
 
   check_trustdb_stale ();
 
-  es_fprintf (es_stdout, "%s%c  %4u%c/%s %s",
+  es_fprintf (LISTFP, "%s%c  %4u%c/%s %s",
           secret? "sec":"pub",
           s2k_char,
           nbits_from_pk (pk), pubkey_letter (pk->pubkey_algo),
@@ -816,21 +833,21 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr, void *opaque)
 
   if (pk->flags.revoked)
     {
-      es_fprintf (es_stdout, " [");
-      es_fprintf (es_stdout, _("revoked: %s"), revokestr_from_pk (pk));
-      es_fprintf (es_stdout, "]");
+      es_fprintf (LISTFP, " [");
+      es_fprintf (LISTFP, _("revoked: %s"), revokestr_from_pk (pk));
+      es_fprintf (LISTFP, "]");
     }
   else if (pk->has_expired)
     {
-      es_fprintf (es_stdout, " [");
-      es_fprintf (es_stdout, _("expired: %s"), expirestr_from_pk (pk));
-      es_fprintf (es_stdout, "]");
+      es_fprintf (LISTFP, " [");
+      es_fprintf (LISTFP, _("expired: %s"), expirestr_from_pk (pk));
+      es_fprintf (LISTFP, "]");
     }
   else if (pk->expiredate)
     {
-      es_fprintf (es_stdout, " [");
-      es_fprintf (es_stdout, _("expires: %s"), expirestr_from_pk (pk));
-      es_fprintf (es_stdout, "]");
+      es_fprintf (LISTFP, " [");
+      es_fprintf (LISTFP, _("expires: %s"), expirestr_from_pk (pk));
+      es_fprintf (LISTFP, "]");
     }
 
 #if 0
@@ -839,17 +856,17 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr, void *opaque)
   if (opt.list_options & LIST_SHOW_VALIDITY)
     {
       int validity = get_validity (pk, NULL);
-      es_fprintf (es_stdout, " [%s]", trust_value_to_string (validity));
+      es_fprintf (LISTFP, " [%s]", trust_value_to_string (validity));
     }
 #endif
 
-  es_fprintf (es_stdout, "\n");
+  es_fprintf (LISTFP, "\n");
 
   if (fpr)
     print_fingerprint (pk, 0);
 
   if (opt.with_keygrip && hexgrip)
-    es_fprintf (es_stdout, "      Keygrip = %s\n", hexgrip);
+    es_fprintf (LISTFP, "      Keygrip = %s\n", hexgrip);
 
   if (serialno)
     print_card_serialno (serialno);
@@ -889,13 +906,13 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr, void *opaque)
 	      if (indent < 0 || indent > 40)
 		indent = 0;
 
-	      es_fprintf (es_stdout, "uid%*s%s ", indent, "", validity);
+	      es_fprintf (LISTFP, "uid%*s%s ", indent, "", validity);
 	    }
 	  else
-	    es_fprintf (es_stdout, "uid%*s", (int) keystrlen () + 10, "");
+	    es_fprintf (LISTFP, "uid%*s", (int) keystrlen () + 10, "");
 
-	  print_utf8_buffer (es_stdout, uid->name, uid->len);
-	  es_putc ('\n', es_stdout);
+	  print_utf8_buffer (LISTFP, uid->name, uid->len);
+	  es_putc ('\n', LISTFP);
 
 	  if ((opt.list_options & LIST_SHOW_PHOTOS) && uid->attribs != NULL)
 	    show_photos (uid->attribs, uid->numattribs, pk, uid);
@@ -932,30 +949,30 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr, void *opaque)
           else
             s2k_char = ' ';
 
-	  es_fprintf (es_stdout, "%s%c  %4u%c/%s %s",
+	  es_fprintf (LISTFP, "%s%c  %4u%c/%s %s",
                   secret? "ssb":"sub",
                   s2k_char,
 		  nbits_from_pk (pk2), pubkey_letter (pk2->pubkey_algo),
 		  keystr_from_pk (pk2), datestr_from_pk (pk2));
 	  if (pk2->flags.revoked)
 	    {
-	      es_fprintf (es_stdout, " [");
-	      es_fprintf (es_stdout, _("revoked: %s"), revokestr_from_pk (pk2));
-	      es_fprintf (es_stdout, "]");
+	      es_fprintf (LISTFP, " [");
+	      es_fprintf (LISTFP, _("revoked: %s"), revokestr_from_pk (pk2));
+	      es_fprintf (LISTFP, "]");
 	    }
 	  else if (pk2->has_expired)
 	    {
-	      es_fprintf (es_stdout, " [");
-	      es_fprintf (es_stdout, _("expired: %s"), expirestr_from_pk (pk2));
-	      es_fprintf (es_stdout, "]");
+	      es_fprintf (LISTFP, " [");
+	      es_fprintf (LISTFP, _("expired: %s"), expirestr_from_pk (pk2));
+	      es_fprintf (LISTFP, "]");
 	    }
 	  else if (pk2->expiredate)
 	    {
-	      es_fprintf (es_stdout, " [");
-	      es_fprintf (es_stdout, _("expires: %s"), expirestr_from_pk (pk2));
-	      es_fprintf (es_stdout, "]");
+	      es_fprintf (LISTFP, " [");
+	      es_fprintf (LISTFP, _("expires: %s"), expirestr_from_pk (pk2));
+	      es_fprintf (LISTFP, "]");
 	    }
-	  es_putc ('\n', es_stdout);
+	  es_putc ('\n', LISTFP);
 	  if (fpr > 1)
             {
               print_fingerprint (pk2, 0);
@@ -963,7 +980,7 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr, void *opaque)
                 print_card_serialno (serialno);
             }
           if (opt.with_keygrip && hexgrip)
-            es_fprintf (es_stdout, "      Keygrip = %s\n", hexgrip);
+            es_fprintf (LISTFP, "      Keygrip = %s\n", hexgrip);
 	  if (opt.with_key_data)
 	    print_key_data (pk2);
 	}
@@ -1017,14 +1034,14 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr, void *opaque)
 	    sigstr = "sig";
 	  else
 	    {
-	      es_fprintf (es_stdout, "sig                             "
+	      es_fprintf (LISTFP, "sig                             "
 		      "[unexpected signature class 0x%02x]\n",
 		      sig->sig_class);
 	      continue;
 	    }
 
-	  es_fputs (sigstr, es_stdout);
-	  es_fprintf (es_stdout, "%c%c %c%c%c%c%c%c %s %s",
+	  es_fputs (sigstr, LISTFP);
+	  es_fprintf (LISTFP, "%c%c %c%c%c%c%c%c %s %s",
 		  sigrc, (sig->sig_class - 0x10 > 0 &&
 			  sig->sig_class - 0x10 <
 			  4) ? '0' + sig->sig_class - 0x10 : ' ',
@@ -1038,20 +1055,20 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr, void *opaque)
 		  sig->trust_depth : ' ', keystr (sig->keyid),
 		  datestr_from_sig (sig));
 	  if (opt.list_options & LIST_SHOW_SIG_EXPIRE)
-	    es_fprintf (es_stdout, " %s", expirestr_from_sig (sig));
-	  es_fprintf (es_stdout, "  ");
+	    es_fprintf (LISTFP, " %s", expirestr_from_sig (sig));
+	  es_fprintf (LISTFP, "  ");
 	  if (sigrc == '%')
-	    es_fprintf (es_stdout, "[%s] ", g10_errstr (rc));
+	    es_fprintf (LISTFP, "[%s] ", g10_errstr (rc));
 	  else if (sigrc == '?')
 	    ;
 	  else if (!opt.fast_list_mode)
 	    {
 	      size_t n;
 	      char *p = get_user_id (sig->keyid, &n);
-	      print_utf8_buffer (es_stdout, p, n);
+	      print_utf8_buffer (LISTFP, p, n);
 	      xfree (p);
 	    }
-	  es_putc ('\n', es_stdout);
+	  es_putc ('\n', LISTFP);
 
 	  if (sig->flags.policy_url
 	      && (opt.list_options & LIST_SHOW_POLICY_URLS))
@@ -1073,7 +1090,7 @@ list_keyblock_print (KBNODE keyblock, int secret, int fpr, void *opaque)
 	  /* fixme: check or list other sigs here */
 	}
     }
-  es_putc ('\n', es_stdout);
+  es_putc ('\n', LISTFP);
   xfree (serialno);
   xfree (hexgrip);
 }
@@ -1092,11 +1109,11 @@ print_revokers (PKT_public_key * pk)
 	{
 	  byte *p;
 
-	  es_fprintf (es_stdout, "rvk:::%d::::::", pk->revkey[i].algid);
+	  es_fprintf (LISTFP, "rvk:::%d::::::", pk->revkey[i].algid);
 	  p = pk->revkey[i].fpr;
 	  for (j = 0; j < 20; j++, p++)
-	    es_fprintf (es_stdout, "%02X", *p);
-	  es_fprintf (es_stdout, ":%02x%s:\n", pk->revkey[i].class,
+	    es_fprintf (LISTFP, "%02X", *p);
+	  es_fprintf (LISTFP, ":%02x%s:\n", pk->revkey[i].class,
 		  (pk->revkey[i].class & 0x40) ? "s" : "");
 	}
     }
@@ -1139,13 +1156,13 @@ list_keyblock_colon (KBNODE keyblock, int secret, int fpr)
     stubkey = 1;  /* Key not found.  */
 
   keyid_from_pk (pk, keyid);
-  es_fputs (secret? "sec:":"pub:", es_stdout);
+  es_fputs (secret? "sec:":"pub:", LISTFP);
   if (!pk->flags.valid)
-    es_putc ('i', es_stdout);
+    es_putc ('i', LISTFP);
   else if (pk->flags.revoked)
-    es_putc ('r', es_stdout);
+    es_putc ('r', LISTFP);
   else if (pk->has_expired)
-    es_putc ('e', es_stdout);
+    es_putc ('e', LISTFP);
   else if (opt.fast_list_mode || opt.no_expensive_trust_checks)
     ;
   else
@@ -1153,33 +1170,33 @@ list_keyblock_colon (KBNODE keyblock, int secret, int fpr)
       trustletter = get_validity_info (pk, NULL);
       if (trustletter == 'u')
         ulti_hack = 1;
-      es_putc (trustletter, es_stdout);
+      es_putc (trustletter, LISTFP);
     }
 
-  es_fprintf (es_stdout, ":%u:%d:%08lX%08lX:%s:%s::",
+  es_fprintf (LISTFP, ":%u:%d:%08lX%08lX:%s:%s::",
           nbits_from_pk (pk),
           pk->pubkey_algo,
           (ulong) keyid[0], (ulong) keyid[1],
           colon_datestr_from_pk (pk), colon_strtime (pk->expiredate));
 
   if (!opt.fast_list_mode && !opt.no_expensive_trust_checks)
-    es_putc (get_ownertrust_info (pk), es_stdout);
-  es_putc (':', es_stdout);
+    es_putc (get_ownertrust_info (pk), LISTFP);
+  es_putc (':', LISTFP);
 
-  es_putc (':', es_stdout);
-  es_putc (':', es_stdout);
+  es_putc (':', LISTFP);
+  es_putc (':', LISTFP);
   print_capabilities (pk, keyblock);
   if (secret)
     {
-      es_putc (':', es_stdout);		/* End of field 13. */
-      es_putc (':', es_stdout);		/* End of field 14. */
+      es_putc (':', LISTFP);		/* End of field 13. */
+      es_putc (':', LISTFP);		/* End of field 14. */
       if (stubkey)
-	es_putc ('#', es_stdout);
+	es_putc ('#', LISTFP);
       else if (serialno)
-        es_fputs(serialno, es_stdout);
-      es_putc (':', es_stdout);		/* End of field 15. */
+        es_fputs(serialno, LISTFP);
+      es_putc (':', LISTFP);		/* End of field 15. */
     }
-  es_putc ('\n', es_stdout);
+  es_putc ('\n', LISTFP);
 
   print_revokers (pk);
   if (fpr)
@@ -1187,7 +1204,7 @@ list_keyblock_colon (KBNODE keyblock, int secret, int fpr)
   if (opt.with_key_data || opt.with_keygrip)
     {
       if (hexgrip)
-        es_fprintf (es_stdout, "grp:::::::::%s:\n", hexgrip);
+        es_fprintf (LISTFP, "grp:::::::::%s:\n", hexgrip);
       if (opt.with_key_data)
         print_key_data (pk);
     }
@@ -1206,11 +1223,11 @@ list_keyblock_colon (KBNODE keyblock, int secret, int fpr)
 	   */
 	  str = uid->attrib_data ? "uat" : "uid";
 	  if (uid->is_revoked)
-	    es_fprintf (es_stdout, "%s:r::::", str);
+	    es_fprintf (LISTFP, "%s:r::::", str);
 	  else if (uid->is_expired)
-	    es_fprintf (es_stdout, "%s:e::::", str);
+	    es_fprintf (LISTFP, "%s:e::::", str);
 	  else if (opt.no_expensive_trust_checks)
-	    es_fprintf (es_stdout, "%s:::::", str);
+	    es_fprintf (LISTFP, "%s:::::", str);
 	  else
 	    {
 	      int uid_validity;
@@ -1219,25 +1236,25 @@ list_keyblock_colon (KBNODE keyblock, int secret, int fpr)
 		uid_validity = get_validity_info (pk, uid);
 	      else
 		uid_validity = 'u';
-	      es_fprintf (es_stdout, "%s:%c::::", str, uid_validity);
+	      es_fprintf (LISTFP, "%s:%c::::", str, uid_validity);
 	    }
 
-	  es_fprintf (es_stdout, "%s:", colon_strtime (uid->created));
-	  es_fprintf (es_stdout, "%s:", colon_strtime (uid->expiredate));
+	  es_fprintf (LISTFP, "%s:", colon_strtime (uid->created));
+	  es_fprintf (LISTFP, "%s:", colon_strtime (uid->expiredate));
 
 	  namehash_from_uid (uid);
 
 	  for (i = 0; i < 20; i++)
-	    es_fprintf (es_stdout, "%02X", uid->namehash[i]);
+	    es_fprintf (LISTFP, "%02X", uid->namehash[i]);
 
-	  es_fprintf (es_stdout, "::");
+	  es_fprintf (LISTFP, "::");
 
 	  if (uid->attrib_data)
-	    es_fprintf (es_stdout, "%u %lu", uid->numattribs, uid->attrib_len);
+	    es_fprintf (LISTFP, "%u %lu", uid->numattribs, uid->attrib_len);
 	  else
-	    es_write_sanitized (es_stdout, uid->name, uid->len, ":", NULL);
-	  es_putc (':', es_stdout);
-	  es_putc ('\n', es_stdout);
+	    es_write_sanitized (LISTFP, uid->name, uid->len, ":", NULL);
+	  es_putc (':', LISTFP);
+	  es_putc ('\n', LISTFP);
 	}
       else if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
 	{
@@ -1259,22 +1276,22 @@ list_keyblock_colon (KBNODE keyblock, int secret, int fpr)
             stubkey = 1;  /* Key not found.  */
 
 	  keyid_from_pk (pk2, keyid2);
-	  es_fputs (secret? "ssb:":"sub:", es_stdout);
+	  es_fputs (secret? "ssb:":"sub:", LISTFP);
 	  if (!pk2->flags.valid)
-	    es_putc ('i', es_stdout);
+	    es_putc ('i', LISTFP);
 	  else if (pk2->flags.revoked)
-	    es_putc ('r', es_stdout);
+	    es_putc ('r', LISTFP);
 	  else if (pk2->has_expired)
-	    es_putc ('e', es_stdout);
+	    es_putc ('e', LISTFP);
 	  else if (opt.fast_list_mode || opt.no_expensive_trust_checks)
 	    ;
 	  else
 	    {
 	      /* TRUSTLETTER should always be defined here. */
 	      if (trustletter)
-		es_fprintf (es_stdout, "%c", trustletter);
+		es_fprintf (LISTFP, "%c", trustletter);
 	    }
-	  es_fprintf (es_stdout, ":%u:%d:%08lX%08lX:%s:%s:::::",
+	  es_fprintf (LISTFP, ":%u:%d:%08lX%08lX:%s:%s:::::",
 		  nbits_from_pk (pk2),
 		  pk2->pubkey_algo,
 		  (ulong) keyid2[0], (ulong) keyid2[1],
@@ -1284,21 +1301,21 @@ list_keyblock_colon (KBNODE keyblock, int secret, int fpr)
 	  print_capabilities (pk2, NULL);
           if (secret)
             {
-              es_putc (':', es_stdout);	/* End of field 13. */
-              es_putc (':', es_stdout);	/* End of field 14. */
+              es_putc (':', LISTFP);	/* End of field 13. */
+              es_putc (':', LISTFP);	/* End of field 14. */
               if (stubkey)
-                es_putc ('#', es_stdout);
+                es_putc ('#', LISTFP);
               else if (serialno)
-                es_fputs (serialno, es_stdout);
-              es_putc (':', es_stdout);	/* End of field 15. */
+                es_fputs (serialno, LISTFP);
+              es_putc (':', LISTFP);	/* End of field 15. */
             }
-	  es_putc ('\n', es_stdout);
+	  es_putc ('\n', LISTFP);
 	  if (fpr > 1)
 	    print_fingerprint (pk2, 0);
 	  if (opt.with_key_data || opt.with_keygrip)
             {
               if (hexgrip)
-                es_fprintf (es_stdout, "grp:::::::::%s:\n", hexgrip);
+                es_fprintf (LISTFP, "grp:::::::::%s:\n", hexgrip);
               if (opt.with_key_data)
                 print_key_data (pk2);
             }
@@ -1322,7 +1339,7 @@ list_keyblock_colon (KBNODE keyblock, int secret, int fpr)
 	    sigstr = "sig";
 	  else
 	    {
-	      es_fprintf (es_stdout, "sig::::::::::%02x%c:\n",
+	      es_fprintf (LISTFP, "sig::::::::::%02x%c:\n",
 		      sig->sig_class, sig->flags.exportable ? 'x' : 'l');
 	      continue;
 	    }
@@ -1369,45 +1386,45 @@ list_keyblock_colon (KBNODE keyblock, int secret, int fpr)
 	      rc = 0;
 	      sigrc = ' ';
 	    }
-	  es_fputs (sigstr, es_stdout);
-	  es_putc (':', es_stdout);
+	  es_fputs (sigstr, LISTFP);
+	  es_putc (':', LISTFP);
 	  if (sigrc != ' ')
-	    es_putc (sigrc, es_stdout);
-	  es_fprintf (es_stdout, "::%d:%08lX%08lX:%s:%s:", sig->pubkey_algo,
+	    es_putc (sigrc, LISTFP);
+	  es_fprintf (LISTFP, "::%d:%08lX%08lX:%s:%s:", sig->pubkey_algo,
 		  (ulong) sig->keyid[0], (ulong) sig->keyid[1],
 		  colon_datestr_from_sig (sig),
 		  colon_expirestr_from_sig (sig));
 
 	  if (sig->trust_depth || sig->trust_value)
-	    es_fprintf (es_stdout, "%d %d", sig->trust_depth, sig->trust_value);
-	  es_fprintf (es_stdout, ":");
+	    es_fprintf (LISTFP, "%d %d", sig->trust_depth, sig->trust_value);
+	  es_fprintf (LISTFP, ":");
 
 	  if (sig->trust_regexp)
-	    es_write_sanitized (es_stdout, sig->trust_regexp,
+	    es_write_sanitized (LISTFP, sig->trust_regexp,
                                 strlen (sig->trust_regexp), ":", NULL);
-	  es_fprintf (es_stdout, ":");
+	  es_fprintf (LISTFP, ":");
 
 	  if (sigrc == '%')
-	    es_fprintf (es_stdout, "[%s] ", g10_errstr (rc));
+	    es_fprintf (LISTFP, "[%s] ", g10_errstr (rc));
 	  else if (sigrc == '?')
 	    ;
 	  else if (!opt.fast_list_mode)
 	    {
 	      size_t n;
 	      p = get_user_id (sig->keyid, &n);
-	      es_write_sanitized (es_stdout, p, n, ":", NULL);
+	      es_write_sanitized (LISTFP, p, n, ":", NULL);
 	      xfree (p);
 	    }
-	  es_fprintf (es_stdout, ":%02x%c::", sig->sig_class,
+	  es_fprintf (LISTFP, ":%02x%c::", sig->sig_class,
 		  sig->flags.exportable ? 'x' : 'l');
 
 	  if (opt.no_sig_cache && opt.check_sigs && fprokay)
 	    {
 	      for (i = 0; i < fplen; i++)
-		es_fprintf (es_stdout, "%02X", fparray[i]);
+		es_fprintf (LISTFP, "%02X", fparray[i]);
 	    }
 
-	  es_fprintf (es_stdout, ":::%d:\n", sig->digest_algo);
+	  es_fprintf (LISTFP, ":::%d:\n", sig->digest_algo);
 
 	  if (opt.show_subpackets)
 	    print_subpackets_colon (sig);
@@ -1551,7 +1568,7 @@ print_fingerprint (PKT_public_key *pk, int mode)
     }
   else
     {
-      fp = es_stdout;
+      fp = LISTFP;
       text = _("      Key fingerprint =");
     }
 
@@ -1590,18 +1607,18 @@ print_card_serialno (const char *serialno)
   if (opt.with_colons)
     return; /* Handled elsewhere. */
 
-  es_fputs (_("      Card serial no. ="), es_stdout);
-  es_putc (' ', es_stdout);
+  es_fputs (_("      Card serial no. ="), LISTFP);
+  es_putc (' ', LISTFP);
   if (strlen (serialno) == 32 && !strncmp (serialno, "D27600012401", 12))
     {
       /* This is an OpenPGP card.  Print the relevant part.  */
       /* Example: D2760001240101010001000003470000 */
       /*                          xxxxyyyyyyyy     */
-      es_fprintf (es_stdout, "%.*s %.*s", 4, serialno+16, 8, serialno+20);
+      es_fprintf (LISTFP, "%.*s %.*s", 4, serialno+16, 8, serialno+20);
     }
  else
-   es_fputs (serialno, es_stdout);
-  es_putc ('\n', es_stdout);
+   es_fputs (serialno, LISTFP);
+  es_putc ('\n', LISTFP);
 }
 
 
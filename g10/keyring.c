@@ -386,7 +386,7 @@ keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
 	return G10ERR_KEYRING_OPEN;
     }
 
-    pkt = xmalloc (sizeof *pkt);
+    pkt = pkt_arena_alloc (sizeof *pkt);
     init_packet (pkt);
     hd->found.n_packets = 0;;
     lastnode = NULL;
@@ -465,7 +465,7 @@ keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
             break;
           }
 
-        pkt = xmalloc (sizeof *pkt);
+        pkt = pkt_arena_alloc (sizeof *pkt);
         init_packet(pkt);
     }
     set_packet_list_mode(save_mode);
@@ -488,7 +488,7 @@ keyring_get_keyblock (KEYRING_HANDLE hd, KBNODE *ret_kb)
 	*ret_kb = keyblock;
     }
     free_packet (pkt);
-    xfree (pkt);
+    pkt_arena_free (pkt);
     iobuf_close(a);
 
     /* Make sure that future search operations fail immediately when
@@ -827,8 +827,9 @@ prepare_word_match (const byte *name)
 
 
 
-static int
-compare_name (int mode, const char *name, const char *uid, size_t uidlen)
+int
+keyring_compare_name (int mode, const char *name,
+                      const char *uid, size_t uidlen)
 {
     int i;
     const char *s, *se;
@@ -1054,9 +1055,9 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
           case KEYDB_SEARCH_MODE_MAILSUB:
           case KEYDB_SEARCH_MODE_MAILEND:
           case KEYDB_SEARCH_MODE_WORDS:
-            if ( uid && !compare_name (desc[n].mode,
-                                       desc[n].u.name,
-                                       uid->name, uid->len))
+            if ( uid && !keyring_compare_name (desc[n].mode,
+                                               desc[n].u.name,
+                                               uid->name, uid->len))
               goto found;
             break;
 
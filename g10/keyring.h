@@ -39,6 +39,8 @@ int keyring_delete_keyblock (KEYRING_HANDLE hd);
 int keyring_search_reset (KEYRING_HANDLE hd);
 int keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
 		    size_t ndesc, size_t *descindex);
+int keyring_compare_name (int mode, const char *name,
+                          const char *uid, size_t uidlen);
 int keyring_rebuild_cache (void *token,int noisy);
 
 #endif /*GPG_KEYRING_H*/
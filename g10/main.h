@@ -70,6 +70,11 @@ extern int g10_errors_seen;
 void print_pubkey_algo_note( int algo );
 void print_cipher_algo_note( int algo );
 void print_digest_algo_note( int algo );
+void gpg_init_default_ctrl (ctrl_t ctrl);
+void gpg_deinit_default_ctrl (ctrl_t ctrl);
+void gpg_init_npth (void);
+void gpg_npth_unprotect (void);
+void gpg_npth_protect (void);
 
 /*-- armor.c --*/
 char *make_radix64_string( const byte *data, size_t len );
@@ -162,6 +167,7 @@ unsigned int ecdsa_qbits_from_Q (unsigned int qbits);
 
 /*-- status.c --*/
 void set_status_fd ( int fd );
+void set_status_stream_hook (estream_t (*fnc) (void));
 int  is_status_enabled ( void );
 void write_status ( int no );
 void write_status_error (const char *where, gpg_error_t err);
@@ -208,9 +214,20 @@ int complete_sig (PKT_signature *sig, PKT_public_key *pksk, gcry_md_hd_t md,
                   const char *cache_nonce);
 int sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 	       int do_encrypt, strlist_t remusr, const char *outfile );
+int sign_fd (ctrl_t ctrl, int filefd, int detached, strlist_t locusr,
+             int outputfd);
 int clearsign_file( const char *fname, strlist_t locusr, const char *outfile );
 int sign_symencrypt_file (const char *fname, strlist_t locusr);
 
+/*-- sigcache.c --*/
+#define SIGCACHE_KEYLEN 32
+int sigcache_make_key (PKT_public_key *signer, PKT_signature *sig,
+                       gcry_md_hd_t md, byte *key);
+int sigcache_lookup (const byte *key, int *r_rc);
+void sigcache_store (const byte *key, int rc);
+void sigcache_sync (void);
+void sigcache_print_stats (void);
+
 /*-- sig-check.c --*/
 int check_revocation_keys (PKT_public_key *pk, PKT_signature *sig);
 int check_backsig(PKT_public_key *main_pk,PKT_public_key *sub_pk,
@@ -220,6 +237,23 @@ int check_key_signature2( KBNODE root, KBNODE node, PKT_public_key *check_pk,
 			  PKT_public_key *ret_pk, int *is_selfsig,
 			  u32 *r_expiredate, int *r_expired );
 
+/* State of a certification check split by check_key_signature_prepare.  */
+struct key_sig_check_s
+{
+  KBNODE root;             /* The keyblock.  */
+  KBNODE node;             /* The signature node.  */
+  PKT_public_key *signer;  /* The key of the signer.  */
+  gcry_mpi_t hash;         /* The encoded digest.  */
+  int rc;                  /* Result of the public key operation.  */
+  int cached;              /* RC has been taken from the sigcache.  */
+  int have_cachekey;       /* CACHEKEY is valid.  */
+  byte cachekey[SIGCACHE_KEYLEN];
+};
+int check_key_signature_prepare (KBNODE root, KBNODE node,
+                                 struct key_sig_check_s *chk);
+void check_key_signature_verify (struct key_sig_check_s *chk);
+int check_key_signature_finish (struct key_sig_check_s *chk);
+
 /*-- delkey.c --*/
 int delete_keys( strlist_t names, int secret, int allow_both );
 
@@ -312,6 +346,7 @@ struct revocation_reason_info *
 void release_revocation_reason_info( struct revocation_reason_info *reason );
 
 /*-- keylist.c --*/
+estream_t keylist_set_output (estream_t fp);
 void public_key_list (ctrl_t ctrl, strlist_t list, int locate_mode );
 void secret_key_list (ctrl_t ctrl, strlist_t list );
 void print_subpackets_colon(PKT_signature *sig);
@@ -336,7 +371,8 @@ int gpg_verify (ctrl_t ctrl, int sig_fd, int data_fd, estream_t out_fp);
 
 /*-- decrypt.c --*/
 int decrypt_message (ctrl_t ctrl, const char *filename );
-gpg_error_t decrypt_message_fd (ctrl_t ctrl, int input_fd, int output_fd);
+gpg_error_t decrypt_message_fd (ctrl_t ctrl, int input_fd,
+                                estream_t output);
 void decrypt_messages (ctrl_t ctrl, int nfiles, char *files[]);
 
 /*-- plaintext.c --*/
@@ -353,6 +389,7 @@ void unblock_all_signals(void);
 
 /*-- server.c --*/
 int gpg_server (ctrl_t);
+int gpg_daemon (void);
 
 #ifdef ENABLE_CARD_SUPPORT
 /*-- card-util.c --*/
@@ -83,6 +83,9 @@ struct
   int compress_level;
   int bz2_compress_level;
   int bz2_decompress_lowmem;
+  int compress_threads; /* Number of threads used for ZIP and ZLIB.  */
+  int compress_probe;   /* Skip compression of incompressible data.  */
+  int pipelined_decryption; /* Decrypt and decompress in threads.  */
   const char *def_secret_key;
   char *def_recipient;
   int def_recipient_self;
@@ -95,6 +98,9 @@ struct
   int marginals_needed;
   int completes_needed;
   int max_cert_depth;
+  int trustdb_jobs;     /* Number of threads used by validate_keys.  */
+  int recipient_jobs;   /* Number of threads used for pubkey_enc.  */
+  int incremental_trustdb; /* Revalidate only changed keys if possible.  */
   const char *homedir;
   const char *agent_program;
 
@@ -137,6 +143,7 @@ struct
   int not_dash_escaped;
   int escape_from;
   int lock_once;
+  int trustdb_mmap;  /* Read the trustdb using mmap.  */
   keyserver_spec_t keyserver;  /* The list of configured keyservers.  */
   struct
   {
@@ -185,6 +192,7 @@ struct
   int try_all_secrets;
   int no_expensive_trust_checks;
   int no_sig_cache;
+  int persistent_sig_cache; /* Use the file sigcache.db.  */
   int no_sig_create_check;
   int no_auto_check_trustdb;
   int preserve_permissions;
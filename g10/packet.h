@@ -476,6 +476,13 @@ int cmp_public_keys( PKT_public_key *a, PKT_public_key *b );
 int cmp_signatures( PKT_signature *a, PKT_signature *b );
 int cmp_user_ids( PKT_user_id *a, PKT_user_id *b );
 
+/*-- kbnode.c --*/
+void *pkt_arena_alloc (size_t n);
+void *pkt_arena_alloc_clear (size_t n);
+int pkt_arena_owns (const void *p);
+void pkt_arena_free (void *p);
+void pkt_arena_print_stats (void);
+
 
 /*-- sig-check.c --*/
 int signature_check( PKT_signature *sig, gcry_md_hd_t digest );
@@ -577,7 +577,7 @@ parse (IOBUF inp, PACKET * pkt, int onlykeypkts, off_t * retpos,
       rc = parse_pubkeyenc (inp, pkttype, pktlen, pkt);
       break;
     case PKT_SIGNATURE:
-      pkt->pkt.signature = xmalloc_clear (sizeof *pkt->pkt.signature);
+      pkt->pkt.signature = pkt_arena_alloc_clear (sizeof *pkt->pkt.signature);
       rc = parse_signature (inp, pkttype, pktlen, pkt->pkt.signature);
       break;
     case PKT_ONEPASS_SIG:
@@ -1596,7 +1596,7 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 	}
       if (n)
 	{
-	  sig->hashed = xmalloc (sizeof (*sig->hashed) + n - 1);
+	  sig->hashed = pkt_arena_alloc (sizeof (*sig->hashed) + n - 1);
 	  sig->hashed->size = n;
 	  sig->hashed->len = n;
 	  if (iobuf_read (inp, sig->hashed->data, n) != n)
@@ -1618,7 +1618,7 @@ parse_signature (IOBUF inp, int pkttype, unsigned long pktlen,
 	}
       if (n)
 	{
-	  sig->unhashed = xmalloc (sizeof (*sig->unhashed) + n - 1);
+	  sig->unhashed = pkt_arena_alloc (sizeof (*sig->unhashed) + n - 1);
 	  sig->unhashed->size = n;
 	  sig->unhashed->len = n;
 	  if (iobuf_read (inp, sig->unhashed->data, n) != n)
@@ -2378,7 +2378,8 @@ parse_user_id (IOBUF inp, int pkttype, unsigned long pktlen, PACKET * packet)
       return G10ERR_INVALID_PACKET;
     }
 
-  packet->pkt.user_id = xmalloc_clear (sizeof *packet->pkt.user_id + pktlen);
+  packet->pkt.user_id = pkt_arena_alloc_clear (sizeof *packet->pkt.user_id
+                                               + pktlen);
   packet->pkt.user_id->len = pktlen;
   packet->pkt.user_id->ref = 1;
 
@@ -2448,8 +2449,8 @@ parse_attribute (IOBUF inp, int pkttype, unsigned long pktlen,
   (void) pkttype;
 
 #define EXTRA_UID_NAME_SPACE 71
-  packet->pkt.user_id = xmalloc_clear (sizeof *packet->pkt.user_id
-				       + EXTRA_UID_NAME_SPACE);
+  packet->pkt.user_id = pkt_arena_alloc_clear (sizeof *packet->pkt.user_id
+                                               + EXTRA_UID_NAME_SPACE);
   packet->pkt.user_id->ref = 1;
   packet->pkt.user_id->attrib_data = xmalloc (pktlen);
   packet->pkt.user_id->attrib_len = pktlen;
@@ -0,0 +1,285 @@
+/* pipeline.c - run the lower filters of an input chain in a thread
+ * Copyright (C) 2012 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The pipeline filter is used with --pipelined-decryption.  It is
+   pushed on top of the decryption filter and on top of the
+   decompression filter.  On the first read it starts a thread which
+   reads from the filters below it and stores the data in a ring of
+   PIPELINE_NBUFS buffers.  The reader of the iobuf takes the data
+   from the ring.  Thus the decryption, the decompression and the
+   parsing of the plaintext each run in their own thread.
+
+   Like all threads of gpg, a producer thread holds the nPth lock
+   while it runs the filters below it.  The filters release the lock
+   only around the actual decryption, hashing and decompression,
+   which thus may run on another core.
+
+   The owner of a pipeline (decrypt_data or handle_compressed) stops
+   it with release_pipeline_context before it looks at the state of
+   the filters below.  If the filter has not yet seen EOF, it then
+   returns the already buffered data and reads from the chain
+   directly, just as if there was no pipeline.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <npth.h>
+
+#include "gpg.h"
+#include "iobuf.h"
+#include "filter.h"
+#include "util.h"
+#include "main.h"
+#include "options.h"
+
+#define PIPELINE_NBUFS   4
+#define PIPELINE_BUFSIZE (64*1024)
+
+struct pipeline_filter_context_s
+{
+  int refcount;
+  npth_mutex_t lock;
+  npth_cond_t cond;        /* Signaled on any change of the ring.  */
+  npth_t thread;
+  int running;             /* The thread has been started.  */
+  int stopped;             /* The thread will not be started again.  */
+  int stop;                /* Ask the thread to terminate.  */
+  int eof;                 /* The thread has seen EOF.  */
+  iobuf_t chain;           /* The iobuf read by the thread.  */
+  struct {
+    byte *buf;
+    size_t len;
+  } ring[PIPELINE_NBUFS];
+  unsigned int head;       /* Slot the reader takes data from.  */
+  unsigned int count;      /* Number of filled slots.  */
+  size_t pos;              /* Offset of the next byte at HEAD.  */
+};
+
+
+static void
+release_context (pipeline_filter_context_t pfx)
+{
+  int i;
+
+  if (!pfx)
+    return;
+
+  assert (pfx->refcount);
+  if ( --pfx->refcount )
+    return;
+
+  for (i=0; i < PIPELINE_NBUFS; i++)
+    xfree (pfx->ring[i].buf);
+  npth_cond_destroy (&pfx->cond);
+  npth_mutex_destroy (&pfx->lock);
+  xfree (pfx);
+}
+
+
+/* The thread function.  */
+static void *
+pipeline_thread (void *arg)
+{
+  pipeline_filter_context_t pfx = arg;
+  unsigned int slot;
+  int n;
+
+  npth_mutex_lock (&pfx->lock);
+  for (;;)
+    {
+      while (pfx->count == PIPELINE_NBUFS && !pfx->stop)
+        npth_cond_wait (&pfx->cond, &pfx->lock);
+      if (pfx->stop)
+        break;
+      slot = (pfx->head + pfx->count) % PIPELINE_NBUFS;
+      npth_mutex_unlock (&pfx->lock);
+
+      n = iobuf_read (pfx->chain, pfx->ring[slot].buf, PIPELINE_BUFSIZE);
+
+      npth_mutex_lock (&pfx->lock);
+      if (n == -1)
+        {
+          pfx->eof = 1;
+          break;
+        }
+      pfx->ring[slot].len = n;
+      pfx->count++;
+      npth_cond_broadcast (&pfx->cond);
+    }
+  npth_cond_broadcast (&pfx->cond);
+  npth_mutex_unlock (&pfx->lock);
+  return NULL;
+}
+
+
+/* Start the thread for PFX reading from CHAIN.  */
+static void
+start_thread (pipeline_filter_context_t pfx, iobuf_t chain)
+{
+  npth_attr_t tattr;
+  int i, err;
+
+  pfx->chain = chain;
+  for (i=0; i < PIPELINE_NBUFS; i++)
+    pfx->ring[i].buf = xmalloc (PIPELINE_BUFSIZE);
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  err = npth_create (&pfx->thread, &tattr, pipeline_thread, pfx);
+  npth_attr_destroy (&tattr);
+  if (err)
+    {
+      log_error ("error spawning pipeline thread: %s\n", strerror (err));
+      pfx->stopped = 1;
+    }
+  else
+    pfx->running = 1;
+}
+
+
+/* Stop the thread of PFX and wait for it.  */
+static void
+stop_thread (pipeline_filter_context_t pfx)
+{
+  if (pfx->running)
+    {
+      npth_mutex_lock (&pfx->lock);
+      pfx->stop = 1;
+      npth_cond_broadcast (&pfx->cond);
+      npth_mutex_unlock (&pfx->lock);
+      npth_join (pfx->thread, NULL);
+      pfx->running = 0;
+    }
+  pfx->stopped = 1;
+}
+
+
+/* Copy up to SIZE bytes from the ring of PFX to BUF and return the
+   number of bytes copied.  Must be called with PFX->LOCK held or
+   after the thread has terminated.  */
+static size_t
+take_data (pipeline_filter_context_t pfx, byte *buf, size_t size)
+{
+  size_t n;
+
+  if (!pfx->count)
+    return 0;
+  n = pfx->ring[pfx->head].len - pfx->pos;
+  if (n > size)
+    n = size;
+  memcpy (buf, pfx->ring[pfx->head].buf + pfx->pos, n);
+  pfx->pos += n;
+  if (pfx->pos == pfx->ring[pfx->head].len)
+    {
+      pfx->head = (pfx->head + 1) % PIPELINE_NBUFS;
+      pfx->count--;
+      pfx->pos = 0;
+    }
+  return n;
+}
+
+
+static int
+pipeline_filter (void *opaque, int control,
+                 iobuf_t a, byte *buf, size_t *ret_len)
+{
+  pipeline_filter_context_t pfx = opaque;
+  size_t n = 0;
+  int rc = 0;
+
+  if (control == IOBUFCTRL_UNDERFLOW)
+    {
+      if (!pfx->running && !pfx->stopped)
+        start_thread (pfx, a);
+
+      if (pfx->running)
+        {
+          npth_mutex_lock (&pfx->lock);
+          while (!pfx->count && !pfx->eof)
+            npth_cond_wait (&pfx->cond, &pfx->lock);
+          n = take_data (pfx, buf, *ret_len);
+          npth_cond_broadcast (&pfx->cond);
+          npth_mutex_unlock (&pfx->lock);
+          if (!n)
+            stop_thread (pfx);
+        }
+      else
+        {
+          n = take_data (pfx, buf, *ret_len);
+          if (!n && !pfx->eof)
+            {
+              int len = iobuf_read (a, buf, *ret_len);
+
+              n = len == -1? 0 : len;
+            }
+        }
+
+      if (!n)
+        rc = -1; /* EOF */
+      *ret_len = n;
+    }
+  else if (control == IOBUFCTRL_FREE)
+    {
+      stop_thread (pfx);
+      release_context (pfx);
+    }
+  else if (control == IOBUFCTRL_DESC)
+    *(char**)buf = "pipeline_filter";
+
+  return rc;
+}
+
+
+/* Push a pipeline filter on A if enabled.  Returns NULL if not.  The
+   caller must call release_pipeline_context when done with A.  */
+pipeline_filter_context_t
+push_pipeline_filter (iobuf_t a)
+{
+  pipeline_filter_context_t pfx;
+  int err;
+
+  /* Status lines must not be written from another thread.  */
+  if (!opt.pipelined_decryption || opt.enable_progress_filter)
+    return NULL;
+
+  gpg_init_npth ();
+  pfx = xmalloc_clear (sizeof *pfx);
+  if ((err = npth_mutex_init (&pfx->lock, NULL))
+      || (err = npth_cond_init (&pfx->cond, NULL)))
+    log_fatal ("error initializing the pipeline: %s\n", strerror (err));
+
+  pfx->refcount = 2;
+  iobuf_push_filter (a, pipeline_filter, pfx);
+  return pfx;
+}
+
+
+/* Stop the thread of PFX and release the caller's reference.  The
+   filter itself may still be in use.  */
+void
+release_pipeline_context (pipeline_filter_context_t pfx)
+{
+  if (!pfx)
+    return;
+
+  stop_thread (pfx);
+  release_context (pfx);
+}
@@ -772,37 +772,15 @@ expand_group(strlist_t input)
 }
 
 
-/* Helper for build_pk_list to find and check one key.  This helper is
-   also used directly in server mode by the RECIPIENTS command.  On
-   success the new key is added to PK_LIST_ADDR.  NAME is the user id
-   of the key. USE the requested usage and a set MARK_HIDDEN will mark
-   the key in the updated list as a hidden recipient. */
-gpg_error_t
-find_and_check_key (ctrl_t ctrl, const char *name, unsigned int use,
-                    int mark_hidden, pk_list_t *pk_list_addr)
+/* Check the key PK found for NAME and add it to PK_LIST_ADDR.  PK is
+   consumed.  */
+static gpg_error_t
+check_and_add_key (const char *name, PKT_public_key *pk, unsigned int use,
+                   int mark_hidden, pk_list_t *pk_list_addr)
 {
   int rc;
-  PKT_public_key *pk;
   int trustlevel;
 
-  if (!name || !*name)
-    return gpg_error (GPG_ERR_INV_USER_ID);
-
-  pk = xtrycalloc (1, sizeof *pk);
-  if (!pk)
-    return gpg_error_from_syserror ();
-  pk->req_usage = use;
-
-  rc = get_pubkey_byname (ctrl, NULL, pk, name, NULL, NULL, 0, 0);
-  if (rc)
-    {
-      /* Key not found or other error. */
-      log_error (_("%s: skipped: %s\n"), name, g10_errstr(rc) );
-      send_status_inv_recp (0, name);
-      free_public_key (pk);
-      return rc;
-    }
-
   rc = openpgp_pk_test_algo2 (pk->pubkey_algo, use);
   if (rc)
     {
@@ -861,6 +839,40 @@ find_and_check_key (ctrl_t ctrl, const char *name, unsigned int use,
 }
 
 
+/* Helper for build_pk_list to find and check one key.  This helper is
+   also used directly in server mode by the RECIPIENTS command.  On
+   success the new key is added to PK_LIST_ADDR.  NAME is the user id
+   of the key. USE the requested usage and a set MARK_HIDDEN will mark
+   the key in the updated list as a hidden recipient. */
+gpg_error_t
+find_and_check_key (ctrl_t ctrl, const char *name, unsigned int use,
+                    int mark_hidden, pk_list_t *pk_list_addr)
+{
+  int rc;
+  PKT_public_key *pk;
+
+  if (!name || !*name)
+    return gpg_error (GPG_ERR_INV_USER_ID);
+
+  pk = xtrycalloc (1, sizeof *pk);
+  if (!pk)
+    return gpg_error_from_syserror ();
+  pk->req_usage = use;
+
+  rc = get_pubkey_byname (ctrl, NULL, pk, name, NULL, NULL, 0, 0);
+  if (rc)
+    {
+      /* Key not found or other error. */
+      log_error (_("%s: skipped: %s\n"), name, g10_errstr(rc) );
+      send_status_inv_recp (0, name);
+      free_public_key (pk);
+      return rc;
+    }
+
+  return check_and_add_key (name, pk, use, mark_hidden, pk_list_addr);
+}
+
+
 
 /* This is the central function to collect the keys for recipients.
    It is thus used to prepare a public key encryption. encrypt-to
@@ -892,6 +904,9 @@ build_pk_list (ctrl_t ctrl,
   int any_recipients=0;
   strlist_t rov,remusr;
   char *def_rec = NULL;
+  char **names = NULL;
+  PKT_public_key **pks = NULL;
+  int nnames = 0, i;
 
   /* Try to expand groups if any have been defined. */
   if (opt.grouplist)
@@ -1174,15 +1189,37 @@ build_pk_list (ctrl_t ctrl,
     }
   else
     {
-      /* General case: Check all keys. */
+      /* General case: Check all keys.  With several recipients we
+         first look up their keys in one go.  */
+      for (nnames = 0, rov = remusr; rov; rov = rov->next)
+        if (!(rov->flags & 1))
+          nnames++;
+      if (nnames > 1)
+        {
+          names = xcalloc (nnames, sizeof *names);
+          pks = xcalloc (nnames, sizeof *pks);
+          for (i = 0, rov = remusr; rov; rov = rov->next)
+            if (!(rov->flags & 1))
+              names[i++] = rov->d;
+          get_pubkeys_byname (names, nnames, use, pks);
+        }
+
       any_recipients = 0;
-      for (; remusr; remusr = remusr->next )
+      for (i = 0; remusr; remusr = remusr->next )
         {
           if ( (remusr->flags & 1) )
             continue; /* encrypt-to keys are already handled. */
 
-          rc = find_and_check_key (ctrl, remusr->d, use, !!(remusr->flags&2),
-                                   &pk_list);
+          if (pks && pks[i])
+            {
+              rc = check_and_add_key (remusr->d, pks[i], use,
+                                      !!(remusr->flags&2), &pk_list);
+              pks[i] = NULL;
+            }
+          else
+            rc = find_and_check_key (ctrl, remusr->d, use,
+                                     !!(remusr->flags&2), &pk_list);
+          i++;
           if (rc)
             goto fail;
           any_recipients = 1;
@@ -1198,6 +1235,14 @@ build_pk_list (ctrl_t ctrl,
 
  fail:
 
+  if (pks)
+    {
+      for (i = 0; i < nnames; i++)
+        if (pks[i])
+          free_public_key (pks[i]);
+      xfree (pks);
+    }
+  xfree (names);
   if ( rc )
     release_pk_list( pk_list );
   else
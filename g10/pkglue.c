@@ -137,7 +137,11 @@ pk_verify (int algo, gcry_mpi_t hash, gcry_mpi_t *data, gcry_mpi_t *pkey)
     BUG ();
 
   if (!rc)
-    rc = gcry_pk_verify (s_sig, s_hash, s_pkey);
+    {
+      gpg_npth_unprotect ();
+      rc = gcry_pk_verify (s_sig, s_hash, s_pkey);
+      gpg_npth_protect ();
+    }
 
   gcry_sexp_release (s_sig);
   gcry_sexp_release (s_hash);
@@ -210,7 +214,9 @@ pk_encrypt (int algo, gcry_mpi_t *resarr, gcry_mpi_t data,
 
 
   /* Pass it to libgcrypt. */
+  gpg_npth_unprotect ();
   rc = gcry_pk_encrypt (&s_ciph, s_data, s_pkey);
+  gpg_npth_protect ();
   gcry_sexp_release (s_data);
   gcry_sexp_release (s_pkey);
 
@@ -519,10 +519,14 @@ do_hash (gcry_md_hd_t md, gcry_md_hd_t md2, IOBUF fp, int textmode)
     }
   else
     {
-      while ((c = iobuf_get (fp)) != -1)
+      const void *p;
+      size_t n;
+
+      /* Hash the data directly from the buffer of FP.  */
+      while ((p = iobuf_get_span (fp, (size_t)(-1), &n)))
 	{
 	  if (md)
-	    gcry_md_putc (md, c);
+	    gcry_md_write (md, p, n);
 	}
     }
 }
@@ -25,7 +25,14 @@
 #include <stdarg.h>
 #include <ctype.h>
 #include <unistd.h>
-
+#ifndef HAVE_W32_SYSTEM
+# include <sys/socket.h>
+# include <sys/un.h>
+#endif /*!HAVE_W32_SYSTEM*/
+#ifdef HAVE_SIGNAL_H
+# include <signal.h>
+#endif
+#include <npth.h>
 
 #include "gpg.h"
 #include <assuan.h>
@@ -34,6 +41,11 @@
 #include "options.h"
 #include "../common/sysutils.h"
 #include "status.h"
+#include "keydb.h"
+#include "main.h"
+#include "iobuf.h"
+#include "filter.h"
+#include "trustdb.h"
 
 
 #define set_error(e,t) assuan_set_error (ctx, gpg_error (e), (t))
@@ -50,9 +62,87 @@ struct server_local_s
   /* List of prepared recipients.  */
   pk_list_t recplist;
 
+  /* List of signers as set by the SIGNER command.  */
+  strlist_t signerlist;
+
+  /* The stream used for the status lines of this connection.  */
+  estream_t status_fp;
 };
 
 
+/* Flag telling whether we are running as a daemon serving several
+   connections.  */
+static int daemon_mode;
+
+/* In daemon mode the connections share the key database caches, the
+   trustdb, the connection to the gpg-agent and some global state.
+   Commands which only read the key databases take this lock in
+   shared mode; commands which modify them, talk to the gpg-agent or
+   change global state take it exclusively.  */
+static npth_rwlock_t keydb_lock;
+
+/* Flag indicating that a shutdown of the daemon has been requested.  */
+static int shutdown_pending;
+
+/* Counter for the currently running connections.  */
+static int active_connections;
+
+/* The nonce used to check connections to the daemon socket.  */
+static assuan_sock_nonce_t socket_nonce;
+
+/* Name of the daemon socket.  */
+static char *socket_name;
+
+/* The key to access the status stream of the connection served by
+   the current thread in daemon mode.  */
+static npth_key_t status_fp_key;
+
+/* The status stream of the connection if we are not running as a
+   daemon.  */
+static estream_t server_status_fp;
+
+/* The default system hooks for Assuan are replaced by the npth ones
+   in daemon mode.  */
+ASSUAN_SYSTEM_NPTH_IMPL;
+
+
+/* Cookie definition for assuan data line output.  */
+static ssize_t data_line_cookie_write (void *cookie,
+                                       const void *buffer, size_t size);
+static int data_line_cookie_close (void *cookie);
+static es_cookie_io_functions_t data_line_cookie_functions =
+  {
+    NULL,
+    data_line_cookie_write,
+    NULL,
+    data_line_cookie_close
+  };
+
+/* Cookie definition for assuan status line output.  */
+static ssize_t status_line_cookie_write (void *cookie,
+                                         const void *buffer, size_t size);
+static int status_line_cookie_close (void *cookie);
+static es_cookie_io_functions_t status_line_cookie_functions =
+  {
+    NULL,
+    status_line_cookie_write,
+    NULL,
+    status_line_cookie_close
+  };
+
+/* Cookie definition for output to a file descriptor of the client.  */
+static ssize_t client_fd_cookie_write (void *cookie,
+                                       const void *buffer, size_t size);
+static int client_fd_cookie_close (void *cookie);
+static es_cookie_io_functions_t client_fd_cookie_functions =
+  {
+    NULL,
+    client_fd_cookie_write,
+    NULL,
+    client_fd_cookie_close
+  };
+
+
 
 /* Helper to close the message fd if it is open. */
 static void
@@ -66,6 +156,54 @@ close_message_fd (ctrl_t ctrl)
 }
 
 
+/* Take the key database lock; in shared mode unless EXCLUSIVE is
+   set.  This is a no-op if we are not running as a daemon.  */
+static void
+lock_keydb (int exclusive)
+{
+  int err;
+
+  if (!daemon_mode)
+    return;
+
+  if (exclusive)
+    err = npth_rwlock_wrlock (&keydb_lock);
+  else
+    err = npth_rwlock_rdlock (&keydb_lock);
+  if (err)
+    log_fatal ("failed to acquire the keydb lock: %s\n", strerror (err));
+}
+
+
+/* Return true if --auto-key-locate may import keys, i.e. it uses a
+   mechanism other than the local keyring.  */
+static int
+akl_may_import (void)
+{
+  struct akl *akl;
+
+  for (akl = opt.auto_key_locate; akl; akl = akl->next)
+    if (akl->type != AKL_NODEFAULT && akl->type != AKL_LOCAL)
+      return 1;
+  return 0;
+}
+
+
+/* Release the lock taken by lock_keydb.  */
+static void
+unlock_keydb (void)
+{
+  int err;
+
+  if (!daemon_mode)
+    return;
+
+  err = npth_rwlock_unlock (&keydb_lock);
+  if (err)
+    log_fatal ("failed to release the keydb lock: %s\n", strerror (err));
+}
+
+
 /* Skip over options.  Blanks after the options are also removed.  */
 static char *
 skip_options (const char *line)
@@ -97,6 +235,214 @@ has_option (const char *line, const char *name)
 }
 
 
+/* Note that it is sufficient to allocate the target string D as
+   long as the source string S, i.e.: strlen(s)+1; */
+static void
+strcpy_escaped_plus (char *d, const char *s)
+{
+  while (*s)
+    {
+      if (*s == '%' && s[1] && s[2])
+        {
+          s++;
+          *d++ = xtoi_2 (s);
+          s += 2;
+        }
+      else if (*s == '+')
+        *d++ = ' ', s++;
+      else
+        *d++ = *s++;
+    }
+  *d = 0;
+}
+
+
+/* Break LINE down into a list of plus-escaped patterns and store it
+   at R_LIST.  */
+static gpg_error_t
+line_to_strlist (char *line, strlist_t *r_list)
+{
+  char *p;
+  strlist_t list, sl;
+
+  list = NULL;
+  for (p=line; *p; line = p)
+    {
+      while (*p && *p != ' ')
+        p++;
+      if (*p)
+        *p++ = 0;
+      if (*line)
+        {
+          sl = xtrymalloc (sizeof *sl + strlen (line));
+          if (!sl)
+            {
+              gpg_error_t err = gpg_error_from_syserror ();
+              free_strlist (list);
+              return err;
+            }
+          sl->flags = 0;
+          strcpy_escaped_plus (sl->d, line);
+          sl->next = list;
+          list = sl;
+        }
+    }
+  *r_list = list;
+  return 0;
+}
+
+
+/* A write handler used by es_fopencookie to write assuan data
+   lines.  */
+static ssize_t
+data_line_cookie_write (void *cookie, const void *buffer, size_t size)
+{
+  assuan_context_t ctx = cookie;
+
+  if (assuan_send_data (ctx, buffer, size))
+    {
+      gpg_err_set_errno (EIO);
+      return -1;
+    }
+
+  return size;
+}
+
+static int
+data_line_cookie_close (void *cookie)
+{
+  assuan_context_t ctx = cookie;
+
+  if (assuan_send_data (ctx, NULL, 0))
+    {
+      gpg_err_set_errno (EIO);
+      return -1;
+    }
+
+  return 0;
+}
+
+
+/* The object used as cookie for the status line stream.  The status
+   functions write complete lines in the --status-fd format; they are
+   collected in LINE and sent as assuan status lines.  */
+struct status_line_cookie_s
+{
+  assuan_context_t ctx;
+  size_t len;
+  char line[ASSUAN_LINELENGTH - 16];
+};
+
+
+/* Send the status line collected in COOKIE to the client.  */
+static void
+send_status_line (struct status_line_cookie_s *cookie)
+{
+  char *keyword, *args;
+
+  cookie->line[cookie->len] = 0;
+  cookie->len = 0;
+  keyword = cookie->line;
+  if (!strncmp (keyword, "[GNUPG:] ", 9))
+    keyword += 9;
+  args = strchr (keyword, ' ');
+  if (args)
+    *args++ = 0;
+  if (*keyword)
+    assuan_write_status (cookie->ctx, keyword, args? args : "");
+}
+
+
+/* A write handler used by es_fopencookie to write assuan status
+   lines.  Overlong lines are truncated.  Errors are ignored: a
+   vanished client is noticed by the I/O of the command and must not
+   terminate the process as --exit-on-status-write-error would.  */
+static ssize_t
+status_line_cookie_write (void *cookie, const void *buffer, size_t size)
+{
+  struct status_line_cookie_s *slc = cookie;
+  const char *p = buffer;
+  size_t n;
+
+  for (n = 0; n < size; n++, p++)
+    {
+      if (*p == '\n')
+        send_status_line (slc);
+      else if (slc->len < sizeof slc->line - 1)
+        slc->line[slc->len++] = *p;
+    }
+
+  return size;
+}
+
+static int
+status_line_cookie_close (void *cookie)
+{
+  struct status_line_cookie_s *slc = cookie;
+
+  if (slc->len)
+    send_status_line (slc);
+  xfree (slc);
+  return 0;
+}
+
+
+/* Return the status stream of the connection served by the current
+   thread.  This is the hook used by the status functions.  */
+static estream_t
+connection_status_fp (void)
+{
+  if (daemon_mode)
+    return npth_getspecific (status_fp_key);
+  return server_status_fp;
+}
+
+
+/* A write handler used by es_fopencookie to write to a file
+   descriptor passed by the client.  The nPth lock is released while
+   the write blocks so that the other connections are served.  */
+static ssize_t
+client_fd_cookie_write (void *cookie, const void *buffer, size_t size)
+{
+  int fd = *(int*)cookie;
+  ssize_t n;
+
+  gpg_npth_unprotect ();
+  do
+    n = write (fd, buffer, size);
+  while (n == -1 && errno == EINTR);
+  gpg_npth_protect ();
+
+  return n;
+}
+
+static int
+client_fd_cookie_close (void *cookie)
+{
+  xfree (cookie);
+  return 0;
+}
+
+
+/* Return a stream for writing to the file descriptor FD of the
+   client.  The file descriptor is not closed by es_fclose.  */
+static estream_t
+open_client_fd (int fd)
+{
+  int *cookie;
+  estream_t fp;
+
+  cookie = xtrymalloc (sizeof *cookie);
+  if (!cookie)
+    return NULL;
+  *cookie = fd;
+  fp = es_fopencookie (cookie, "wb", client_fd_cookie_functions);
+  if (!fp)
+    xfree (cookie);
+  return fp;
+}
+
+
 
 
 
@@ -153,6 +499,8 @@ reset_notify (assuan_context_t ctx, char *line)
 
   release_pk_list (ctrl->server_local->recplist);
   ctrl->server_local->recplist = NULL;
+  free_strlist (ctrl->server_local->signerlist);
+  ctrl->server_local->signerlist = NULL;
 
   close_message_fd (ctrl);
   assuan_close_input_fd (ctx);
@@ -231,8 +579,11 @@ cmd_recipient (assuan_context_t ctx, char *line)
     remusr = rcpts;
   */
 
+  /* Locating a missing key may import it.  */
+  lock_keydb (akl_may_import ());
   err = find_and_check_key (ctrl, line, PUBKEY_USAGE_ENC, hidden,
                             &ctrl->server_local->recplist);
+  unlock_keydb ();
 
   if (err)
     log_error ("command '%s' failed: %s\n", "RECIPIENT", gpg_strerror (err));
@@ -259,9 +610,29 @@ cmd_recipient (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_signer (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  strlist_t sl = NULL;
+  SK_LIST sk_list = NULL;
+
+  line = skip_options (line);
+  if (!*line)
+    return set_error (GPG_ERR_ASS_PARAMETER, "no user ID given");
+
+  /* Check the key now so that the client learns about unusable keys
+     before the SIGN command.  */
+  add_to_strlist (&sl, line);
+  lock_keydb (1);
+  err = build_sk_list (sl, &sk_list, PUBKEY_USAGE_SIG);
+  unlock_keydb ();
+  release_sk_list (sk_list);
+  free_strlist (sl);
+  if (!err)
+    append_to_strlist (&ctrl->server_local->signerlist, line);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n", "SIGNER", gpg_strerror (err));
+  return err;
 }
 
 
@@ -324,9 +695,11 @@ cmd_encrypt (assuan_context_t ctx, char *line)
 
   /* fixme: err = ctrl->audit? 0 : start_audit_session (ctrl);*/
 
+  lock_keydb (0);
   err = encrypt_crypt (ctrl, inp_fd, NULL, NULL, 0,
                        ctrl->server_local->recplist,
                        out_fd);
+  unlock_keydb ();
 
  leave:
   /* Release the recipient list on success.  */
@@ -357,6 +730,7 @@ cmd_decrypt (assuan_context_t ctx, char *line)
   ctrl_t ctrl = assuan_get_pointer (ctx);
   gpg_error_t err;
   int inp_fd, out_fd;
+  estream_t out_fp;
 
   (void)line; /* LINE is not used.  */
 
@@ -366,11 +740,19 @@ cmd_decrypt (assuan_context_t ctx, char *line)
   out_fd = translate_sys2libc_fd (assuan_get_output_fd (ctx), 1);
   if (out_fd == -1)
     return set_error (GPG_ERR_ASS_NO_OUTPUT, NULL);
+  out_fp = open_client_fd (out_fd);
+  if (!out_fp)
+    return set_error (gpg_err_code_from_syserror (), "fdopen() failed");
 
+  lock_keydb (1);
   glo_ctrl.lasterr = 0;
-  err = decrypt_message_fd (ctrl, inp_fd, out_fd);
+  err = decrypt_message_fd (ctrl, inp_fd, out_fp);
   if (!err)
     err = glo_ctrl.lasterr;
+  unlock_keydb ();
+
+  if (es_fclose (out_fp) && !err)
+    err = gpg_error_from_syserror ();
 
   /* Close and reset the fds. */
   close_message_fd (ctrl);
@@ -412,7 +794,7 @@ cmd_verify (assuan_context_t ctx, char *line)
 
   if (out_fd != GNUPG_INVALID_FD)
     {
-      out_fp = es_fdopen_nc (out_fd, "w");
+      out_fp = open_client_fd (translate_sys2libc_fd (out_fd, 1));
       if (!out_fp)
         return set_error (gpg_err_code_from_syserror (), "fdopen() failed");
     }
@@ -420,7 +802,12 @@ cmd_verify (assuan_context_t ctx, char *line)
   log_debug ("WARNING: The server mode is WORK "
              "iN PROGRESS and not ready for use\n");
 
+  /* Retrieving a missing key from a keyserver modifies the key
+     database.  */
+  lock_keydb (!!(opt.keyserver_options.options
+                 & KEYSERVER_AUTO_KEY_RETRIEVE));
   rc = gpg_verify (ctrl, fd, ctrl->server_local->message_fd, out_fp);
+  unlock_keydb ();
 
   es_fclose (out_fp);
   close_message_fd (ctrl);
@@ -438,16 +825,49 @@ cmd_verify (assuan_context_t ctx, char *line)
 
    Sign the data set with the INPUT command and write it to the sink
    set by OUTPUT.  With "--detached" specified, a detached signature
-   is created.  */
+   is created.  The keys set with SIGNER are used or the default key
+   if no SIGNER command has been given.  */
 static gpg_error_t
 cmd_sign (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  int inp_fd, out_fd;
+  int detached;
+
+  detached = has_option (line, "--detached");
+
+  inp_fd = translate_sys2libc_fd (assuan_get_input_fd (ctx), 0);
+  if (inp_fd == -1)
+    {
+      err = set_error (GPG_ERR_ASS_NO_INPUT, NULL);
+      goto leave;
+    }
+  out_fd = translate_sys2libc_fd (assuan_get_output_fd (ctx), 1);
+  if (out_fd == -1)
+    {
+      err = set_error (GPG_ERR_ASS_NO_OUTPUT, NULL);
+      goto leave;
+    }
+
+  lock_keydb (1);
+  err = sign_fd (ctrl, inp_fd, detached, ctrl->server_local->signerlist,
+                 out_fd);
+  unlock_keydb ();
+
+ leave:
+  /* Close and reset the fds. */
+  close_message_fd (ctrl);
+  assuan_close_input_fd (ctx);
+  assuan_close_output_fd (ctx);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n", "SIGN", gpg_strerror (err));
+  return err;
 }
 
 
+
 
 /*  IMPORT
 
@@ -456,46 +876,163 @@ cmd_sign (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_import (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  int inp_fd;
+  iobuf_t inp;
+
   (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  inp_fd = translate_sys2libc_fd (assuan_get_input_fd (ctx), 0);
+  if (inp_fd == -1)
+    return set_error (GPG_ERR_ASS_NO_INPUT, NULL);
+
+  inp = iobuf_fdopen_nc (inp_fd, "rb");
+  if (!inp)
+    err = set_error (gpg_err_code_from_syserror (), "fdopen() failed");
+  else
+    {
+      lock_keydb (1);
+      err = import_keys_stream (ctrl, inp, NULL, NULL, NULL,
+                                opt.import_options);
+      unlock_keydb ();
+      iobuf_close (inp);
+    }
+
+  /* Close and reset the fds. */
+  close_message_fd (ctrl);
+  assuan_close_input_fd (ctx);
+  assuan_close_output_fd (ctx);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n", "IMPORT", gpg_strerror (err));
+  return err;
 }
 
 
+
 
-/*  EXPORT [--data [--armor|--base64]] [--] pattern
+/*  EXPORT [--data [--armor]] [--] pattern
 
    Similar to the --export command line command, this command exports
    public keys matching PATTERN.  The output is send to the output fd
    unless the --data option has been used in which case the output
-   gets send inline using regular data lines.  The options "--armor"
-   and "--base" ospecify an output format if "--data" has been used.
-   Recall that in general the output format is set with the OUTPUT
-   command.
+   gets send inline using regular data lines.  The option "--armor"
+   specifies the output format if "--data" has been used.  Recall
+   that in general the output format is set with the OUTPUT command.
  */
 static gpg_error_t
 cmd_export (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  strlist_t list;
+  int use_data, armor;
+  iobuf_t out;
+  armor_filter_context_t *afx = NULL;
+
+  use_data = has_option (line, "--data");
+  armor = use_data? has_option (line, "--armor") : opt.armor;
+  line = skip_options (line);
+
+  err = line_to_strlist (line, &list);
+  if (err)
+    return err;
+
+  if (use_data)
+    out = iobuf_temp ();
+  else
+    {
+      int fd = translate_sys2libc_fd (assuan_get_output_fd (ctx), 1);
+
+      if (fd == -1)
+        {
+          free_strlist (list);
+          return set_error (GPG_ERR_ASS_NO_OUTPUT, NULL);
+        }
+      out = iobuf_fdopen_nc (fd, "wb");
+      if (!out)
+        {
+          free_strlist (list);
+          return set_error (gpg_err_code_from_syserror (), "fdopen() failed");
+        }
+    }
+
+  if (armor)
+    {
+      afx = new_armor_context ();
+      afx->what = 1;
+      push_armor_filter (afx, out);
+    }
+
+  lock_keydb (0);
+  err = export_pubkeys_stream (ctrl, out, list, NULL, opt.export_options);
+  unlock_keydb ();
+  if (err == -1)
+    err = gpg_error (GPG_ERR_NOT_FOUND);
+
+  if (use_data)
+    {
+      iobuf_flush_temp (out);
+      if (!err)
+        err = assuan_send_data (ctx, iobuf_get_temp_buffer (out),
+                                iobuf_get_temp_length (out));
+      iobuf_close (out);
+    }
+  else
+    {
+      if (err)
+        iobuf_cancel (out);
+      else
+        iobuf_close (out);
+      assuan_close_output_fd (ctx);
+    }
+  release_armor_context (afx);
+  free_strlist (list);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n", "EXPORT", gpg_strerror (err));
+  return err;
 }
 
 
+
 
-/*  DELKEYS
+/*  DELKEYS [--] pattern
 
-    Fixme
-*/
+    Delete the public keys matching PATTERN.  Because the server runs
+    in batch mode, the keys need to be given by fingerprint.  */
 static gpg_error_t
 cmd_delkeys (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  strlist_t list;
+
+  line = skip_options (line);
+  err = line_to_strlist (line, &list);
+  if (err)
+    return err;
+  if (!list)
+    return set_error (GPG_ERR_ASS_PARAMETER, "no pattern given");
+
+  lock_keydb (1);
+  err = delete_keys (list, 0, 0);
+  unlock_keydb ();
+  free_strlist (list);
+
+  /* Close and reset the fds. */
+  close_message_fd (ctrl);
+  assuan_close_input_fd (ctx);
+  assuan_close_output_fd (ctx);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n", "DELKEYS", gpg_strerror (err));
+  return err;
 }
 
 
+
 
 /*  MESSAGE FD[=<n>]
 
@@ -522,16 +1059,46 @@ cmd_message (assuan_context_t ctx, char *line)
 /* LISTKEYS [<patterns>]
    LISTSECRETKEYS [<patterns>]
 
-   fixme
+   List the public respective secret keys matching the plus-escaped
+   PATTERNS or all keys if no pattern is given.  The listing is
+   returned in the --with-colons format using data lines.
 */
 static gpg_error_t
 do_listkeys (assuan_context_t ctx, char *line, int mode)
 {
-  (void)ctx;
-  (void)line;
-  (void)mode;
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  strlist_t list;
+  estream_t fp, oldfp;
+  int save_with_colons;
 
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  err = line_to_strlist (line, &list);
+  if (err)
+    return err;
+
+  fp = es_fopencookie (ctx, "w", data_line_cookie_functions);
+  if (!fp)
+    {
+      free_strlist (list);
+      return set_error (GPG_ERR_ASS_GENERAL, "error setting up a data stream");
+    }
+
+  lock_keydb (1);
+  save_with_colons = opt.with_colons;
+  opt.with_colons = 1;
+  oldfp = keylist_set_output (fp);
+  if (mode == 2)
+    secret_key_list (ctrl, list);
+  else
+    public_key_list (ctrl, list, 0);
+  keylist_set_output (oldfp);
+  opt.with_colons = save_with_colons;
+  unlock_keydb ();
+
+  if (es_fclose (fp))
+    err = set_error (GPG_ERR_ASS_WRITE_ERROR, NULL);
+  free_strlist (list);
+  return err;
 }
 
 
@@ -660,22 +1227,18 @@ register_commands (assuan_context_t ctx)
 
 
 
-/* Startup the server.  CTRL must have been allocated by the caller
-   and set to the default values. */
-int
-gpg_server (ctrl_t ctrl)
+/* Run the command loop for one connection.  If FD is
+   GNUPG_INVALID_FD the server uses stdin and stdout, otherwise FD is
+   an accepted socket connection.  CTRL must have been allocated by
+   the caller and set to the default values. */
+static int
+serve_connection (ctrl_t ctrl, gnupg_fd_t fd)
 {
   int rc;
-  int filedes[2];
   assuan_context_t ctx = NULL;
   static const char hello[] = ("GNU Privacy Guard's OpenPGP server "
                                VERSION " ready");
 
-  /* We use a pipe based server so that we can work from scripts.
-     assuan_init_pipe_server will automagically detect when we are
-     called with a socketpair and ignore FILEDES in this case.  */
-  filedes[0] = assuan_fdopen (0);
-  filedes[1] = assuan_fdopen (1);
   rc = assuan_new (&ctx);
   if (rc)
     {
@@ -684,7 +1247,19 @@ gpg_server (ctrl_t ctrl)
       goto leave;
     }
 
-  rc = assuan_init_pipe_server (ctx, filedes);
+  if (fd == GNUPG_INVALID_FD)
+    {
+      assuan_fd_t filedes[2];
+
+      /* We use a pipe based server so that we can work from scripts.
+         assuan_init_pipe_server will automagically detect when we are
+         called with a socketpair and ignore FILEDES in this case.  */
+      filedes[0] = assuan_fdopen (0);
+      filedes[1] = assuan_fdopen (1);
+      rc = assuan_init_pipe_server (ctx, filedes);
+    }
+  else
+    rc = assuan_init_socket_server (ctx, fd, ASSUAN_SOCKET_SERVER_ACCEPTED);
   if (rc)
     {
       log_error ("failed to initialize the server: %s\n", gpg_strerror (rc));
@@ -735,6 +1310,31 @@ gpg_server (ctrl_t ctrl)
   ctrl->server_local->assuan_ctx = ctx;
   ctrl->server_local->message_fd = GNUPG_INVALID_FD;
 
+  /* Send the status lines of our commands to the client.  */
+  {
+    struct status_line_cookie_s *slc;
+
+    slc = xtrycalloc (1, sizeof *slc);
+    if (!slc)
+      {
+        rc = gpg_error_from_syserror ();
+        goto leave;
+      }
+    slc->ctx = ctx;
+    ctrl->server_local->status_fp = es_fopencookie
+      (slc, "w", status_line_cookie_functions);
+    if (!ctrl->server_local->status_fp)
+      {
+        rc = gpg_error_from_syserror ();
+        xfree (slc);
+        goto leave;
+      }
+    if (daemon_mode)
+      npth_setspecific (status_fp_key, ctrl->server_local->status_fp);
+    else
+      server_status_fp = ctrl->server_local->status_fp;
+  }
+
   for (;;)
     {
       rc = assuan_accept (ctx);
@@ -761,6 +1361,15 @@ gpg_server (ctrl_t ctrl)
   if (ctrl->server_local)
     {
       release_pk_list (ctrl->server_local->recplist);
+      free_strlist (ctrl->server_local->signerlist);
+      if (ctrl->server_local->status_fp)
+        {
+          if (daemon_mode)
+            npth_setspecific (status_fp_key, NULL);
+          else
+            server_status_fp = NULL;
+          es_fclose (ctrl->server_local->status_fp);
+        }
 
       xfree (ctrl->server_local);
       ctrl->server_local = NULL;
@@ -768,3 +1377,331 @@ gpg_server (ctrl_t ctrl)
   assuan_release (ctx);
   return rc;
 }
+
+
+/* Startup the server.  CTRL must have been allocated by the caller
+   and set to the default values. */
+int
+gpg_server (ctrl_t ctrl)
+{
+  set_status_stream_hook (connection_status_fp);
+  return serve_connection (ctrl, GNUPG_INVALID_FD);
+}
+
+
+
+
+/* Check whether another gpg daemon is listening on the socket
+   described by ADDR and ADDRLEN.  */
+static int
+socket_in_use (struct sockaddr *addr, socklen_t addrlen)
+{
+  gnupg_fd_t fd;
+  int rc;
+
+  fd = assuan_sock_new (AF_UNIX, SOCK_STREAM, 0);
+  if (fd == ASSUAN_INVALID_FD)
+    return 0;
+  rc = assuan_sock_connect (fd, addr, addrlen);
+  assuan_sock_close (fd);
+  return rc != -1;
+}
+
+
+/* Create the listening socket for the daemon at NAME.  Returns the
+   file descriptor or GNUPG_INVALID_FD on error.  A stale socket left
+   behind by a crashed daemon is removed.  */
+static gnupg_fd_t
+create_server_socket (const char *name)
+{
+  struct sockaddr_un serv_addr;
+  socklen_t len;
+  gnupg_fd_t fd;
+  int rc;
+
+  memset (&serv_addr, 0, sizeof serv_addr);
+  serv_addr.sun_family = AF_UNIX;
+  if (strlen (name) + 1 >= sizeof (serv_addr.sun_path))
+    {
+      log_error (_("socket name '%s' is too long\n"), name);
+      return GNUPG_INVALID_FD;
+    }
+  strcpy (serv_addr.sun_path, name);
+  len = SUN_LEN (&serv_addr);
+
+  fd = assuan_sock_new (AF_UNIX, SOCK_STREAM, 0);
+  if (fd == ASSUAN_INVALID_FD)
+    {
+      log_error (_("can't create socket: %s\n"), strerror (errno));
+      return GNUPG_INVALID_FD;
+    }
+
+  rc = assuan_sock_bind (fd, (struct sockaddr*)&serv_addr, len);
+  if (rc == -1
+      && (errno == EADDRINUSE
+#ifdef HAVE_W32_SYSTEM
+          || errno == EEXIST
+#endif
+          ))
+    {
+      if (socket_in_use ((struct sockaddr*)&serv_addr, len))
+        {
+          log_error ("a gpg daemon is already running on '%s'\n", name);
+          assuan_sock_close (fd);
+          return GNUPG_INVALID_FD;
+        }
+      gnupg_remove (name);
+      rc = assuan_sock_bind (fd, (struct sockaddr*)&serv_addr, len);
+    }
+  if (rc != -1
+      && (rc=assuan_sock_get_nonce ((struct sockaddr*)&serv_addr, len,
+                                    &socket_nonce)))
+    log_error (_("error getting nonce for the socket\n"));
+  if (rc == -1)
+    {
+      log_error (_("error binding socket to '%s': %s\n"), name,
+                 gpg_strerror (gpg_error_from_errno (errno)));
+      assuan_sock_close (fd);
+      return GNUPG_INVALID_FD;
+    }
+
+  if (listen (FD2INT (fd), 5) == -1)
+    {
+      log_error (_("listen() failed: %s\n"), strerror (errno));
+      assuan_sock_close (fd);
+      gnupg_remove (name);
+      return GNUPG_INVALID_FD;
+    }
+
+  if (opt.verbose)
+    log_info (_("listening on socket '%s'\n"), name);
+
+  return fd;
+}
+
+
+/* The main function of a connection thread.  */
+static void *
+start_connection_thread (void *arg)
+{
+  ctrl_t ctrl = arg;
+  gnupg_fd_t fd = ctrl->thread_startup.fd;
+
+  active_connections++;
+  if (assuan_sock_check_nonce (fd, &socket_nonce))
+    {
+      log_info (_("error reading nonce on fd %d: %s\n"),
+                FD2INT (fd), strerror (errno));
+      assuan_sock_close (fd);
+    }
+  else
+    {
+      if (opt.verbose)
+        log_info ("handler 0x%lx for fd %d started\n",
+                  (unsigned long) npth_self (), FD2INT (fd));
+      serve_connection (ctrl, fd);
+      if (opt.verbose)
+        log_info ("handler 0x%lx for fd %d terminated\n",
+                  (unsigned long) npth_self (), FD2INT (fd));
+    }
+
+  gpg_deinit_default_ctrl (ctrl);
+  xfree (ctrl);
+  active_connections--;
+  return NULL;
+}
+
+
+/* Handle the signal SIGNO in the daemon's main loop.  */
+static void
+handle_signal (int signo)
+{
+  switch (signo)
+    {
+    case SIGTERM:
+    case SIGINT:
+      if (!shutdown_pending)
+        log_info ("SIGTERM received - shutting down ...\n");
+      else
+        log_info ("SIGTERM received - still %i open connections\n",
+                  active_connections);
+      shutdown_pending++;
+      if (shutdown_pending > 2)
+        {
+          log_info ("shutdown forced\n");
+          gnupg_remove (socket_name);
+          g10_exit (0);
+        }
+      break;
+
+    default:
+      log_info ("signal %d received - no action defined\n", signo);
+    }
+}
+
+
+/* Wait for connection requests on LISTEN_FD and spawn a thread for
+   each accepted connection.  Returns after a shutdown has been
+   requested and all connections are closed.  */
+static void
+handle_connections (gnupg_fd_t listen_fd)
+{
+  npth_attr_t tattr;
+  struct sockaddr_un paddr;
+  socklen_t plen;
+  fd_set fdset, read_fdset;
+  struct timespec timeout;
+  gnupg_fd_t fd;
+  int nfd, ret, saved_errno;
+
+  ret = npth_attr_init (&tattr);
+  if (ret)
+    log_fatal ("error allocating thread attributes: %s\n", strerror (ret));
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+
+#ifndef HAVE_W32_SYSTEM
+  npth_sigev_init ();
+  npth_sigev_add (SIGINT);
+  npth_sigev_add (SIGTERM);
+  npth_sigev_fini ();
+#endif
+
+  FD_ZERO (&fdset);
+  FD_SET (FD2INT (listen_fd), &fdset);
+  nfd = FD2INT (listen_fd);
+
+  for (;;)
+    {
+      if (shutdown_pending)
+        {
+          if (!active_connections)
+            break; /* Ready.  */
+
+          /* Do not accept new connections but keep on running the
+             loop until all connections are closed.  */
+          FD_ZERO (&fdset);
+        }
+
+      /* We need a timeout so that we notice the end of the last
+         connection after a shutdown request.  */
+      read_fdset = fdset;
+      timeout.tv_sec = 1;
+      timeout.tv_nsec = 0;
+
+#ifndef HAVE_W32_SYSTEM
+      ret = npth_pselect (nfd+1, &read_fdset, NULL, NULL, &timeout,
+                          npth_sigev_sigmask ());
+      saved_errno = errno;
+
+      {
+        int signo;
+        while (npth_sigev_get_pending (&signo))
+          handle_signal (signo);
+      }
+#else
+      ret = npth_eselect (nfd+1, &read_fdset, NULL, NULL, &timeout,
+                          NULL, NULL);
+      saved_errno = errno;
+#endif
+
+      if (ret == -1 && saved_errno != EINTR)
+        {
+          log_error (_("npth_pselect failed: %s - waiting 1s\n"),
+                     strerror (saved_errno));
+          npth_sleep (1);
+          continue;
+        }
+      if (ret <= 0)
+        continue; /* Interrupt or timeout.  */
+
+      if (!shutdown_pending && FD_ISSET (FD2INT (listen_fd), &read_fdset))
+        {
+          ctrl_t ctrl;
+
+          plen = sizeof paddr;
+          fd = INT2FD (npth_accept (FD2INT (listen_fd),
+                                    (struct sockaddr *)&paddr, &plen));
+          if (fd == GNUPG_INVALID_FD)
+            log_error ("accept failed: %s\n", strerror (errno));
+          else if (!(ctrl = xtrycalloc (1, sizeof *ctrl)))
+            {
+              log_error ("error allocating connection control data: %s\n",
+                         strerror (errno));
+              assuan_sock_close (fd);
+            }
+          else
+            {
+              npth_t thread;
+
+              gpg_init_default_ctrl (ctrl);
+              ctrl->thread_startup.fd = fd;
+              ret = npth_create (&thread, &tattr,
+                                 start_connection_thread, ctrl);
+              if (ret)
+                {
+                  log_error ("error spawning connection handler: %s\n",
+                             strerror (ret));
+                  assuan_sock_close (fd);
+                  gpg_deinit_default_ctrl (ctrl);
+                  xfree (ctrl);
+                }
+            }
+        }
+    }
+
+  npth_attr_destroy (&tattr);
+}
+
+
+/* Run gpg as a daemon which listens on a socket in the home directory
+   and serves any number of clients concurrently.  Each connection
+   gets its own control object and Assuan context; the key database
+   caches, the trustdb and the signature cache are shared.  */
+int
+gpg_daemon (void)
+{
+  gnupg_fd_t fd;
+  int err;
+
+  gpg_init_npth ();
+  assuan_set_system_hooks (ASSUAN_SYSTEM_NPTH);
+
+  err = npth_rwlock_init (&keydb_lock, NULL);
+  if (err)
+    log_fatal ("error initializing the keydb lock: %s\n", strerror (err));
+  err = npth_key_create (&status_fp_key, NULL);
+  if (err)
+    log_fatal ("error creating the status stream key: %s\n", strerror (err));
+
+  /* Do the trustdb check now so that it does not happen in the
+     middle of a shared-locked command.  */
+  check_trustdb_stale ();
+
+  socket_name = make_filename (opt.homedir, "S.gpg", NULL);
+  fd = create_server_socket (socket_name);
+  if (fd == GNUPG_INVALID_FD)
+    {
+      xfree (socket_name);
+      socket_name = NULL;
+      return gpg_error (GPG_ERR_GENERAL);
+    }
+
+  /* Let the other connections run while a connection waits for the
+     I/O on its file descriptors.  */
+  iobuf_set_syscall_clamp (gpg_npth_unprotect, gpg_npth_protect);
+  set_status_stream_hook (connection_status_fp);
+
+  daemon_mode = 1;
+  handle_connections (fd);
+  daemon_mode = 0;
+
+  set_status_stream_hook (NULL);
+  iobuf_set_syscall_clamp (NULL, NULL);
+
+  assuan_sock_close (fd);
+  gnupg_remove (socket_name);
+  xfree (socket_name);
+  socket_name = NULL;
+  log_info ("%s %s stopped\n", strusage (11), strusage (13));
+  return 0;
+}
@@ -48,6 +48,41 @@ static int do_check( PKT_public_key *pk, PKT_signature *sig,
                      gcry_md_hd_t digest,
 		     int *r_expired, int *r_revoked, PKT_public_key *ret_pk);
 
+/* Check the backsig of the signing subkey PK.  This is a 0x19
+   signature from the subkey on the primary key.  The idea here is
+   that it should not be possible for someone to "steal" subkeys and
+   claim them as their own.  The attacker couldn't actually use the
+   subkey, but they could try and claim ownership of any signaures
+   issued by it. */
+static int
+check_signer_backsig (PKT_public_key *pk)
+{
+  int rc = 0;
+
+  if (!pk->flags.primary && pk->flags.backsig < 2)
+    {
+      if (!pk->flags.backsig)
+        {
+          log_info(_("WARNING: signing subkey %s is not"
+                     " cross-certified\n"),keystr_from_pk(pk));
+          log_info(_("please see %s for more information\n"),
+                   "http://www.gnupg.org/faq/subkey-cross-certify.html");
+          /* --require-cross-certification makes this warning an
+             error.  TODO: change the default to require this
+             after more keys have backsigs. */
+          if(opt.flags.require_cross_cert)
+            rc=G10ERR_GENERAL;
+        }
+      else if(pk->flags.backsig == 1)
+        {
+          log_info(_("WARNING: signing subkey %s has an invalid"
+                     " cross-certification\n"),keystr_from_pk(pk));
+          rc=G10ERR_GENERAL;
+        }
+    }
+  return rc;
+}
+
 /****************
  * Check the signature which is contained in SIG.
  * The MD_HANDLE should be currently open, so that this function
@@ -92,33 +127,8 @@ signature_check2 (PKT_signature *sig, gcry_md_hd_t digest, u32 *r_expiredate,
 
 	rc = do_check( pk, sig, digest, r_expired, r_revoked, ret_pk );
 
-	/* Check the backsig.  This is a 0x19 signature from the
-	   subkey on the primary key.  The idea here is that it should
-	   not be possible for someone to "steal" subkeys and claim
-	   them as their own.  The attacker couldn't actually use the
-	   subkey, but they could try and claim ownership of any
-	   signaures issued by it. */
-	if(rc==0 && !pk->flags.primary && pk->flags.backsig < 2)
-	  {
-	    if (!pk->flags.backsig)
-	      {
-		log_info(_("WARNING: signing subkey %s is not"
-			   " cross-certified\n"),keystr_from_pk(pk));
-		log_info(_("please see %s for more information\n"),
-			 "http://www.gnupg.org/faq/subkey-cross-certify.html");
-		/* --require-cross-certification makes this warning an
-                     error.  TODO: change the default to require this
-                     after more keys have backsigs. */
-		if(opt.flags.require_cross_cert)
-		  rc=G10ERR_GENERAL;
-	      }
-	    else if(pk->flags.backsig == 1)
-	      {
-		log_info(_("WARNING: signing subkey %s has an invalid"
-			   " cross-certification\n"),keystr_from_pk(pk));
-		rc=G10ERR_GENERAL;
-	      }
-	  }
+	if( !rc )
+	  rc = check_signer_backsig (pk);
       }
 
     free_public_key( pk );
@@ -257,21 +267,10 @@ do_check_messages( PKT_public_key *pk, PKT_signature *sig,
 }
 
 
-static int
-do_check( PKT_public_key *pk, PKT_signature *sig, gcry_md_hd_t digest,
-	  int *r_expired, int *r_revoked, PKT_public_key *ret_pk )
+/* Hash the trailer of SIG into DIGEST and finalize DIGEST.  */
+static void
+hash_sig_trailer (PKT_signature *sig, gcry_md_hd_t digest)
 {
-    gcry_mpi_t result = NULL;
-    int rc = 0;
-
-    if( (rc=do_check_messages(pk,sig,r_expired,r_revoked)) )
-        return rc;
-
-    /* Make sure the digest algo is enabled (in case of a detached
-       signature).  */
-    gcry_md_enable (digest, sig->digest_algo);
-
-    /* Complete the digest. */
     if( sig->version >= 4 )
 	gcry_md_putc( digest, sig->version );
     gcry_md_putc( digest, sig->sig_class );
@@ -311,12 +310,43 @@ do_check( PKT_public_key *pk, PKT_signature *sig, gcry_md_hd_t digest,
 	gcry_md_write( digest, buf, 6 );
     }
     gcry_md_final( digest );
+}
+
+
+static int
+do_check( PKT_public_key *pk, PKT_signature *sig, gcry_md_hd_t digest,
+	  int *r_expired, int *r_revoked, PKT_public_key *ret_pk )
+{
+    gcry_mpi_t result = NULL;
+    int rc = 0;
+    byte cachekey[SIGCACHE_KEYLEN];
+    int have_cachekey = 0;
 
-    result = encode_md_value (pk, digest, sig->digest_algo );
-    if (!result)
-        return G10ERR_GENERAL;
-    rc = pk_verify( pk->pubkey_algo, result, sig->data, pk->pkey );
-    gcry_mpi_release (result);
+    if( (rc=do_check_messages(pk,sig,r_expired,r_revoked)) )
+        return rc;
+
+    /* Make sure the digest algo is enabled (in case of a detached
+       signature).  */
+    gcry_md_enable (digest, sig->digest_algo);
+
+    hash_sig_trailer (sig, digest);
+
+    /* Results for key signatures are also kept in the persistent
+       cache; data signatures are rarely checked twice.  */
+    if (sig->sig_class >= 0x10 && sig->sig_class < 0x40
+        && !sigcache_make_key (pk, sig, digest, cachekey))
+      have_cachekey = 1;
+
+    if (!have_cachekey || !sigcache_lookup (cachekey, &rc))
+      {
+        result = encode_md_value (pk, digest, sig->digest_algo );
+        if (!result)
+          return G10ERR_GENERAL;
+        rc = pk_verify( pk->pubkey_algo, result, sig->data, pk->pkey );
+        gcry_mpi_release (result);
+        if (have_cachekey)
+          sigcache_store (cachekey, rc);
+      }
 
     if( !rc && sig->flags.unknown_critical )
       {
@@ -661,3 +691,140 @@ check_key_signature2( KBNODE root, KBNODE node, PKT_public_key *check_pk,
 
     return rc;
 }
+
+
+/* The following three functions split the check of a user ID
+   certification made by another key into a preparation step, the
+   actual public key operation and a step to take over the result.
+   This allows the caller to run the public key operations of many
+   certifications in parallel.  Only check_key_signature_verify may be
+   called from another thread.
+
+   check_key_signature_prepare returns 0 and fills CHK if the
+   signature NODE of the keyblock ROOT can be checked this way.  Any
+   other return value indicates that the caller should use
+   check_key_signature instead.  */
+int
+check_key_signature_prepare (KBNODE root, KBNODE node,
+                             struct key_sig_check_s *chk)
+{
+  PKT_public_key *pk, *signer;
+  PKT_signature *sig;
+  KBNODE unode;
+  gcry_md_hd_t md;
+  u32 keyid[2], cur_time;
+
+  memset (chk, 0, sizeof *chk);
+  assert (node->pkt->pkttype == PKT_SIGNATURE);
+  assert (root->pkt->pkttype == PKT_PUBLIC_KEY);
+  pk = root->pkt->pkt.public_key;
+  sig = node->pkt->pkt.signature;
+
+  if (opt.no_sig_cache || sig->flags.checked)
+    return -1;
+  if (!IS_UID_SIG (sig) && !IS_UID_REV (sig))
+    return -1;
+  keyid_from_pk (pk, keyid);
+  if (keyid[0] == sig->keyid[0] && keyid[1] == sig->keyid[1])
+    return -1;  /* Self-signature.  */
+  if (openpgp_pk_test_algo (sig->pubkey_algo)
+      || openpgp_md_test_algo (sig->digest_algo))
+    return -1;
+  unode = find_prev_kbnode (root, node, PKT_USER_ID);
+  if (!unode)
+    return -1;
+
+  signer = xmalloc_clear (sizeof *signer);
+  if (get_pubkey (signer, sig->keyid)
+      || (!signer->flags.valid && !signer->flags.primary))
+    {
+      free_public_key (signer);
+      return -1;
+    }
+  /* Leave time conflicts to do_check_messages so that they are
+     reported in the usual way.  */
+  cur_time = make_timestamp ();
+  if (!opt.ignore_time_conflict
+      && (signer->timestamp > sig->timestamp || signer->timestamp > cur_time))
+    {
+      free_public_key (signer);
+      return -1;
+    }
+
+  if (gcry_md_open (&md, sig->digest_algo, 0))
+    BUG ();
+  hash_public_key (md, pk);
+  hash_uid_node (unode, md, sig);
+  hash_sig_trailer (sig, md);
+  if (!sigcache_make_key (signer, sig, md, chk->cachekey))
+    {
+      chk->have_cachekey = 1;
+      chk->cached = sigcache_lookup (chk->cachekey, &chk->rc);
+    }
+  if (!chk->cached)
+    {
+      chk->hash = encode_md_value (signer, md, sig->digest_algo);
+      if (!chk->hash)
+        {
+          gcry_md_close (md);
+          free_public_key (signer);
+          memset (chk, 0, sizeof *chk);
+          return -1;
+        }
+    }
+  gcry_md_close (md);
+
+  chk->root = root;
+  chk->node = node;
+  chk->signer = signer;
+  return 0;
+}
+
+
+/* Run the public key operation for CHK.  This function does not
+   access any global state and may thus be run in a separate
+   thread.  */
+void
+check_key_signature_verify (struct key_sig_check_s *chk)
+{
+  if (chk->cached)
+    return;
+  chk->rc = pk_verify (chk->signer->pubkey_algo, chk->hash,
+                       chk->node->pkt->pkt.signature->data,
+                       chk->signer->pkey);
+}
+
+
+/* Finish the check prepared by check_key_signature_prepare, cache
+   the result in the signature packet the same way check_key_signature
+   does and release the resources of CHK.  Returns the result of the
+   check.  */
+int
+check_key_signature_finish (struct key_sig_check_s *chk)
+{
+  PKT_signature *sig = chk->node->pkt->pkt.signature;
+  PKT_public_key *signer = chk->signer;
+  int rc;
+
+  if (chk->have_cachekey && !chk->cached)
+    sigcache_store (chk->cachekey, chk->rc);
+
+  rc = do_check_messages (signer, sig, NULL, NULL);
+  if (!rc)
+    rc = chk->rc;
+  if (!rc && sig->flags.unknown_critical)
+    {
+      log_info (_("assuming bad signature from key %s"
+                  " due to an unknown critical bit\n"),
+                keystr_from_pk (signer));
+      rc = G10ERR_BAD_SIGN;
+    }
+  if (!rc)
+    rc = check_signer_backsig (signer);
+  cache_sig_result (sig, rc);
+
+  gcry_mpi_release (chk->hash);
+  free_public_key (signer);
+  memset (chk, 0, sizeof *chk);
+  return rc;
+}
@@ -0,0 +1,488 @@
+/* sigcache.c - Persistent cache of signature verification results
+ * Copyright (C) 2012 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The flags in the signature packets and in the ring trust packets
+   only help as long as the keyring has been rebuilt with
+   --rebuild-keydb-caches; keys imported since then need to be checked
+   again by each invocation of gpg.  To avoid this, the outcome of the
+   public key operation for key signatures is also stored in the file
+   "sigcache.db" in the home directory.
+
+   The file starts with an 8 byte header followed by records of
+   SIGCACHE_RECLEN bytes: a SHA-256 hash over the fingerprint of the
+   signing key, the digest of the signed data and the signature values
+   followed by one byte with the result and 3 reserved bytes.  Because
+   the digest covers everything the signature is made over, a record
+   depends only on the cryptographic material; the usual checks for
+   expiration, revocation and critical bits are still done for each
+   signature.
+
+   New records are appended with one write call when gpg terminates so
+   that several gpg processes may update the file concurrently.  If
+   the file grows too large it is rewritten with only the newest
+   records.  The cache is only accessed by the main thread.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gpg.h"
+#include "util.h"
+#include "packet.h"
+#include "keydb.h"
+#include "options.h"
+#include "main.h"
+#include "i18n.h"
+
+#if defined(HAVE_DOSISH_SYSTEM) || defined(__CYGWIN__)
+#define MY_O_BINARY  O_BINARY
+#else
+#define MY_O_BINARY  0
+#endif
+
+#define SIGCACHE_MAGIC      "\x01gpgsc\x00\x01"
+#define SIGCACHE_HDRLEN     8
+#define SIGCACHE_RECLEN     (SIGCACHE_KEYLEN + 4)
+#define SIGCACHE_BUCKETS    16384   /* Must be a power of 2.  */
+#define SIGCACHE_MAX_ITEMS  100000  /* Rewrite the file above this.  */
+
+/* Values of the result byte.  */
+#define SIGCACHE_GOOD  1
+#define SIGCACHE_BAD   2
+
+struct sigcache_item
+{
+  byte key[SIGCACHE_KEYLEN];
+  byte result;
+  unsigned int next;   /* Index+1 of the next item in the bucket.  */
+};
+
+static struct sigcache_item *items;
+static unsigned int n_items;     /* Number of used items.  */
+static unsigned int n_alloced;   /* Number of allocated items.  */
+static unsigned int n_saved;     /* Items [0,n_saved) are in the file.  */
+static unsigned int n_records;   /* Number of records in the file.  */
+static unsigned int *buckets;    /* Index+1 of the first item.  */
+static int initialized;
+static int disabled;
+static char *cache_fname;
+
+static struct
+{
+  unsigned int hits;
+  unsigned int misses;
+  unsigned int stored;
+} cache_stats;
+
+
+static int
+sigcache_enabled (void)
+{
+  return opt.persistent_sig_cache && !opt.no_sig_cache && !disabled;
+}
+
+
+static unsigned int
+hash_key (const byte *key)
+{
+  /* The key is already a hash value.  */
+  return ((key[0] << 8) | key[1]) & (SIGCACHE_BUCKETS - 1);
+}
+
+
+static struct sigcache_item *
+find_item (const byte *key)
+{
+  unsigned int idx;
+
+  for (idx = buckets[hash_key (key)]; idx; idx = items[idx-1].next)
+    if (!memcmp (items[idx-1].key, key, SIGCACHE_KEYLEN))
+      return items + idx - 1;
+  return NULL;
+}
+
+
+/* Insert KEY with RESULT or update an existing item.  Returns true if
+   a new item has been created.  */
+static int
+insert_item (const byte *key, byte result)
+{
+  struct sigcache_item *item;
+  unsigned int h;
+
+  item = find_item (key);
+  if (item)
+    {
+      item->result = result;
+      return 0;
+    }
+
+  if (n_items == n_alloced)
+    {
+      n_alloced = n_alloced? n_alloced * 2 : 1024;
+      items = xrealloc (items, n_alloced * sizeof *items);
+    }
+  item = items + n_items++;
+  memcpy (item->key, key, SIGCACHE_KEYLEN);
+  item->result = result;
+  h = hash_key (key);
+  item->next = buckets[h];
+  buckets[h] = n_items;
+  return 1;
+}
+
+
+/* Read the cache file.  The file is read only once and only if a
+   key signature actually needs to be checked.  */
+static void
+load_cache (void)
+{
+  int fd;
+  struct stat st;
+  byte hdr[SIGCACHE_HDRLEN];
+  byte *buffer = NULL;
+  unsigned int nrec, chunk, i;
+  ssize_t n;
+
+  initialized = 1;
+  buckets = xcalloc (SIGCACHE_BUCKETS, sizeof *buckets);
+  cache_fname = make_filename (opt.homedir, "sigcache" EXTSEP_S "db", NULL);
+
+  fd = open (cache_fname, O_RDONLY | MY_O_BINARY);
+  if (fd == -1)
+    {
+      if (errno != ENOENT)
+        {
+          log_info (_("can't open '%s': %s\n"), cache_fname, strerror (errno));
+          disabled = 1;
+        }
+      return;
+    }
+
+  if (fstat (fd, &st)
+      || read (fd, hdr, SIGCACHE_HDRLEN) != SIGCACHE_HDRLEN
+      || memcmp (hdr, SIGCACHE_MAGIC, SIGCACHE_HDRLEN))
+    {
+      /* Not a valid cache file; it will be rewritten.  */
+      if (opt.verbose)
+        log_info ("%s: invalid signature cache file\n", cache_fname);
+      goto leave;
+    }
+
+  /* A trailing partial record may be the result of an interrupted
+     write; it is ignored.  */
+  nrec = (st.st_size - SIGCACHE_HDRLEN) / SIGCACHE_RECLEN;
+  if (nrec > SIGCACHE_MAX_ITEMS)
+    {
+      /* Skip the oldest records.  The next update will truncate the
+         file.  */
+      if (lseek (fd, SIGCACHE_HDRLEN
+                 + (off_t)(nrec - SIGCACHE_MAX_ITEMS) * SIGCACHE_RECLEN,
+                 SEEK_SET) == (off_t)-1)
+        goto leave;
+      n_records = nrec;
+      nrec = SIGCACHE_MAX_ITEMS;
+    }
+  else
+    n_records = nrec;
+
+  buffer = xmalloc (1024 * SIGCACHE_RECLEN);
+  while (nrec)
+    {
+      chunk = nrec > 1024? 1024 : nrec;
+      do
+        n = read (fd, buffer, chunk * SIGCACHE_RECLEN);
+      while (n == -1 && errno == EINTR);
+      if (n != chunk * SIGCACHE_RECLEN)
+        {
+          log_info ("%s: read error: %s\n", cache_fname,
+                    n == -1? strerror (errno) : "premature EOF");
+          break;
+        }
+      for (i=0; i < chunk; i++)
+        {
+          const byte *rec = buffer + i * SIGCACHE_RECLEN;
+
+          if (rec[SIGCACHE_KEYLEN] == SIGCACHE_GOOD
+              || rec[SIGCACHE_KEYLEN] == SIGCACHE_BAD)
+            insert_item (rec, rec[SIGCACHE_KEYLEN]);
+        }
+      nrec -= chunk;
+    }
+  n_saved = n_items;
+
+ leave:
+  xfree (buffer);
+  close (fd);
+}
+
+
+/* Compute the cache key for the signature SIG made by SIGNER over the
+   data hashed into MD.  MD must already have been finalized.  Returns
+   0 on success or -1 if the signature can't be cached.  */
+int
+sigcache_make_key (PKT_public_key *signer, PKT_signature *sig,
+                   gcry_md_hd_t md, byte *key)
+{
+  gcry_md_hd_t h;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  const byte *digest;
+  unsigned char *buf;
+  size_t n;
+  int i, nsig;
+
+  if (!sigcache_enabled ())
+    return -1;
+  nsig = pubkey_get_nsig (sig->pubkey_algo);
+  if (!nsig)
+    return -1;
+  for (i=0; i < nsig; i++)
+    if (!sig->data[i])
+      return -1;
+  digest = gcry_md_read (md, sig->digest_algo);
+  if (!digest)
+    return -1;
+
+  if (gcry_md_open (&h, GCRY_MD_SHA256, 0))
+    BUG ();
+  fingerprint_from_pk (signer, fpr, &n);
+  gcry_md_putc (h, n);
+  gcry_md_write (h, fpr, n);
+  gcry_md_putc (h, sig->pubkey_algo);
+  gcry_md_putc (h, sig->digest_algo);
+  gcry_md_write (h, digest, gcry_md_get_algo_dlen (sig->digest_algo));
+  for (i=0; i < nsig; i++)
+    {
+      if (gcry_mpi_get_flag (sig->data[i], GCRYMPI_FLAG_OPAQUE))
+        {
+          unsigned int nbits;
+          const void *p = gcry_mpi_get_opaque (sig->data[i], &nbits);
+
+          n = (nbits + 7) / 8;
+          gcry_md_putc (h, n >> 8);
+          gcry_md_putc (h, n);
+          gcry_md_write (h, p, n);
+        }
+      else if (!gcry_mpi_aprint (GCRYMPI_FMT_USG, &buf, &n, sig->data[i]))
+        {
+          gcry_md_putc (h, n >> 8);
+          gcry_md_putc (h, n);
+          gcry_md_write (h, buf, n);
+          gcry_free (buf);
+        }
+      else
+        {
+          gcry_md_close (h);
+          return -1;
+        }
+    }
+  memcpy (key, gcry_md_read (h, GCRY_MD_SHA256), SIGCACHE_KEYLEN);
+  gcry_md_close (h);
+  return 0;
+}
+
+
+/* Look up KEY in the cache.  Returns true and stores the result of
+   the public key operation at R_RC if KEY has been found.  */
+int
+sigcache_lookup (const byte *key, int *r_rc)
+{
+  struct sigcache_item *item;
+
+  if (!sigcache_enabled ())
+    return 0;
+  if (!initialized)
+    load_cache ();
+  if (disabled)
+    return 0;
+
+  item = find_item (key);
+  if (!item)
+    {
+      cache_stats.misses++;
+      return 0;
+    }
+  cache_stats.hits++;
+  *r_rc = item->result == SIGCACHE_GOOD? 0 : G10ERR_BAD_SIGN;
+  return 1;
+}
+
+
+/* Store the result RC of the public key operation for KEY.  Only
+   good and bad signatures are stored; other errors may be
+   temporary.  */
+void
+sigcache_store (const byte *key, int rc)
+{
+  if (!sigcache_enabled ())
+    return;
+  if (rc && gpg_err_code (rc) != GPG_ERR_BAD_SIGNATURE)
+    return;
+  if (!initialized)
+    load_cache ();
+  if (disabled)
+    return;
+
+  if (insert_item (key, rc? SIGCACHE_BAD : SIGCACHE_GOOD))
+    cache_stats.stored++;
+}
+
+
+static void
+put_record (byte *p, const struct sigcache_item *item)
+{
+  memcpy (p, item->key, SIGCACHE_KEYLEN);
+  p[SIGCACHE_KEYLEN] = item->result;
+  memset (p + SIGCACHE_KEYLEN + 1, 0, 3);
+}
+
+
+static int
+write_all (int fd, const byte *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len)
+    {
+      n = write (fd, buf, len);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n == -1)
+        return -1;
+      buf += n;
+      len -= n;
+    }
+  return 0;
+}
+
+
+/* Write the newest items to a new cache file.  */
+static void
+rewrite_cache (void)
+{
+  char *tmpfname;
+  byte *buffer, *p;
+  unsigned int first, i;
+  int fd;
+
+  first = n_items > SIGCACHE_MAX_ITEMS/2? n_items - SIGCACHE_MAX_ITEMS/2 : 0;
+  buffer = xmalloc (SIGCACHE_HDRLEN + (n_items - first) * SIGCACHE_RECLEN);
+  memcpy (buffer, SIGCACHE_MAGIC, SIGCACHE_HDRLEN);
+  for (p = buffer + SIGCACHE_HDRLEN, i = first; i < n_items; i++)
+    {
+      put_record (p, items + i);
+      p += SIGCACHE_RECLEN;
+    }
+
+  tmpfname = xstrconcat (cache_fname, EXTSEP_S "tmp", NULL);
+  fd = open (tmpfname, O_WRONLY | O_CREAT | O_TRUNC | MY_O_BINARY,
+             S_IRUSR | S_IWUSR);
+  if (fd == -1)
+    {
+      if (opt.verbose)
+        log_info (_("can't create '%s': %s\n"), tmpfname, strerror (errno));
+      goto leave;
+    }
+  if (write_all (fd, buffer, p - buffer))
+    {
+      log_info (_("error writing '%s': %s\n"), tmpfname, strerror (errno));
+      close (fd);
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  if (close (fd))
+    {
+      log_info (_("error writing '%s': %s\n"), tmpfname, strerror (errno));
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+#if defined(HAVE_DOSISH_SYSTEM) || defined(__riscos__)
+  gnupg_remove (cache_fname);
+#endif
+  if (rename (tmpfname, cache_fname))
+    {
+      log_info (_("renaming '%s' to '%s' failed: %s\n"),
+                tmpfname, cache_fname, strerror (errno));
+      gnupg_remove (tmpfname);
+    }
+
+ leave:
+  xfree (tmpfname);
+  xfree (buffer);
+}
+
+
+/* Append the items stored since the cache has been loaded to the
+   cache file.  This is called when gpg terminates.  */
+void
+sigcache_sync (void)
+{
+  byte *buffer, *p;
+  unsigned int i;
+  int fd;
+
+  if (!initialized || disabled || n_saved == n_items)
+    return;
+
+  if (!n_records || n_records + n_items - n_saved > SIGCACHE_MAX_ITEMS)
+    {
+      rewrite_cache ();
+      n_saved = n_items;
+      return;
+    }
+
+  buffer = xmalloc ((n_items - n_saved) * SIGCACHE_RECLEN);
+  for (p = buffer, i = n_saved; i < n_items; i++)
+    {
+      put_record (p, items + i);
+      p += SIGCACHE_RECLEN;
+    }
+
+  fd = open (cache_fname, O_WRONLY | O_APPEND | MY_O_BINARY);
+  if (fd == -1)
+    {
+      if (opt.verbose)
+        log_info (_("can't open '%s': %s\n"), cache_fname, strerror (errno));
+    }
+  else
+    {
+      /* Use a single write so that concurrent updates by other
+         processes do not interleave within a record.  */
+      if (write (fd, buffer, p - buffer) != p - buffer || close (fd))
+        log_info (_("error writing '%s': %s\n"), cache_fname,
+                  strerror (errno));
+    }
+  xfree (buffer);
+  n_records += n_items - n_saved;
+  n_saved = n_items;
+}
+
+
+void
+sigcache_print_stats (void)
+{
+  log_info ("persistent sig cache: %u items, %u hits, %u misses, %u new\n",
+            n_items, cache_stats.hits, cache_stats.misses, cache_stats.stored);
+}
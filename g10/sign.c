@@ -653,16 +653,18 @@ write_plaintext_packet (IOBUF out, IOBUF inp, const char *fname, int ptmode)
         pt->buf = NULL;
     }
     else {
-        byte copy_buffer[4096];
+        unsigned int copy_size = iobuf_get_buffer_size ();
+        byte *copy_buffer = xmalloc (copy_size);
         int  bytes_copied;
 
-        while ((bytes_copied = iobuf_read(inp, copy_buffer, 4096)) != -1)
+        while ((bytes_copied = iobuf_read(inp, copy_buffer, copy_size)) != -1)
             if ( (rc=iobuf_write(out, copy_buffer, bytes_copied)) ) {
                 log_error ("copying input to output failed: %s\n",
                            gpg_strerror (rc));
                 break;
             }
-        wipememory(copy_buffer,4096); /* burn buffer */
+        wipememory(copy_buffer,copy_size); /* burn buffer */
+        xfree (copy_buffer);
     }
     /* fixme: it seems that we never freed pt/pkt */
 
@@ -759,10 +761,14 @@ write_signature_packets (SK_LIST sk_list, IOBUF out, gcry_md_hd_t hash,
  * If OUTFILE is not NULL; this file is used for output and the function
  * does not ask for overwrite permission; output is then always
  * uncompressed, non-armored and in binary mode.
+ * If FILEFD is not -1 the data is read from that file descriptor
+ * instead of FILENAMES; if OUTPUTFD is not -1 the output is written
+ * to that file descriptor.
  */
-int
-sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
-	   int encryptflag, strlist_t remusr, const char *outfile )
+static int
+do_sign_file (ctrl_t ctrl, strlist_t filenames, int filefd, int detached,
+              strlist_t locusr, int encryptflag, strlist_t remusr,
+              const char *outfile, int outputfd)
 {
     const char *fname;
     armor_filter_context_t *afx;
@@ -829,7 +835,7 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
     if( multifile )  /* have list of filenames */
 	inp = NULL; /* we do it later */
     else {
-      inp = iobuf_open(fname);
+      inp = iobuf_open_fd_or_name (filefd, fname, "rb");
       if (inp && is_secured_file (iobuf_get_fd (inp)))
         {
           iobuf_close (inp);
@@ -838,8 +844,15 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
         }
       if( !inp )
         {
+          char xname[64];
+
           rc = gpg_error_from_syserror ();
-          log_error (_("can't open '%s': %s\n"), fname? fname: "[stdin]",
+          if (filefd != -1)
+            snprintf (xname, sizeof xname, "[fd %d]", filefd);
+          else if (!fname)
+            strcpy (xname, "[stdin]");
+          log_error (_("can't open '%s': %s\n"),
+                     (filefd != -1 || !fname)? xname : fname,
                      strerror(errno) );
           goto leave;
 	}
@@ -863,7 +876,7 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 	else if( opt.verbose )
 	    log_info(_("writing to '%s'\n"), outfile );
     }
-    else if( (rc = open_outfile (GNUPG_INVALID_FD, fname,
+    else if( (rc = open_outfile (outputfd, fname,
                                  opt.armor? 1: detached? 2:0, &out )))
 	goto leave;
 
@@ -1101,6 +1114,27 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 }
 
 
+int
+sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
+	   int encryptflag, strlist_t remusr, const char *outfile )
+{
+  return do_sign_file (ctrl, filenames, -1, detached, locusr,
+                       encryptflag, remusr, outfile, -1);
+}
+
+
+/* Sign the data read from FILEFD and write the signed data or with
+   DETACHED the detached signature to OUTPUTFD.  The keys are taken
+   from LOCUSR or the default key.  This is used by the server.  */
+int
+sign_fd (ctrl_t ctrl, int filefd, int detached, strlist_t locusr,
+         int outputfd)
+{
+  return do_sign_file (ctrl, NULL, filefd, detached, locusr, 0, NULL,
+                       NULL, outputfd);
+}
+
+
 
 /****************
  * make a clear signature. note that opt.armor is not needed
@@ -27,6 +27,10 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+# define USE_TDB_MMAP 1
+#endif
 
 #include "gpg.h"
 #include "status.h"
@@ -57,13 +61,17 @@
 #endif
 
 /****************
- * Yes, this is a very simple implementation. We should really
- * use a page aligned buffer and read complete pages.
- * To implement a simple trannsaction system, this is sufficient.
+ * The record cache.  All entries are kept in CACHE_LIST; entries in
+ * use are additionally linked into a hash table indexed by the
+ * record number and unused ones into a free list so that lookups and
+ * insertions do not need to walk over the entire cache.  Dirty
+ * entries are written back sorted by record number so that runs of
+ * adjacent records go out with a single write call.
  */
 typedef struct cache_ctrl_struct *CACHE_CTRL;
 struct cache_ctrl_struct {
-    CACHE_CTRL next;
+    CACHE_CTRL next;   /* Next item in CACHE_LIST.  */
+    CACHE_CTRL hnext;  /* Next item in the hash bucket or free list.  */
     struct {
 	unsigned used:1;
 	unsigned dirty:1;
@@ -74,8 +82,13 @@ struct cache_ctrl_struct {
 
 #define MAX_CACHE_ENTRIES_SOFT	200    /* may be increased while in a */
 #define MAX_CACHE_ENTRIES_HARD	10000  /* transaction to this one */
+#define CACHE_BUCKETS		1024   /* must be a power of 2 */
+#define MAX_WRITE_RECORDS	64     /* records coalesced into one write */
 static CACHE_CTRL cache_list;
+static CACHE_CTRL cache_hash[CACHE_BUCKETS];
+static CACHE_CTRL cache_unused;
 static int cache_entries;
+static int cache_dirty_entries;
 static int cache_is_dirty;
 
 /* a type used to pass infomation to cmp_krec_fpr */
@@ -98,14 +111,87 @@ static int is_locked;
 static int  db_fd = -1;
 static int in_transaction;
 
+#ifdef USE_TDB_MMAP
+/* The read-only mapping of the trustdb used with --trustdb-mmap.  */
+static const byte *db_map;
+static size_t db_maplen;
+static int db_map_stale;  /* The file has grown beyond the mapping.  */
+#endif
+
 static void open_db(void);
 
 
-
+
 /*************************************
  ************* record cache **********
  *************************************/
 
+#define cache_bucket(recno) (&cache_hash[(recno) & (CACHE_BUCKETS - 1)])
+
+static CACHE_CTRL
+cache_lookup( ulong recno )
+{
+    CACHE_CTRL r;
+
+    for( r = *cache_bucket( recno ); r; r = r->hnext )
+	if( r->recno == recno )
+	    return r;
+    return NULL;
+}
+
+/* Take an unused entry off the free list and insert it into the
+ * hash table for RECNO.  */
+static CACHE_CTRL
+cache_take_unused( ulong recno )
+{
+    CACHE_CTRL r, *bucket;
+
+    r = cache_unused;
+    assert( r );
+    cache_unused = r->hnext;
+    r->flags.used = 1;
+    r->flags.dirty = 0;
+    r->recno = recno;
+    bucket = cache_bucket( recno );
+    r->hnext = *bucket;
+    *bucket = r;
+    cache_entries++;
+    return r;
+}
+
+/* Remove entry R from the hash table and put it on the free list.  */
+static void
+cache_drop( CACHE_CTRL r )
+{
+    CACHE_CTRL *rp;
+
+    for( rp = cache_bucket( r->recno ); *rp != r; rp = &(*rp)->hnext )
+	assert( *rp );
+    *rp = r->hnext;
+    if( r->flags.dirty )
+	cache_dirty_entries--;
+    r->flags.used = 0;
+    r->flags.dirty = 0;
+    r->hnext = cache_unused;
+    cache_unused = r;
+    cache_entries--;
+}
+
+/* Allocate a new entry and put it on the free list.  */
+static void
+cache_grow(void)
+{
+    CACHE_CTRL r;
+
+    r = xmalloc( sizeof *r );
+    r->flags.used = 0;
+    r->flags.dirty = 0;
+    r->next = cache_list;
+    cache_list = r;
+    r->hnext = cache_unused;
+    cache_unused = r;
+}
+
 /****************
  * Get the data from therecord cache and return a
  * pointer into that cache.  Caller should copy
@@ -114,16 +200,29 @@ static void open_db(void);
 static const char *
 get_record_from_cache( ulong recno )
 {
-    CACHE_CTRL r;
+    CACHE_CTRL r = cache_lookup( recno );
 
-    for( r = cache_list; r; r = r->next ) {
-	if( r->flags.used && r->recno == recno )
-	    return r->data;
-    }
-    return NULL;
+    return r? r->data : NULL;
 }
 
 
+#ifdef USE_TDB_MMAP
+/****************
+ * Note that the records up to but not including ENDRECNO have been
+ * written.  If the file has grown beyond the mapping, the file is
+ * mapped again with the next read.
+ */
+static void
+note_records_written( ulong endrecno )
+{
+    if( db_map && (off_t)endrecno * TRUST_RECORD_LEN > (off_t)db_maplen )
+	db_map_stale = 1;
+}
+#else
+#define note_records_written(a) do { } while (0)
+#endif
+
+
 static int
 write_cache_item( CACHE_CTRL r )
 {
@@ -143,10 +242,100 @@ write_cache_item( CACHE_CTRL r )
 					    r->recno, n, strerror(errno) );
 	return err;
     }
+    note_records_written( r->recno + 1 );
     r->flags.dirty = 0;
+    cache_dirty_entries--;
     return 0;
 }
 
+
+static int
+compare_cache_items( const void *a, const void *b )
+{
+    ulong ra = (*(const CACHE_CTRL *)a)->recno;
+    ulong rb = (*(const CACHE_CTRL *)b)->recno;
+
+    return ra < rb? -1 : ra > rb? 1 : 0;
+}
+
+/****************
+ * Write the NITEMS dirty cache entries in ITEMS back to the file.
+ * The entries are sorted by record number and runs of consecutive
+ * records are written using one lseek and one write.
+ */
+static int
+write_cache_items( CACHE_CTRL *items, size_t nitems )
+{
+    char buffer[MAX_WRITE_RECORDS * TRUST_RECORD_LEN];
+    gpg_error_t err;
+    size_t i, j, k;
+    int n;
+
+    qsort( items, nitems, sizeof *items, compare_cache_items );
+    for( i=0; i < nitems; i = j ) {
+	for( j=i+1; j < nitems && j - i < MAX_WRITE_RECORDS
+		    && items[j]->recno == items[j-1]->recno + 1; j++ )
+	    ;
+	if( j - i == 1 ) {
+	    err = write_cache_item( items[i] );
+	    if( err )
+		return err;
+	    continue;
+	}
+
+	for( k=i; k < j; k++ )
+	    memcpy( buffer + (k-i) * TRUST_RECORD_LEN,
+		    items[k]->data, TRUST_RECORD_LEN );
+	if( lseek( db_fd, items[i]->recno * TRUST_RECORD_LEN,
+		   SEEK_SET ) == -1 ) {
+	    err = gpg_error_from_syserror ();
+	    log_error(_("trustdb rec %lu: lseek failed: %s\n"),
+				      items[i]->recno, strerror(errno) );
+	    return err;
+	}
+	n = write( db_fd, buffer, (j-i) * TRUST_RECORD_LEN );
+	if( n != (j-i) * TRUST_RECORD_LEN ) {
+	    err = gpg_error_from_syserror ();
+	    log_error(_("trustdb rec %lu: write failed (n=%d): %s\n"),
+				      items[i]->recno, n, strerror(errno) );
+	    return err;
+	}
+	note_records_written( items[j-1]->recno + 1 );
+	for( k=i; k < j; k++ )
+	    items[k]->flags.dirty = 0;
+	cache_dirty_entries -= j - i;
+    }
+    return 0;
+}
+
+/****************
+ * Write back up to LIMIT dirty entries (all if LIMIT is 0).  If DROP
+ * is set the written entries are moved to the free list.
+ */
+static int
+flush_dirty_items( int limit, int drop )
+{
+    CACHE_CTRL r, *items;
+    size_t i, nitems;
+    int rc;
+
+    nitems = limit? limit : cache_dirty_entries;
+    if( !nitems )
+	return 0;
+    items = xmalloc( nitems * sizeof *items );
+    for( i=0, r = cache_list; r && i < nitems; r = r->next )
+	if( r->flags.used && r->flags.dirty )
+	    items[i++] = r;
+    nitems = i;
+
+    rc = write_cache_items( items, nitems );
+    if( !rc && drop )
+	for( i=0; i < nitems; i++ )
+	    cache_drop( items[i] );
+    xfree( items );
+    return rc;
+}
+
 /****************
  * Put data into the cache.  This function may flush the
  * some cache entries if there is not enough space available.
@@ -154,106 +343,60 @@ write_cache_item( CACHE_CTRL r )
 int
 put_record_into_cache( ulong recno, const char *data )
 {
-    CACHE_CTRL r, unused;
-    int dirty_count = 0;
-    int clean_count = 0;
+    CACHE_CTRL r;
 
     /* see whether we already cached this one */
-    for( unused = NULL, r = cache_list; r; r = r->next ) {
-	if( !r->flags.used ) {
-	    if( !unused )
-		unused = r;
-	}
-	else if( r->recno == recno ) {
-	    if( !r->flags.dirty ) {
-		/* Hmmm: should we use a a copy and compare? */
-		if( memcmp(r->data, data, TRUST_RECORD_LEN ) ) {
-		    r->flags.dirty = 1;
-		    cache_is_dirty = 1;
-		}
+    r = cache_lookup( recno );
+    if( r ) {
+	if( !r->flags.dirty ) {
+	    /* Hmmm: should we use a a copy and compare? */
+	    if( memcmp(r->data, data, TRUST_RECORD_LEN ) ) {
+		r->flags.dirty = 1;
+		cache_dirty_entries++;
+		cache_is_dirty = 1;
 	    }
-	    memcpy( r->data, data, TRUST_RECORD_LEN );
-	    return 0;
 	}
-	if( r->flags.used ) {
-	    if( r->flags.dirty )
-		dirty_count++;
-	    else
-		clean_count++;
-	}
-    }
-    /* not in the cache: add a new entry */
-    if( unused ) { /* reuse this entry */
-	r = unused;
-	r->flags.used = 1;
-	r->recno = recno;
-	memcpy( r->data, data, TRUST_RECORD_LEN );
-	r->flags.dirty = 1;
-	cache_is_dirty = 1;
-	cache_entries++;
-	return 0;
-    }
-    /* see whether we reached the limit */
-    if( cache_entries < MAX_CACHE_ENTRIES_SOFT ) { /* no */
-	r = xmalloc( sizeof *r );
-	r->flags.used = 1;
-	r->recno = recno;
 	memcpy( r->data, data, TRUST_RECORD_LEN );
-	r->flags.dirty = 1;
-	r->next = cache_list;
-	cache_list = r;
-	cache_is_dirty = 1;
-	cache_entries++;
 	return 0;
     }
-    /* cache is full: discard some clean entries */
-    if( clean_count ) {
-	int n = clean_count / 3; /* discard a third of the clean entries */
+
+    /* not in the cache: get an unused entry */
+    if( cache_unused )
+	;
+    else if( cache_entries < MAX_CACHE_ENTRIES_SOFT )
+	cache_grow();
+    else if( cache_entries > cache_dirty_entries ) {
+	/* cache is full: discard a third of the clean entries */
+	int n = (cache_entries - cache_dirty_entries) / 3;
+	CACHE_CTRL rnext;
+
 	if( !n )
 	    n = 1;
-	for( unused = NULL, r = cache_list; r; r = r->next ) {
+	for( r = cache_list; r; r = rnext ) {
+	    rnext = r->next;
 	    if( r->flags.used && !r->flags.dirty ) {
-		if( !unused )
-		    unused = r;
-		r->flags.used = 0;
-		cache_entries--;
+		cache_drop( r );
 		if( !--n )
 		    break;
 	    }
 	}
-	assert( unused );
-	r = unused;
-	r->flags.used = 1;
-	r->recno = recno;
-	memcpy( r->data, data, TRUST_RECORD_LEN );
-	r->flags.dirty = 1;
-	cache_is_dirty = 1;
-	cache_entries++;
-	return 0;
     }
-    /* no clean entries: have to flush some dirty entries */
-    if( in_transaction ) {
-	/* but we can't do this while in a transaction
-	 * we increase the cache size instead */
-	if( cache_entries < MAX_CACHE_ENTRIES_HARD ) { /* no */
-	    if( opt.debug && !(cache_entries % 100) )
-		log_debug("increasing tdbio cache size\n");
-	    r = xmalloc( sizeof *r );
-	    r->flags.used = 1;
-	    r->recno = recno;
-	    memcpy( r->data, data, TRUST_RECORD_LEN );
-	    r->flags.dirty = 1;
-	    r->next = cache_list;
-	    cache_list = r;
-	    cache_is_dirty = 1;
-	    cache_entries++;
-	    return 0;
+    else if( in_transaction ) {
+	/* no clean entries and we can't flush dirty entries while
+	 * in a transaction: we increase the cache size instead */
+	if( cache_entries >= MAX_CACHE_ENTRIES_HARD ) {
+	    log_info(_("trustdb transaction too large\n"));
+	    return G10ERR_RESOURCE_LIMIT;
 	}
-	log_info(_("trustdb transaction too large\n"));
-	return G10ERR_RESOURCE_LIMIT;
+	if( opt.debug && !(cache_entries % 100) )
+	    log_debug("increasing tdbio cache size\n");
+	cache_grow();
     }
-    if( dirty_count ) {
-	int n = dirty_count / 5; /* discard some dirty entries */
+    else if( cache_dirty_entries ) {
+	/* no clean entries: flush a fifth of the dirty entries */
+	int n = cache_dirty_entries / 5;
+	int rc;
+
 	if( !n )
 	    n = 1;
 	if( !is_locked ) {
@@ -262,34 +405,23 @@ put_record_into_cache( ulong recno, const char *data )
 	    else
 		is_locked = 1;
 	}
-	for( unused = NULL, r = cache_list; r; r = r->next ) {
-	    if( r->flags.used && r->flags.dirty ) {
-		int rc = write_cache_item( r );
-		if( rc )
-		    return rc;
-		if( !unused )
-		    unused = r;
-		r->flags.used = 0;
-		cache_entries--;
-		if( !--n )
-		    break;
-	    }
-	}
+	rc = flush_dirty_items( n, 1 );
 	if( !opt.lock_once ) {
 	    if( !dotlock_release( lockhandle ) )
 		is_locked = 0;
 	}
-	assert( unused );
-	r = unused;
-	r->flags.used = 1;
-	r->recno = recno;
-	memcpy( r->data, data, TRUST_RECORD_LEN );
-	r->flags.dirty = 1;
-	cache_is_dirty = 1;
-	cache_entries++;
-	return 0;
+	if( rc )
+	    return rc;
     }
-    BUG();
+    else
+	BUG();
+
+    r = cache_take_unused( recno );
+    memcpy( r->data, data, TRUST_RECORD_LEN );
+    r->flags.dirty = 1;
+    cache_dirty_entries++;
+    cache_is_dirty = 1;
+    return 0;
 }
 
 
@@ -306,7 +438,7 @@ tdbio_is_dirty()
 int
 tdbio_sync()
 {
-    CACHE_CTRL r;
+    int rc;
     int did_lock = 0;
 
     if( db_fd == -1 )
@@ -324,13 +456,9 @@ tdbio_sync()
 	    is_locked = 1;
 	did_lock = 1;
     }
-    for( r = cache_list; r; r = r->next ) {
-	if( r->flags.used && r->flags.dirty ) {
-	    int rc = write_cache_item( r );
-	    if( rc )
-		return rc;
-	}
-    }
+    rc = flush_dirty_items( 0, 0 );
+    if( rc )
+	return rc;
     cache_is_dirty = 0;
     if( did_lock && !opt.lock_once ) {
 	if( !dotlock_release (lockhandle) )
@@ -400,11 +528,12 @@ tdbio_cancel_transaction()
     /* remove all dirty marked entries, so that the original ones
      * are read back the next time */
     if( cache_is_dirty ) {
-	for( r = cache_list; r; r = r->next ) {
-	    if( r->flags.used && r->flags.dirty ) {
-		r->flags.used = 0;
-		cache_entries--;
-	    }
+	CACHE_CTRL rnext;
+
+	for( r = cache_list; r; r = rnext ) {
+	    rnext = r->next;
+	    if( r->flags.used && r->flags.dirty )
+		cache_drop( r );
 	}
 	cache_is_dirty = 0;
     }
@@ -751,7 +880,8 @@ tdbio_read_nextcheck ()
     return vr.r.ver.nextcheck;
 }
 
-/* Return true when the stamp was actually changed. */
+/* Return true when the stamp was actually changed.  This also
+   cancels a pending incremental check. */
 int
 tdbio_write_nextcheck (ulong stamp)
 {
@@ -763,10 +893,12 @@ tdbio_write_nextcheck (ulong stamp)
 	log_fatal( _("%s: error reading version record: %s\n"),
 				       db_name, g10_errstr(rc) );
 
-    if (vr.r.ver.nextcheck == stamp)
+    if (vr.r.ver.nextcheck == stamp
+        && !(vr.r.ver.flags & VERREC_FLAG_INCREMENTAL))
       return 0;
 
     vr.r.ver.nextcheck = stamp;
+    vr.r.ver.flags &= ~VERREC_FLAG_INCREMENTAL;
     rc = tdbio_write_record( &vr );
     if( rc )
 	log_fatal( _("%s: error writing version record: %s\n"),
@@ -775,6 +907,52 @@ tdbio_write_nextcheck (ulong stamp)
 }
 
 
+/* Return true if a check of the keys marked as changed is pending.
+   The nextcheck value is not changed for such a check, so that gpg
+   versions not knowing about VERREC_FLAG_INCREMENTAL still see the
+   real time of the next check; they clear the flag when they write
+   the version record.  */
+int
+tdbio_read_incremental (void)
+{
+    TRUSTREC vr;
+    int rc;
+
+    rc = tdbio_read_record( 0, &vr, RECTYPE_VER );
+    if( rc )
+	log_fatal( _("%s: error reading version record: %s\n"),
+						    db_name, g10_errstr(rc) );
+    return !!(vr.r.ver.flags & VERREC_FLAG_INCREMENTAL);
+}
+
+/* Schedule a check of the keys marked as changed.  Unlike
+   tdbio_write_nextcheck(1) the time of the next full check is kept.
+   Returns false if a full check is pending; the caller may then not
+   rely on an incremental check.  */
+int
+tdbio_mark_incremental (void)
+{
+    TRUSTREC vr;
+    int rc;
+
+    rc = tdbio_read_record( 0, &vr, RECTYPE_VER );
+    if( rc )
+	log_fatal( _("%s: error reading version record: %s\n"),
+				       db_name, g10_errstr(rc) );
+
+    if ((vr.r.ver.flags & VERREC_FLAG_INCREMENTAL))
+      return 1;  /* Already scheduled.  */
+    if (vr.r.ver.nextcheck == 1)
+      return 0;  /* A full check is pending.  */
+
+    vr.r.ver.flags |= VERREC_FLAG_INCREMENTAL;
+    rc = tdbio_write_record( &vr );
+    if( rc )
+	log_fatal( _("%s: error writing version record: %s\n"),
+				       db_name, g10_errstr(rc) );
+    return 1;
+}
+
 
 /****************
  * Return the record number of the trusthash tbl or create a new one.
@@ -1192,6 +1370,51 @@ tdbio_dump_record( TRUSTREC *rec, FILE *fp  )
     }
 }
 
+#ifdef USE_TDB_MMAP
+/****************
+ * Return a pointer to record RECNUM in the mapped trustdb or NULL if
+ * the record is beyond the end of the file or the mapping failed.
+ * The file is mapped again if its size has changed since the last
+ * mapping, either by our own writes or, as detected by a read beyond
+ * the mapping, by another process.  Records are still written using
+ * write(2); this is coherent with a shared mapping.
+ */
+static const byte *
+get_record_from_map( ulong recnum )
+{
+    struct stat st;
+    off_t off = (off_t)recnum * TRUST_RECORD_LEN;
+    void *p;
+
+    if( db_map && !db_map_stale && off + TRUST_RECORD_LEN <= db_maplen )
+	return db_map + off;
+
+    if( fstat( db_fd, &st ) ) {
+	log_error(_("trustdb: fstat failed: %s\n"), strerror(errno) );
+	return NULL;
+    }
+    if( off + TRUST_RECORD_LEN > st.st_size )
+	return NULL;  /* The caller's read will detect EOF.  */
+    db_map_stale = 0;
+    if( db_map && st.st_size == db_maplen )
+	return db_map + off;
+    if( db_map )
+	munmap( (void*)db_map, db_maplen );
+    db_map = NULL;
+    db_maplen = 0;
+    p = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, db_fd, 0 );
+    if( p == MAP_FAILED ) {
+	log_info(_("trustdb: mmap failed: %s\n"), strerror(errno) );
+	opt.trustdb_mmap = 0;
+	return NULL;
+    }
+    db_map = p;
+    db_maplen = st.st_size;
+    return db_map + off;
+}
+#endif /*USE_TDB_MMAP*/
+
+
 /****************
  * read the record with number recnum
  * returns: -1 on error, 0 on success
@@ -1207,6 +1430,10 @@ tdbio_read_record( ulong recnum, TRUSTREC *rec, int expected )
     if( db_fd == -1 )
 	open_db();
     buf = get_record_from_cache( recnum );
+#ifdef USE_TDB_MMAP
+    if( !buf && opt.trustdb_mmap )
+	buf = get_record_from_map( recnum );  /* Falls back to read on NULL.  */
+#endif
     if( !buf ) {
 	if( lseek( db_fd, recnum * TRUST_RECORD_LEN, SEEK_SET ) == -1 ) {
             err = gpg_error_from_syserror ();
@@ -1250,7 +1477,8 @@ tdbio_read_record( ulong recnum, TRUSTREC *rec, int expected )
 	rec->r.ver.cert_depth = *p++;
 	rec->r.ver.trust_model = *p++;
 	rec->r.ver.min_cert_level = *p++;
-	p += 2;
+	rec->r.ver.flags = *p++;
+	p++;
 	rec->r.ver.created  = buftoulong(p); p += 4;
 	rec->r.ver.nextcheck = buftoulong(p); p += 4;
 	p += 4;
@@ -1288,7 +1516,7 @@ tdbio_read_record( ulong recnum, TRUSTREC *rec, int expected )
         rec->r.trust.ownertrust = *p++;
         rec->r.trust.depth = *p++;
         rec->r.trust.min_ownertrust = *p++;
-        p++;
+        rec->r.trust.flags = *p++;
 	rec->r.trust.validlist = buftoulong(p); p += 4;
 	break;
       case RECTYPE_VALID:
@@ -1338,7 +1566,8 @@ tdbio_write_record( TRUSTREC *rec )
 	*p++ = rec->r.ver.cert_depth;
 	*p++ = rec->r.ver.trust_model;
 	*p++ = rec->r.ver.min_cert_level;
-	p += 2;
+	*p++ = rec->r.ver.flags;
+	p++;
 	ulongtobuf(p, rec->r.ver.created); p += 4;
 	ulongtobuf(p, rec->r.ver.nextcheck); p += 4;
 	p += 4;
@@ -1371,7 +1600,7 @@ tdbio_write_record( TRUSTREC *rec )
 	*p++ = rec->r.trust.ownertrust;
 	*p++ = rec->r.trust.depth;
 	*p++ = rec->r.trust.min_ownertrust;
-        p++;
+	*p++ = rec->r.trust.flags;
 	ulongtobuf( p, rec->r.trust.validlist); p += 4;
 	break;
 
@@ -1495,6 +1724,8 @@ tdbio_new_recnum()
 		log_error(_("trustdb rec %lu: write failed (n=%d): %s\n"),
 						 recnum, n, strerror(errno) );
 	    }
+	    else
+		note_records_written( recnum + 1 );
 	}
 
 	if( rc )
@@ -40,6 +40,12 @@
 #define RECTYPE_VALID 13
 #define RECTYPE_FREE 254
 
+/* Flags of the version record.  */
+#define VERREC_FLAG_INCREMENTAL 1  /* The keys marked as changed need
+                                      to be validated.  */
+/* Flags of the trust record.  */
+#define TRUSTREC_FLAG_CHANGED   1  /* Key changed since the last check.  */
+
 
 struct trust_record {
     int  rectype;
@@ -55,6 +61,7 @@ struct trust_record {
 	    byte  cert_depth;
 	    byte  trust_model;
 	    byte  min_cert_level;
+	    byte  flags;     /* VER_FLAG_* */
 	    ulong created;   /* timestamp of trustdb creation  */
 	    ulong nextcheck; /* timestamp of next scheduled check */
 	    ulong reserved;
@@ -79,6 +86,7 @@ struct trust_record {
         byte depth;
         ulong validlist;
 	byte min_ownertrust;
+	byte flags;         /* TRUST_FLAG_* */
       } trust;
       struct {
         byte namehash[20];
@@ -102,6 +110,8 @@ int tdbio_db_matches_options(void);
 byte tdbio_read_model(void);
 ulong tdbio_read_nextcheck (void);
 int tdbio_write_nextcheck (ulong stamp);
+int tdbio_read_incremental (void);
+int tdbio_mark_incremental (void);
 int tdbio_is_dirty(void);
 int tdbio_sync(void);
 int tdbio_begin_transaction(void);
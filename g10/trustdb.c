@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <npth.h>
 
 #ifndef DISABLE_REGEX
 #include <sys/types.h>
@@ -589,13 +590,13 @@ check_trustdb ()
 	  ulong scheduled;
 
 	  scheduled = tdbio_read_nextcheck ();
-	  if (!scheduled)
+	  if (!scheduled && !tdbio_read_incremental ())
 	    {
 	      log_info (_("no need for a trustdb check\n"));
 	      return;
 	    }
 
-	  if (scheduled > make_timestamp ())
+	  if (scheduled > make_timestamp () && !tdbio_read_incremental ())
 	    {
 	      log_info (_("next trustdb check due at %s\n"),
 			strtimestamp (scheduled));
@@ -934,6 +935,45 @@ clear_ownertrusts (PKT_public_key *pk)
   return 0;
 }
 
+/* Same as revalidation_mark but only the primary key PK has been
+   changed.  This allows the next check to revalidate just the changed
+   keys.  */
+void
+revalidation_mark_key (PKT_public_key *pk)
+{
+  TRUSTREC trec;
+  int rc;
+
+  init_trustdb ();
+  if (!opt.incremental_trustdb
+      || (opt.trust_model != TM_PGP && opt.trust_model != TM_CLASSIC)
+      || !tdbio_mark_incremental ())
+    {
+      revalidation_mark ();
+      return;
+    }
+
+  rc = read_trust_record (pk, &trec);
+  if (rc && rc != -1)
+    {
+      tdbio_invalid ();
+      return;
+    }
+  if (rc == -1) /* no record yet - create a new one */
+    {
+      size_t dummy;
+
+      memset (&trec, 0, sizeof trec);
+      trec.recnum = tdbio_new_recnum ();
+      trec.rectype = RECTYPE_TRUST;
+      fingerprint_from_pk (pk, trec.r.trust.fingerprint, &dummy);
+    }
+  trec.r.trust.flags |= TRUSTREC_FLAG_CHANGED;
+  write_record (&trec);
+  do_sync ();
+  pending_check_trustdb = 1;
+}
+
 /*
  * Note: Caller has to do a sync
  */
@@ -1046,7 +1086,7 @@ check_trustdb_stale(void)
       did_nextcheck = 1;
       scheduled = tdbio_read_nextcheck ();
       if ((scheduled && scheduled <= make_timestamp ())
-	  || pending_check_trustdb)
+	  || pending_check_trustdb || tdbio_read_incremental ())
         {
           if (opt.no_auto_check_trustdb)
             {
@@ -2077,6 +2117,122 @@ search_skipfnc (void *opaque, u32 *kid, PKT_user_id *dummy)
 }
 
 
+/* Number of keyblocks read ahead per job with --trustdb-jobs.  */
+#define KEYBLOCKS_PER_JOB 16
+
+/* The work queue of check_certs_parallel.  */
+struct cert_check_queue
+{
+  struct key_sig_check_s *chks;
+  size_t nchks;
+  size_t next;  /* Index of the next item to take.  */
+};
+
+
+/* Thread function for check_certs_parallel.  The thread holds the
+   global nPth lock, which also protects NEXT; pk_verify releases it
+   only for the public key operation itself.  */
+static void *
+cert_check_worker (void *arg)
+{
+  struct cert_check_queue *queue = arg;
+  struct key_sig_check_s *chk;
+
+  while (queue->next < queue->nchks)
+    {
+      chk = queue->chks + queue->next++;
+      check_key_signature_verify (chk);
+    }
+  return NULL;
+}
+
+
+/*
+ * Check the certifications issued by keys in KLIST on the NKEYBLOCKS
+ * keyblocks in KEYBLOCKS using up to opt.trustdb_jobs threads.  The
+ * selection of signatures mirrors mark_usable_uid_certs.  The results
+ * are merged in keyblock order and cached in the signature packets
+ * where mark_usable_uid_certs picks them up.
+ */
+static void
+check_certs_parallel (KBNODE *keyblocks, size_t nkeyblocks,
+                      struct key_item *klist)
+{
+  struct cert_check_queue queue;
+  size_t maxchks, i;
+  npth_t *threads;
+  npth_attr_t tattr;
+  int nthreads, n, err;
+
+  memset (&queue, 0, sizeof queue);
+  maxchks = 0;
+  for (i=0; i < nkeyblocks; i++)
+    {
+      KBNODE node;
+      PKT_signature *sig;
+      int in_uid = 0;
+
+      for (node=keyblocks[i]; node; node = node->next)
+        {
+          if (node->pkt->pkttype == PKT_USER_ID)
+            in_uid = (!node->pkt->pkt.user_id->is_revoked
+                      && !node->pkt->pkt.user_id->is_expired);
+          else if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+            in_uid = 0;
+          if (!in_uid || node->pkt->pkttype != PKT_SIGNATURE)
+            continue;
+          sig = node->pkt->pkt.signature;
+          if (sig->sig_class>=0x11 && sig->sig_class<=0x13
+              && sig->sig_class-0x10<opt.min_cert_level)
+            continue;
+          if (!is_in_klist (klist, sig))
+            continue;
+
+          if (queue.nchks == maxchks)
+            {
+              maxchks += 256;
+              queue.chks = xrealloc (queue.chks,
+                                     maxchks * sizeof *queue.chks);
+            }
+          if (!check_key_signature_prepare (keyblocks[i], node,
+                                            queue.chks + queue.nchks))
+            queue.nchks++;
+        }
+    }
+  if (!queue.nchks)
+    {
+      xfree (queue.chks);
+      return;
+    }
+
+  gpg_init_npth ();
+
+  nthreads = opt.trustdb_jobs;
+  if (nthreads > queue.nchks)
+    nthreads = queue.nchks;
+  threads = xcalloc (nthreads, sizeof *threads);
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  /* The main thread takes part in the work.  */
+  for (n=1; n < nthreads; n++)
+    if ((err = npth_create (&threads[n], &tattr, cert_check_worker, &queue)))
+      {
+        log_error ("error spawning trustdb worker: %s\n", strerror (err));
+        break;
+      }
+  nthreads = n;
+  npth_attr_destroy (&tattr);
+  cert_check_worker (&queue);
+  for (n=1; n < nthreads; n++)
+    npth_join (threads[n], NULL);
+  xfree (threads);
+
+  for (i=0; i < queue.nchks; i++)
+    check_key_signature_finish (queue.chks + i);
+  xfree (queue.chks);
+}
+
+
 /*
  * Scan all keys and return a key_array of all suitable keys from
  * kllist.  The caller has to pass keydb handle so that we don't use
@@ -2089,8 +2245,9 @@ validate_key_list (KEYDB_HANDLE hd, KeyHashTable full_trust,
                    struct key_item *klist, u32 curtime, u32 *next_expire)
 {
   KBNODE keyblock = NULL;
+  KBNODE *batch;
   struct key_array *keys = NULL;
-  size_t nkeys, maxkeys;
+  size_t nkeys, maxkeys, nbatch, batchsize, i;
   int rc;
   KEYDB_SEARCH_DESC desc;
 
@@ -2123,17 +2280,20 @@ validate_key_list (KEYDB_HANDLE hd, KeyHashTable full_trust,
       return NULL;
     }
 
+  /* With --trustdb-jobs we read a batch of keyblocks and check their
+     certifications in parallel before validating them in order.  */
+  batchsize = opt.trustdb_jobs > 1? opt.trustdb_jobs * KEYBLOCKS_PER_JOB : 1;
+  batch = xmalloc (batchsize * sizeof *batch);
+  nbatch = 0;
+
   desc.mode = KEYDB_SEARCH_MODE_NEXT; /* change mode */
-  do
+  for (;;)
     {
-      PKT_public_key *pk;
-
       rc = keydb_get_keyblock (hd, &keyblock);
       if (rc)
         {
           log_error ("keydb_get_keyblock failed: %s\n", g10_errstr(rc));
-          xfree (keys);
-          return NULL;
+          goto fail;
         }
 
       if ( keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
@@ -2142,58 +2302,103 @@ validate_key_list (KEYDB_HANDLE hd, KeyHashTable full_trust,
                      keyblock->pkt->pkttype);
           dump_kbnode (keyblock);
           release_kbnode(keyblock);
-          continue;
         }
+      else
+        {
+          /* prepare the keyblock for further processing */
+          merge_keys_and_selfsig (keyblock);
+          clear_kbnode_flags (keyblock);
+          batch[nbatch++] = keyblock;
+        }
+      keyblock = NULL;
 
-      /* prepare the keyblock for further processing */
-      merge_keys_and_selfsig (keyblock);
-      clear_kbnode_flags (keyblock);
-      pk = keyblock->pkt->pkt.public_key;
-      if (pk->has_expired || pk->flags.revoked)
+      if (nbatch < batchsize)
         {
-          /* it does not make sense to look further at those keys */
-          mark_keyblock_seen (full_trust, keyblock);
+          rc = keydb_search (hd, &desc, 1);
+          if (!rc)
+            continue;
+          if (gpg_err_code (rc) != GPG_ERR_NOT_FOUND)
+            {
+              log_error ("keydb_search_next failed: %s\n", g10_errstr(rc));
+              goto fail;
+            }
         }
-      else if (validate_one_keyblock (keyblock, klist, curtime, next_expire))
+
+      if (nbatch > 1)
+        check_certs_parallel (batch, nbatch, klist);
+      for (i=0; i < nbatch; i++)
         {
-	  KBNODE node;
+          PKT_public_key *pk;
+          u32 kid[2];
+
+          keyblock = batch[i];
+          batch[i] = NULL;
+          pk = keyblock->pkt->pkt.public_key;
+          keyid_from_pk (pk, kid);
+          if (test_key_hash_table (full_trust, kid))
+            ; /* Already seen earlier in this batch.  */
+          else if (pk->has_expired || pk->flags.revoked)
+            {
+              /* it does not make sense to look further at those keys */
+              mark_keyblock_seen (full_trust, keyblock);
+            }
+          else if (validate_one_keyblock (keyblock, klist,
+                                          curtime, next_expire))
+            {
+              KBNODE node;
 
-          if (pk->expiredate && pk->expiredate >= curtime
-              && pk->expiredate < *next_expire)
-            *next_expire = pk->expiredate;
+              if (pk->expiredate && pk->expiredate >= curtime
+                  && pk->expiredate < *next_expire)
+                *next_expire = pk->expiredate;
 
-          if (nkeys == maxkeys) {
-            maxkeys += 1000;
-            keys = xrealloc (keys, (maxkeys+1) * sizeof *keys);
-          }
-          keys[nkeys++].keyblock = keyblock;
+              if (nkeys == maxkeys) {
+                maxkeys += 1000;
+                keys = xrealloc (keys, (maxkeys+1) * sizeof *keys);
+              }
+              keys[nkeys++].keyblock = keyblock;
 
-	  /* Optimization - if all uids are fully trusted, then we
-	     never need to consider this key as a candidate again. */
+              /* Optimization - if all uids are fully trusted, then we
+                 never need to consider this key as a candidate again. */
 
-	  for (node=keyblock; node; node = node->next)
-	    if (node->pkt->pkttype == PKT_USER_ID && !(node->flag & 4))
-	      break;
+              for (node=keyblock; node; node = node->next)
+                if (node->pkt->pkttype == PKT_USER_ID && !(node->flag & 4))
+                  break;
 
-	  if(node==NULL)
-	    mark_keyblock_seen (full_trust, keyblock);
+              if(node==NULL)
+                mark_keyblock_seen (full_trust, keyblock);
+
+              keyblock = NULL;
+            }
 
+          release_kbnode (keyblock);
           keyblock = NULL;
         }
+      nbatch = 0;
 
-      release_kbnode (keyblock);
-      keyblock = NULL;
-    }
-  while ( !(rc = keydb_search (hd, &desc, 1)) );
-  if (rc && gpg_err_code (rc) != GPG_ERR_NOT_FOUND)
-    {
-      log_error ("keydb_search_next failed: %s\n", g10_errstr(rc));
-      xfree (keys);
-      return NULL;
+      if (rc)
+        break;  /* Not found: we are done.  */
+      rc = keydb_search (hd, &desc, 1);
+      if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
+        break;
+      if (rc)
+        {
+          log_error ("keydb_search_next failed: %s\n", g10_errstr(rc));
+          goto fail;
+        }
     }
+  xfree (batch);
 
   keys[nkeys].keyblock = NULL;
   return keys;
+
+ fail:
+  for (i=0; i < nbatch; i++)
+    release_kbnode (batch[i]);
+  xfree (batch);
+  for (i=0; i < nkeys; i++)
+    release_kbnode (keys[i].keyblock);
+  xfree (keys);
+  return NULL;
 }
 
 /* Caller must sync */
@@ -2209,9 +2414,11 @@ reset_trust_records(void)
       if(rec.rectype==RECTYPE_TRUST)
 	{
 	  count++;
-	  if(rec.r.trust.min_ownertrust)
+	  if(rec.r.trust.min_ownertrust
+	     || (rec.r.trust.flags & TRUSTREC_FLAG_CHANGED))
 	    {
 	      rec.r.trust.min_ownertrust=0;
+	      rec.r.trust.flags &= ~TRUSTREC_FLAG_CHANGED;
 	      write_record(&rec);
 	    }
 
@@ -2234,6 +2441,273 @@ reset_trust_records(void)
 	      count, nreset);
 }
 
+/*
+ * Return true if one of the user IDs of the key with the trust record
+ * TREC is at least fully valid.  If RESET is set the validity of all
+ * user IDs is cleared the same way reset_trust_records does.
+ */
+static int
+trust_record_fully_valid (TRUSTREC *trec, int reset)
+{
+  TRUSTREC vrec;
+  ulong recno;
+  int any = 0;
+
+  for (recno = trec->r.trust.validlist; recno; recno = vrec.r.valid.next)
+    {
+      read_record (recno, &vrec, RECTYPE_VALID);
+      if ((vrec.r.valid.validity & TRUST_MASK) >= TRUST_FULLY)
+        any = 1;
+      if (reset && ((vrec.r.valid.validity & TRUST_MASK)
+                    || vrec.r.valid.marginal_count
+                    || vrec.r.valid.full_count))
+        {
+          vrec.r.valid.validity &= ~TRUST_MASK;
+          vrec.r.valid.marginal_count = vrec.r.valid.full_count = 0;
+          write_record (&vrec);
+        }
+    }
+  return any;
+}
+
+
+/*
+ * Build the list of keys which certified a user ID of KEYBLOCK and
+ * are used as introducers by validate_keys.  The information about
+ * the signers is taken from the trustdb.  On success the list is
+ * stored at R_KLIST and the depth to use for KEYBLOCK at R_DEPTH.
+ * Returns -1 if this can't be decided without a full check.
+ */
+static int
+collect_certifiers (KBNODE keyblock, struct key_item **r_klist, int *r_depth)
+{
+  struct key_item *klist = NULL, *k, *u;
+  PKT_public_key *pk = keyblock->pkt->pkt.public_key;
+  PKT_public_key *spk;
+  PKT_signature *sig;
+  TRUSTREC trec;
+  KBNODE node, n;
+  u32 main_kid[2], kid[2];
+  int depth = 0;
+  int rc = 0;
+
+  keyid_from_pk (pk, main_kid);
+  spk = xmalloc_clear (sizeof *spk);
+  for (node=keyblock; node && !rc; node = node->next)
+    {
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      if (!IS_UID_SIG (sig) && !IS_UID_REV (sig))
+        continue;
+      if (sig->keyid[0] == main_kid[0] && sig->keyid[1] == main_kid[1])
+        continue;
+      if (is_in_klist (klist, sig))
+        continue;
+
+      for (u=utk_list; u; u = u->next)
+        if (u->kid[0] == sig->keyid[0] && u->kid[1] == sig->keyid[1])
+          break;
+      if (u)
+        {
+          k = new_key_item ();
+          *k = *u;
+          k->trust_regexp = u->trust_regexp? xstrdup (u->trust_regexp):NULL;
+          k->next = klist;
+          klist = k;
+          continue;
+        }
+
+      /* Only primary keys with a fully valid user ID are introducers.  */
+      release_public_key_parts (spk);
+      memset (spk, 0, sizeof *spk);
+      if (get_pubkey (spk, sig->keyid))
+        continue;
+      keyid_from_pk (spk, kid);
+      if (kid[0] != sig->keyid[0] || kid[1] != sig->keyid[1]
+          || spk->main_keyid[0] != kid[0] || spk->main_keyid[1] != kid[1])
+        continue;
+      if (read_trust_record (spk, &trec))
+        continue;
+      if (!trust_record_fully_valid (&trec, 0))
+        continue;
+
+      /* The validity of a changed signer or of one near the maximum
+         certification depth may be different after a full check.  */
+      if ((trec.r.trust.flags & TRUSTREC_FLAG_CHANGED)
+          || trec.r.trust.depth + 1 >= opt.max_cert_depth)
+        {
+          rc = -1;
+          break;
+        }
+
+      /* Trust signatures on the signer may restrict its introductions
+         or change its ownertrust; leave them to the full check.  */
+      if (opt.trust_model == TM_PGP)
+        {
+          KBNODE skb = get_pubkeyblock (kid);
+
+          for (n=skb; n; n = n->next)
+            if (n->pkt->pkttype == PKT_SIGNATURE
+                && n->pkt->pkt.signature->trust_depth)
+              break;
+          release_kbnode (skb);
+          if (n)
+            {
+              rc = -1;
+              break;
+            }
+        }
+
+      k = new_key_item ();
+      k->kid[0] = kid[0];
+      k->kid[1] = kid[1];
+      k->ownertrust = get_ownertrust (spk) & TRUST_MASK;
+      k->min_ownertrust = get_min_ownertrust (spk);
+      k->next = klist;
+      klist = k;
+      if (trec.r.trust.depth + 1 > depth)
+        depth = trec.r.trust.depth + 1;
+    }
+  free_public_key (spk);
+
+  if (rc)
+    release_key_items (klist);
+  else
+    {
+      *r_klist = klist;
+      *r_depth = depth;
+    }
+  return rc;
+}
+
+
+/*
+ * Revalidate only the keys marked by revalidation_mark_key.  This is
+ * only possible as long as none of these keys is or becomes fully
+ * valid, because only then the change can't propagate through the
+ * web of trust.  SCHEDULED is the time of the next regular check.
+ * Returns -1 if a full check is required; the trustdb may then have
+ * been partly updated, which the full check takes care of.
+ */
+static int
+validate_changed_keys (ulong scheduled)
+{
+  TRUSTREC rec;
+  ulong recnum;
+  ulong *changed = NULL;
+  size_t nchanged = 0, maxchanged = 0, i;
+  KeyHashTable stored;
+  u32 start_time, next_expire;
+  int rc = 0;
+
+  start_time = make_timestamp ();
+  if ((scheduled && scheduled <= start_time)
+      || !tdbio_db_matches_options () || !utk_list)
+    return -1;
+
+  for (recnum=1; !tdbio_read_record (recnum, &rec, 0); recnum++)
+    if (rec.rectype == RECTYPE_TRUST
+        && (rec.r.trust.flags & TRUSTREC_FLAG_CHANGED))
+      {
+        if (nchanged == maxchanged)
+          {
+            maxchanged += 64;
+            changed = xrealloc (changed, maxchanged * sizeof *changed);
+          }
+        changed[nchanged++] = recnum;
+      }
+
+  next_expire = 0xffffffff;
+  stored = new_key_hash_table ();
+  for (i=0; i < nchanged && !rc; i++)
+    {
+      struct key_item *klist = NULL, *u;
+      KBNODE keyblock = NULL, node;
+      PKT_public_key *pk;
+      u32 kid[2];
+      int depth;
+
+      read_record (changed[i], &rec, RECTYPE_TRUST);
+      if (trust_record_fully_valid (&rec, 0))
+        {
+          rc = -1;  /* The key is an introducer.  */
+          break;
+        }
+      if (get_keyblock_byfprint (&keyblock, rec.r.trust.fingerprint,
+                                 MAX_FINGERPRINT_LEN))
+        keyblock = NULL;  /* Deleted.  */
+      else
+        {
+          pk = keyblock->pkt->pkt.public_key;
+          keyid_from_pk (pk, kid);
+          for (u=utk_list; u; u = u->next)
+            if (u->kid[0] == kid[0] && u->kid[1] == kid[1])
+              break;
+          if (u)
+            rc = -1;
+          else
+            {
+              merge_keys_and_selfsig (keyblock);
+              clear_kbnode_flags (keyblock);
+              rc = collect_certifiers (keyblock, &klist, &depth);
+            }
+        }
+
+      if (!rc)
+        {
+          /* Recompute the validity from scratch.  */
+          trust_record_fully_valid (&rec, 1);
+          if (!keyblock)
+            ;
+          else if (pk->has_expired || pk->flags.revoked)
+            ;
+          else if (validate_one_keyblock (keyblock, klist,
+                                          start_time, &next_expire))
+            {
+              for (node=keyblock; node; node = node->next)
+                if (node->pkt->pkttype == PKT_USER_ID && (node->flag & 4))
+                  rc = -1;  /* Now an introducer.  */
+              if (!rc)
+                {
+                  if (pk->expiredate && pk->expiredate >= start_time
+                      && pk->expiredate < next_expire)
+                    next_expire = pk->expiredate;
+                  store_validation_status (depth, keyblock, stored);
+                }
+            }
+        }
+
+      if (!rc)
+        {
+          read_record (changed[i], &rec, RECTYPE_TRUST);
+          rec.r.trust.flags &= ~TRUSTREC_FLAG_CHANGED;
+          write_record (&rec);
+        }
+      release_key_items (klist);
+      release_kbnode (keyblock);
+    }
+  release_key_hash_table (stored);
+  xfree (changed);
+
+  if (!rc)
+    {
+      if (next_expire != 0xffffffff && next_expire >= start_time
+          && (!scheduled || next_expire < scheduled))
+        scheduled = next_expire;
+      tdbio_write_nextcheck (scheduled);
+      do_sync ();
+      pending_check_trustdb = 0;
+      if (!opt.quiet)
+        log_info (_("%lu changed keys revalidated\n"), (ulong)nchanged);
+    }
+  else if (opt.verbose)
+    log_info (_("changed keys affect other keys"
+                " - checking the entire trustdb\n"));
+  return rc;
+}
+
+
 /*
  * Run the key validation procedure.
  *
@@ -2274,6 +2748,11 @@ validate_keys (int interactive)
   KeyHashTable stored,used,full_trust;
   u32 start_time, next_expire;
 
+  /* If only a few keys have been changed, try to validate just them.  */
+  if (!interactive && opt.incremental_trustdb
+      && tdbio_read_incremental ()
+      && !validate_changed_keys (tdbio_read_nextcheck ()))
+    return 0;
   /* Make sure we have all sigs cached.  TODO: This is going to
      require some architectual re-thinking, as it is agonizingly slow.
      Perhaps combine this with reset_trust_records(), or only check
@@ -54,6 +54,7 @@ const char *trust_value_to_string (unsigned int value);
 int string_to_trust_value (const char *str);
 
 void revalidation_mark (void);
+void revalidation_mark_key (PKT_public_key *pk);
 int trustdb_pending_check(void);
 void trustdb_check_or_update(void);
 
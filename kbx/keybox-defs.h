@@ -44,14 +44,6 @@
 #include "keybox.h"
 
 
-enum {
-  BLOBTYPE_EMPTY = 0,
-  BLOBTYPE_HEADER = 1,
-  BLOBTYPE_PGP = 2,
-  BLOBTYPE_X509 = 3
-};
-
-
 typedef struct keyboxblob *KEYBOXBLOB;
 
 
@@ -66,6 +58,9 @@ struct keybox_name
   /* True if this is a keybox with secret keys.  */
   int secret;
 
+  /* True if the keybox may not be modified.  */
+  int read_only;
+
   /*DOTLOCK lockhd;*/
 
   /* A table with all the handles accessing this resources.
@@ -90,6 +85,14 @@ struct keybox_handle {
   CONST_KB_NAME kb;
   int secret;             /* this is for a secret keybox */
   FILE *fp;
+  struct {
+    /* If the file has been mapped into memory for a search, this
+       is the mapping and the current read position.  FP is not used
+       in this case.  */
+    const unsigned char *mem;
+    size_t len;
+    size_t pos;
+  } map;
   int eof;
   int error;
   int ephemeral;
@@ -152,12 +155,17 @@ typedef struct _keybox_openpgp_info *keybox_openpgp_info_t;
 
 /*-- keybox-init.c --*/
 void _keybox_close_file (KEYBOX_HANDLE hd);
+gpg_error_t _keybox_map_file (KEYBOX_HANDLE hd);
+void _keybox_unmap_file (KEYBOX_HANDLE hd);
 
 
 /*-- keybox-blob.c --*/
-#ifdef KEYBOX_WITH_OPENPGP
-  /* fixme */
-#endif /*KEYBOX_WITH_OPENPGP*/
+gpg_error_t _keybox_create_openpgp_blob (KEYBOXBLOB *r_blob,
+                                         keybox_openpgp_info_t info,
+                                         const unsigned char *image,
+                                         size_t imagelen,
+                                         u32 *sigstatus,
+                                         int as_ephemeral);
 #ifdef KEYBOX_WITH_X509
 int _keybox_create_x509_blob (KEYBOXBLOB *r_blob, ksba_cert_t cert,
                               unsigned char *sha1_digest, int as_ephemeral);
@@ -166,6 +174,10 @@ int _keybox_create_x509_blob (KEYBOXBLOB *r_blob, ksba_cert_t cert,
 int  _keybox_new_blob (KEYBOXBLOB *r_blob,
                        unsigned char *image, size_t imagelen,
                        off_t off);
+void _keybox_set_blob_ref (KEYBOXBLOB blob,
+                           const unsigned char *image, size_t imagelen,
+                           off_t off);
+gpg_error_t _keybox_copy_blob (KEYBOXBLOB *r_blob, KEYBOXBLOB blob);
 void _keybox_release_blob (KEYBOXBLOB blob);
 const unsigned char *_keybox_get_blob_image (KEYBOXBLOB blob, size_t *n);
 off_t _keybox_get_blob_fileoffset (KEYBOXBLOB blob);
@@ -181,8 +193,21 @@ void _keybox_destroy_openpgp_info (keybox_openpgp_info_t info);
 /*-- keybox-file.c --*/
 int _keybox_read_blob (KEYBOXBLOB *r_blob, FILE *fp);
 int _keybox_read_blob2 (KEYBOXBLOB *r_blob, FILE *fp, int *skipped_deleted);
+int _keybox_read_blob_mapped (KEYBOXBLOB blob, KEYBOX_HANDLE hd);
 int _keybox_write_blob (KEYBOXBLOB blob, FILE *fp);
-int _keybox_write_header_blob (FILE *fp);
+
+/*-- keybox-index.c --*/
+gpg_error_t _keybox_index_rebuild (const char *fname);
+void _keybox_index_remove (const char *fname);
+int  _keybox_index_is_current (const char *fname);
+void _keybox_index_commit (const char *fname, off_t off, long delta,
+                           KEYBOXBLOB newblob);
+gpg_error_t _keybox_index_lookup (KEYBOX_HANDLE hd,
+                                  KEYBOX_SEARCH_DESC *desc, size_t ndesc,
+                                  off_t **r_offsets, size_t *r_noffsets);
+int _keybox_index_seek_next (KEYBOX_HANDLE hd,
+                             const off_t *offsets, size_t noffsets,
+                             size_t *idx);
 
 /*-- keybox-search.c --*/
 gpg_err_code_t _keybox_get_flag_location (const unsigned char *buffer,
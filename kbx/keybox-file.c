@@ -115,6 +115,40 @@ _keybox_read_blob (KEYBOXBLOB *r_blob, FILE *fp)
 }
 
 
+/* Read the blob at the current position of the memory mapped file of
+   HD.  This is the counterpart of _keybox_read_blob but instead of
+   allocating a new blob, BLOB is set to refer to the image in the
+   mapping.  Deleted blobs are skipped.  */
+int
+_keybox_read_blob_mapped (KEYBOXBLOB blob, KEYBOX_HANDLE hd)
+{
+  const unsigned char *p;
+  size_t imagelen;
+  off_t off;
+
+ again:
+  if (hd->map.pos >= hd->map.len)
+    return -1; /* eof */
+  if (hd->map.len - hd->map.pos < 5)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+
+  p = hd->map.mem + hd->map.pos;
+  imagelen = (p[0] << 24) | (p[1] << 16) | (p[2] << 8 ) | p[3];
+  if (imagelen > 500000) /* Sanity check. */
+    return gpg_error (GPG_ERR_TOO_LARGE);
+  if (imagelen < 5 || imagelen > hd->map.len - hd->map.pos)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+
+  off = hd->map.pos;
+  hd->map.pos += imagelen;
+  if (!p[4])
+    goto again; /* Skip empty blobs.  */
+
+  _keybox_set_blob_ref (blob, p, imagelen, off);
+  return 0;
+}
+
+
 /* Write the block to the current file position */
 int
 _keybox_write_blob (KEYBOXBLOB blob, FILE *fp)
@@ -140,7 +174,7 @@ _keybox_write_header_blob (FILE *fp)
   /* Length of this blob. */
   image[3] = 32;
 
-  image[4] = BLOBTYPE_HEADER;
+  image[4] = KEYBOX_BLOBTYPE_HEADER;
   image[5] = 1; /* Version */
 
   memcpy (image+8, "KBXf", 4);
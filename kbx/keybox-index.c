@@ -0,0 +1,733 @@
+/* keybox-index.c - Sidecar index for keybox files
+ * Copyright (C) 2012 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The index file is stored next to the keybox file using the suffix
+   ".idx".  It maps the key IDs of all keys in the keybox to the file
+   offsets of their blobs and allows to locate a blob by its key ID
+   or fingerprint with O(log n) reads instead of scanning the entire
+   keybox.  The index is optional: If it is missing or does not match
+   the keybox, the search code falls back to a full scan.  All
+   integers are stored in network byte order.
+
+   The file starts with a header of 32 bytes:
+
+     byte 4   Magic "KBXi"
+     byte 1   Version (2)
+     byte 3   RFU
+     u32      Number of entries
+     u32      Upper 32 bits of the length of the keybox file
+     u32      Lower 32 bits of the length of the keybox file
+     u32      Modification time of the keybox file
+     u32      Nanoseconds part of the modification time or 0
+     byte 4   RFU
+
+   The length and the modification time of the keybox file are used
+   to detect a stale index.  Our own modifications of the keybox
+   update the index, thus this only needs to detect changes by other
+   programs.  The nanoseconds are used where available, so that a
+   change which keeps the length is detected even if it happens in
+   the same second in which the index was written.  The header is
+   followed by the entries,
+   sorted by their first 16 bytes:
+
+     byte 4   Low 32 bits of the key ID (bytes 16 to 19 of the fpr)
+     byte 4   High 32 bits of the key ID (bytes 12 to 15 of the fpr)
+     u32      Upper 32 bits of the file offset of the blob
+     u32      Lower 32 bits of the file offset of the blob
+
+   Putting the low part of the key ID first allows to look up short
+   key IDs using the same sorted table.  Note that the key IDs are
+   taken from the same bytes of the fingerprint which are also
+   compared by the regular search code.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_LIMITS_H
+# include <limits.h>
+#endif
+
+#include "keybox-defs.h"
+#include "../common/sysutils.h"
+
+#define EXTSEP_S "."
+
+#define INDEX_VERSION    2
+#define INDEX_HEADER_LEN 32
+#define INDEX_STAMP_LEN  16
+#define INDEX_ENTRY_LEN  16
+
+
+#if !defined(HAVE_FSEEKO) && !defined(fseeko)
+static int
+fseeko (FILE *stream, off_t newpos, int whence)
+{
+  while (newpos != (long) newpos)
+    {
+      long pos = newpos < 0 ? LONG_MIN : LONG_MAX;
+      if (fseek (stream, pos, whence) != 0)
+	return -1;
+      newpos -= pos;
+      whence = SEEK_CUR;
+    }
+  return fseek (stream, (long) newpos, whence);
+}
+#endif /* !defined(HAVE_FSEEKO) && !defined(fseeko) */
+
+#if !defined(HAVE_FTELLO) && !defined(ftello)
+static off_t
+ftello (FILE *stream)
+{
+  long int off;
+
+  off = ftell (stream);
+  if (off == -1)
+    return (off_t)-1;
+  return off;
+}
+#endif /* !defined(HAVE_FTELLO) && !defined(ftello) */
+
+
+/* The in-core representation of the index.  */
+struct index_table_s
+{
+  size_t nentries;
+  size_t size;             /* Allocated number of entries.  */
+  unsigned char *entries;  /* Array of NENTRIES * INDEX_ENTRY_LEN.  */
+};
+typedef struct index_table_s *index_table_t;
+
+
+
+static inline u32
+get32 (const unsigned char *buffer)
+{
+  return ((buffer[0] << 24) | (buffer[1] << 16)
+          | (buffer[2] << 8) | buffer[3]);
+}
+
+static inline void
+put32 (unsigned char *buffer, u32 a)
+{
+  buffer[0] = a >> 24;
+  buffer[1] = a >> 16;
+  buffer[2] = a >>  8;
+  buffer[3] = a;
+}
+
+static inline off_t
+get_entry_offset (const unsigned char *entry)
+{
+  return (off_t)(((unsigned long long)get32 (entry+8) << 32)
+                 | get32 (entry+12));
+}
+
+static inline void
+put_entry_offset (unsigned char *entry, off_t off)
+{
+  put32 (entry+8,  (u32)((unsigned long long)off >> 32));
+  put32 (entry+12, (u32)off);
+}
+
+
+/* Return a malloced string with the name of the index file for the
+   keybox FNAME.  */
+static char *
+make_index_fname (const char *fname)
+{
+  char *idxfname;
+
+  idxfname = xtrymalloc (strlen (fname) + 5);
+  if (idxfname)
+    strcpy (stpcpy (idxfname, fname), EXTSEP_S "idx");
+  return idxfname;
+}
+
+
+/* Store the stamp for the keybox file FNAME into the buffer STAMP of
+   INDEX_STAMP_LEN bytes.  */
+static gpg_error_t
+make_stamp (const char *fname, unsigned char *stamp)
+{
+  struct stat st;
+  unsigned long long size;
+
+  if (stat (fname, &st))
+    return gpg_error_from_syserror ();
+  size = st.st_size;
+  put32 (stamp,   (u32)(size >> 32));
+  put32 (stamp+4, (u32)size);
+  put32 (stamp+8, (u32)st.st_mtime);
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  put32 (stamp+12, (u32)st.st_mtim.tv_nsec);
+#else
+  put32 (stamp+12, 0);
+#endif
+  return 0;
+}
+
+
+/* Open the index for the keybox FNAME and, if CHECK is set, check
+   that it is current.  On success the stream is returned and the
+   number of entries is stored at R_NENTRIES.  If R_KBXLEN is not
+   NULL the length of the keybox file as recorded in the index is
+   stored there.  Returns NULL if there is no usable index.  */
+static FILE *
+open_index (const char *fname, int check,
+            size_t *r_nentries, off_t *r_kbxlen)
+{
+  char *idxfname;
+  FILE *fp;
+  unsigned char header[INDEX_HEADER_LEN];
+  unsigned char stamp[INDEX_STAMP_LEN];
+
+  idxfname = make_index_fname (fname);
+  if (!idxfname)
+    return NULL;
+  fp = fopen (idxfname, "rb");
+  xfree (idxfname);
+  if (!fp)
+    return NULL;
+
+  if (fread (header, INDEX_HEADER_LEN, 1, fp) != 1
+      || memcmp (header, "KBXi", 4)
+      || header[4] != INDEX_VERSION
+      || (check && (make_stamp (fname, stamp)
+                    || memcmp (header+12, stamp, INDEX_STAMP_LEN))))
+    {
+      fclose (fp);
+      return NULL;
+    }
+
+  *r_nentries = get32 (header+8);
+  if (r_kbxlen)
+    *r_kbxlen = (off_t)(((unsigned long long)get32 (header+12) << 32)
+                        | get32 (header+16));
+  return fp;
+}
+
+
+static void
+release_table (index_table_t table)
+{
+  if (table)
+    {
+      xfree (table->entries);
+      xfree (table);
+    }
+}
+
+
+static gpg_error_t
+add_entry (index_table_t table, const unsigned char *fpr, off_t off)
+{
+  unsigned char *p;
+
+  if (table->nentries == table->size)
+    {
+      size_t newsize = table->size? 2 * table->size : 64;
+
+      p = xtryrealloc (table->entries, newsize * INDEX_ENTRY_LEN);
+      if (!p)
+        return gpg_error_from_syserror ();
+      table->entries = p;
+      table->size = newsize;
+    }
+
+  p = table->entries + table->nentries * INDEX_ENTRY_LEN;
+  memcpy (p, fpr+16, 4);
+  memcpy (p+4, fpr+12, 4);
+  put_entry_offset (p, off);
+  table->nentries++;
+  return 0;
+}
+
+
+/* Add entries for all keys of the blob image {BUFFER,LENGTH} which
+   is located at file offset OFF.  Blobs without keys are ignored.  */
+static gpg_error_t
+add_blob_entries (index_table_t table, const unsigned char *buffer,
+                  size_t length, off_t off)
+{
+  gpg_error_t err;
+  size_t nkeys, keyinfolen, idx;
+
+  if (length < 40)
+    return 0;
+  if (buffer[4] != KEYBOX_BLOBTYPE_PGP && buffer[4] != KEYBOX_BLOBTYPE_X509)
+    return 0;
+
+  nkeys = (buffer[16] << 8) | buffer[17];
+  keyinfolen = (buffer[18] << 8) | buffer[19];
+  if (keyinfolen < 28 || 20 + keyinfolen*nkeys > length)
+    return 0;  /* Invalid blob - the search code won't find it either.  */
+
+  for (idx=0; idx < nkeys; idx++)
+    {
+      err = add_entry (table, buffer + 20 + idx*keyinfolen, off);
+      if (err)
+        return err;
+    }
+  return 0;
+}
+
+
+static int
+compare_entries (const void *a, const void *b)
+{
+  return memcmp (a, b, INDEX_ENTRY_LEN);
+}
+
+
+/* Read the entire index of the keybox FNAME into a new table.  Return
+   NULL on error or, if CHECK is set, if the index is not current.  */
+static index_table_t
+read_table (const char *fname, int check, off_t *r_kbxlen)
+{
+  FILE *fp;
+  size_t nentries;
+  index_table_t table;
+
+  fp = open_index (fname, check, &nentries, r_kbxlen);
+  if (!fp)
+    return NULL;
+
+  table = xtrycalloc (1, sizeof *table);
+  if (table && nentries)
+    {
+      table->entries = xtrymalloc (nentries * INDEX_ENTRY_LEN);
+      if (!table->entries
+          || fread (table->entries, INDEX_ENTRY_LEN, nentries, fp) != nentries)
+        {
+          release_table (table);
+          table = NULL;
+        }
+      else
+        table->nentries = table->size = nentries;
+    }
+  fclose (fp);
+  return table;
+}
+
+
+/* Sort TABLE and write it out as the index for the keybox FNAME.  The
+   index is first written to a temporary file which is then renamed,
+   so that readers never see a partially written index.  */
+static gpg_error_t
+write_table (const char *fname, index_table_t table)
+{
+  gpg_error_t err;
+  char *idxfname, *tmpfname;
+  FILE *fp;
+  unsigned char header[INDEX_HEADER_LEN];
+
+  if (table->nentries)
+    qsort (table->entries, table->nentries, INDEX_ENTRY_LEN,
+           compare_entries);
+
+  memset (header, 0, sizeof header);
+  memcpy (header, "KBXi", 4);
+  header[4] = INDEX_VERSION;
+  put32 (header+8, table->nentries);
+  err = make_stamp (fname, header+12);
+  if (err)
+    return err;
+
+  idxfname = make_index_fname (fname);
+  if (!idxfname)
+    return gpg_error_from_syserror ();
+  tmpfname = xtrymalloc (strlen (idxfname) + 5);
+  if (!tmpfname)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (idxfname);
+      return err;
+    }
+  strcpy (stpcpy (tmpfname, idxfname), EXTSEP_S "tmp");
+
+  fp = fopen (tmpfname, "wb");
+  if (!fp)
+    err = gpg_error_from_syserror ();
+  else
+    {
+      if (fwrite (header, INDEX_HEADER_LEN, 1, fp) != 1
+          || (table->nentries
+              && fwrite (table->entries, INDEX_ENTRY_LEN,
+                         table->nentries, fp) != table->nentries))
+        err = gpg_error_from_syserror ();
+      if (fclose (fp) && !err)
+        err = gpg_error_from_syserror ();
+    }
+
+  if (!err)
+    {
+#if defined(HAVE_DOSISH_SYSTEM) || defined(__riscos__)
+      gnupg_remove (idxfname);
+#endif
+      if (rename (tmpfname, idxfname))
+        err = gpg_error_from_syserror ();
+    }
+  if (err)
+    gnupg_remove (tmpfname);
+
+  xfree (tmpfname);
+  xfree (idxfname);
+  return err;
+}
+
+
+
+/* Build the index for the keybox FNAME from scratch.  This is called
+   after a compress run but may be used at any time while holding the
+   lock for the keybox.  */
+gpg_error_t
+_keybox_index_rebuild (const char *fname)
+{
+  gpg_error_t err;
+  int rc;
+  FILE *fp;
+  KEYBOXBLOB blob;
+  index_table_t table;
+
+  fp = fopen (fname, "rb");
+  if (!fp)
+    return gpg_error_from_syserror ();
+
+  table = xtrycalloc (1, sizeof *table);
+  if (!table)
+    {
+      err = gpg_error_from_syserror ();
+      fclose (fp);
+      return err;
+    }
+
+  err = 0;
+  while (!(rc = _keybox_read_blob (&blob, fp)))
+    {
+      const unsigned char *buffer;
+      size_t length;
+
+      buffer = _keybox_get_blob_image (blob, &length);
+      err = add_blob_entries (table, buffer, length,
+                              _keybox_get_blob_fileoffset (blob));
+      _keybox_release_blob (blob);
+      if (err)
+        break;
+    }
+  if (!err && rc != -1)
+    err = rc;
+  fclose (fp);
+
+  if (!err)
+    err = write_table (fname, table);
+  release_table (table);
+  if (err)
+    _keybox_index_remove (fname);
+  return err;
+}
+
+
+/* Remove the index of the keybox FNAME.  */
+void
+_keybox_index_remove (const char *fname)
+{
+  char *idxfname;
+
+  idxfname = make_index_fname (fname);
+  if (idxfname)
+    {
+      gnupg_remove (idxfname);
+      xfree (idxfname);
+    }
+}
+
+
+/* Return true if the keybox FNAME has an index which is in sync with
+   the keybox.  Used before modifying the keybox to decide whether
+   the index shall be updated.  */
+int
+_keybox_index_is_current (const char *fname)
+{
+  FILE *fp;
+  size_t nentries;
+
+  fp = open_index (fname, 1, &nentries, NULL);
+  if (!fp)
+    return 0;
+  fclose (fp);
+  return 1;
+}
+
+
+/* Update the index of the keybox FNAME after the blob at file offset
+   OFF has been changed.  This must only be called if
+   _keybox_index_is_current returned true before the keybox was
+   modified.  All entries for the blob at OFF are removed and the
+   offsets of all following blobs are adjusted by DELTA.  If NEWBLOB
+   is not NULL its keys are then added with offset OFF.  An OFF of -1
+   indicates that NEWBLOB has been appended to the keybox.  If the
+   index can't be updated it is removed.  */
+void
+_keybox_index_commit (const char *fname, off_t off, long delta,
+                      KEYBOXBLOB newblob)
+{
+  gpg_error_t err;
+  index_table_t table;
+  off_t kbxlen, entoff;
+  unsigned char *src, *dst;
+  size_t n;
+
+  /* The keybox has already been modified, thus we can't check the
+     stamp here.  */
+  table = read_table (fname, 0, &kbxlen);
+  if (!table)
+    {
+      _keybox_index_remove (fname);
+      return;
+    }
+
+  if (off == (off_t)-1)
+    off = kbxlen;
+  else
+    {
+      /* Remove the entries of the old blob and shift the others.  */
+      src = dst = table->entries;
+      for (n=0; n < table->nentries; n++, src += INDEX_ENTRY_LEN)
+        {
+          entoff = get_entry_offset (src);
+          if (entoff == off)
+            continue;
+          if (dst != src)
+            memcpy (dst, src, INDEX_ENTRY_LEN);
+          if (entoff > off)
+            put_entry_offset (dst, entoff + delta);
+          dst += INDEX_ENTRY_LEN;
+        }
+      table->nentries = (dst - table->entries) / INDEX_ENTRY_LEN;
+    }
+
+  err = 0;
+  if (newblob)
+    {
+      const unsigned char *buffer;
+      size_t length;
+
+      buffer = _keybox_get_blob_image (newblob, &length);
+      err = add_blob_entries (table, buffer, length, off);
+    }
+  if (!err)
+    err = write_table (fname, table);
+  release_table (table);
+  if (err)
+    _keybox_index_remove (fname);
+}
+
+
+/* Search the index stream FP with NENTRIES entries for the first
+   entry matching the KEYLEN bytes at KEY.  Returns the index of that
+   entry or NENTRIES if there is none.  */
+static size_t
+lower_bound (FILE *fp, size_t nentries, const unsigned char *key,
+             size_t keylen, gpg_error_t *r_err)
+{
+  size_t lo, hi, mid;
+  unsigned char entry[INDEX_ENTRY_LEN];
+
+  lo = 0;
+  hi = nentries;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (fseeko (fp, INDEX_HEADER_LEN + (off_t)mid * INDEX_ENTRY_LEN,
+                  SEEK_SET)
+          || fread (entry, INDEX_ENTRY_LEN, 1, fp) != 1)
+        {
+          *r_err = gpg_error (GPG_ERR_INV_KEYRING);
+          return nentries;
+        }
+      if (memcmp (entry, key, keylen) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+
+static int
+compare_offsets (const void *a, const void *b)
+{
+  off_t aoff = *(const off_t*)a;
+  off_t boff = *(const off_t*)b;
+
+  return aoff < boff? -1 : aoff > boff? 1 : 0;
+}
+
+
+/* Use the index of the keybox used by HD to find the candidate blobs
+   for the search descriptions DESC.  On success a sorted array with
+   the file offsets of the candidate blobs is stored at R_OFFSETS and
+   the number of its elements at R_NOFFSETS.  The caller needs to
+   check each candidate blob and release the array.  An error is
+   returned if there is no current index or if one of the search
+   modes can't be handled using the index; the caller must then fall
+   back to a full scan.  */
+gpg_error_t
+_keybox_index_lookup (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc,
+                      size_t ndesc, off_t **r_offsets, size_t *r_noffsets)
+{
+  gpg_error_t err = 0;
+  FILE *fp;
+  size_t nentries, n, pos, noffsets, allocated;
+  off_t *offsets = NULL;
+  unsigned char key[8];
+  size_t keylen;
+  unsigned char entry[INDEX_ENTRY_LEN];
+
+  *r_offsets = NULL;
+  *r_noffsets = 0;
+
+  if (!ndesc)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  for (n=0; n < ndesc; n++)
+    switch (desc[n].mode)
+      {
+      case KEYDB_SEARCH_MODE_SHORT_KID:
+      case KEYDB_SEARCH_MODE_LONG_KID:
+      case KEYDB_SEARCH_MODE_FPR:
+      case KEYDB_SEARCH_MODE_FPR20:
+        break;
+      default:
+        return gpg_error (GPG_ERR_NOT_SUPPORTED);
+      }
+
+  fp = open_index (hd->kb->fname, 1, &nentries, NULL);
+  if (!fp)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  noffsets = allocated = 0;
+  for (n=0; !err && n < ndesc; n++)
+    {
+      switch (desc[n].mode)
+        {
+        case KEYDB_SEARCH_MODE_SHORT_KID:
+          put32 (key, desc[n].u.kid[1]);
+          keylen = 4;
+          break;
+        case KEYDB_SEARCH_MODE_LONG_KID:
+          put32 (key, desc[n].u.kid[1]);
+          put32 (key+4, desc[n].u.kid[0]);
+          keylen = 8;
+          break;
+        default: /* KEYDB_SEARCH_MODE_FPR or KEYDB_SEARCH_MODE_FPR20. */
+          memcpy (key, desc[n].u.fpr+16, 4);
+          memcpy (key+4, desc[n].u.fpr+12, 4);
+          keylen = 8;
+          break;
+        }
+
+      pos = lower_bound (fp, nentries, key, keylen, &err);
+      if (err || pos == nentries)
+        continue;
+      if (fseeko (fp, INDEX_HEADER_LEN + (off_t)pos * INDEX_ENTRY_LEN,
+                  SEEK_SET))
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      for (; pos < nentries; pos++)
+        {
+          if (fread (entry, INDEX_ENTRY_LEN, 1, fp) != 1)
+            {
+              err = gpg_error (GPG_ERR_INV_KEYRING);
+              break;
+            }
+          if (memcmp (entry, key, keylen))
+            break;
+          if (noffsets == allocated)
+            {
+              off_t *tmp;
+
+              allocated += 16;
+              tmp = xtryrealloc (offsets, allocated * sizeof *offsets);
+              if (!tmp)
+                {
+                  err = gpg_error_from_syserror ();
+                  break;
+                }
+              offsets = tmp;
+            }
+          offsets[noffsets++] = get_entry_offset (entry);
+        }
+    }
+  fclose (fp);
+
+  if (err)
+    {
+      xfree (offsets);
+      return err;
+    }
+
+  if (noffsets > 1)
+    qsort (offsets, noffsets, sizeof *offsets, compare_offsets);
+  *r_offsets = offsets;
+  *r_noffsets = noffsets;
+  return 0;
+}
+
+
+/* Position the file or the memory mapping of HD at the next
+   candidate blob from the sorted array OFFSETS with NOFFSETS elements
+   which is located at or after the current read position.  *IDX is
+   the first element of the array to consider and updated to point
+   behind the selected element.  Returns -1 if no more candidates are
+   left.  */
+int
+_keybox_index_seek_next (KEYBOX_HANDLE hd,
+                         const off_t *offsets, size_t noffsets, size_t *idx)
+{
+  off_t cur;
+
+  if (hd->map.mem)
+    cur = hd->map.pos;
+  else
+    {
+      cur = ftello (hd->fp);
+      if (cur == (off_t)-1)
+        return gpg_error_from_syserror ();
+    }
+  while (*idx < noffsets && offsets[*idx] < cur)
+    (*idx)++;
+  if (*idx == noffsets)
+    return -1;
+  if (hd->map.mem)
+    {
+      if (offsets[*idx] > hd->map.len)
+        return gpg_error (GPG_ERR_INV_KEYRING);
+      hd->map.pos = offsets[*idx];
+    }
+  else if (fseeko (hd->fp, offsets[*idx], SEEK_SET))
+    return gpg_error_from_syserror ();
+  (*idx)++;
+  return 0;
+}
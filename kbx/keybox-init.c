@@ -23,6 +23,13 @@
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+# define USE_MMAP 1
+#endif
 
 #include "../common/mischelp.h"
 #include "keybox-defs.h"
@@ -30,25 +37,31 @@
 static KB_NAME kb_names;
 
 
-/* Register a filename for plain keybox files.  Returns a pointer to
-   be used to create a handles and so on.  Returns NULL to indicate
-   that FNAME has already been registered.  */
-void *
-keybox_register_file (const char *fname, int secret)
+/* Register a filename for plain keybox files.  On success the token
+   to be used to create handles and so on is stored at R_TOKEN.  If
+   FNAME has already been registered, GPG_ERR_EEXIST is returned and
+   the token of the existing registration is stored at R_TOKEN.  */
+gpg_error_t
+keybox_register_file (const char *fname, int secret, void **r_token)
 {
   KB_NAME kr;
 
+  *r_token = NULL;
   for (kr=kb_names; kr; kr = kr->next)
     {
       if (same_file_p (kr->fname, fname) )
-        return NULL; /* Already registered. */
+        {
+          *r_token = kr;
+          return gpg_error (GPG_ERR_EEXIST); /* Already registered. */
+        }
     }
 
   kr = xtrymalloc (sizeof *kr + strlen (fname));
   if (!kr)
-    return NULL;
+    return gpg_error_from_syserror ();
   strcpy (kr->fname, fname);
   kr->secret = !!secret;
+  kr->read_only = 0;
 
   kr->handle_table = NULL;
   kr->handle_table_size = 0;
@@ -64,15 +77,29 @@ keybox_register_file (const char *fname, int secret)
 /*      if (!kb_offtbl) */
 /*        kb_offtbl = new_offset_hash_table (); */
 
-  return kr;
+  *r_token = kr;
+  return 0;
 }
 
+
+/* Mark the keybox resource TOKEN as read-only.  All functions
+   modifying the keybox then return GPG_ERR_EACCES.  */
+void
+keybox_set_read_only (void *token)
+{
+  KB_NAME r = token;
+
+  if (r)
+    r->read_only = 1;
+}
+
+
 int
 keybox_is_writable (void *token)
 {
   KB_NAME r = token;
 
-  return r? !access (r->fname, W_OK) : 0;
+  return r? (!r->read_only && !access (r->fname, W_OK)) : 0;
 }
 
 
@@ -153,6 +180,7 @@ keybox_release (KEYBOX_HANDLE hd)
       fclose (hd->fp);
       hd->fp = NULL;
     }
+  _keybox_unmap_file (hd);
   xfree (hd->word_match.name);
   xfree (hd->word_match.pattern);
   xfree (hd);
@@ -197,6 +225,71 @@ _keybox_close_file (KEYBOX_HANDLE hd)
             fclose (roverhd->fp);
             roverhd->fp = NULL;
           }
+        _keybox_unmap_file (roverhd);
       }
   assert (!hd->fp);
+  assert (!hd->map.mem);
+}
+
+
+/* Map the file of HD into memory for reading.  Returns an error if
+   mmap is not available or the file can't be mapped; the caller
+   shall then use stdio to read the file.  Note that all functions
+   modifying the file call _keybox_close_file before they start and
+   thus a mapping is never used while the file is being rewritten.  */
+gpg_error_t
+_keybox_map_file (KEYBOX_HANDLE hd)
+{
+#ifdef USE_MMAP
+  gpg_error_t err;
+  int fd;
+  struct stat st;
+  void *mem;
+
+  assert (!hd->map.mem);
+
+  fd = open (hd->kb->fname, O_RDONLY);
+  if (fd == -1)
+    return gpg_error_from_syserror ();
+  if (fstat (fd, &st))
+    {
+      err = gpg_error_from_syserror ();
+      close (fd);
+      return err;
+    }
+  if (!st.st_size || (size_t)st.st_size != st.st_size)
+    {
+      /* Empty files can't be mapped and large files won't fit into
+         the address space.  */
+      close (fd);
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+
+  mem = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (mem == MAP_FAILED)
+    return gpg_error_from_syserror ();
+
+  hd->map.mem = mem;
+  hd->map.len = st.st_size;
+  hd->map.pos = 0;
+  return 0;
+#else /*!USE_MMAP*/
+  (void)hd;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif /*!USE_MMAP*/
+}
+
+
+/* Release the memory mapping of HD, if any.  */
+void
+_keybox_unmap_file (KEYBOX_HANDLE hd)
+{
+#ifdef USE_MMAP
+  if (hd->map.mem)
+    munmap ((void*)hd->map.mem, hd->map.len);
+#endif /*USE_MMAP*/
+  hd->map.mem = NULL;
+  hd->map.len = 0;
+  hd->map.pos = 0;
 }
@@ -24,6 +24,7 @@
 #include <errno.h>
 #include <time.h>
 #include <unistd.h>
+#include <assert.h>
 
 #include "keybox-defs.h"
 #include "../common/sysutils.h"
@@ -384,6 +385,8 @@ keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
     return gpg_error (GPG_ERR_INV_HANDLE);
   if (!hd->kb)
     return gpg_error (GPG_ERR_INV_HANDLE);
+  if (hd->kb->read_only)
+    return gpg_error (GPG_ERR_EACCES);
   fname = hd->kb->fname;
   if (!fname)
     return gpg_error (GPG_ERR_INV_HANDLE);
@@ -396,7 +399,11 @@ keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
   rc = _keybox_create_x509_blob (&blob, cert, sha1_digest, hd->ephemeral);
   if (!rc)
     {
+      int use_index = _keybox_index_is_current (fname);
+
       rc = blob_filecopy (1, fname, blob, hd->secret, 0);
+      if (!rc && use_index)
+        _keybox_index_commit (fname, (off_t)-1, 0, blob);
       _keybox_release_blob (blob);
       /*    if (!rc && !hd->secret && kb_offtbl) */
       /*      { */
@@ -419,6 +426,116 @@ keybox_update_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
 
 #endif /*KEYBOX_WITH_X509*/
 
+
+/* Insert the OpenPGP keyblock {IMAGE,IMAGELEN} into the keybox.
+   SIGSTATUS is a vector with the signature status of all signatures
+   in the keyblock; its first element gives the number of following
+   elements.  It may be NULL to mark all signatures as not checked.  */
+gpg_error_t
+keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen,
+                        u32 *sigstatus)
+{
+  gpg_error_t err;
+  const char *fname;
+  KEYBOXBLOB blob;
+  size_t nparsed;
+  struct _keybox_openpgp_info info;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  if (!hd->kb)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  if (hd->kb->read_only)
+    return gpg_error (GPG_ERR_EACCES);
+  fname = hd->kb->fname;
+  if (!fname)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+
+  /* Close this one otherwise we will mess up the position for a next
+     search.  Fixme: it would be better to adjust the position after
+     the write operation.  */
+  _keybox_close_file (hd);
+
+  err = _keybox_parse_openpgp (image, imagelen, &nparsed, &info);
+  if (err)
+    return err;
+  assert (nparsed <= imagelen);
+  err = _keybox_create_openpgp_blob (&blob, &info, image, imagelen,
+                                     sigstatus, hd->ephemeral);
+  _keybox_destroy_openpgp_info (&info);
+  if (!err)
+    {
+      int use_index = _keybox_index_is_current (fname);
+
+      err = blob_filecopy (1, fname, blob, hd->secret, 0);
+      if (!err && use_index)
+        _keybox_index_commit (fname, (off_t)-1, 0, blob);
+      _keybox_release_blob (blob);
+    }
+  return err;
+}
+
+
+/* Update the current key at HD with the given OpenPGP keyblock in
+   {IMAGE,IMAGELEN}.  SIGSTATUS has the same meaning as with
+   keybox_insert_keyblock.  */
+gpg_error_t
+keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen,
+                        u32 *sigstatus)
+{
+  gpg_error_t err;
+  const char *fname;
+  off_t off;
+  KEYBOXBLOB blob;
+  size_t nparsed;
+  struct _keybox_openpgp_info info;
+
+  if (!hd || !image || !imagelen)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  if (!hd->found.blob)
+    return gpg_error (GPG_ERR_NOTHING_FOUND);
+  if (!hd->kb)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  if (hd->kb->read_only)
+    return gpg_error (GPG_ERR_EACCES);
+  fname = hd->kb->fname;
+  if (!fname)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+
+  off = _keybox_get_blob_fileoffset (hd->found.blob);
+  if (off == (off_t)-1)
+    return gpg_error (GPG_ERR_GENERAL);
+
+  /* Close the file so that we do no mess up the position for a
+     next search.  */
+  _keybox_close_file (hd);
+
+  /* Build a new blob.  */
+  err = _keybox_parse_openpgp (image, imagelen, &nparsed, &info);
+  if (err)
+    return err;
+  assert (nparsed <= imagelen);
+  err = _keybox_create_openpgp_blob (&blob, &info, image, imagelen,
+                                     sigstatus, hd->ephemeral);
+  _keybox_destroy_openpgp_info (&info);
+
+  /* Update the keyblock.  */
+  if (!err)
+    {
+      int use_index = _keybox_index_is_current (fname);
+      size_t oldlen, newlen;
+
+      _keybox_get_blob_image (hd->found.blob, &oldlen);
+      _keybox_get_blob_image (blob, &newlen);
+      err = blob_filecopy (3, fname, blob, hd->secret, off);
+      if (!err && use_index)
+        _keybox_index_commit (fname, off, (long)newlen - (long)oldlen, blob);
+      _keybox_release_blob (blob);
+    }
+  return err;
+}
+
+
 /* Note: We assume that the keybox has been locked before the current
    search was executed.  This is needed so that we can depend on the
    offset information of the flags. */
@@ -432,6 +549,8 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
   size_t flag_pos, flag_size;
   const unsigned char *buffer;
   size_t length;
+  off_t bloboff;
+  int use_index;
 
   (void)idx;  /* Not yet used.  */
 
@@ -443,6 +562,8 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
     return gpg_error (GPG_ERR_INV_HANDLE);
   if (!hd->found.blob)
     return gpg_error (GPG_ERR_NOTHING_FOUND);
+  if (hd->kb->read_only)
+    return gpg_error (GPG_ERR_EACCES);
   fname = hd->kb->fname;
   if (!fname)
     return gpg_error (GPG_ERR_INV_HANDLE);
@@ -456,8 +577,10 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
   if (ec)
     return gpg_error (ec);
 
+  bloboff = off;
   off += flag_pos;
 
+  use_index = _keybox_index_is_current (fname);
   _keybox_close_file (hd);
   fp = fopen (hd->kb->fname, "r+b");
   if (!fp)
@@ -495,6 +618,10 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
         ec = gpg_err_code_from_syserror ();
     }
 
+  /* The blob did not move but the index needs a new stamp.  */
+  if (!ec && use_index)
+    _keybox_index_commit (fname, bloboff, 0, hd->found.blob);
+
   return gpg_error (ec);
 }
 
@@ -507,6 +634,7 @@ keybox_delete (KEYBOX_HANDLE hd)
   const char *fname;
   FILE *fp;
   int rc;
+  int use_index;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -514,6 +642,8 @@ keybox_delete (KEYBOX_HANDLE hd)
     return gpg_error (GPG_ERR_NOTHING_FOUND);
   if (!hd->kb)
     return gpg_error (GPG_ERR_INV_HANDLE);
+  if (hd->kb->read_only)
+    return gpg_error (GPG_ERR_EACCES);
   fname = hd->kb->fname;
   if (!fname)
     return gpg_error (GPG_ERR_INV_HANDLE);
@@ -521,14 +651,13 @@ keybox_delete (KEYBOX_HANDLE hd)
   off = _keybox_get_blob_fileoffset (hd->found.blob);
   if (off == (off_t)-1)
     return gpg_error (GPG_ERR_GENERAL);
-  off += 4;
-
+  use_index = _keybox_index_is_current (fname);
   _keybox_close_file (hd);
   fp = fopen (hd->kb->fname, "r+b");
   if (!fp)
     return gpg_error_from_syserror ();
 
-  if (fseeko (fp, off, SEEK_SET))
+  if (fseeko (fp, off + 4, SEEK_SET))
     rc = gpg_error_from_syserror ();
   else if (putc (0, fp) == EOF)
     rc = gpg_error_from_syserror ();
@@ -541,12 +670,43 @@ keybox_delete (KEYBOX_HANDLE hd)
         rc = gpg_error_from_syserror ();
     }
 
+  if (!rc && use_index)
+    _keybox_index_commit (fname, off, 0, NULL);
+
   return rc;
 }
 
 
+/* Set the time of the last maintenance run in the header blob at the
+   start of the keybox FNAME to the current time.  The file is
+   modified in place.  */
+static gpg_error_t
+update_maintenance_stamp (const char *fname)
+{
+  gpg_error_t err = 0;
+  FILE *fp;
+  unsigned char buf[4];
+  u32 val = time (NULL);
+
+  buf[0] = (val >> 24);
+  buf[1] = (val >> 16);
+  buf[2] = (val >>  8);
+  buf[3] = (val      );
+
+  fp = fopen (fname, "r+b");
+  if (!fp)
+    return gpg_error_from_syserror ();
+  if (fseeko (fp, 20, SEEK_SET) || fwrite (buf, 4, 1, fp) != 1)
+    err = gpg_error_from_syserror ();
+  if (fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  return err;
+}
+
+
 /* Compress the keybox file.  This should be run with the file
-   locked. */
+   locked.  This also rebuilds the index file of the keybox if it is
+   not current.  */
 int
 keybox_compress (KEYBOX_HANDLE hd)
 {
@@ -567,6 +727,8 @@ keybox_compress (KEYBOX_HANDLE hd)
     return gpg_error (GPG_ERR_INV_HANDLE);
   if (hd->secret)
     return gpg_error (GPG_ERR_NOT_IMPLEMENTED);
+  if (hd->kb->read_only)
+    return gpg_error (GPG_ERR_EACCES);
   fname = hd->kb->fname;
   if (!fname)
     return gpg_error (GPG_ERR_INV_HANDLE);
@@ -595,7 +757,7 @@ keybox_compress (KEYBOX_HANDLE hd)
       size_t length;
 
       buffer = _keybox_get_blob_image (blob, &length);
-      if (length > 4 && buffer[4] == BLOBTYPE_HEADER)
+      if (length > 4 && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
         {
           u32 last_maint = ((buffer[20] << 24) | (buffer[20+1] << 16)
                             | (buffer[20+2] << 8) | (buffer[20+3]));
@@ -604,7 +766,11 @@ keybox_compress (KEYBOX_HANDLE hd)
             {
               fclose (fp);
               _keybox_release_blob (blob);
-              return 0; /* Compress run not yet needed. */
+              /* Compress run not yet needed.  But make sure that the
+                 index is usable.  */
+              if (!_keybox_index_is_current (fname))
+                _keybox_index_rebuild (fname);
+              return 0;
             }
         }
       _keybox_release_blob (blob);
@@ -642,7 +808,7 @@ keybox_compress (KEYBOX_HANDLE hd)
       if (first_blob)
         {
           first_blob = 0;
-          if (length > 4 && buffer[4] == BLOBTYPE_HEADER)
+          if (length > 4 && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
             {
               /* Write out the blob with an updated maintenance time stamp. */
               _keybox_update_header_blob (blob);
@@ -658,7 +824,7 @@ keybox_compress (KEYBOX_HANDLE hd)
             break;
           any_changes = 1;
         }
-      else if (length > 4 && buffer[4] == BLOBTYPE_HEADER)
+      else if (length > 4 && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
         {
           /* Oops: There is another header record - remove it. */
           any_changes = 1;
@@ -715,6 +881,28 @@ keybox_compress (KEYBOX_HANDLE hd)
   else
     rc = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
 
+  /* If nothing has been compressed, we still need to record the
+     maintenance run; otherwise each following call would copy the
+     entire keybox again.  FIRST_BLOB is only still set for an empty
+     file; a missing header blob counts as a change.  Writing the
+     stamp changes the modification time of the keybox, thus the
+     stamp of a current index is updated as well.  */
+  if (!rc && !any_changes && !first_blob)
+    {
+      int use_index = _keybox_index_is_current (fname);
+
+      rc = update_maintenance_stamp (fname);
+      /* The header blob at offset 0 has no index entries, thus this
+         only updates the stamp of the index.  */
+      if (!rc && use_index)
+        _keybox_index_commit (fname, 0, 0, NULL);
+    }
+
+  /* (Re-)create the index.  Errors are not fatal because the search
+     code falls back to a full scan without a valid index.  */
+  if (!rc && (any_changes || !_keybox_index_is_current (fname)))
+    _keybox_index_rebuild (fname);
+
   xfree(bakfname);
   xfree(tmpfname);
   return rc;
@@ -104,38 +104,6 @@ struct base64_context_s {
 };
 
 
-/* The base-64 character list */
-static char bintoasc[64] =
-       "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-       "abcdefghijklmnopqrstuvwxyz"
-       "0123456789+/";
-/* The reverse base-64 list */
-static unsigned char asctobin[256] = {
-  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
-  0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff,
-  0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
-  0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12,
-  0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
-  0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24,
-  0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
-  0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
-  0xff, 0xff, 0xff, 0xff
-};
-
-
 static int
 has_only_base64 (const unsigned char *line, int linelen)
 {
@@ -145,7 +113,7 @@ has_only_base64 (const unsigned char *line, int linelen)
     {
       if (*line == '\n' || (linelen > 1 && *line == '\r' && line[1] == '\n'))
           break;
-      if ( !strchr (bintoasc, *line) )
+      if (radix64_asctobin[*line] == 0xff)
         return 0;
     }
   return 1;  /* yes */
@@ -312,6 +280,23 @@ base64_reader_cb (void *cb_value, char *buffer, size_t count, size_t *nread)
 
           while (n < count && parm->readpos < parm->linelen )
             {
+              if (!idx && count - n >= 3)
+                {
+                  /* Convert a run of complete groups at once.  */
+                  size_t nc = parm->linelen - parm->readpos;
+
+                  if (nc > (count - n) / 3 * 4)
+                    nc = (count - n) / 3 * 4;
+                  nc = radix64_decode_groups (buffer + n,
+                                              parm->line + parm->readpos, nc);
+                  if (nc)
+                    {
+                      parm->readpos += nc;
+                      n += nc / 4 * 3;
+                      continue;
+                    }
+                }
+
               c = parm->line[parm->readpos++];
               if (c == '\n' || c == ' ' || c == '\r' || c == '\t')
                 continue;
@@ -322,7 +307,7 @@ base64_reader_cb (void *cb_value, char *buffer, size_t count, size_t *nread)
                   parm->stop_seen = 1;
                   break;
                 }
-              if( (c = asctobin[(c2=c)]) == 255 )
+              if( (c = radix64_asctobin[(c2=c)]) == 255 )
                 {
                   log_error (_("invalid radix64 character %02x skipped\n"),
                              c2);
@@ -434,19 +419,48 @@ base64_writer_cb (void *cb_value, const void *buffer, size_t count)
   for (i=0; i < idx; i++)
     radbuf[i] = parm->base64.radbuf[i];
 
-  for (p=buffer; count; p++, count--)
+  p = buffer;
+  while (count)
     {
-      radbuf[idx++] = *p;
+      if (!idx && count >= 3)
+        {
+          /* Encode as many complete groups as fit on the current
+             line and write them out in one go.  */
+          char line[64+2];
+          size_t n, ngroups;
+
+          ngroups = (64/4) - quad_count;
+          if (ngroups > count / 3)
+            ngroups = count / 3;
+          radix64_encode_groups (line, p, ngroups);
+          n = 4 * ngroups;
+          p += 3 * ngroups;
+          count -= 3 * ngroups;
+          quad_count += ngroups;
+          if (quad_count >= (64/4))
+            {
+              memcpy (line + n, LF, strlen (LF));
+              n += strlen (LF);
+              quad_count = 0;
+            }
+          es_write (stream, line, n, NULL);
+          continue;
+        }
+
+      radbuf[idx++] = *p++;
+      count--;
       if (idx > 2)
         {
           idx = 0;
-          c = bintoasc[(*radbuf >> 2) & 077];
+          c = radix64_bintoasc[(*radbuf >> 2) & 077];
           es_putc (c, stream);
-          c = bintoasc[(((*radbuf<<4)&060)|((radbuf[1] >> 4)&017))&077];
+          c = radix64_bintoasc[(((*radbuf<<4)&060)
+                                |((radbuf[1] >> 4)&017))&077];
           es_putc (c, stream);
-          c = bintoasc[(((radbuf[1]<<2)&074)|((radbuf[2]>>6)&03))&077];
+          c = radix64_bintoasc[(((radbuf[1]<<2)&074)
+                                |((radbuf[2]>>6)&03))&077];
           es_putc (c, stream);
-          c = bintoasc[radbuf[2]&077];
+          c = radix64_bintoasc[radbuf[2]&077];
           es_putc (c, stream);
           if (++quad_count >= (64/4))
             {
@@ -498,20 +512,20 @@ base64_finish_write (struct writer_cb_parm_s *parm)
     {
       radbuf = parm->base64.radbuf;
 
-      c = bintoasc[(*radbuf>>2)&077];
+      c = radix64_bintoasc[(*radbuf>>2)&077];
       es_putc (c, stream);
       if (idx == 1)
         {
-          c = bintoasc[((*radbuf << 4) & 060) & 077];
+          c = radix64_bintoasc[((*radbuf << 4) & 060) & 077];
           es_putc (c, stream);
           es_putc ('=', stream);
           es_putc ('=', stream);
         }
       else
         {
-          c = bintoasc[(((*radbuf<<4)&060)|((radbuf[1]>>4)&017))&077];
+          c = radix64_bintoasc[(((*radbuf<<4)&060)|((radbuf[1]>>4)&017))&077];
           es_putc (c, stream);
-          c = bintoasc[((radbuf[1] << 2) & 074) & 077];
+          c = radix64_bintoasc[((radbuf[1] << 2) & 074) & 077];
           es_putc (c, stream);
           es_putc ('=', stream);
 
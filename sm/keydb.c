@@ -201,9 +201,13 @@ keydb_add_resource (const char *url, int force, int secret, int *auto_created)
         /* now register the file */
         {
 
-          void *token = keybox_register_file (filename, secret);
-          if (!token)
-            ; /* already registered - ignore it */
+          void *token;
+
+          rc = keybox_register_file (filename, secret, &token);
+          if (gpg_err_code (rc) == GPG_ERR_EEXIST)
+            rc = 0; /* already registered - ignore it */
+          else if (rc)
+            ;
           else if (used_resources >= MAX_KEYDB_RESOURCES)
             rc = gpg_error (GPG_ERR_RESOURCE_LIMIT);
           else
@@ -905,7 +909,8 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc, size_t ndesc)
           BUG(); /* we should never see it here */
           break;
         case KEYDB_RESOURCE_TYPE_KEYBOX:
-          rc = keybox_search (hd->active[hd->current].u.kr, desc, ndesc);
+          rc = keybox_search (hd->active[hd->current].u.kr, desc, ndesc,
+                              KEYBOX_BLOBTYPE_X509, NULL);
           break;
         }
       if (rc == -1) /* EOF -> switch to next resource */